@@ -89,7 +89,6 @@
 */
 
 
-
 #include <assert.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -125,10 +124,10 @@
 
 #define da_reserve_arena(arena, da, expected_capacity)                                     \
 	do {                                                                                   \
-		size_t old_size = (da)->capacity;                                                  \
+		size_t old_size = (da)->capacity * sizeof(*(da)->items);                           \
 		if ((expected_capacity) > (da)->capacity) {                                        \
 			if ((da)->capacity == 0) {                                                     \
-				(da)->capacity = 256;                                                      \
+				(da)->capacity = 16;                                                       \
 			}                                                                              \
 			while ((expected_capacity) > (da)->capacity) {                                 \
 				(da)->capacity *= 2;                                                       \
@@ -735,25 +734,46 @@ typedef struct Region {
 	struct Region *next;
 	size_t capacity;
 	size_t size;
+	int mapped;        // allocated with mmap instead of malloc
 	char buffer[];
 } Region;
 
 Region *region_new(size_t capacity);
 
 #define ARENA_DEFAULT_CAPACITY (640 * 1000)
+// every new region doubles the last one up to this, so big graphs don't end up
+// with thousands of small regions and can use huge pages
+#define ARENA_MAX_REGION_CAPACITY (64 * 1024 * 1024)
 
 typedef struct {
     Region *first;
     Region *last;
+    size_t requested;  // bytes asked for over the arena's lifetime
+    size_t abandoned;  // bytes left behind by arena_realloc moving an allocation
 } Arena;
 
+// a position to go back to, everything allocated after it is released at once
+typedef struct ArenaMark {
+	Region *region;
+	size_t size;
+} ArenaMark;
+
+typedef struct ArenaSummary {
+	size_t used;
+	size_t capacity;
+	size_t requested;
+	size_t abandoned;
+	size_t regions;
+} ArenaSummary;
+
 void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment);
 void *arena_alloc(Arena *arena, size_t size);
 void *arena_realloc(Arena *arena, void *old_ptr, size_t old_size, size_t new_size);
+ArenaMark arena_save(Arena *arena);
+void arena_restore(Arena *arena, ArenaMark mark);
 void arena_clean(Arena *arena);
 void arena_free(Arena *arena);
-void arena_summary(Arena *arena);
-
+ArenaSummary arena_summary(Arena *arena);
 
 #include <assert.h>
 #include <stdint.h>
@@ -761,20 +781,65 @@ void arena_summary(Arena *arena);
 #include <stdio.h>
 #include <stdbool.h>
 
+#if !defined(_WIN32) && !defined(ARENA_NO_MMAP)
+	#include <sys/mman.h>
+	#define ARENA_MMAP
+	// regions this big are mapped directly, the kernel hands out zeroed pages lazily
+	#define ARENA_MMAP_THRESHOLD (1024 * 1024)
+	#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
 Region *region_new(size_t capacity) {
 	const size_t region_size = sizeof(Region) + capacity;
+#ifdef ARENA_MMAP
+	if (region_size >= ARENA_MMAP_THRESHOLD) {
+		void *mem = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+			if (region_size >= ARENA_HUGE_PAGE_SIZE) {
+				madvise(mem, region_size, MADV_HUGEPAGE);
+			}
+#endif
+			Region *region = mem;
+			region->capacity = capacity;
+			region->mapped = 1;
+			return region;
+		}
+	}
+#endif
+	// allocations are zeroed one by one, so only the header needs it here
 	Region *region = malloc(region_size);
-	memset(region, 0, region_size);
+	assert(region != NULL);
+	memset(region, 0, sizeof(Region));
 	region->capacity = capacity;
 	return region;
 }
 
+static void region_free(Region *region) {
+#ifdef ARENA_MMAP
+	if (region->mapped) {
+		munmap(region, sizeof(Region) + region->capacity);
+		return;
+	}
+#endif
+	free(region);
+}
+
+static size_t arena_next_capacity(Arena *arena, size_t size) {
+	size_t capacity = ARENA_DEFAULT_CAPACITY;
+	if (arena->last && arena->last->capacity * 2 <= ARENA_MAX_REGION_CAPACITY) {
+		capacity = arena->last->capacity * 2;
+	} else if (arena->last) {
+		capacity = ARENA_MAX_REGION_CAPACITY;
+	}
+	return size > capacity ? size : capacity;
+}
+
 void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 	if (arena->last == NULL) {
 		assert(arena->first == NULL);
 
-		Region *region = region_new(
-			size > ARENA_DEFAULT_CAPACITY ? size : ARENA_DEFAULT_CAPACITY);
+		Region *region = region_new(arena_next_capacity(arena, size));
 
 		arena->last = region;
 		arena->first = region;
@@ -788,6 +853,7 @@ void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 
 	// alignment must be a power of two.
 	assert((alignment & (alignment - 1)) == 0);
+	arena->requested += size;
 
 	Region *cur = arena->last;
 	while (true) {
@@ -797,7 +863,10 @@ void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 
 		if (cur->size + real_size > cur->capacity) {
 			if (cur->next) {
+				// left over by arena_clean or arena_restore, reuse it
 				cur = cur->next;
+				cur->size = 0;
+				arena->last = cur;
 				continue;
 			} else {
 				// out of space, make a new one. even though we are making a new region, there
@@ -805,9 +874,7 @@ void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 				// so, allocate enough extra bytes to fix the 'worst case' alignment.
 				size_t worst_case = size + (alignment - 1);
 
-				Region *region = region_new(worst_case > ARENA_DEFAULT_CAPACITY
-								   ? worst_case
-								   : ARENA_DEFAULT_CAPACITY);
+				Region *region = region_new(arena_next_capacity(arena, worst_case));
 
 				arena->last->next = region;
 				arena->last = region;
@@ -832,22 +899,49 @@ void *arena_alloc(Arena *arena, size_t size) {
 }
 
 void *arena_realloc(Arena *arena, void *old_ptr, size_t old_size, size_t new_size) {
-	if (old_size < new_size) {
-		void *new_ptr = arena_alloc(arena, new_size);
-		memcpy(new_ptr, old_ptr, old_size);
-		return new_ptr;
-	} else {
+	if (old_size >= new_size) {
 		return old_ptr;
 	}
+
+	// the last allocation of the current region grows in place, like a doubling da
+	Region *cur = arena->last;
+	if (old_ptr && cur && (char*)old_ptr + old_size == cur->buffer + cur->size
+		&& cur->size + (new_size - old_size) <= cur->capacity) {
+		memset(cur->buffer + cur->size, 0, new_size - old_size);
+		cur->size += new_size - old_size;
+		arena->requested += new_size - old_size;
+		return old_ptr;
+	}
+
+	void *new_ptr = arena_alloc(arena, new_size);
+	if (old_size > 0) {
+		memcpy(new_ptr, old_ptr, old_size);
+	}
+	arena->abandoned += old_size;
+	return new_ptr;
 }
 
-void arena_clean(Arena *arena) {
-	for (Region *iter = arena->first;
-	iter != NULL;
-	iter = iter->next) {
-		iter->size = 0;
+ArenaMark arena_save(Arena *arena) {
+	return (ArenaMark){
+		.region = arena->last,
+		.size = arena->last ? arena->last->size : 0,
+	};
+}
+
+// the regions after the mark stay around and are reused by the next allocations
+void arena_restore(Arena *arena, ArenaMark mark) {
+	if (mark.region == NULL) {
+		arena_clean(arena);
+		return;
 	}
+	mark.region->size = mark.size;
+	arena->last = mark.region;
+}
 
+void arena_clean(Arena *arena) {
+	if (arena->first) {
+		arena->first->size = 0;
+	}
 	arena->last = arena->first;
 }
 
@@ -855,32 +949,54 @@ void arena_free(Arena *arena) {
 	Region *iter = arena->first;
 	while (iter != NULL) {
 		Region *next = iter->next;
-		free(iter);
+		region_free(iter);
 		iter = next;
 	}
-	arena->first = NULL;
-	arena->last = NULL;
+	*arena = (Arena){0};
 }
 
-void arena_summary(Arena *arena) {
-	if (arena->first == NULL) {
-		printf("[empty]");
-	}
-
-	for (Region *iter = arena->first;
-	iter != NULL;
-	iter = iter->next) {
-		printf("[%zu/%zu] -> ", iter->size, iter->capacity);
+ArenaSummary arena_summary(Arena *arena) {
+	ArenaSummary summary = {
+		.requested = arena->requested,
+		.abandoned = arena->abandoned,
+	};
+	bool in_use = arena->last != NULL;
+	for (Region *iter = arena->first; iter != NULL; iter = iter->next) {
+		// regions after last only hold what a clean or restore released
+		if (in_use) summary.used += iter->size;
+		if (iter == arena->last) in_use = false;
+		summary.capacity += iter->capacity;
+		summary.regions++;
 	}
-	printf("\n");
+	return summary;
 }
 
 
 
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#define INTERN_NONE UINT32_MAX
+
+// stores every distinct string once and hands out dense 32 bit ids for them.
+// equal strings always get the same id, so ids can be compared instead of strings.
+typedef struct InternPool {
+	Arena arena;
+	StringList strings;  // id -> string
+	uint32_t* slots;     // open addressing table of id + 1, 0 is an empty slot
+	size_t slot_count;
+} InternPool;
+
+uint32_t   intern     (InternPool* pool, StringView sv);
+uint32_t   intern_find(InternPool* pool, StringView sv);
+StringView intern_get (InternPool* pool, uint32_t id);
+void       intern_free(InternPool* pool);
+
 
 
 
+#include <stdint.h>
 #include <stdio.h>
 
 typedef enum ExpressionType {
@@ -902,6 +1018,7 @@ typedef struct Expression Expression;
 
 typedef struct {
 	Token name;
+	uint32_t id;    // of name, interned by the parser
 	Expression* value;
 } ExpressionAssignment;
 
@@ -941,6 +1058,7 @@ typedef struct {
 
 typedef struct {
 	Token name;
+	uint32_t id;    // of name, interned by the parser
 } ExpressionVariable;
 
 typedef struct {
@@ -979,7 +1097,6 @@ void expression_print(Expression* expr, int indent);
 
 
 
-
 typedef enum StatementType {
 	STATEMENT_EXPRESSION,
 	STATEMENT_BLOCK,
@@ -1004,8 +1121,11 @@ typedef struct {
 	Statement* block;
 } StatementDescription;
 
+struct BuildCommand;
+
 struct Statement {
 	StatementType type;
+	struct BuildCommand* attached;  // the build command whose body this is, see constructor_attach_statements
 	union {
 		StatementExpression expression;
 		StatementBlock block;
@@ -1033,6 +1153,7 @@ typedef struct {
 	Token next;
 	Token previous;
 	Arena arena;
+	InternPool names;  // of every identifier, variables are looked up by id
 	bool had_error;
 } Parser;
 
@@ -1077,10 +1198,81 @@ Statement* parse_expression_statement(Parser* p);
 void parser_dump(Parser* p);
 
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// what --stats reports: time spent in each phase of cook itself and counters
+// bumped by the modules doing the work. process wide, like the stat cache.
+typedef enum StatsPhase {
+	PHASE_PARSE,
+	PHASE_CONSTRUCT,
+	PHASE_LOAD_STATE,
+	PHASE_ANALYZE,
+	PHASE_INTERPRET,
+	PHASE_PLAN,
+	PHASE_EXECUTE,
+	PHASE_SAVE_STATE,
+	PHASE_CLEANUP,
+	PHASE_COUNT,
+} StatsPhase;
+
+typedef struct PhaseTime {
+	uint64_t wall;  // nanoseconds
+	uint64_t cpu;   // of cook itself, the commands it runs are not included
+	size_t count;
+} PhaseTime;
+
+typedef struct PhaseStart {
+	uint64_t trace;
+	uint64_t wall;
+	uint64_t cpu;
+} PhaseStart;
+
+typedef struct StatsArena {
+	const char* name;
+	size_t used;
+	size_t capacity;
+	size_t requested;  // asked for by callers, the rest of used is alignment padding
+	size_t abandoned;  // copied away from by arena_realloc
+	size_t regions;
+} StatsArena;
+
+#define STATS_MAX_ARENAS 16
+
+typedef struct Stats {
+	PhaseTime phases[PHASE_COUNT];
 
+	size_t tokens;
+	size_t statements;
+	size_t build_commands;
+	size_t stat_calls;        // actual stat syscalls, after the stat cache
+	size_t stat_cache_hits;
+	size_t stat_cache_misses;
+	size_t dirty_targets;
+	size_t spawns;
+	size_t compile_cache_hits;
+	size_t compile_cache_misses;
+	bool compile_cache_enabled;
 
+	StatsArena arenas[STATS_MAX_ARENAS];
+	size_t arena_count;
+} Stats;
 
+extern Stats stats;
 
+// monotonic, in nanoseconds
+uint64_t stats_clock(void);
+
+// a phase also becomes a span of --trace
+PhaseStart stats_phase_begin(void);
+void       stats_phase_end  (StatsPhase phase, PhaseStart start);
+
+// remembers how much of the arena is in use, call before freeing it
+void stats_arena(const char* name, Arena* arena);
+
+void stats_print     (FILE* stream);
+bool stats_write_json(const char* path);
 
 #include <stdio.h>
 
@@ -1107,6 +1299,7 @@ Expression* parser_arena_alloc_expression(Parser* p) {
 	return (Expression*)arena_alloc(&p->arena, sizeof(Expression));
 }
 Statement* parser_arena_alloc_statement(Parser* p) {
+	stats.statements++;
 	return (Statement*)arena_alloc(&p->arena, sizeof(Statement));
 }
 
@@ -1119,6 +1312,7 @@ Token parser_advance(Parser* p) {
 	p->previous = p->current;
 	p->current = p->next;
 	p->next = lexer_next_token(p->lexer);
+	if (p->next.type != TOKEN_END) stats.tokens++;
 	return p->previous;
 }
 
@@ -1160,6 +1354,7 @@ Expression* parse_assignment(Parser* p) {
 			Expression* assign = parser_arena_alloc_expression(p);
 			assign->type = EXPR_ASSIGNMENT;
 			assign->assignment.name = expression->variable.name;
+			assign->assignment.id = expression->variable.id;
 			assign->assignment.value = value;
 			return assign;
 		} else {
@@ -1326,6 +1521,7 @@ Expression* parse_primary(Parser* p) {
 			Expression* e = parser_arena_alloc_expression(p);
 			e->type = EXPR_VARIABLE;
 			e->variable.name = p->previous;
+			e->variable.id = intern(&p->names, p->previous.str);
 			return e;
 		}
 		case TOKEN_KEYWORD_FALSE: {
@@ -1545,6 +1741,10 @@ void expression_print(Expression* expr, int indent) {
 		case EXPR_VARIABLE:
 			printf("variable: %.*s\n", (int)expr->variable.name.str.count, expr->variable.name.str.items);
 			break;
+		case EXPR_ASSIGNMENT:
+			printf("assignment: %.*s\n", (int)expr->assignment.name.str.count, expr->assignment.name.str.items);
+			expression_print(expr->assignment.value, indent + 2);
+			break;
 		case EXPR_LITERAL_INT:
 			printf("literal int: %d\n", expr->literal_int.value);
 			break;
@@ -1650,6 +1850,7 @@ void statement_print(Statement* s, int indent) {
 
 
 
+#include <stdint.h>
 
 typedef enum SymbolValueType {
 	SYMBOL_VALUE_NIL = 0,
@@ -1675,6 +1876,7 @@ typedef enum MethodType {
 	METHOD_DIRTY,
 	METHOD_MARK_CLEAN,
 	METHOD_ECHO,
+	METHOD_CACHE,
 } MethodType;
 
 typedef struct SymbolValue {
@@ -1689,24 +1891,29 @@ typedef struct SymbolValue {
 } SymbolValue;
 
 typedef struct SymbolEntry {
-	StringView name;
+	uint32_t name;      // interned by the parser, + 1 so 0 is an empty slot
 	SymbolValue value;
 } SymbolEntry;
 
+// open addressing map from interned variable name to value
 typedef struct SymbolMap {
-	// TODO: use hash map
-	// string -> symbol
-	SymbolEntry** items;
+	SymbolEntry* slots;
+	size_t slot_count;
 	size_t count;
-	size_t capacity;
 } SymbolMap;
 
 
+// one scope, the block of a description opens a new one
 typedef struct Environment {
 	struct Environment* enclosing;
 	SymbolMap map;
 } Environment;
-Environment* environment_new(Arena*);
+Environment* environment_new(Arena*, Environment* enclosing);
+
+// assignment always binds in the innermost scope, shadowing outer ones
+void         environment_define(Arena* arena, Environment* env, uint32_t name, SymbolValue value);
+// NULL if no scope up the chain has it
+SymbolValue* environment_lookup(Environment* env, uint32_t name);
 
 
 const char* symbol_value_type_name_cstr(SymbolValueType);
@@ -1718,20 +1925,82 @@ MethodType method_extract(StringView sv);
 
 
 
+#include <stdbool.h>
+
+// the flags and dirs a build command inherits from its parent. a child links to
+// the parent's list instead of copying it and only stores what it appends itself,
+// so both can keep growing without writing into each other's arrays.
+typedef struct OptionList {
+	struct OptionList* parent;
+	size_t parent_count;   // how much of the parent was there when it was inherited
+	StringList local;
+	size_t count;          // parent_count + local.count
+} OptionList;
+
+OptionList option_list_inherit(OptionList* parent);
+void       option_list_append (Arena* arena, OptionList* list, StringView option);
+StringView option_list_at     (const OptionList* list, size_t index);
+bool       option_list_same   (const OptionList* a, const OptionList* b);
+
+
 
 #include <stdio.h>
 
 
 
+
+#include <stdint.h>
+
+// process wide pool of every path cook deals with, targets and the stat cache
+// refer to paths by their 32 bit id. like the stat cache it lives across --watch
+// reloads, a path is stored once no matter how many targets use it.
+typedef uint32_t PathId;
+
+#define PATH_NONE UINT32_MAX
+
+PathId     path_intern(StringView path);
+PathId     path_find  (StringView path);  // PATH_NONE if it was never interned
+StringView path_get   (PathId id);        // NUL terminated
+size_t     path_count (void);
+Arena*     path_arena (void);
+void       path_pool_free(void);
+
 #include <stdbool.h>
+#include <stdint.h>
+
+struct BuildCommand;
+struct Target;
+
+// why the dirty analysis decided to build a target, for --explain
+typedef enum DirtyReason {
+	DIRTY_NONE,
+	DIRTY_OUTPUT_MISSING,
+	DIRTY_INPUT_CHANGED,
+	DIRTY_DEPS_UNKNOWN,     // no recorded header dependencies
+	DIRTY_COMMAND_CHANGED,
+	DIRTY_CHILD,            // a build command below it is dirty
+	DIRTY_FORCED,           // -B
+} DirtyReason;
+
+typedef struct DirtyCause {
+	DirtyReason reason;
+	PathId input;                  // the first input that changed
+	uint64_t input_time;
+	uint64_t output_time;
+	struct BuildCommand* from;     // DIRTY_CHILD: the dirty build command
+	struct Target* from_target;    // and its first dirty target, if it has one
+} DirtyCause;
 
 typedef struct Target {
 	StringView name;
-	StringBuilder input_name;
-	StringBuilder output_name;
-	StringBuilder header_file;
+	PathId input;
+	PathId output;
+	PathId header;             // PATH_NONE if it has none
+	PathId depfile;            // written by the compiler, PATH_NONE if not supported
 	bool dirty;
 	bool built;
+	DirtyCause cause;
+	uint64_t fingerprint;      // of everything target_is_same compares
 } Target;
 
 typedef struct TargetList {
@@ -1741,11 +2010,33 @@ typedef struct TargetList {
 } TargetList;
 
 
-struct BuildCommand;
+// argument vector of a command, terminated by a NULL entry that is not counted
+typedef struct Cmd {
+	const char** items;
+	size_t count;
+	size_t capacity;
+} Cmd;
+
+// the arguments that are the same for every target of a build command, the
+// targets only splice their output, input and depfile in between
+typedef struct CmdTemplate {
+	Cmd head;              // compiler, cflags, -c and -o
+	Cmd tail;              // include dirs, inputs, libraries and ldflags
+	StringView head_line;  // both rendered, each argument followed by a space
+	StringView tail_line;
+	bool ready;
+} CmdTemplate;
+
+CmdTemplate   cmd_template_new            (Arena* arena, struct BuildCommand* bc);
+
+Cmd           target_generate_cmd         (Arena* arena, struct BuildCommand* bc, Target* t);
 StringBuilder target_generate_cmdline_cstr(Arena* arena, struct BuildCommand* bc, Target* t);
 StringBuilder target_generate_cmdline     (Arena* arena, struct BuildCommand* bc, Target* t);
 
-bool target_check_dirty(struct BuildCommand* bc, Target* t);
+StringBuilder cmd_render(Arena* arena, Cmd cmd);
+
+struct BuildState;
+bool target_check_dirty(Arena* arena, struct BuildState* state, struct BuildCommand* bc, Target* t);
 
 
 
@@ -1779,14 +2070,14 @@ struct BuildCommand {
 	StringList input_files;
 	StringList input_objects;
 
-	StringList include_dirs;
+	OptionList include_dirs;
 	StringList include_files;
 
-	StringList library_dirs;
-	StringList library_links;
+	OptionList library_dirs;
+	OptionList library_links;
 
-	StringList cflags;
-	StringList ldflags;
+	OptionList cflags;
+	OptionList ldflags;
 
 	StringView source_dir;
 	StringView output_dir;
@@ -1794,7 +2085,10 @@ struct BuildCommand {
 	// StringList defines;
 
 	Statement* body;
+	CmdTemplate cmd;       // see build_command_prepare_cmd
+	uint64_t fingerprint;  // of its fields, targets and children, see build_command_fingerprint
 	bool dirty;
+	bool marked_dirty_explicitly;
 	bool marked_clean_explicitly;
 };
 
@@ -1803,6 +2097,7 @@ BuildCommand* build_command_new(Arena*);
 BuildCommand build_command_default(void);
 void         build_command_print  (BuildCommand* bc, size_t indent);
 void         build_command_dump   (Arena* arena, BuildCommand* bc, FILE* stream, size_t target_to_build);
+void         build_command_explain(BuildCommand* bc, FILE* stream);
 
 BuildCommand* build_command_inherit(Arena* arena, BuildCommand* parent);
 
@@ -1811,6 +2106,19 @@ void build_type_print(BuildType type);
 void build_command_mark_all_targets_dirty (BuildCommand* bc, bool dirty);
 void build_command_mark_all_children_dirty(BuildCommand* bc, bool dirty);
 
+// the gcc or clang driver the compiler is, without its directory, target prefix
+// and version suffix: /usr/bin/gcc, gcc-12 and x86_64-w64-mingw32-gcc are all "gcc".
+// empty for any other compiler.
+StringView build_command_compiler_family(BuildCommand* bc);
+bool       build_command_supports_depfile(BuildCommand* bc);
+
+// hashes bottom up what the *_is_same functions compare, once the targets are
+// expanded. equal fingerprints still need the full comparison to rule out collisions.
+void build_command_fingerprint(BuildCommand* bc);
+
+// renders the arguments its targets share once, the tree must not change after this
+void build_command_prepare_cmd(Arena* arena, BuildCommand* bc);
+
 bool target_is_same(Target* a, Target* b);
 bool build_command_is_same(BuildCommand* a, BuildCommand* b);
 
@@ -1823,11 +2131,57 @@ bool build_command_is_same(BuildCommand* a, BuildCommand* b);
 // COOK_VERSION=0.0.1
 // GCC_VERSION (get it from gcc itself) ...
 // DEBUG/RELEASE/MIN_SIZE_REL/DIST
-Environment* environment_new(Arena* arena) {
+Environment* environment_new(Arena* arena, Environment* enclosing) {
 	Environment* env = (Environment*)arena_alloc(arena, sizeof(Environment));
+	env->enclosing = enclosing;
 	return env;
 }
 
+inline static size_t symbol_map_home(SymbolMap* map, uint32_t name) {
+	// fibonacci hashing, the ids are dense so the high bits are the mixed ones
+	return (size_t)(((uint64_t)name * 0x9e3779b97f4a7c15ull) >> 32) & (map->slot_count - 1);
+}
+
+static SymbolEntry* symbol_map_slot(SymbolMap* map, uint32_t name) {
+	size_t i = symbol_map_home(map, name);
+	while (map->slots[i].name != 0 && map->slots[i].name != name + 1) {
+		i = (i + 1) & (map->slot_count - 1);
+	}
+	return &map->slots[i];
+}
+
+void environment_define(Arena* arena, Environment* env, uint32_t name, SymbolValue value) {
+	SymbolMap* map = &env->map;
+	// keep the load factor under a half
+	if ((map->count + 1) * 2 > map->slot_count) {
+		SymbolMap grown = { .slot_count = map->slot_count == 0 ? 16 : map->slot_count * 2 };
+		grown.slots = arena_alloc(arena, grown.slot_count * sizeof(SymbolEntry));
+		for (size_t i = 0; i < map->slot_count; ++i) {
+			SymbolEntry* entry = &map->slots[i];
+			if (entry->name == 0) continue;
+			*symbol_map_slot(&grown, entry->name - 1) = *entry;
+			grown.count++;
+		}
+		*map = grown;
+	}
+
+	SymbolEntry* entry = symbol_map_slot(map, name);
+	if (entry->name == 0) {
+		entry->name = name + 1;
+		map->count++;
+	}
+	entry->value = value;
+}
+
+SymbolValue* environment_lookup(Environment* env, uint32_t name) {
+	for (; env; env = env->enclosing) {
+		if (env->map.count == 0) continue;
+		SymbolEntry* entry = symbol_map_slot(&env->map, name);
+		if (entry->name != 0) return &entry->value;
+	}
+	return NULL;
+}
+
 const char* symbol_value_type_name_cstr(SymbolValueType type) {
 	switch (type) {
 		#define CASE(T) case T: return #T;
@@ -1862,493 +2216,3317 @@ void symbol_value_print(SymbolValue value, int indent) {
 	printf("\n");
 }
 
+// the whole word has to match, "c" is a variable and not compiler
+#define METHOD_IS(name, sv) ((sv).count == sizeof(name) - 1 && strncmp(name, (sv).items, (sv).count) == 0)
+
 MethodType method_extract(StringView sv) {
-	if (strncmp("build",       sv.items, sv.count) == 0) return METHOD_BUILD;
-	if (strncmp("compiler",    sv.items, sv.count) == 0) return METHOD_COMPILER;
-	if (strncmp("input",       sv.items, sv.count) == 0) return METHOD_INPUT;
-	if (strncmp("cflags",      sv.items, sv.count) == 0) return METHOD_CFLAGS;
-	if (strncmp("ldflags",     sv.items, sv.count) == 0) return METHOD_LDFLAGS;
-	if (strncmp("source_dir",  sv.items, sv.count) == 0) return METHOD_SOURCE_DIR;
-	if (strncmp("output_dir",  sv.items, sv.count) == 0) return METHOD_OUTPUT_DIR;
-	if (strncmp("include_dir", sv.items, sv.count) == 0) return METHOD_INCLUDE_DIR;
-	if (strncmp("library_dir", sv.items, sv.count) == 0) return METHOD_LIBRARY_DIR;
-	if (strncmp("link",        sv.items, sv.count) == 0) return METHOD_LINK;
-	if (strncmp("dirty",       sv.items, sv.count) == 0) return METHOD_DIRTY;
-	if (strncmp("mark_clean",  sv.items, sv.count) == 0) return METHOD_MARK_CLEAN;
-	if (strncmp("echo",        sv.items, sv.count) == 0) return METHOD_ECHO;
+	if (METHOD_IS("build",       sv)) return METHOD_BUILD;
+	if (METHOD_IS("compiler",    sv)) return METHOD_COMPILER;
+	if (METHOD_IS("input",       sv)) return METHOD_INPUT;
+	if (METHOD_IS("cflags",      sv)) return METHOD_CFLAGS;
+	if (METHOD_IS("ldflags",     sv)) return METHOD_LDFLAGS;
+	if (METHOD_IS("source_dir",  sv)) return METHOD_SOURCE_DIR;
+	if (METHOD_IS("output_dir",  sv)) return METHOD_OUTPUT_DIR;
+	if (METHOD_IS("include_dir", sv)) return METHOD_INCLUDE_DIR;
+	if (METHOD_IS("library_dir", sv)) return METHOD_LIBRARY_DIR;
+	if (METHOD_IS("link",        sv)) return METHOD_LINK;
+	if (METHOD_IS("dirty",       sv)) return METHOD_DIRTY;
+	if (METHOD_IS("mark_clean",  sv)) return METHOD_MARK_CLEAN;
+	if (METHOD_IS("echo",        sv)) return METHOD_ECHO;
+	if (METHOD_IS("cache",       sv)) return METHOD_CACHE;
 
 	return METHOD_NONE;
 }
 
+#include <string.h>
 
+// most build commands add one or two options, not the 256 of da_reserve_arena
+#define OPTION_LIST_INITIAL_CAPACITY 4
 
+OptionList option_list_inherit(OptionList* parent) {
+	// an empty ancestor adds nothing to the chain, link past it
+	while (parent && parent->local.count == 0) {
+		parent = parent->parent;
+	}
+	return (OptionList){
+		.parent = parent,
+		.parent_count = parent ? parent->count : 0,
+		.count = parent ? parent->count : 0,
+	};
+}
 
+void option_list_append(Arena* arena, OptionList* list, StringView option) {
+	StringList* local = &list->local;
+	if (local->count == local->capacity) {
+		size_t capacity = local->capacity == 0 ? OPTION_LIST_INITIAL_CAPACITY : local->capacity * 2;
+		local->items = arena_realloc(arena, local->items,
+			local->capacity * sizeof(StringView), capacity * sizeof(StringView));
+		assert(local->items != NULL);
+		local->capacity = capacity;
+	}
+	local->items[local->count++] = option;
+	list->count++;
+}
 
-#include <stdint.h>
-#include <stdbool.h>
+StringView option_list_at(const OptionList* list, size_t index) {
+	assert(index < list->count);
+	while (index < list->parent_count) {
+		list = list->parent;
+	}
+	return list->local.items[index - list->parent_count];
+}
 
-typedef struct {
-	Target** items;
-	size_t count;
-	size_t capacity;
-} BuiltList;
+bool option_list_same(const OptionList* a, const OptionList* b) {
+	if (a->count != b->count) return false;
+	// inherited unchanged from the same list
+	if (a->local.count == 0 && b->local.count == 0 && a->parent == b->parent) return true;
+	for (size_t i = 0; i < a->count; ++i) {
+		StringView x = option_list_at(a, i), y = option_list_at(b, i);
+		if (x.count != y.count || memcmp(x.items, y.items, x.count) != 0) return false;
+	}
+	return true;
+}
 
-typedef struct {
-	BuildCommandList executed;
-	BuiltList built;
-	Arena* arena;
-} Executer;
+#include <stddef.h>
+#include <stdint.h>
 
-Executer executer_new(Arena* arena);
-void executer_dry_run(Executer* e, BuildCommand* root);
-void executer_execute(Executer* e, BuildCommand* root);
+#define HASH_SEED 0xcbf29ce484222325ull
 
+// fnv-1a, chain calls by passing the previous result as the seed
+static inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t h = seed;
+	for (size_t i = 0; i < size; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
 
-uint64_t get_modification_time_sv(StringView path);
-uint64_t get_modification_time(const char *path_cstr);
+#include <assert.h>
+#include <string.h>
 
+inline static bool intern_same(StringView a, StringView b) {
+	return a.count == b.count && memcmp(a.items, b.items, a.count) == 0;
+}
 
+static void intern_grow(InternPool* pool) {
+	size_t slot_count = pool->slot_count == 0 ? 1024 : pool->slot_count * 2;
+	uint32_t* slots = calloc(slot_count, sizeof(uint32_t));
+	assert(slots != NULL);
 
+	for (size_t id = 0; id < pool->strings.count; ++id) {
+		StringView sv = pool->strings.items[id];
+		size_t i = hash_bytes(sv.items, sv.count, HASH_SEED) & (slot_count - 1);
+		while (slots[i] != 0) {
+			i = (i + 1) & (slot_count - 1);
+		}
+		slots[i] = (uint32_t)id + 1;
+	}
 
-StringBuilder target_generate_cmdline_cstr(Arena* arena, struct BuildCommand* bc, Target* t) {
-	StringBuilder sb = target_generate_cmdline(arena, bc, t);
-	da_append_arena(arena, &sb, '\0');
-	return sb;
+	free(pool->slots);
+	pool->slots = slots;
+	pool->slot_count = slot_count;
 }
 
-
-inline static void target_print_stringview(Arena* arena, StringBuilder* sb, StringView sv) {
-	da_reserve_arena(arena, sb, sb->count + sv.count + 1);
-	int written = snprintf(sb->items + sb->count, sv.count + 2, "%.*s ", (int)sv.count, sv.items);
-	sb->count += written;
+// returns the slot for sv, either holding its id or the empty one it would go into
+inline static size_t intern_slot(InternPool* pool, StringView sv) {
+	size_t i = hash_bytes(sv.items, sv.count, HASH_SEED) & (pool->slot_count - 1);
+	while (pool->slots[i] != 0) {
+		if (intern_same(pool->strings.items[pool->slots[i] - 1], sv)) break;
+		i = (i + 1) & (pool->slot_count - 1);
+	}
+	return i;
 }
 
-inline static void target_string_list_print_flat(Arena* arena, StringBuilder* sb, const StringList* list, const char* prefix, size_t prefix_len) {
-	if (!list || !list->items) {
-		return;
+uint32_t intern(InternPool* pool, StringView sv) {
+	// keep the load factor under a half
+	if ((pool->strings.count + 1) * 2 > pool->slot_count) {
+		intern_grow(pool);
 	}
-	for (size_t i = 0; i < list->count; ++i) {
-		if (prefix_len > 0) {
-			da_reserve_arena(arena, sb, sb->count + prefix_len + 1);
-			int written = snprintf(sb->items + sb->count, prefix_len + 1, "%.*s", (int)prefix_len, prefix);
-			sb->count += written;
-		}
-		target_print_stringview(arena, sb, list->items[i]);
+
+	size_t i = intern_slot(pool, sv);
+	if (pool->slots[i] != 0) {
+		return pool->slots[i] - 1;
 	}
+
+	char* copy = arena_alloc(&pool->arena, sv.count + 1);
+	memcpy(copy, sv.items, sv.count);
+	copy[sv.count] = '\0';
+
+	uint32_t id = (uint32_t)pool->strings.count;
+	da_append(&pool->strings, ((StringView){ .items = copy, .count = sv.count }));
+	pool->slots[i] = id + 1;
+	return id;
 }
 
-StringBuilder target_generate_cmdline(Arena* arena, struct BuildCommand* bc, Target* t) {
-	StringBuilder sb = {0};
-	if (!arena || !bc || !t) return sb;
+uint32_t intern_find(InternPool* pool, StringView sv) {
+	if (pool->slot_count == 0) return INTERN_NONE;
+	size_t i = intern_slot(pool, sv);
+	return pool->slots[i] != 0 ? pool->slots[i] - 1 : INTERN_NONE;
+}
 
+StringView intern_get(InternPool* pool, uint32_t id) {
+	assert(id < pool->strings.count);
+	return pool->strings.items[id];
+}
 
-	if (bc->compiler.count > 0) {
-		target_print_stringview(arena, &sb, bc->compiler);
-	}
+void intern_free(InternPool* pool) {
+	arena_free(&pool->arena);
+	free(pool->strings.items);
+	free(pool->slots);
+	*pool = (InternPool){0};
+}
 
-	target_string_list_print_flat(arena, &sb, &bc->cflags, "",0);
 
-	if (bc->build_type == BUILD_OBJECT) {
-		da_append_many_arena(arena, &sb, "-c ", 3);
-	}
+static InternPool path_pool = {0};
 
-	da_append_many_arena(arena, &sb, "-o ", 3);
-	target_print_stringview(arena, &sb, sv_from_sb(t->output_name));
-	target_print_stringview(arena, &sb, sv_from_sb(t->input_name));
+PathId path_intern(StringView path) {
+	return intern(&path_pool, path);
+}
 
-	target_string_list_print_flat(arena, &sb, &bc->include_dirs,  "-I", 2);
-	target_string_list_print_flat(arena, &sb, &bc->input_files,   "",   0);
-	target_string_list_print_flat(arena, &sb, &bc->input_objects, "",   0);
-	if (bc->build_type == BUILD_EXECUTABLE || bc->build_type == BUILD_LIB) {
-		target_string_list_print_flat(arena, &sb, &bc->library_dirs,  "-L", 2);
-		target_string_list_print_flat(arena, &sb, &bc->library_links, "-l", 2);
-	}
-	target_string_list_print_flat(arena, &sb, &bc->ldflags,       "",   0);
+PathId path_find(StringView path) {
+	uint32_t id = intern_find(&path_pool, path);
+	return id == INTERN_NONE ? PATH_NONE : id;
+}
 
-	return sb;
+StringView path_get(PathId id) {
+	return intern_get(&path_pool, id);
 }
 
+size_t path_count(void) {
+	return path_pool.strings.count;
+}
 
-bool target_check_dirty(struct BuildCommand* bc, Target* t) {
-	if (bc->marked_clean_explicitly) return false;
+Arena* path_arena(void) {
+	return &path_pool.arena;
+}
 
-	uint64_t out_time = get_modification_time_sv(sv_from_sb(t->output_name));
-	uint64_t in_time  = get_modification_time_sv(sv_from_sb(t->input_name));
+void path_pool_free(void) {
+	intern_free(&path_pool);
+}
 
-	for (size_t i = 0; i < bc->input_files.count; ++i) {
-		uint64_t time = get_modification_time_sv(bc->input_files.items[i]);
-		if (time != 0 && time > in_time) {
-			in_time = time;
+
+
+#include <stdbool.h>
+
+// reads the make style dependency files written by `-MMD -MF`.
+// only the prerequisites are collected, the targets of the rules are skipped.
+void depfile_parse(Arena* arena, StringView content, StringList* deps);
+bool depfile_read (Arena* arena, StringView path, StringList* deps);
+
+#include <stdio.h>
+
+void depfile_parse(Arena* arena, StringView content, StringList* deps) {
+	const char* c = content.items;
+	const char* end = content.items + content.count;
+
+	StringBuilder word = {0};
+	bool targets = true; // a rule starts with its targets, up to the word ending in `:`
+
+	while (c < end) {
+		// skip separators and line continuations, a real line break starts the next rule
+		if (*c == '\n') {
+			targets = true;
+			c++;
+			continue;
+		}
+		if (*c == ' ' || *c == '\t' || *c == '\r') {
+			c++;
+			continue;
+		}
+		if (*c == '\\' && c + 1 < end && (c[1] == '\n' || c[1] == '\r')) {
+			c += 2;
+			if (c[-1] == '\r' && c < end && *c == '\n') c++;
+			continue;
 		}
-	}
 
-	uint64_t header_time = get_modification_time_sv(sv_from_sb(t->header_file));
-	if (header_time > in_time) {
-		in_time = header_time;
-	}
+		word.count = 0;
+		while (c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n') {
+			if (*c == '\\' && c + 1 < end && (c[1] == ' ' || c[1] == '#' || c[1] == '\\')) {
+				da_append_arena(arena, &word, c[1]);
+				c += 2;
+			} else if (*c == '\\' && c + 1 < end && (c[1] == '\n' || c[1] == '\r')) {
+				break;
+			} else if (*c == '$' && c + 1 < end && c[1] == '$') {
+				da_append_arena(arena, &word, '$');
+				c += 2;
+			} else {
+				da_append_arena(arena, &word, *c);
+				c++;
+			}
+		}
 
-	if (out_time >= in_time) {
-		return false;
-	}
-	
-	t->dirty = true;
-	bc->dirty = true;
+		if (word.count == 0) continue;
 
-	BuildCommand* p = bc->parent;
-	while (p) {
-		p->dirty = true;
-		p = p->parent;
+		// `target:` or a lone `:` ends the targets of a rule
+		if (word.items[word.count - 1] == ':') {
+			targets = false;
+			continue;
+		}
+		if (targets) continue;
+
+		StringView dep = { .items = word.items, .count = word.count };
+		da_append_arena(arena, deps, dep);
+		word = (StringBuilder){0};
 	}
+}
+
+bool depfile_read(Arena* arena, StringView path, StringList* deps) {
+	char buf[512];
+	if (path.count >= sizeof(buf)) return false;
+	memcpy(buf, path.items, path.count);
+	buf[path.count] = '\0';
+
+	if (access(buf, F_OK) != 0) return false;
 
+	StringBuilder content = {0};
+	if (!read_entire_file(buf, &content)) {
+		return false;
+	}
+	depfile_parse(arena, sv_from_sb(content), deps);
+	sb_free(&content);
 	return true;
 }
 
 
+#include <stdio.h>
 
+#define DEPS_LOG_FILENAME ".cook_deps"
+
+// header dependencies of every object, folded from the compiler's depfiles into
+// one append only binary file in the output dir.
+//
+// the file is a header followed by records, each starting with a u32:
+//   path record: size, the path padded to 4 bytes with NULs, u32 checksum (~id)
+//   deps record: size | DEPS_LOG_DEPS_BIT, u32 output id, u64 mtime, u32 input ids...
+// paths get ids in the order they appear, a later deps record replaces an earlier one.
+typedef struct DepsRecord {
+	uint64_t mtime;     // mtime of the output when the record was written
+	uint32_t count;
+	uint32_t* inputs;
+} DepsRecord;
+
+typedef struct DepsLog {
+	Arena arena;
+	InternPool paths;
+	DepsRecord** records;      // output id -> record, NULL if none
+	size_t records_capacity;
+	size_t record_count;       // deps records in the file, stale ones included
+	size_t live_count;         // outputs with a record
+	size_t written_paths;      // paths with ids below this are in the file
+	char* filepath;
+	FILE* file;
+	bool needs_recompact;
+} DepsLog;
+
+bool        deps_log_load  (DepsLog* log, StringView output_dir);
+DepsRecord* deps_log_find  (DepsLog* log, StringView output);
+bool        deps_log_record(DepsLog* log, StringView output, uint64_t mtime, const StringList* inputs);
+void        deps_log_close (DepsLog* log);
+// prints every output with a record and its inputs, in the order of their ids
+void        deps_log_report(DepsLog* log, FILE* stream);
 
+#include <errno.h>
+#include <string.h>
 
+#define DEPS_LOG_SIGNATURE "# cookdeps\n"
+#define DEPS_LOG_SIGNATURE_SIZE (sizeof(DEPS_LOG_SIGNATURE) - 1)
+#define DEPS_LOG_VERSION 2
+#define DEPS_LOG_DEPS_BIT 0x80000000u
+#define DEPS_LOG_MAX_RECORD_SIZE (1u << 20)
+// don't bother compacting small logs
+#define DEPS_LOG_MIN_RECORDS_TO_COMPACT 1000
 
-#define INDENT_MULTIPLIER 4
+inline static uint32_t deps_log_read_u32(const char* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
 
-BuildCommand* build_command_new(Arena* arena) {
-	BuildCommand* bc = (BuildCommand*)arena_alloc(arena, sizeof(BuildCommand));
-	*bc = build_command_default();
-	return bc;
+static void deps_log_set_record(DepsLog* log, uint32_t output, DepsRecord* record) {
+	if (output >= log->records_capacity) {
+		size_t capacity = log->records_capacity == 0 ? 256 : log->records_capacity;
+		while (output >= capacity) capacity *= 2;
+		log->records = realloc(log->records, capacity * sizeof(*log->records));
+		assert(log->records != NULL);
+		memset(log->records + log->records_capacity, 0,
+			(capacity - log->records_capacity) * sizeof(*log->records));
+		log->records_capacity = capacity;
+	}
+	if (!log->records[output]) {
+		log->live_count++;
+	}
+	log->records[output] = record;
 }
 
-BuildCommand build_command_default(void) {
-	static const StringView cc = { .items = "cc", .count = 3 };
+bool deps_log_load(DepsLog* log, StringView output_dir) {
+	StringBuilder path = {0};
+	if (output_dir.count > 0) {
+		da_append_many(&path, output_dir.items, output_dir.count);
+		da_append(&path, '/');
+	}
+	da_append_many(&path, DEPS_LOG_FILENAME, strlen(DEPS_LOG_FILENAME));
+	da_append(&path, '\0');
+	log->filepath = path.items;
 
-	BuildCommand bc = {0};
-	bc.compiler = cc;
-	bc.build_type = BUILD_EXECUTABLE;
-	return bc;
-}
+	if (access(log->filepath, F_OK) != 0) {
+		return true;
+	}
 
-BuildCommand* build_command_inherit(Arena* arena, BuildCommand* parent) {
-	if (!parent) {
-		return NULL;
+	StringBuilder content = {0};
+	if (!read_entire_file(log->filepath, &content)) {
+		return false;
 	}
-	BuildCommand* bc = build_command_new(arena);
 
-	bc->parent = parent;
-	bc->compiler = parent->compiler;
-	bc->include_dirs = parent->include_dirs;
-	bc->library_dirs = parent->library_dirs;
-	bc->library_links = parent->library_links;
-	bc->cflags = parent->cflags;
-	bc->ldflags = parent->ldflags;
-	bc->source_dir = parent->source_dir;
-	bc->output_dir = parent->output_dir;
+	const char* data = content.items;
+	size_t size = content.count;
+	size_t pos = DEPS_LOG_SIGNATURE_SIZE + sizeof(uint32_t);
 
-	if (parent->parent != NULL) {
-		bc->build_type = BUILD_OBJECT;
+	if (size < pos
+		|| memcmp(data, DEPS_LOG_SIGNATURE, DEPS_LOG_SIGNATURE_SIZE) != 0
+		|| deps_log_read_u32(data + DEPS_LOG_SIGNATURE_SIZE) != DEPS_LOG_VERSION) {
+		// unknown format, start over
+		log->needs_recompact = true;
+		sb_free(&content);
+		return true;
 	}
 
-	da_append_arena(arena, &parent->children, bc);
-	return bc;
-}
+	bool corrupt = false;
+	while (pos + sizeof(uint32_t) <= size) {
+		uint32_t header = deps_log_read_u32(data + pos);
+		uint32_t record_size = header & ~DEPS_LOG_DEPS_BIT;
+		pos += sizeof(uint32_t);
 
+		if (record_size > DEPS_LOG_MAX_RECORD_SIZE || pos + record_size > size || record_size % 4 != 0) {
+			corrupt = true;
+			break;
+		}
 
-inline static void indent_label(int indent, const char* label) {
-	printf("%*s%-14s: ", indent * INDENT_MULTIPLIER, "", label);
-}
-inline static void indent_label_sv(int indent, StringView sv) {
-	printf("%*s%-14.*s: ", indent * INDENT_MULTIPLIER, "", (int)sv.count, sv.items);
-}
-inline static void string_list_print_big(int indent, const char* label, const StringList* list) {
-	if (list->count == 0) return;
+		const char* record = data + pos;
+		pos += record_size;
 
-	indent_label(indent, label);
-	for (size_t i = 0; i < list->count; ++i) {
-		const StringView* sv = &list->items[i];
-		printf("%.*s", (int)sv->count, sv->items);
-		if (i + 1 < list->count) {
-			printf(", ");
-		}
-	}
-	printf("\n");
-}
+		if (header & DEPS_LOG_DEPS_BIT) {
+			if (record_size < 12) { corrupt = true; break; }
 
-inline static void target_list_print_pretty(size_t indent, TargetList list) {
-	if (list.count == 0) return;
+			uint32_t path_count = (uint32_t)log->paths.strings.count;
+			uint32_t output = deps_log_read_u32(record);
+			if (output >= path_count) { corrupt = true; break; }
 
-	indent_label(indent, "targets");
-	printf("\n");
+			DepsRecord* r = arena_alloc(&log->arena, sizeof(DepsRecord));
+			memcpy(&r->mtime, record + 4, sizeof(r->mtime));
+			r->count = (record_size - 12) / 4;
+			r->inputs = arena_alloc(&log->arena, r->count * sizeof(uint32_t));
+			memcpy(r->inputs, record + 12, r->count * sizeof(uint32_t));
+			for (uint32_t i = 0; i < r->count; ++i) {
+				if (r->inputs[i] >= path_count) { corrupt = true; break; }
+			}
+			if (corrupt) break;
 
-	for (size_t i = 0; i <  list.count; ++i) {
-		Target* t = &list.items[i];
-		indent_label_sv(indent+1, t->name);
-		printf("input: %-25.*s ", (int)t->input_name.count, t->input_name.items);
-		printf("output: %-25.*s ", (int)t->output_name.count, t->output_name.items);
-		if (t->dirty) printf("[dirty]");
-		printf("\n");
-	}
-}
+			deps_log_set_record(log, output, r);
+			log->record_count++;
+		} else {
+			if (record_size < 4) { corrupt = true; break; }
 
-void build_command_print(BuildCommand* bc, size_t indent) {
-	if (!bc) {
-		return;
-	}
-	size_t ni = indent + 1;
+			size_t path_size = record_size - 4;
+			while (path_size > 0 && record[path_size - 1] == '\0') path_size--;
 
-	indent_label(ni, "build command");
-	if (bc->dirty) printf("[dirty]");
-	printf("\n");
+			uint32_t expected_id = (uint32_t)log->paths.strings.count;
+			uint32_t checksum = deps_log_read_u32(record + record_size - 4);
+			if (checksum != ~expected_id) { corrupt = true; break; }
 
+			StringView sv = { .items = record, .count = path_size };
+			if (intern(&log->paths, sv) != expected_id) { corrupt = true; break; }
+		}
+	}
 
-	if (bc->compiler.count > 0) {
-		indent_label(ni, "compiler");
-		printf("%.*s\n", (int)bc->compiler.count, bc->compiler.items);
+	// drop whatever follows a truncated or broken record
+	if (corrupt || pos != size) {
+		log->needs_recompact = true;
 	}
+	if (log->record_count > DEPS_LOG_MIN_RECORDS_TO_COMPACT && log->record_count > 3 * log->live_count) {
+		log->needs_recompact = true;
+	}
+	log->written_paths = log->paths.strings.count;
 
-	indent_label(ni, "build type");
-	build_type_print(bc->build_type);
-	printf("\n");
+	sb_free(&content);
+	return true;
+}
 
-	target_list_print_pretty(ni, bc->targets);
-	string_list_print_big(ni, "input files", &bc->input_files);
-	string_list_print_big(ni, "input objects", &bc->input_objects);
-	string_list_print_big(ni, "include dirs", &bc->include_dirs);
-	string_list_print_big(ni, "include files", &bc->include_files);
-	string_list_print_big(ni, "library dirs", &bc->library_dirs);
-	string_list_print_big(ni, "library links", &bc->library_links);
-	string_list_print_big(ni, "cflags", &bc->cflags);
-	string_list_print_big(ni, "ldflags", &bc->ldflags);
+DepsRecord* deps_log_find(DepsLog* log, StringView output) {
+	uint32_t id = intern_find(&log->paths, output);
+	if (id == INTERN_NONE || id >= log->records_capacity) return NULL;
+	return log->records[id];
+}
 
-	if (bc->source_dir.count > 0) {
-		indent_label(ni, "source dir");
-		printf("%.*s\n", (int)bc->source_dir.count, bc->source_dir.items);
-	}
-	if (bc->output_dir.count > 0) {
-		indent_label(ni, "output dir");
-		printf("%.*s\n", (int)bc->output_dir.count, bc->output_dir.items);
-	}
 
-	if (bc->children.count > 0) {
-		indent_label(ni, "children");
-		printf("%zu\n", bc->children.count);
-		for (size_t i = 0; i < bc->children.count; ++i) {
-			indent_label(indent + 2, "child");
-			printf("%zu\n", i);
-			build_command_print(bc->children.items[i], indent + 2);
-		}
-	}
+static bool deps_log_write_path(FILE* f, StringView path, uint32_t id) {
+	uint32_t padding = (4 - path.count % 4) % 4;
+	uint32_t size = (uint32_t)path.count + padding + 4;
+	uint32_t checksum = ~id;
+	static const char zeroes[4] = {0};
+
+	return fwrite(&size, 4, 1, f) == 1
+		&& fwrite(path.items, 1, path.count, f) == path.count
+		&& fwrite(zeroes, 1, padding, f) == padding
+		&& fwrite(&checksum, 4, 1, f) == 1;
 }
 
+static bool deps_log_write_deps(FILE* f, uint32_t output, DepsRecord* r) {
+	uint32_t header = (12 + r->count * 4) | DEPS_LOG_DEPS_BIT;
 
+	return fwrite(&header, 4, 1, f) == 1
+		&& fwrite(&output, 4, 1, f) == 1
+		&& fwrite(&r->mtime, 8, 1, f) == 1
+		&& fwrite(r->inputs, 4, r->count, f) == r->count;
+}
 
-void build_command_dump(Arena* arena, BuildCommand* bc, FILE* stream, size_t target_to_build) {
-	if (!bc || !bc->dirty) {
-		return;
+// rewrites the file with only the live records and the paths they use
+static bool deps_log_recompact(DepsLog* log) {
+	StringBuilder tmp = {0};
+	da_append_many(&tmp, log->filepath, strlen(log->filepath));
+	da_append_many(&tmp, ".tmp", 5);
+
+	FILE* f = fopen(tmp.items, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][deps_log] could not open %s: %s\n", tmp.items, strerror(errno));
+		free(tmp.items);
+		return false;
 	}
 
-	// skip root bc
-	if (!bc->parent) {
-		for (size_t i = 0; i < bc->children.count; ++i) {
-			build_command_dump(arena, bc->children.items[i], stream, 0);
+	uint32_t version = DEPS_LOG_VERSION;
+	bool ok = fwrite(DEPS_LOG_SIGNATURE, 1, DEPS_LOG_SIGNATURE_SIZE, f) == DEPS_LOG_SIGNATURE_SIZE
+		&& fwrite(&version, 4, 1, f) == 1;
+
+	InternPool paths = {0};
+	DepsRecord** records = log->records;
+	size_t records_capacity = log->records_capacity;
+	log->records = NULL;
+	log->records_capacity = 0;
+	log->live_count = 0;
+
+	for (size_t output = 0; ok && output < records_capacity; ++output) {
+		DepsRecord* r = records[output];
+		if (!r) continue;
+
+		for (uint32_t i = 0; ok && i <= r->count; ++i) {
+			uint32_t old_id = i < r->count ? r->inputs[i] : (uint32_t)output;
+			StringView sv = intern_get(&log->paths, old_id);
+			size_t count_before = paths.strings.count;
+			uint32_t id = intern(&paths, sv);
+			if (paths.strings.count != count_before) {
+				ok = deps_log_write_path(f, sv, id);
+			}
+			if (i < r->count) r->inputs[i] = id;
 		}
-		return;
-	}
 
-	// recurse into children
-	for (size_t i = 0; i < bc->children.count; ++i) {
-		build_command_dump(arena, bc->children.items[i], stream, 0);
+		uint32_t new_output = intern(&paths, intern_get(&log->paths, (uint32_t)output));
+		ok = ok && deps_log_write_deps(f, new_output, r);
+		deps_log_set_record(log, new_output, r);
 	}
+	free(records);
 
-	if (bc->targets.count == 0) {
-		return;
+	intern_free(&log->paths);
+	log->paths = paths;
+	log->written_paths = paths.strings.count;
+	log->record_count = log->live_count;
+	log->needs_recompact = false;
+
+	if (fclose(f) != 0) ok = false;
+	if (ok) {
+#ifdef _WIN32
+		remove(log->filepath);
+#endif
+		ok = rename(tmp.items, log->filepath) == 0;
 	}
-	if (bc->targets.count <= target_to_build) {
-		return;
+	if (!ok) {
+		fprintf(stderr, "[ERROR][deps_log] could not write %s: %s\n", log->filepath, strerror(errno));
 	}
+	free(tmp.items);
+	return ok;
+}
 
-	Target* t = &bc->targets.items[target_to_build];
-	if (!t->built) {
-		StringBuilder sb = target_generate_cmdline(arena, bc, t);
-		printf("%.*s\n", (int)sb.count, sb.items);
-		t->built = true;
+static bool deps_log_open(DepsLog* log) {
+	if (log->file) return true;
+	if (!log->filepath) return false;
+
+	if (log->needs_recompact || access(log->filepath, F_OK) != 0) {
+		if (!deps_log_recompact(log)) return false;
 	}
 
-	if (target_to_build == 0) {
-		for (size_t i = 1; i < bc->targets.count; ++i) {
-			build_command_dump(arena, bc, stream, i);
-		}
+	log->file = fopen(log->filepath, "ab");
+	if (!log->file) {
+		fprintf(stderr, "[ERROR][deps_log] could not open %s: %s\n", log->filepath, strerror(errno));
+		return false;
 	}
+	return true;
 }
 
-void build_type_print(BuildType type) {
-	switch (type) {
-		case BUILD_EXECUTABLE: printf("executable"); return;
-		case BUILD_OBJECT:     printf("object");     return;
-		case BUILD_LIB:        printf("lib");        return;
+bool deps_log_record(DepsLog* log, StringView output, uint64_t mtime, const StringList* inputs) {
+	// opening may recompact and renumber the paths, so intern after it
+	if (!deps_log_open(log)) return false;
+
+	uint32_t output_id = intern(&log->paths, output);
+
+	DepsRecord* r = arena_alloc(&log->arena, sizeof(DepsRecord));
+	r->mtime = mtime;
+	r->count = (uint32_t)inputs->count;
+	r->inputs = arena_alloc(&log->arena, r->count * sizeof(uint32_t));
+	for (size_t i = 0; i < inputs->count; ++i) {
+		r->inputs[i] = intern(&log->paths, inputs->items[i]);
 	}
-}
 
-void build_command_mark_all_targets_dirty(BuildCommand* bc, bool dirty) {
-	if (!bc || (bc->marked_clean_explicitly==dirty)) return;
-	for (size_t i = 0; i < bc->targets.count; ++i) {
-		bc->targets.items[i].dirty = dirty;
+	DepsRecord* old = output_id < log->records_capacity ? log->records[output_id] : NULL;
+	if (old && old->mtime == r->mtime && old->count == r->count
+		&& memcmp(old->inputs, r->inputs, r->count * sizeof(uint32_t)) == 0) {
+		return true;
 	}
-}
-void build_command_mark_all_children_dirty(BuildCommand* bc, bool dirty) {
-	if (!bc || (bc->marked_clean_explicitly==dirty)) return;
-	bc->dirty = dirty;
-	build_command_mark_all_targets_dirty(bc, dirty);
-	for (size_t i = 0; i < bc->children.count; ++i) {
-		build_command_mark_all_children_dirty(bc->children.items[i], dirty);
+	deps_log_set_record(log, output_id, r);
+
+	bool ok = true;
+	for (uint32_t id = (uint32_t)log->written_paths; ok && id < log->paths.strings.count; ++id) {
+		ok = deps_log_write_path(log->file, intern_get(&log->paths, id), id);
 	}
-}
+	log->written_paths = log->paths.strings.count;
 
-bool bc_string_view_same(StringView* a, StringView* b) {
-	if (a->count != b->count) return false;
-	if (strncmp(a->items, b->items, a->count) != 0) return false;
-	return true;
+	ok = ok && deps_log_write_deps(log->file, output_id, r);
+	ok = ok && fflush(log->file) == 0;
+	log->record_count++;
+	return ok;
 }
-bool bc_string_builder_same(StringBuilder* a, StringBuilder* b) {
-	if (a->count != b->count) return false;
-	if (strncmp(a->items, b->items, a->count) != 0) return false;
-	return true;
+
+void deps_log_report(DepsLog* log, FILE* stream) {
+	for (size_t id = 0; id < log->records_capacity; ++id) {
+		DepsRecord* r = log->records[id];
+		if (!r) continue;
+		StringView output = intern_get(&log->paths, (uint32_t)id);
+		fprintf(stream, "%.*s: %u inputs\n", (int)output.count, output.items, r->count);
+		for (uint32_t i = 0; i < r->count; ++i) {
+			StringView input = intern_get(&log->paths, r->inputs[i]);
+			fprintf(stream, "    %.*s\n", (int)input.count, input.items);
+		}
+	}
+	fprintf(stream, "[deps] %zu outputs, %zu records in %s\n", log->live_count, log->record_count,
+		log->filepath ? log->filepath : DEPS_LOG_FILENAME);
 }
-bool bc_string_list_same(StringList* a, StringList* b) {
-	if (a->count != b->count) return false;
-	for (size_t i = 0; i < a->count; ++i) {
-		if (!bc_string_view_same(&a->items[i], &b->items[i])) return false;
+
+void deps_log_close(DepsLog* log) {
+	if (log->file) {
+		fclose(log->file);
 	}
-	return true;
+	intern_free(&log->paths);
+	arena_free(&log->arena);
+	free(log->records);
+	free(log->filepath);
+	*log = (DepsLog){0};
 }
 
 
-bool target_is_same(Target* a, Target* b) {
-	if (!bc_string_view_same(&a->name, &b->name)) return false;
-	if (!bc_string_builder_same(&a->input_name,  &b->input_name)) return false;
-	if (!bc_string_builder_same(&a->output_name, &b->output_name)) return false;
-	if (!bc_string_builder_same(&a->header_file, &b->header_file)) return false;
+#include <stdio.h>
+
+#define BUILD_LOG_FILENAME ".cook_log"
+
+// what a command cost, as measured when it was reaped
+typedef struct CommandUsage {
+	uint64_t wall;     // microseconds
+	uint64_t user;     // microseconds of cpu
+	uint64_t system;
+	uint64_t max_rss;  // kilobytes
+	int exit_code;
+} CommandUsage;
+
+// one line per finished job, appended to a text file in the output dir:
+//   <command hash> <exit code> <wall> <user> <system> <max rss> <output path>
+// tab separated, the hash in hex. a later line for the same output replaces an
+// earlier one. a failed job is logged with hash 0, which keeps it dirty.
+typedef struct BuildLogEntry {
+	uint64_t command_hash;
+	CommandUsage usage;
+	bool valid;
+} BuildLogEntry;
+
+typedef struct BuildLog {
+	InternPool outputs;
+	BuildLogEntry* items;  // output id -> entry
+	size_t capacity;
+	size_t line_count;     // stale lines included
+	size_t live_count;
+	char* filepath;
+	FILE* file;
+	bool needs_recompact;
+} BuildLog;
+
+bool           build_log_load  (BuildLog* log, StringView output_dir);
+BuildLogEntry* build_log_find  (BuildLog* log, StringView output);
+bool           build_log_record(BuildLog* log, StringView output, uint64_t command_hash, CommandUsage usage);
+void           build_log_close (BuildLog* log);
+
+// the `count` slowest and most memory hungry outputs of the last builds
+void build_log_report(BuildLog* log, FILE* stream, size_t count);
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#define BUILD_LOG_SIGNATURE "# cook log v2\n"
+#define BUILD_LOG_SIGNATURE_SIZE (sizeof(BUILD_LOG_SIGNATURE) - 1)
+// v1 lines only have the hash, they are read and rewritten as v2
+#define BUILD_LOG_SIGNATURE_V1 "# cook log v1\n"
+// hash, exit code, wall, user, system, max rss
+#define BUILD_LOG_FIELDS 6
+// don't bother compacting small logs
+#define BUILD_LOG_MIN_LINES_TO_COMPACT 1000
+
+static BuildLogEntry* build_log_entry(BuildLog* log, uint32_t id) {
+	if (id >= log->capacity) {
+		size_t capacity = log->capacity == 0 ? 256 : log->capacity;
+		while (id >= capacity) capacity *= 2;
+		log->items = realloc(log->items, capacity * sizeof(BuildLogEntry));
+		assert(log->items != NULL);
+		memset(log->items + log->capacity, 0, (capacity - log->capacity) * sizeof(BuildLogEntry));
+		log->capacity = capacity;
+	}
+	return &log->items[id];
+}
+
+static void build_log_set(BuildLog* log, StringView output, BuildLogEntry entry) {
+	BuildLogEntry* e = build_log_entry(log, intern(&log->outputs, output));
+	if (!e->valid) log->live_count++;
+	*e = entry;
+	e->valid = true;
+}
+
+// a number in `base` followed by a tab, `c` is left after the tab
+static bool build_log_parse_field(const char** c, const char* end, int base, uint64_t* value) {
+	const char* p = *c;
+	uint64_t v = 0;
+	for (; p < end && *p != '\t'; ++p) {
+		int digit = (*p >= '0' && *p <= '9') ? *p - '0'
+		          : (base == 16 && *p >= 'a' && *p <= 'f') ? *p - 'a' + 10 : -1;
+		if (digit < 0) return false;
+		v = v * (uint64_t)base + (uint64_t)digit;
+	}
+	if (p == *c || p == end) return false;
+	*value = v;
+	*c = p + 1;
 	return true;
 }
 
+bool build_log_load(BuildLog* log, StringView output_dir) {
+	StringBuilder path = {0};
+	if (output_dir.count > 0) {
+		da_append_many(&path, output_dir.items, output_dir.count);
+		da_append(&path, '/');
+	}
+	da_append_many(&path, BUILD_LOG_FILENAME, strlen(BUILD_LOG_FILENAME));
+	da_append(&path, '\0');
+	log->filepath = path.items;
+
+	if (access(log->filepath, F_OK) != 0) {
+		return true;
+	}
 
+	StringBuilder content = {0};
+	if (!read_entire_file(log->filepath, &content)) {
+		return false;
+	}
 
-bool build_command_is_same(BuildCommand* a, BuildCommand* b) {
-	if (a->children.count != b->children.count) return false;
-	// NOTE: not sure about this, what if the order is different?
-	for (size_t i = 0; i < a->children.count; ++i) {
-		BuildCommand* abc = a->children.items[i];
-		BuildCommand* bbc = b->children.items[i];
-		if (!build_command_is_same(abc, bbc)) return false;
+	size_t fields = BUILD_LOG_FIELDS;
+	if (content.count >= BUILD_LOG_SIGNATURE_SIZE
+		&& memcmp(content.items, BUILD_LOG_SIGNATURE_V1, BUILD_LOG_SIGNATURE_SIZE) == 0) {
+		fields = 1;
+		log->needs_recompact = true;
+	} else if (content.count < BUILD_LOG_SIGNATURE_SIZE
+		|| memcmp(content.items, BUILD_LOG_SIGNATURE, BUILD_LOG_SIGNATURE_SIZE) != 0) {
+		log->needs_recompact = true;
+		sb_free(&content);
+		return true;
 	}
 
-	if (a->build_type != b->build_type) return false;
+	const char* c = content.items + BUILD_LOG_SIGNATURE_SIZE;
+	const char* end = content.items + content.count;
+	while (c < end) {
+		const char* line_end = memchr(c, '\n', end - c);
+		if (!line_end) {
+			// cut off while writing
+			log->needs_recompact = true;
+			break;
+		}
 
-	if (a->targets.count != b->targets.count) return false;
-	for (size_t i = 0; i < a->targets.count; ++i) {
-		if (!target_is_same(&a->targets.items[i], &b->targets.items[i])) return false;
+		uint64_t values[BUILD_LOG_FIELDS] = {0};
+		const char* field = c;
+		bool ok = true;
+		for (size_t f = 0; ok && f < fields; ++f) {
+			ok = build_log_parse_field(&field, line_end, f == 0 ? 16 : 10, &values[f]);
+		}
+		StringView output = { .items = field, .count = line_end - field };
+		if (ok && output.count > 0) {
+			BuildLogEntry entry = {
+				.command_hash = values[0],
+				.usage = {
+					.exit_code = (int)(uint32_t)values[1],
+					.wall = values[2],
+					.user = values[3],
+					.system = values[4],
+					.max_rss = values[5],
+				},
+			};
+			build_log_set(log, output, entry);
+		}
+		log->line_count++;
+		c = line_end + 1;
 	}
 
-	if (!bc_string_view_same(&a->compiler,      &b->compiler))      return false;
-	if (!bc_string_view_same(&a->source_dir,    &b->source_dir))    return false;
-	if (!bc_string_view_same(&a->output_dir,    &b->output_dir))    return false;
-	if (!bc_string_list_same(&a->input_files,   &b->input_files))   return false;
-	if (!bc_string_list_same(&a->input_objects, &b->input_objects)) return false;
-	if (!bc_string_list_same(&a->include_dirs,  &b->include_dirs))  return false;
-	if (!bc_string_list_same(&a->include_files, &b->include_files)) return false;
-	if (!bc_string_list_same(&a->library_dirs,  &b->library_dirs))  return false;
-	if (!bc_string_list_same(&a->library_links, &b->library_links)) return false;
-	if (!bc_string_list_same(&a->cflags,        &b->cflags))        return false;
-	if (!bc_string_list_same(&a->ldflags,       &b->ldflags))       return false;
+	if (log->line_count > BUILD_LOG_MIN_LINES_TO_COMPACT && log->line_count > 3 * log->live_count) {
+		log->needs_recompact = true;
+	}
 
+	sb_free(&content);
 	return true;
 }
 
+BuildLogEntry* build_log_find(BuildLog* log, StringView output) {
+	uint32_t id = intern_find(&log->outputs, output);
+	if (id == INTERN_NONE || id >= log->capacity || !log->items[id].valid) return NULL;
+	return &log->items[id];
+}
 
+inline static bool build_log_write_entry(FILE* f, StringView output, BuildLogEntry* entry) {
+	CommandUsage* u = &entry->usage;
+	return fprintf(f, "%016" PRIx64 "\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%.*s\n",
+		entry->command_hash, (unsigned)u->exit_code, u->wall, u->user, u->system, u->max_rss,
+		(int)output.count, output.items) > 0;
+}
 
+static bool build_log_recompact(BuildLog* log) {
+	StringBuilder tmp = {0};
+	da_append_many(&tmp, log->filepath, strlen(log->filepath));
+	da_append_many(&tmp, ".tmp", 5);
 
+	FILE* f = fopen(tmp.items, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][build_log] could not open %s: %s\n", tmp.items, strerror(errno));
+		free(tmp.items);
+		return false;
+	}
 
-typedef struct {
-	Arena arena;
-	bool had_error;
-	Environment*  current_environment;
-	BuildCommand* current_build_command;
-	Statement*    current_statement;
-} Constructor;
-// TODO: keep track of the current Cookfile, for better error messages
+	bool ok = fwrite(BUILD_LOG_SIGNATURE, 1, BUILD_LOG_SIGNATURE_SIZE, f) == BUILD_LOG_SIGNATURE_SIZE;
+	for (size_t id = 0; ok && id < log->outputs.strings.count; ++id) {
+		if (id >= log->capacity || !log->items[id].valid) continue;
+		ok = build_log_write_entry(f, log->outputs.strings.items[id], &log->items[id]);
+	}
 
-Constructor constructor_new(Statement*);
+	if (fclose(f) != 0) ok = false;
+	if (ok) {
+#ifdef _WIN32
+		remove(log->filepath);
+#endif
+		ok = rename(tmp.items, log->filepath) == 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "[ERROR][build_log] could not write %s: %s\n", log->filepath, strerror(errno));
+	}
+	log->line_count = log->live_count;
+	log->needs_recompact = false;
+	free(tmp.items);
+	return ok;
+}
 
-BuildCommand* constructor_construct_build_command(Constructor*);
+bool build_log_record(BuildLog* log, StringView output, uint64_t command_hash, CommandUsage usage) {
+	if (!log->file) {
+		if (!log->filepath) return false;
+		if (log->needs_recompact || access(log->filepath, F_OK) != 0) {
+			if (!build_log_recompact(log)) return false;
+		}
+		log->file = fopen(log->filepath, "ab");
+		if (!log->file) {
+			fprintf(stderr, "[ERROR][build_log] could not open %s: %s\n", log->filepath, strerror(errno));
+			return false;
+		}
+	}
 
-void constructor_analyze(Constructor*, BuildCommand*);
+	BuildLogEntry entry = { .command_hash = command_hash, .usage = usage };
+	build_log_set(log, output, entry);
+	log->line_count++;
 
+	bool ok = build_log_write_entry(log->file, output, &entry);
+	return fflush(log->file) == 0 && ok;
+}
 
-void constructor_error(Constructor* con, Token token, const char* error_cstr);
+void build_log_close(BuildLog* log) {
+	if (log->file) {
+		fclose(log->file);
+	}
+	intern_free(&log->outputs);
+	free(log->items);
+	free(log->filepath);
+	*log = (BuildLog){0};
+}
 
-SymbolValue constructor_evaluate(Constructor* con, Expression* e);
-SymbolValue constructor_execute (Constructor* con, Statement*  s);
+typedef struct BuildLogRow {
+	StringView output;
+	CommandUsage* usage;
+} BuildLogRow;
 
-SymbolValue constructor_lookup_variable(Constructor* con, StringView sv, Expression* e);
+static int build_log_by_wall(const void* a, const void* b) {
+	uint64_t x = ((const BuildLogRow*)a)->usage->wall, y = ((const BuildLogRow*)b)->usage->wall;
+	return (x < y) - (x > y);
+}
 
-SymbolValue constructor_interpret_block       (Constructor* con, StatementBlock*  s);
-SymbolValue constructor_interpret_call        (Constructor* con, ExpressionCall*  e);
-SymbolValue constructor_interpret_chain       (Constructor* con, ExpressionChain* e);
-SymbolValue constructor_interpret_description (Constructor* con, StatementDescription* s);
-SymbolValue constructor_interpret_method_build(Constructor* con, ExpressionCall* e);
+static int build_log_by_rss(const void* a, const void* b) {
+	uint64_t x = ((const BuildLogRow*)a)->usage->max_rss, y = ((const BuildLogRow*)b)->usage->max_rss;
+	return (x < y) - (x > y);
+}
 
-void constructor_expand_build_command_targets(Constructor* con, BuildCommand* bc);
+static void build_log_print_rows(FILE* stream, BuildLogRow* rows, size_t count) {
+	fprintf(stream, "%10s %10s %10s %10s %5s  %s\n", "wall ms", "user ms", "sys ms", "rss KiB", "exit", "output");
+	for (size_t i = 0; i < count; ++i) {
+		CommandUsage* u = rows[i].usage;
+		fprintf(stream, "%10.1f %10.1f %10.1f %10" PRIu64 " %5d  %.*s\n",
+			(double)u->wall / 1000.0, (double)u->user / 1000.0, (double)u->system / 1000.0,
+			u->max_rss, u->exit_code, (int)rows[i].output.count, rows[i].output.items);
+	}
+}
+
+void build_log_report(BuildLog* log, FILE* stream, size_t count) {
+	BuildLogRow* rows = malloc((log->live_count + 1) * sizeof(BuildLogRow));
+	assert(rows != NULL);
+	size_t n = 0;
+	uint64_t wall = 0, cpu = 0;
+	for (size_t id = 0; id < log->outputs.strings.count; ++id) {
+		if (id >= log->capacity || !log->items[id].valid) continue;
+		CommandUsage* u = &log->items[id].usage;
+		rows[n++] = (BuildLogRow){ .output = log->outputs.strings.items[id], .usage = u };
+		wall += u->wall;
+		cpu += u->user + u->system;
+	}
+	if (n == 0) {
+		fprintf(stream, "[report] %s has no finished commands yet\n", log->filepath ? log->filepath : BUILD_LOG_FILENAME);
+		free(rows);
+		return;
+	}
+	if (count > n) count = n;
 
+	fprintf(stream, "[report] %zu outputs, %.1f ms of commands, %.1f ms of cpu\n",
+		n, (double)wall / 1000.0, (double)cpu / 1000.0);
 
+	qsort(rows, n, sizeof(BuildLogRow), build_log_by_wall);
+	fprintf(stream, "[report] slowest:\n");
+	build_log_print_rows(stream, rows, count);
+
+	qsort(rows, n, sizeof(BuildLogRow), build_log_by_rss);
+	fprintf(stream, "[report] most memory:\n");
+	build_log_print_rows(stream, rows, count);
+	free(rows);
+}
 
 
 
-#include <signal.h>
 #include <stdint.h>
 
-static const SymbolValue nill = { .type = SYMBOL_VALUE_NIL };
+// process wide cache of file modification times keyed by path id,
+// so every unique path is stat'ed once per build no matter how often it is referenced.
+typedef struct FileState {
+	uint64_t mtime; // nanoseconds, 0 if the file does not exist
+	uint64_t size;
+	uint64_t inode;
+} FileState;
 
-Constructor constructor_new(Statement* root_statement) {
-	Constructor con = {0};
-	con.current_statement = root_statement;
-	con.current_environment = environment_new(&con.arena);
-	con.current_build_command = build_command_new(&con.arena);
-	return con;
-}
+typedef struct StatCacheStats {
+	size_t hits;
+	size_t misses;
+} StatCacheStats;
 
-BuildCommand* constructor_construct_build_command(Constructor* con) {
-	Statement* root = con->current_statement;
-	con->current_build_command->body = root;
+FileState      stat_cache_state        (StringView path);
+FileState      stat_cache_state_id     (PathId id);
+uint64_t       stat_cache_mtime        (StringView path);
+uint64_t       stat_cache_mtime_id     (PathId id);
+void           stat_cache_invalidate   (StringView path);
+void           stat_cache_invalidate_id(PathId id);
+StatCacheStats stat_cache_stats        (void);
+void           stat_cache_free         (void);
 
-	constructor_execute(con, root);
-	constructor_expand_build_command_targets(con, con->current_build_command);
-	constructor_analyze(con, con->current_build_command);
-	con->current_build_command->dirty = true; // root build command is always dirty
-	return con->current_build_command;
-}
 
 
-void constructor_analyze(Constructor* con, BuildCommand* bc) {
-	if (!con || !bc) return;
 
-	bool dirty_child = false;
-	for (size_t i = 0; i < bc->children.count; ++i) {
-		constructor_analyze(con, bc->children.items[i]);
-		if (bc->children.items[i]->dirty) {
-			dirty_child = true;
-		}
-	}
+
+
+
+#define FILE_STATE_FILENAME ".cook_state"
+
+// (mtime, size, inode) and content hash of every input, as it was at the end of the
+// last successful build. a file only counts as changed if that tuple differs and
+// its content hashes differently, so touching or checking out identical content
+// doesn't rebuild anything. an output written after that build may come from other
+// content, such outputs are compared by mtime only.
+typedef struct FileSnapshot {
+	FileState state;      // recorded by the last successful build
+	uint64_t hash;
+	FileState seen;       // what this run's dirty analysis saw
+	uint64_t seen_hash;
+	bool recorded;
+	bool tracked;         // used as an input during this run
+	bool seen_hashed;
+} FileSnapshot;
+
+typedef struct FileStateDb {
+	InternPool paths;
+	FileSnapshot* items;  // path id -> snapshot
+	size_t capacity;
+	char* filepath;
+	uint64_t saved;       // mtime of the file, when the snapshots were last saved
+} FileStateDb;
+
+bool file_state_load   (FileStateDb* db, StringView output_dir);
+bool file_state_changed(FileStateDb* db, StringView path, uint64_t since);
+bool file_state_save   (FileStateDb* db);
+void file_state_close  (FileStateDb* db);
+
+
+// everything cook remembers between runs, kept in the root output dir
+typedef struct BuildState {
+	DepsLog deps;
+	BuildLog log;
+	FileStateDb files;
+} BuildState;
+
+bool build_state_load (BuildState* state, StringView output_dir);
+void build_state_close(BuildState* state);
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define COMPILE_CACHE_DEFAULT_SIZE (5ull * 1024 * 1024 * 1024)
+
+// content addressed store of object files shared between builds, checkouts and
+// concurrent cook processes. entries live in `<dir>/<xx>/<key>.o` and are written
+// with a rename so readers never see a partial object.
+typedef struct CacheKey {
+	uint64_t a;
+	uint64_t b;
+} CacheKey;
+
+typedef struct CompilerId {
+	StringView name;
+	uint64_t id;
+} CompilerId;
+
+typedef struct CompilerIdList {
+	CompilerId* items;
+	size_t count;
+	size_t capacity;
+} CompilerIdList;
+
+typedef struct CompileCache {
+	char* dir;
+	uint64_t max_size;
+	uint64_t stored; // bytes added during this run
+	size_t hits;
+	size_t misses;
+	CompilerIdList compilers;
+} CompileCache;
+
+bool compile_cache_open (CompileCache* cache, StringView dir, uint64_t max_size);
+void compile_cache_close(CompileCache* cache);
+
+// the key covers the compiler binary, the argv without its output paths and the
+// preprocessed translation unit at `preprocessed`
+bool compile_cache_key  (CompileCache* cache, Cmd cmd, const char* preprocessed, CacheKey* key);
+bool compile_cache_fetch(CompileCache* cache, CacheKey key, const char* output);
+void compile_cache_store(CompileCache* cache, CacheKey key, const char* output);
+
+// drops the least recently used entries until the cache fits into max_size
+void compile_cache_evict(CompileCache* cache);
+
+// accepts plain bytes or a K, M or G suffix
+bool compile_cache_parse_size(StringView sv, uint64_t* size);
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// how often the load average and cpu pressure are read while a build runs
+#define LOAD_SAMPLE_INTERVAL_MS 1000
+
+// how many jobs may run right now. a build starts with as many as the cpus cook
+// may use, then backs off while the machine is contended and ramps up again
+// once it is idle, never above `max`.
+typedef struct LoadController {
+	size_t max;
+	size_t limit;
+	double max_load;       // -l: back off while the load average is above it, 0 for none
+	bool adaptive;         // follow cpu pressure, off for an explicit -j
+	uint64_t sampled;      // stats_clock of the last sample, 0 before the first
+	uint64_t stalled;      // cpu pressure total at the last sample, µs
+	bool has_stalled;
+} LoadController;
+
+// online cpus, narrowed down by the affinity mask and the cgroup cpu quota
+size_t load_cpu_count(void);
+
+LoadController load_controller_new(size_t max, double max_load, bool adaptive);
+// samples the machine at most every LOAD_SAMPLE_INTERVAL_MS, returns the new limit
+size_t load_controller_update(LoadController* lc);
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+	Target** items;
+	size_t count;
+	size_t capacity;
+} BuiltList;
+
+typedef struct {
+	size_t* items;
+	size_t count;
+	size_t capacity;
+} JobIndexList;
+
+typedef enum JobState {
+	JOB_WAITING,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_FAILED,
+	JOB_SKIPPED,               // something it depends on failed
+} JobState;
+
+// a cached object compile first runs the preprocessor to find its cache key
+typedef enum JobPhase {
+	JOB_PHASE_COMPILE,
+	JOB_PHASE_PREPROCESS,
+} JobPhase;
+
+// one node of the build graph, a single target of a build command.
+// a job can start once all the jobs it depends on are done.
+typedef struct Job {
+	BuildCommand* bc;
+	Target* target;
+	JobState state;
+	size_t pending;            // number of unfinished dependencies
+	uint64_t priority;         // µs on the longest estimated path through it to the end
+	JobIndexList dependents;   // jobs waiting on this one
+	long pid;
+	uint64_t command_hash;
+	Cmd cmd;
+	StringView cmdline;        // what it was hashed as, printed when it fails
+	int output_fd;             // read end of its stdout and stderr, -1 once closed
+	StringBuilder output;      // everything it printed, shown when it ends
+	JobPhase phase;
+	bool cacheable;            // the key is known, store the object once it is built
+	CacheKey cache_key;
+	bool cancelled;            // killed by --watch or because another job failed
+	bool cached;               // restored from the compile cache
+	size_t slot;               // which of the max_jobs slots it runs in
+	uint64_t start_time;       // for --trace
+	uint64_t started;          // stats_clock when it was started
+	CommandUsage usage;        // of all its phases together, goes to the build log
+} Job;
+
+typedef struct {
+	Job* items;
+	size_t count;
+	size_t capacity;
+} JobList;
+
+typedef struct FingerprintSlot {
+	uint64_t fingerprint;
+	size_t index;              // + 1 into the list the set indexes, 0 is an empty slot
+} FingerprintSlot;
+
+// open addressing set over `executed` or `built`, keyed by fingerprint
+typedef struct FingerprintSet {
+	FingerprintSlot* slots;
+	size_t slot_count;
+	size_t count;
+} FingerprintSet;
+
+// an @file argument and the build command whose shared arguments it holds
+typedef struct ResponseFile {
+	BuildCommand* bc;
+	const char* arg;
+} ResponseFile;
+
+typedef struct {
+	ResponseFile* items;
+	size_t count;
+	size_t capacity;
+} ResponseFileList;
+
+typedef struct {
+	BuildCommandList executed;
+	BuiltList built;
+	FingerprintSet executed_set;
+	FingerprintSet built_set;
+	ResponseFileList responses;
+	FingerprintSet response_set;  // build command fingerprint to responses
+	JobList jobs;
+	JobIndexList ready;        // heap of job indices, the longest critical path on top
+	JobIndexList free_slots;
+	size_t* slot_jobs;         // which job runs in each slot, SIZE_MAX for a free one
+	struct pollfd* pollfds;    // the sigchld pipe, watch_fd and one output per slot
+	Arena* arena;
+	BuildState* state;
+	CompileCache* cache;       // NULL when caching is off
+	size_t max_jobs;
+	LoadController load;       // how many of the max_jobs slots may be used right now
+	size_t running;
+	bool failed;
+	bool keep_going;           // -k: a failure only stops the jobs that depend on it
+	size_t failures;           // commands that failed
+
+	// without --verbose a job prints a [done/total] line instead of its command,
+	// on a terminal that line is rewritten in place
+	int verbose;
+	bool progress;             // stdout is a terminal
+	bool color;                // so the compilers are asked for colored diagnostics
+	bool status_shown;         // the progress line is on screen and has no newline yet
+	size_t finished;
+	size_t total;
+
+	// --watch: while jobs run, watch_fd is polled too and a relevant change
+	// stops the build early, the caller decides what happens to running jobs
+	int watch_fd;
+	bool (*watch_changed)(void* ctx);
+	void* watch_ctx;
+	bool interrupted;
+} Executer;
+
+Executer executer_new(Arena* arena, size_t max_jobs, double max_load);
+void executer_dry_run(Executer* e, BuildCommand* root);
+bool executer_execute(Executer* e, BuildCommand* root);
+
+void executer_watch     (Executer* e, int fd, bool (*changed)(void* ctx), void* ctx);
+void executer_cancel_job(Executer* e, size_t index);
+void executer_drain     (Executer* e);
+// whether SIGINT or SIGTERM arrived since executer_watch
+bool executer_stopped   (void);
+// readable once a signal arrived, for waiting outside of a build
+int  executer_signal_fd (void);
+
+
+FileState get_file_state(const char *path_cstr);
+
+uint64_t get_modification_time_sv(StringView path);
+uint64_t get_modification_time(const char *path_cstr);
+
+
+
+typedef struct StatCacheEntry {
+	FileState state;
+	bool valid;
+} StatCacheEntry;
+
+typedef struct StatCache {
+	StatCacheEntry* entries; // path id -> entry
+	size_t capacity;
+	StatCacheStats stats;
+} StatCache;
+
+static StatCache stat_cache = {0};
+
+static StatCacheEntry* stat_cache_entry(PathId id) {
+	if (id >= stat_cache.capacity) {
+		size_t capacity = stat_cache.capacity == 0 ? 1024 : stat_cache.capacity;
+		while (id >= capacity) capacity *= 2;
+		stat_cache.entries = realloc(stat_cache.entries, capacity * sizeof(StatCacheEntry));
+		assert(stat_cache.entries != NULL);
+		memset(stat_cache.entries + stat_cache.capacity, 0,
+			(capacity - stat_cache.capacity) * sizeof(StatCacheEntry));
+		stat_cache.capacity = capacity;
+	}
+	return &stat_cache.entries[id];
+}
+
+FileState stat_cache_state_id(PathId id) {
+	StatCacheEntry* entry = stat_cache_entry(id);
+	if (entry->valid) {
+		stat_cache.stats.hits++;
+		return entry->state;
+	}
+	stat_cache.stats.misses++;
+	// interned strings are NUL terminated
+	entry->state = get_file_state(path_get(id).items);
+	entry->valid = true;
+	return entry->state;
+}
+
+FileState stat_cache_state(StringView path) {
+	return stat_cache_state_id(path_intern(path));
+}
+
+uint64_t stat_cache_mtime(StringView path) {
+	return stat_cache_state_id(path_intern(path)).mtime;
+}
+
+uint64_t stat_cache_mtime_id(PathId id) {
+	return stat_cache_state_id(id).mtime;
+}
+
+void stat_cache_invalidate_id(PathId id) {
+	if (id != PATH_NONE && id < stat_cache.capacity) {
+		stat_cache.entries[id].valid = false;
+	}
+}
+
+void stat_cache_invalidate(StringView path) {
+	stat_cache_invalidate_id(path_find(path));
+}
+
+StatCacheStats stat_cache_stats(void) {
+	return stat_cache.stats;
+}
+
+void stat_cache_free(void) {
+	free(stat_cache.entries);
+	stat_cache = (StatCache){0};
+}
+
+#include <errno.h>
+#include <stdio.h>
+
+#define FILE_STATE_SIGNATURE "# cookstate\n"
+#define FILE_STATE_SIGNATURE_SIZE (sizeof(FILE_STATE_SIGNATURE) - 1)
+#define FILE_STATE_VERSION 1
+#define FILE_STATE_ENTRY_SIZE (5 * sizeof(uint64_t))
+
+inline static bool file_state_same(FileState a, FileState b) {
+	return a.mtime == b.mtime && a.size == b.size && a.inode == b.inode;
+}
+
+static FileSnapshot* file_state_snapshot(FileStateDb* db, StringView path) {
+	uint32_t id = intern(&db->paths, path);
+	if (id >= db->capacity) {
+		size_t capacity = db->capacity == 0 ? 1024 : db->capacity;
+		while (id >= capacity) capacity *= 2;
+		db->items = realloc(db->items, capacity * sizeof(FileSnapshot));
+		assert(db->items != NULL);
+		memset(db->items + db->capacity, 0, (capacity - db->capacity) * sizeof(FileSnapshot));
+		db->capacity = capacity;
+	}
+	return &db->items[id];
+}
+
+static bool file_state_hash_file(const char* path_cstr, uint64_t* hash) {
+	StringBuilder content = {0};
+	if (!read_entire_file(path_cstr, &content)) {
+		return false;
+	}
+	*hash = hash_bytes(content.items, content.count, HASH_SEED);
+	sb_free(&content);
+	return true;
+}
+
+bool file_state_load(FileStateDb* db, StringView output_dir) {
+	StringBuilder path = {0};
+	if (output_dir.count > 0) {
+		da_append_many(&path, output_dir.items, output_dir.count);
+		da_append(&path, '/');
+	}
+	da_append_many(&path, FILE_STATE_FILENAME, strlen(FILE_STATE_FILENAME));
+	da_append(&path, '\0');
+	db->filepath = path.items;
+
+	if (access(db->filepath, F_OK) != 0) {
+		return true;
+	}
+
+	StringBuilder content = {0};
+	if (!read_entire_file(db->filepath, &content)) {
+		return false;
+	}
+
+	const char* data = content.items;
+	size_t size = content.count;
+	size_t pos = FILE_STATE_SIGNATURE_SIZE + sizeof(uint32_t);
+
+	uint32_t version = 0;
+	if (size >= pos) memcpy(&version, data + FILE_STATE_SIGNATURE_SIZE, sizeof(version));
+	if (size < pos || memcmp(data, FILE_STATE_SIGNATURE, FILE_STATE_SIGNATURE_SIZE) != 0
+		|| version != FILE_STATE_VERSION) {
+		sb_free(&content);
+		return true;
+	}
+
+	while (pos + sizeof(uint32_t) <= size) {
+		uint32_t path_size;
+		memcpy(&path_size, data + pos, sizeof(path_size));
+		pos += sizeof(uint32_t);
+		if (pos + path_size + FILE_STATE_ENTRY_SIZE > size) break;
+
+		StringView sv = { .items = data + pos, .count = path_size };
+		pos += path_size;
+
+		uint64_t fields[5];
+		memcpy(fields, data + pos, FILE_STATE_ENTRY_SIZE);
+		pos += FILE_STATE_ENTRY_SIZE;
+
+		FileSnapshot* s = file_state_snapshot(db, sv);
+		s->state.mtime = fields[0];
+		s->state.size  = fields[1];
+		s->state.inode = fields[2];
+		s->hash        = fields[3];
+		s->recorded    = fields[4] != 0;
+	}
+	db->saved = get_file_state(db->filepath).mtime;
+
+	sb_free(&content);
+	return true;
+}
+
+// whether path changed since an output written at `since` was built from it.
+// the path is remembered as an input, and snapshotted by file_state_save.
+bool file_state_changed(FileStateDb* db, StringView path, uint64_t since) {
+	FileState now = stat_cache_state(path);
+	FileSnapshot* s = file_state_snapshot(db, path);
+	if (!s->tracked || !file_state_same(s->seen, now)) {
+		s->seen = now;
+		s->seen_hashed = false;
+	}
+	s->tracked = true;
+
+	if (now.mtime == 0 || since == 0) return false;
+	// a run that failed somewhere may have built the output from content that was
+	// never snapshotted, and reverting the input would otherwise look unchanged
+	if (!s->recorded || since > db->saved) return now.mtime > since;
+	if (file_state_same(s->state, now)) return false;
+
+	if (!s->seen_hashed) {
+		// interned strings are NUL terminated
+		StringView interned = intern_get(&db->paths, intern_find(&db->paths, path));
+		if (!file_state_hash_file(interned.items, &s->seen_hash)) return true;
+		s->seen_hashed = true;
+	}
+	return s->seen_hash != s->hash;
+}
+
+static bool file_state_write(FileStateDb* db) {
+	StringBuilder tmp = {0};
+	da_append_many(&tmp, db->filepath, strlen(db->filepath));
+	da_append_many(&tmp, ".tmp", 5);
+
+	FILE* f = fopen(tmp.items, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][file_state] could not open %s: %s\n", tmp.items, strerror(errno));
+		free(tmp.items);
+		return false;
+	}
+
+	uint32_t version = FILE_STATE_VERSION;
+	bool ok = fwrite(FILE_STATE_SIGNATURE, 1, FILE_STATE_SIGNATURE_SIZE, f) == FILE_STATE_SIGNATURE_SIZE
+		&& fwrite(&version, sizeof(version), 1, f) == 1;
+
+	for (size_t id = 0; ok && id < db->paths.strings.count; ++id) {
+		FileSnapshot* s = &db->items[id];
+		if (!s->recorded) continue;
+		StringView sv = db->paths.strings.items[id];
+		uint32_t path_size = (uint32_t)sv.count;
+		uint64_t fields[5] = { s->state.mtime, s->state.size, s->state.inode, s->hash, 1 };
+		ok = fwrite(&path_size, sizeof(path_size), 1, f) == 1
+			&& fwrite(sv.items, 1, sv.count, f) == sv.count
+			&& fwrite(fields, FILE_STATE_ENTRY_SIZE, 1, f) == 1;
+	}
+
+	if (fclose(f) != 0) ok = false;
+	if (ok) {
+#ifdef _WIN32
+		remove(db->filepath);
+#endif
+		ok = rename(tmp.items, db->filepath) == 0;
+	}
+	if (ok) {
+		db->saved = get_file_state(db->filepath).mtime;
+	}
+	if (!ok) {
+		fprintf(stderr, "[ERROR][file_state] could not write %s: %s\n", db->filepath, strerror(errno));
+	}
+	free(tmp.items);
+	return ok;
+}
+
+// call only after a fully successful build, every target is then up to date
+// with the inputs as the dirty analysis saw them. the file is written even when no
+// snapshot changed, its mtime tells which outputs the snapshots vouch for.
+bool file_state_save(FileStateDb* db) {
+	if (!db->filepath) return false;
+
+	for (size_t id = 0; id < db->paths.strings.count; ++id) {
+		FileSnapshot* s = &db->items[id];
+		if (!s->tracked) continue;
+
+		const char* path_cstr = db->paths.strings.items[id].items;
+		FileState now = get_file_state(path_cstr);
+
+		// edited while building, the output may have been built from either version
+		if (now.mtime == 0 || !file_state_same(now, s->seen)) {
+			s->recorded = false;
+			continue;
+		}
+		if (s->recorded && file_state_same(s->state, s->seen)) continue;
+
+		if (!s->seen_hashed) {
+			if (!file_state_hash_file(path_cstr, &s->seen_hash)) continue;
+			s->seen_hashed = true;
+		}
+		s->state = s->seen;
+		s->hash = s->seen_hash;
+		s->recorded = true;
+	}
+
+	return file_state_write(db);
+}
+
+void file_state_close(FileStateDb* db) {
+	intern_free(&db->paths);
+	free(db->items);
+	free(db->filepath);
+	*db = (FileStateDb){0};
+}
+
+
+bool build_state_load(BuildState* state, StringView output_dir) {
+	bool ok = deps_log_load(&state->deps, output_dir);
+	ok = build_log_load(&state->log, output_dir) && ok;
+	ok = file_state_load(&state->files, output_dir) && ok;
+	return ok;
+}
+
+void build_state_close(BuildState* state) {
+	deps_log_close(&state->deps);
+	build_log_close(&state->log);
+	file_state_close(&state->files);
+}
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/file.h>
+	#include <time.h>
+	#include <utime.h>
+#endif
+
+#define COMPILE_CACHE_VERSION "cook cache 1"
+#define COMPILE_CACHE_SEED_B (HASH_SEED ^ 0x9e3779b97f4a7c15ull)
+#define COMPILE_CACHE_STALE_TMP (60ull * 60 * 1000000000ull)
+
+bool compile_cache_parse_size(StringView sv, uint64_t* size) {
+	if (sv.count == 0) return false;
+	uint64_t n = 0;
+	size_t i = 0;
+	for (; i < sv.count && sv.items[i] >= '0' && sv.items[i] <= '9'; ++i) {
+		n = n * 10 + (uint64_t)(sv.items[i] - '0');
+	}
+	if (i == 0) return false;
+	if (i < sv.count) {
+		if (i + 1 != sv.count) return false;
+		switch (sv.items[i]) {
+			case 'k': case 'K': n *= 1024ull; break;
+			case 'm': case 'M': n *= 1024ull * 1024; break;
+			case 'g': case 'G': n *= 1024ull * 1024 * 1024; break;
+			default: return false;
+		}
+	}
+	*size = n;
+	return n > 0;
+}
+
+#ifdef _WIN32
+
+bool compile_cache_open(CompileCache* cache, StringView dir, uint64_t max_size) {
+	(void)cache; (void)dir; (void)max_size;
+	fprintf(stderr, "[WARNING][cache] the compile cache is not supported on windows\n");
+	return false;
+}
+void compile_cache_close(CompileCache* cache) { (void)cache; }
+bool compile_cache_key(CompileCache* cache, Cmd cmd, const char* preprocessed, CacheKey* key) {
+	(void)cache; (void)cmd; (void)preprocessed; (void)key;
+	return false;
+}
+bool compile_cache_fetch(CompileCache* cache, CacheKey key, const char* output) {
+	(void)cache; (void)key; (void)output;
+	return false;
+}
+void compile_cache_store(CompileCache* cache, CacheKey key, const char* output) {
+	(void)cache; (void)key; (void)output;
+}
+void compile_cache_evict(CompileCache* cache) { (void)cache; }
+
+#else
+
+bool compile_cache_open(CompileCache* cache, StringView dir, uint64_t max_size) {
+	memset(cache, 0, sizeof(*cache));
+	cache->max_size = max_size > 0 ? max_size : COMPILE_CACHE_DEFAULT_SIZE;
+	cache->dir = malloc(dir.count + 1);
+	assert(cache->dir != NULL);
+	memcpy(cache->dir, dir.items, dir.count);
+	cache->dir[dir.count] = '\0';
+
+	if (MKDIR(cache->dir) != 0 && errno != EEXIST) {
+		fprintf(stderr, "[ERROR][cache] could not create %s: %s\n", cache->dir, strerror(errno));
+		free(cache->dir);
+		cache->dir = NULL;
+		return false;
+	}
+	return true;
+}
+
+void compile_cache_close(CompileCache* cache) {
+	if (!cache->dir) return;
+	// also runs without new entries, the cap may have been lowered
+	compile_cache_evict(cache);
+	free(cache->dir);
+	for (size_t i = 0; i < cache->compilers.count; ++i) {
+		free((char*)cache->compilers.items[i].name.items);
+	}
+	free(cache->compilers.items);
+	cache->dir = NULL;
+}
+
+inline static void cache_key_update(CacheKey* key, const void* data, size_t size) {
+	key->a = hash_bytes(data, size, key->a);
+	key->b = hash_bytes(data, size, key->b);
+}
+
+// resolves the compiler like posix_spawnp does and identifies it by the binary it
+// points to, so upgrading the compiler does not hand out stale objects
+static uint64_t compile_cache_compiler_id(CompileCache* cache, const char* name) {
+	StringView sv = { .items = name, .count = strlen(name) };
+	for (size_t i = 0; i < cache->compilers.count; ++i) {
+		CompilerId* c = &cache->compilers.items[i];
+		if (c->name.count == sv.count && memcmp(c->name.items, sv.items, sv.count) == 0) {
+			return c->id;
+		}
+	}
+
+	uint64_t id = hash_bytes(name, sv.count, HASH_SEED);
+	char path[4096] = {0};
+	if (strchr(name, '/')) {
+		snprintf(path, sizeof(path), "%s", name);
+	} else {
+		const char* dirs = getenv("PATH");
+		while (dirs && *dirs) {
+			const char* end = strchr(dirs, ':');
+			size_t len = end ? (size_t)(end - dirs) : strlen(dirs);
+			snprintf(path, sizeof(path), "%.*s/%s", (int)len, len ? dirs : ".", name);
+			if (access(path, X_OK) == 0) break;
+			path[0] = '\0';
+			dirs = end ? end + 1 : NULL;
+		}
+	}
+	if (path[0] != '\0') {
+		FileState fs = get_file_state(path);
+		id = hash_bytes(path, strlen(path), id);
+		id = hash_bytes(&fs.mtime, sizeof(fs.mtime), id);
+		id = hash_bytes(&fs.size, sizeof(fs.size), id);
+	}
+
+	// the argv lives in an arena that --watch cleans between builds
+	CompilerId c = { .name = { .items = strdup(name), .count = sv.count }, .id = id };
+	da_append(&cache->compilers, c);
+	return id;
+}
+
+bool compile_cache_key(CompileCache* cache, Cmd cmd, const char* preprocessed, CacheKey* key) {
+	if (cmd.count == 0) return false;
+
+	StringBuilder content = {0};
+	if (!read_entire_file(preprocessed, &content)) {
+		return false;
+	}
+
+	CacheKey k = { .a = HASH_SEED, .b = COMPILE_CACHE_SEED_B };
+	cache_key_update(&k, COMPILE_CACHE_VERSION, sizeof(COMPILE_CACHE_VERSION));
+
+	uint64_t compiler = compile_cache_compiler_id(cache, cmd.items[0]);
+	cache_key_update(&k, &compiler, sizeof(compiler));
+
+	// where the results are written does not change them
+	for (size_t i = 1; i < cmd.count; ++i) {
+		if (strcmp(cmd.items[i], "-o") == 0 || strcmp(cmd.items[i], "-MF") == 0) {
+			++i;
+			continue;
+		}
+		cache_key_update(&k, cmd.items[i], strlen(cmd.items[i]) + 1);
+	}
+
+	uint64_t size = content.count;
+	cache_key_update(&k, &size, sizeof(size));
+	cache_key_update(&k, content.items, content.count);
+	sb_free(&content);
+
+	*key = k;
+	return true;
+}
+
+// <dir>/<first two hex digits>/<remaining 30 hex digits>.o
+static void compile_cache_entry_path(CompileCache* cache, CacheKey key, char* path, size_t size, bool create_dir) {
+	char hex[33];
+	snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)key.a, (unsigned long long)key.b);
+	if (create_dir) {
+		snprintf(path, size, "%s/%.2s", cache->dir, hex);
+		if (MKDIR(path) != 0 && errno != EEXIST) {
+			fprintf(stderr, "[ERROR][cache] could not create %s: %s\n", path, strerror(errno));
+		}
+	}
+	snprintf(path, size, "%s/%.2s/%s.o", cache->dir, hex, hex + 2);
+}
+
+// copies into a temporary next to `to` and renames it over, returns the bytes copied
+static uint64_t copy_file_atomic(const char* from, const char* to) {
+	FILE* in = fopen(from, "rb");
+	if (!in) return 0;
+
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", to, (long)getpid());
+	FILE* out = fopen(tmp, "wb");
+	if (!out) {
+		fclose(in);
+		return 0;
+	}
+
+	char buffer[64 * 1024];
+	uint64_t total = 0;
+	bool ok = true;
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		if (fwrite(buffer, 1, n, out) != n) {
+			ok = false;
+			break;
+		}
+		total += n;
+	}
+	if (ferror(in)) ok = false;
+	fclose(in);
+	if (fclose(out) != 0) ok = false;
+
+	if (!ok || total == 0 || rename(tmp, to) != 0) {
+		remove(tmp);
+		return 0;
+	}
+	return total;
+}
+
+bool compile_cache_fetch(CompileCache* cache, CacheKey key, const char* output) {
+	char path[4096];
+	compile_cache_entry_path(cache, key, path, sizeof(path), false);
+
+	if (copy_file_atomic(path, output) == 0) {
+		cache->misses++;
+		return false;
+	}
+	// the mtime of an entry is its last use
+	utime(path, NULL);
+	cache->hits++;
+	return true;
+}
+
+// an entry that is already there, from another process or target, is left alone
+// and not counted again
+void compile_cache_store(CompileCache* cache, CacheKey key, const char* output) {
+	char path[4096];
+	compile_cache_entry_path(cache, key, path, sizeof(path), true);
+	if (access(path, F_OK) == 0) return;
+	cache->stored += copy_file_atomic(output, path);
+}
+
+
+typedef struct CacheEntry {
+	char* path;
+	uint64_t size;
+	uint64_t mtime;
+} CacheEntry;
+
+typedef struct CacheEntryList {
+	CacheEntry* items;
+	size_t count;
+	size_t capacity;
+} CacheEntryList;
+
+static int cache_entry_compare(const void* a, const void* b) {
+	const CacheEntry* x = a;
+	const CacheEntry* y = b;
+	return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+// walks every bucket, also sweeps temporaries left behind by killed processes
+static uint64_t compile_cache_scan(CompileCache* cache, CacheEntryList* entries) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+
+	uint64_t total = 0;
+	char bucket[4096];
+	char path[4096 + 1 + 256];
+	for (int i = 0; i < 256; ++i) {
+		snprintf(bucket, sizeof(bucket), "%s/%02x", cache->dir, i);
+		DIR* dir = opendir(bucket);
+		if (!dir) continue;
+
+		struct dirent* d;
+		while ((d = readdir(dir)) != NULL) {
+			if (d->d_name[0] == '.') continue;
+			snprintf(path, sizeof(path), "%s/%s", bucket, d->d_name);
+			FileState fs = get_file_state(path);
+			if (fs.mtime == 0) continue;
+
+			if (strstr(d->d_name, ".tmp.")) {
+				if (now_ns > fs.mtime + COMPILE_CACHE_STALE_TMP) remove(path);
+				continue;
+			}
+			if (!ends_with(d->d_name, ".o")) continue;
+
+			CacheEntry e = { .path = strdup(path), .size = fs.size, .mtime = fs.mtime };
+			da_append(entries, e);
+			total += fs.size;
+		}
+		closedir(dir);
+	}
+	return total;
+}
+
+// the total size is kept in `<dir>/size` so a build that stays under the cap does
+// not have to walk the whole cache. the lock serializes concurrent cook processes.
+void compile_cache_evict(CompileCache* cache) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/lock", cache->dir);
+	int lock = open(path, O_RDWR | O_CREAT, 0666);
+	if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+		fprintf(stderr, "[ERROR][cache] could not lock %s: %s\n", path, strerror(errno));
+		if (lock >= 0) close(lock);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/size", cache->dir);
+	uint64_t total = 0;
+	FILE* f = fopen(path, "r");
+	if (f) {
+		unsigned long long n = 0;
+		if (fscanf(f, "%llu", &n) == 1) total = n;
+		fclose(f);
+	}
+	total += cache->stored;
+	cache->stored = 0;
+
+	if (total > cache->max_size) {
+		CacheEntryList entries = {0};
+		total = compile_cache_scan(cache, &entries);
+		qsort(entries.items, entries.count, sizeof(CacheEntry), cache_entry_compare);
+
+		// leave some headroom so the next few builds do not rescan right away
+		uint64_t target = cache->max_size / 10 * 9;
+		for (size_t i = 0; i < entries.count; ++i) {
+			if (total > target && remove(entries.items[i].path) == 0) {
+				total -= entries.items[i].size;
+			}
+			free(entries.items[i].path);
+		}
+		free(entries.items);
+	}
+
+	f = fopen(path, "w");
+	if (f) {
+		fprintf(f, "%llu\n", (unsigned long long)total);
+		fclose(f);
+	}
+
+	flock(lock, LOCK_UN);
+	close(lock);
+}
+
+#endif // _WIN32
+
+
+
+#include <stdbool.h>
+
+// inotify based file watching for --watch. the directories of the files are watched
+// rather than the files, since editors often save by renaming over the old file.
+typedef struct WatchDir {
+	int wd;
+	uint32_t dir; // id in Watcher.dirs, "" stands for the current directory
+} WatchDir;
+
+typedef struct WatchDirList {
+	WatchDir* items;
+	size_t count;
+	size_t capacity;
+} WatchDirList;
+
+typedef struct Watcher {
+	int fd;
+	InternPool files;      // every path a build depends on
+	InternPool dirs;
+	WatchDirList watches;
+	StringList changed;    // watched files changed since the last watcher_clear
+} Watcher;
+
+bool watcher_open (Watcher* w);
+void watcher_close(Watcher* w);
+// returns the id of path in Watcher.files, INTERN_NONE for an empty path
+uint32_t watcher_add(Watcher* w, StringView path);
+
+// waits up to timeout_ms (-1 blocks) for events, returns whether any watched file changed.
+// wake_fd being readable ends the wait early, it is drained and false is returned.
+bool watcher_wait (Watcher* w, int wake_fd, int timeout_ms);
+// collects the events that are already queued without blocking
+bool watcher_read (Watcher* w);
+bool watcher_changed(Watcher* w, StringView path);
+void watcher_clear(Watcher* w);
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+	#include <poll.h>
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#endif
+
+// a save is often several events in a row, wait this long for the rest of them
+#define WATCH_SETTLE_MS 5
+
+bool watcher_changed(Watcher* w, StringView path) {
+	for (size_t i = 0; i < w->changed.count; ++i) {
+		StringView c = w->changed.items[i];
+		if (c.count == path.count && memcmp(c.items, path.items, path.count) == 0) return true;
+	}
+	return false;
+}
+
+void watcher_clear(Watcher* w) {
+	w->changed.count = 0;
+}
+
+#ifndef __linux__
+
+bool watcher_open(Watcher* w) {
+	*w = (Watcher){ .fd = -1 };
+	fprintf(stderr, "[ERROR][watch] --watch needs inotify and is only supported on linux\n");
+	return false;
+}
+void watcher_close(Watcher* w) { (void)w; }
+uint32_t watcher_add(Watcher* w, StringView path) { (void)w; (void)path; return INTERN_NONE; }
+bool watcher_wait(Watcher* w, int wake_fd, int timeout_ms) { (void)w; (void)wake_fd; (void)timeout_ms; return false; }
+bool watcher_read(Watcher* w) { (void)w; return false; }
+
+#else
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_ATTRIB)
+
+bool watcher_open(Watcher* w) {
+	*w = (Watcher){0};
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd < 0) {
+		fprintf(stderr, "[ERROR][watch] inotify_init1 failed: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void watcher_close(Watcher* w) {
+	if (w->fd >= 0) close(w->fd);
+	intern_free(&w->files);
+	intern_free(&w->dirs);
+	free(w->watches.items);
+	free(w->changed.items);
+	*w = (Watcher){ .fd = -1 };
+}
+
+uint32_t watcher_add(Watcher* w, StringView path) {
+	if (path.count == 0) return INTERN_NONE;
+
+	size_t before = w->files.strings.count;
+	uint32_t file = intern(&w->files, path);
+	if (w->files.strings.count == before) return file;
+
+	StringView dir = { .items = path.items, .count = 0 };
+	for (size_t i = path.count; i > 0; --i) {
+		if (path.items[i - 1] == '/') {
+			dir.count = i > 1 ? i - 1 : 1;
+			break;
+		}
+	}
+
+	before = w->dirs.strings.count;
+	uint32_t id = intern(&w->dirs, dir);
+	if (w->dirs.strings.count == before) return file;
+
+	const char* dir_cstr = dir.count > 0 ? intern_get(&w->dirs, id).items : ".";
+	int wd = inotify_add_watch(w->fd, dir_cstr, WATCH_EVENTS);
+	if (wd < 0) {
+		fprintf(stderr, "[ERROR][watch] could not watch %s: %s\n", dir_cstr, strerror(errno));
+		return file;
+	}
+	da_append(&w->watches, ((WatchDir){ .wd = wd, .dir = id }));
+	return file;
+}
+
+static void watcher_mark(Watcher* w, StringView path) {
+	uint32_t id = intern_find(&w->files, path);
+	if (id == INTERN_NONE) return;
+	StringView interned = intern_get(&w->files, id);
+	if (!watcher_changed(w, interned)) {
+		da_append(&w->changed, interned);
+	}
+}
+
+static void watcher_handle(Watcher* w, const struct inotify_event* ev) {
+	if (ev->mask & IN_Q_OVERFLOW) {
+		// events were dropped, anything could have changed
+		for (size_t i = 0; i < w->files.strings.count; ++i) {
+			watcher_mark(w, w->files.strings.items[i]);
+		}
+		return;
+	}
+	if (ev->len == 0) return;
+
+	// the same directory can be reached through differently spelled paths
+	char path[4096 + 1 + 256];
+	for (size_t i = 0; i < w->watches.count; ++i) {
+		if (w->watches.items[i].wd != ev->wd) continue;
+		StringView dir = intern_get(&w->dirs, w->watches.items[i].dir);
+		int n;
+		if (dir.count == 0) {
+			n = snprintf(path, sizeof(path), "%s", ev->name);
+		} else if (dir.items[dir.count - 1] == '/') {
+			n = snprintf(path, sizeof(path), "%s%s", dir.items, ev->name);
+		} else {
+			n = snprintf(path, sizeof(path), "%s/%s", dir.items, ev->name);
+		}
+		if (n <= 0 || (size_t)n >= sizeof(path)) continue;
+		watcher_mark(w, (StringView){ .items = path, .count = (size_t)n });
+	}
+}
+
+bool watcher_read(Watcher* w) {
+	size_t before = w->changed.count;
+	_Alignas(struct inotify_event) char buffer[64 * 1024];
+	while (true) {
+		ssize_t n = read(w->fd, buffer, sizeof(buffer));
+		if (n <= 0) break;
+		for (char* p = buffer; p < buffer + n; ) {
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			watcher_handle(w, ev);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	return w->changed.count > before;
+}
+
+bool watcher_wait(Watcher* w, int wake_fd, int timeout_ms) {
+	struct pollfd pfds[2] = {
+		{ .fd = w->fd, .events = POLLIN },
+		{ .fd = wake_fd, .events = POLLIN },
+	};
+	while (true) {
+		int r = poll(pfds, 2, timeout_ms);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		if (pfds[1].revents & POLLIN) {
+			char buffer[64];
+			while (read(wake_fd, buffer, sizeof(buffer)) > 0) {}
+			return false;
+		}
+		if (watcher_read(w)) break;
+	}
+	struct pollfd pfd = pfds[0];
+	while (poll(&pfd, 1, WATCH_SETTLE_MS) > 0) {
+		watcher_read(w);
+	}
+	return true;
+}
+
+#endif // __linux__
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// chrome trace event json for --trace, open it in perfetto or chrome://tracing.
+// cook's own phases go on the first lane and every spawned command on the lane
+// of the executer slot it ran in. all calls do nothing until trace_open.
+bool     trace_open (const char* path);
+void     trace_close(void);
+bool     trace_enabled(void);
+void     trace_flush(void);
+
+// microseconds since trace_open, 0 when tracing is off
+uint64_t trace_now  (void);
+
+// a phase of cook itself that started at `start` and ends now
+void trace_phase  (const char* name, uint64_t start);
+void trace_command(uint64_t start, size_t slot, StringView output, StringView target,
+                   size_t depth, int exit_code, bool cached);
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+#define TRACE_PID 1
+#define TRACE_MAIN_TID 0
+
+typedef struct Trace {
+	FILE* file;
+	uint64_t origin;     // monotonic clock at trace_open, in microseconds
+	size_t lanes;        // worker lanes that already have a name
+	bool first;
+} Trace;
+
+static Trace trace = {0};
+
+static uint64_t trace_clock(void) {
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000ull
+		+ (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000ull / (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000ull;
+#endif
+}
+
+static void trace_write_string(const char* s, size_t n) {
+	fputc('"', trace.file);
+	for (size_t i = 0; i < n; ++i) {
+		unsigned char c = (unsigned char)s[i];
+		if (c == '"' || c == '\\') {
+			fputc('\\', trace.file);
+			fputc(c, trace.file);
+		} else if (c < 0x20) {
+			fprintf(trace.file, "\\u%04x", c);
+		} else {
+			fputc(c, trace.file);
+		}
+	}
+	fputc('"', trace.file);
+}
+
+static void trace_begin_event(void) {
+	fputs(trace.first ? "\n" : ",\n", trace.file);
+	trace.first = false;
+}
+
+static void trace_lane_name(size_t tid, const char* name) {
+	trace_begin_event();
+	fprintf(trace.file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+		TRACE_PID, tid, name);
+}
+
+bool trace_open(const char* path) {
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][trace] could not open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	trace = (Trace){ .file = f, .origin = trace_clock(), .first = true };
+	fputc('[', trace.file);
+	trace_lane_name(TRACE_MAIN_TID, "cook");
+	return true;
+}
+
+// a file that never gets closed, like under --watch, still loads without the `]`
+void trace_close(void) {
+	if (!trace.file) return;
+	fputs("\n]\n", trace.file);
+	fclose(trace.file);
+	trace = (Trace){0};
+}
+
+bool trace_enabled(void) {
+	return trace.file != NULL;
+}
+
+void trace_flush(void) {
+	if (trace.file) fflush(trace.file);
+}
+
+uint64_t trace_now(void) {
+	if (!trace.file) return 0;
+	return trace_clock() - trace.origin;
+}
+
+void trace_phase(const char* name, uint64_t start) {
+	if (!trace.file) return;
+	uint64_t end = trace_now();
+	trace_begin_event();
+	fprintf(trace.file, "{\"name\":\"%s\",\"cat\":\"cook\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d}",
+		name, (unsigned long long)start, (unsigned long long)(end - start), TRACE_PID, TRACE_MAIN_TID);
+}
+
+void trace_command(uint64_t start, size_t slot, StringView output, StringView target,
+                   size_t depth, int exit_code, bool cached) {
+	if (!trace.file) return;
+	uint64_t end = trace_now();
+	size_t tid = slot + 1;
+	while (trace.lanes < tid) {
+		char name[32];
+		snprintf(name, sizeof(name), "slot %zu", trace.lanes);
+		trace_lane_name(++trace.lanes, name);
+	}
+
+	trace_begin_event();
+	fputs("{\"name\":", trace.file);
+	trace_write_string(output.items, output.count);
+	fprintf(trace.file, ",\"cat\":\"command\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%zu,\"args\":{\"target\":",
+		(unsigned long long)start, (unsigned long long)(end - start), TRACE_PID, tid);
+	trace_write_string(target.items, target.count);
+	fprintf(trace.file, ",\"depth\":%zu,\"exit_code\":%d,\"cached\":%s}}",
+		depth, exit_code, cached ? "true" : "false");
+}
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/resource.h>
+	#include <time.h>
+#endif
+
+Stats stats = {0};
+
+static const char* phase_names[PHASE_COUNT] = {
+	[PHASE_PARSE]      = "parse",
+	[PHASE_CONSTRUCT]  = "construct",
+	[PHASE_LOAD_STATE] = "load state",
+	[PHASE_ANALYZE]    = "analyze",
+	[PHASE_INTERPRET]  = "interpret",
+	[PHASE_PLAN]       = "plan",
+	[PHASE_EXECUTE]    = "execute",
+	[PHASE_SAVE_STATE] = "save state",
+	[PHASE_CLEANUP]    = "cleanup",
+};
+
+#ifdef _WIN32
+static uint64_t filetime_ns(FILETIME ft) {
+	return ((uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime) * 100ull;
+}
+#endif
+
+uint64_t stats_clock(void) {
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ull
+		+ (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ull / (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint64_t stats_cpu_ns(void) {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0;
+	return filetime_ns(kernel) + filetime_ns(user);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// user + system time of every command cook waited for
+static uint64_t stats_children_cpu_ns(void) {
+#ifdef _WIN32
+	return 0;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_CHILDREN, &ru) != 0) return 0;
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull
+		+ (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+#endif
+}
+
+PhaseStart stats_phase_begin(void) {
+	return (PhaseStart){
+		.trace = trace_now(),
+		.wall = stats_clock(),
+		.cpu = stats_cpu_ns(),
+	};
+}
+
+void stats_phase_end(StatsPhase phase, PhaseStart start) {
+	PhaseTime* p = &stats.phases[phase];
+	p->wall += stats_clock() - start.wall;
+	p->cpu += stats_cpu_ns() - start.cpu;
+	p->count++;
+	trace_phase(phase_names[phase], start.trace);
+}
+
+void stats_arena(const char* name, Arena* arena) {
+	ArenaSummary sum = arena_summary(arena);
+
+	// an arena that is recorded again, like the interpreter's under --watch, keeps its peak
+	for (size_t i = 0; i < stats.arena_count; ++i) {
+		StatsArena* a = &stats.arenas[i];
+		if (strcmp(a->name, name) != 0) continue;
+		if (sum.used > a->used) a->used = sum.used;
+		if (sum.capacity > a->capacity) a->capacity = sum.capacity;
+		if (sum.requested > a->requested) a->requested = sum.requested;
+		if (sum.abandoned > a->abandoned) a->abandoned = sum.abandoned;
+		if (sum.regions > a->regions) a->regions = sum.regions;
+		return;
+	}
+	if (stats.arena_count < STATS_MAX_ARENAS) {
+		stats.arenas[stats.arena_count++] = (StatsArena){
+			.name = name,
+			.used = sum.used,
+			.capacity = sum.capacity,
+			.requested = sum.requested,
+			.abandoned = sum.abandoned,
+			.regions = sum.regions,
+		};
+	}
+}
+
+inline static double ms(uint64_t ns) {
+	return (double)ns / 1000000.0;
+}
+
+void stats_print(FILE* stream) {
+	fprintf(stream, "[stats] %-12s %10s %10s\n", "phase", "wall ms", "cpu ms");
+	uint64_t wall = 0, cpu = 0;
+	for (size_t i = 0; i < PHASE_COUNT; ++i) {
+		PhaseTime* p = &stats.phases[i];
+		if (p->count == 0) continue;
+		fprintf(stream, "[stats] %-12s %10.3f %10.3f\n", phase_names[i], ms(p->wall), ms(p->cpu));
+		wall += p->wall;
+		cpu += p->cpu;
+	}
+	fprintf(stream, "[stats] %-12s %10.3f %10.3f\n", "total", ms(wall), ms(cpu));
+	fprintf(stream, "[stats] commands cpu: %.3f ms\n", ms(stats_children_cpu_ns()));
+
+	fprintf(stream, "[stats] tokens lexed: %zu\n", stats.tokens);
+	fprintf(stream, "[stats] statements: %zu\n", stats.statements);
+	fprintf(stream, "[stats] build commands: %zu\n", stats.build_commands);
+	fprintf(stream, "[stats] stat calls: %zu\n", stats.stat_calls);
+	fprintf(stream, "[stats] stat cache: %zu hits, %zu misses\n", stats.stat_cache_hits, stats.stat_cache_misses);
+	fprintf(stream, "[stats] dirty targets: %zu\n", stats.dirty_targets);
+	fprintf(stream, "[stats] commands spawned: %zu\n", stats.spawns);
+	if (stats.compile_cache_enabled) {
+		fprintf(stream, "[stats] compile cache: %zu hits, %zu misses\n",
+			stats.compile_cache_hits, stats.compile_cache_misses);
+	}
+	for (size_t i = 0; i < stats.arena_count; ++i) {
+		StatsArena* a = &stats.arenas[i];
+		fprintf(stream, "[stats] arena %-12s %10zu / %zu bytes in %zu regions, %zu requested, %zu abandoned\n",
+			a->name, a->used, a->capacity, a->regions, a->requested, a->abandoned);
+	}
+}
+
+bool stats_write_json(const char* path) {
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][stats] could not open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	fprintf(f, "{\n\t\"phases\": {");
+	bool first = true;
+	for (size_t i = 0; i < PHASE_COUNT; ++i) {
+		PhaseTime* p = &stats.phases[i];
+		if (p->count == 0) continue;
+		fprintf(f, "%s\n\t\t\"%s\": { \"wall_ns\": %llu, \"cpu_ns\": %llu, \"count\": %zu }",
+			first ? "" : ",", phase_names[i],
+			(unsigned long long)p->wall, (unsigned long long)p->cpu, p->count);
+		first = false;
+	}
+	fprintf(f, "\n\t},\n");
+
+	fprintf(f, "\t\"commands_cpu_ns\": %llu,\n", (unsigned long long)stats_children_cpu_ns());
+	fprintf(f, "\t\"tokens\": %zu,\n", stats.tokens);
+	fprintf(f, "\t\"statements\": %zu,\n", stats.statements);
+	fprintf(f, "\t\"build_commands\": %zu,\n", stats.build_commands);
+	fprintf(f, "\t\"stat_calls\": %zu,\n", stats.stat_calls);
+	fprintf(f, "\t\"stat_cache_hits\": %zu,\n", stats.stat_cache_hits);
+	fprintf(f, "\t\"stat_cache_misses\": %zu,\n", stats.stat_cache_misses);
+	fprintf(f, "\t\"dirty_targets\": %zu,\n", stats.dirty_targets);
+	fprintf(f, "\t\"spawns\": %zu,\n", stats.spawns);
+	if (stats.compile_cache_enabled) {
+		fprintf(f, "\t\"compile_cache_hits\": %zu,\n", stats.compile_cache_hits);
+		fprintf(f, "\t\"compile_cache_misses\": %zu,\n", stats.compile_cache_misses);
+	}
+
+	fprintf(f, "\t\"arenas\": {");
+	for (size_t i = 0; i < stats.arena_count; ++i) {
+		StatsArena* a = &stats.arenas[i];
+		fprintf(f, "%s\n\t\t\"%s\": { \"used\": %zu, \"capacity\": %zu, \"regions\": %zu, \"requested\": %zu, \"abandoned\": %zu }",
+			i == 0 ? "" : ",", a->name, a->used, a->capacity, a->regions, a->requested, a->abandoned);
+	}
+	fprintf(f, "\n\t}\n}\n");
+
+	bool ok = fclose(f) == 0;
+	if (!ok) {
+		fprintf(stderr, "[ERROR][stats] could not write %s: %s\n", path, strerror(errno));
+	}
+	return ok;
+}
+
+#include <ctype.h>
+
+StringBuilder target_generate_cmdline_cstr(Arena* arena, struct BuildCommand* bc, Target* t) {
+	StringBuilder sb = target_generate_cmdline(arena, bc, t);
+	da_append_arena(arena, &sb, '\0');
+	return sb;
+}
+
+
+inline static const char* target_cstr(Arena* arena, const char* prefix, size_t prefix_len, StringView sv) {
+	char* cstr = arena_alloc(arena, prefix_len + sv.count + 1);
+	memcpy(cstr, prefix, prefix_len);
+	memcpy(cstr + prefix_len, sv.items, sv.count);
+	cstr[prefix_len + sv.count] = '\0';
+	return cstr;
+}
+
+inline static void cmd_append(Arena* arena, Cmd* cmd, const char* arg) {
+	da_reserve_arena(arena, cmd, cmd->count + 2);
+	cmd->items[cmd->count++] = arg;
+	cmd->items[cmd->count] = NULL;
+}
+
+inline static void cmd_append_sv(Arena* arena, Cmd* cmd, StringView sv) {
+	cmd_append(arena, cmd, target_cstr(arena, "", 0, sv));
+}
+
+inline static void cmd_append_list(Arena* arena, Cmd* cmd, const StringList* list, const char* prefix) {
+	if (!list || !list->items) {
+		return;
+	}
+	size_t prefix_len = strlen(prefix);
+	for (size_t i = 0; i < list->count; ++i) {
+		cmd_append(arena, cmd, target_cstr(arena, prefix, prefix_len, list->items[i]));
+	}
+}
+
+inline static void cmd_append_options(Arena* arena, Cmd* cmd, const OptionList* list, const char* prefix) {
+	size_t prefix_len = strlen(prefix);
+	for (size_t i = 0; i < list->count; ++i) {
+		cmd_append(arena, cmd, target_cstr(arena, prefix, prefix_len, option_list_at(list, i)));
+	}
+}
+
+// flags used to go through the shell, so `cflags(-O2 -g)` is two arguments
+inline static void cmd_append_flags(Arena* arena, Cmd* cmd, const OptionList* list) {
+	for (size_t i = 0; i < list->count; ++i) {
+		StringView sv = option_list_at(list, i);
+		size_t start = 0;
+		while (start < sv.count) {
+			while (start < sv.count && isspace((unsigned char)sv.items[start])) start++;
+			size_t end = start;
+			while (end < sv.count && !isspace((unsigned char)sv.items[end])) end++;
+			if (end > start) {
+				cmd_append_sv(arena, cmd, (StringView){ .items = sv.items + start, .count = end - start });
+			}
+			start = end;
+		}
+	}
+}
+
+inline static bool cmd_arg_needs_quotes(const char* arg) {
+	if (*arg == '\0') return true;
+	for (const char* c = arg; *c; ++c) {
+		if (!isalnum((unsigned char)*c) && !strchr("-_+=./:,@%^", *c)) return true;
+	}
+	return false;
+}
+
+inline static void cmd_render_arg(Arena* arena, StringBuilder* sb, const char* arg) {
+	if (!cmd_arg_needs_quotes(arg)) {
+		da_append_many_arena(arena, sb, arg, strlen(arg));
+	} else {
+#ifdef _WIN32
+		da_append_arena(arena, sb, '"');
+		da_append_many_arena(arena, sb, arg, strlen(arg));
+		da_append_arena(arena, sb, '"');
+#else
+		da_append_arena(arena, sb, '\'');
+		for (const char* c = arg; *c; ++c) {
+			if (*c == '\'') {
+				da_append_many_arena(arena, sb, "'\\''", 4);
+			} else {
+				da_append_arena(arena, sb, *c);
+			}
+		}
+		da_append_arena(arena, sb, '\'');
+#endif
+	}
+	da_append_arena(arena, sb, ' ');
+}
+
+// only for printing and --dry-run, commands are spawned from the argv directly
+StringBuilder cmd_render(Arena* arena, Cmd cmd) {
+	StringBuilder sb = {0};
+	size_t size = 0;
+	for (size_t i = 0; i < cmd.count; ++i) {
+		size += strlen(cmd.items[i]) + 1;
+	}
+	// quoting may still grow it, the common case fits
+	da_reserve_arena(arena, &sb, size + 1);
+	for (size_t i = 0; i < cmd.count; ++i) {
+		cmd_render_arg(arena, &sb, cmd.items[i]);
+	}
+	return sb;
+}
+
+CmdTemplate cmd_template_new(Arena* arena, struct BuildCommand* bc) {
+	CmdTemplate tmpl = { .ready = true };
+
+	if (bc->compiler.count > 0) {
+		cmd_append_sv(arena, &tmpl.head, bc->compiler);
+	}
+	cmd_append_flags(arena, &tmpl.head, &bc->cflags);
+	if (bc->build_type == BUILD_OBJECT) {
+		cmd_append(arena, &tmpl.head, "-c");
+	}
+	cmd_append(arena, &tmpl.head, "-o");
+
+	cmd_append_options(arena, &tmpl.tail, &bc->include_dirs, "-I");
+	cmd_append_list(arena, &tmpl.tail, &bc->input_files,   "");
+	cmd_append_list(arena, &tmpl.tail, &bc->input_objects, "");
+	if (bc->build_type == BUILD_EXECUTABLE || bc->build_type == BUILD_LIB) {
+		cmd_append_options(arena, &tmpl.tail, &bc->library_dirs,  "-L");
+		cmd_append_options(arena, &tmpl.tail, &bc->library_links, "-l");
+	}
+	cmd_append_flags(arena, &tmpl.tail, &bc->ldflags);
+
+	StringBuilder head = cmd_render(arena, tmpl.head);
+	StringBuilder tail = cmd_render(arena, tmpl.tail);
+	tmpl.head_line = (StringView){ .items = head.items, .count = head.count };
+	tmpl.tail_line = (StringView){ .items = tail.items, .count = tail.count };
+	return tmpl;
+}
+
+// a build command that was not prepared, like one made outside the constructor,
+// gets a template that only lives as long as the result
+inline static CmdTemplate target_cmd_template(Arena* arena, struct BuildCommand* bc) {
+	return bc->cmd.ready ? bc->cmd : cmd_template_new(arena, bc);
+}
+
+#define TARGET_MAX_ARGS 5
+
+// the arguments that differ between the targets of a build command, pooled paths
+// are NUL terminated already
+inline static size_t target_args(Target* t, const char* args[TARGET_MAX_ARGS]) {
+	size_t count = 0;
+	args[count++] = path_get(t->output).items;
+	args[count++] = path_get(t->input).items;
+	if (t->depfile != PATH_NONE) {
+		args[count++] = "-MMD";
+		args[count++] = "-MF";
+		args[count++] = path_get(t->depfile).items;
+	}
+	return count;
+}
+
+Cmd target_generate_cmd(Arena* arena, struct BuildCommand* bc, Target* t) {
+	Cmd cmd = {0};
+	if (!arena || !bc || !t) return cmd;
+
+	CmdTemplate tmpl = target_cmd_template(arena, bc);
+	const char* args[TARGET_MAX_ARGS];
+	size_t arg_count = target_args(t, args);
+
+	cmd.capacity = tmpl.head.count + arg_count + tmpl.tail.count + 1;
+	cmd.items = arena_alloc(arena, cmd.capacity * sizeof(*cmd.items));
+	memcpy(cmd.items, tmpl.head.items, tmpl.head.count * sizeof(*cmd.items));
+	cmd.count = tmpl.head.count;
+	memcpy(cmd.items + cmd.count, args, arg_count * sizeof(*cmd.items));
+	cmd.count += arg_count;
+	if (tmpl.tail.count > 0) {
+		memcpy(cmd.items + cmd.count, tmpl.tail.items, tmpl.tail.count * sizeof(*cmd.items));
+		cmd.count += tmpl.tail.count;
+	}
+	cmd.items[cmd.count] = NULL;
+	return cmd;
+}
+
+StringBuilder target_generate_cmdline(Arena* arena, struct BuildCommand* bc, Target* t) {
+	StringBuilder sb = {0};
+	if (!arena || !bc || !t) return sb;
+
+	CmdTemplate tmpl = target_cmd_template(arena, bc);
+	const char* args[TARGET_MAX_ARGS];
+	size_t arg_count = target_args(t, args);
+
+	size_t size = tmpl.head_line.count + tmpl.tail_line.count;
+	for (size_t i = 0; i < arg_count; ++i) {
+		size += strlen(args[i]) + 1;
+	}
+	// one more for target_generate_cmdline_cstr
+	da_reserve_arena(arena, &sb, size + 1);
+	da_append_many_arena(arena, &sb, tmpl.head_line.items, tmpl.head_line.count);
+	for (size_t i = 0; i < arg_count; ++i) {
+		cmd_render_arg(arena, &sb, args[i]);
+	}
+	da_append_many_arena(arena, &sb, tmpl.tail_line.items, tmpl.tail_line.count);
+	return sb;
+}
+
+
+// remembers the first input that changed in `cause`
+inline static void target_check_input(BuildState* state, StringView path, uint64_t out_time,
+                                      uint64_t* in_time, DirtyCause* cause) {
+	uint64_t time = get_modification_time_sv(path);
+	if (time > *in_time) {
+		*in_time = time;
+	}
+	bool changed = state ? file_state_changed(&state->files, path, out_time) : time > out_time;
+	if (changed && cause->reason == DIRTY_NONE) {
+		*cause = (DirtyCause){
+			.reason = DIRTY_INPUT_CHANGED,
+			.input = path_intern(path),
+			.input_time = time,
+			.output_time = out_time,
+		};
+	}
+}
+
+bool target_check_dirty(Arena* arena, BuildState* state, struct BuildCommand* bc, Target* t) {
+	if (bc->marked_clean_explicitly) return false;
+
+	// the depfile and the cmdline are only needed for the check itself
+	ArenaMark mark = arena_save(arena);
+	uint64_t out_time = stat_cache_mtime_id(t->output);
+	StringView output = path_get(t->output);
+	uint64_t in_time  = 0;
+	DirtyCause cause = {0};
+
+	target_check_input(state, path_get(t->input), out_time, &in_time, &cause);
+
+	for (size_t i = 0; i < bc->input_files.count; ++i) {
+		target_check_input(state, bc->input_files.items[i], out_time, &in_time, &cause);
+	}
+
+	if (t->header != PATH_NONE) {
+		target_check_input(state, path_get(t->header), out_time, &in_time, &cause);
+	}
+
+	// every header the compiler saw last time, an object without recorded deps was
+	// never compiled by us and has to be built once to get them
+	if (t->depfile != PATH_NONE && out_time != 0) {
+		DepsLog* deps_log = state ? &state->deps : NULL;
+		DepsRecord* record = deps_log ? deps_log_find(deps_log, output) : NULL;
+		StringList deps = {0};
+		if (record && record->mtime >= out_time) {
+			for (uint32_t i = 0; i < record->count; ++i) {
+				StringView dep = intern_get(&deps_log->paths, record->inputs[i]);
+				target_check_input(state, dep, out_time, &in_time, &cause);
+			}
+		} else if (depfile_read(arena, path_get(t->depfile), &deps)) {
+			for (size_t i = 0; i < deps.count; ++i) {
+				target_check_input(state, deps.items[i], out_time, &in_time, &cause);
+			}
+		} else if (cause.reason == DIRTY_NONE) {
+			cause = (DirtyCause){ .reason = DIRTY_DEPS_UNKNOWN, .output_time = out_time };
+		}
+	}
+
+	// the command that built the output last time, changed flags rebuild it
+	if (state && out_time != 0 && cause.reason == DIRTY_NONE) {
+		StringBuilder cmdline = target_generate_cmdline(arena, bc, t);
+		uint64_t command_hash = hash_bytes(cmdline.items, cmdline.count, HASH_SEED);
+		BuildLogEntry* entry = build_log_find(&state->log, output);
+		if (!entry || entry->command_hash != command_hash) {
+			cause = (DirtyCause){ .reason = DIRTY_COMMAND_CHANGED, .output_time = out_time };
+		}
+	}
+
+	// a missing output only needs building if there is something to build it from
+	if (out_time == 0 && in_time != 0) {
+		cause = (DirtyCause){ .reason = DIRTY_OUTPUT_MISSING };
+	}
+	arena_restore(arena, mark);
+	bool dirty = out_time == 0 ? in_time != 0 : cause.reason != DIRTY_NONE;
+	if (!dirty) {
+		return false;
+	}
+
+	t->cause = cause;
+	t->dirty = true;
+	bc->dirty = true;
+	stats.dirty_targets++;
+
+	BuildCommand* p = bc->parent;
+	while (p) {
+		p->dirty = true;
+		p = p->parent;
+	}
+
+	return true;
+}
+
+#include <ctype.h>
+#include <time.h>
+
+#define INDENT_MULTIPLIER 4
+
+BuildCommand* build_command_new(Arena* arena) {
+	BuildCommand* bc = (BuildCommand*)arena_alloc(arena, sizeof(BuildCommand));
+	*bc = build_command_default();
+	stats.build_commands++;
+	return bc;
+}
+
+BuildCommand build_command_default(void) {
+	static const StringView cc = { .items = "cc", .count = 2 };
+
+	BuildCommand bc = {0};
+	bc.compiler = cc;
+	bc.build_type = BUILD_EXECUTABLE;
+	return bc;
+}
+
+BuildCommand* build_command_inherit(Arena* arena, BuildCommand* parent) {
+	if (!parent) {
+		return NULL;
+	}
+	BuildCommand* bc = build_command_new(arena);
+
+	bc->parent = parent;
+	bc->compiler = parent->compiler;
+	bc->include_dirs = option_list_inherit(&parent->include_dirs);
+	bc->library_dirs = option_list_inherit(&parent->library_dirs);
+	bc->library_links = option_list_inherit(&parent->library_links);
+	bc->cflags = option_list_inherit(&parent->cflags);
+	bc->ldflags = option_list_inherit(&parent->ldflags);
+	bc->source_dir = parent->source_dir;
+	bc->output_dir = parent->output_dir;
+
+	if (parent->parent != NULL) {
+		bc->build_type = BUILD_OBJECT;
+	}
+
+	da_append_arena(arena, &parent->children, bc);
+	return bc;
+}
+
+
+inline static void indent_label(int indent, const char* label) {
+	printf("%*s%-14s: ", indent * INDENT_MULTIPLIER, "", label);
+}
+inline static void indent_label_sv(int indent, StringView sv) {
+	printf("%*s%-14.*s: ", indent * INDENT_MULTIPLIER, "", (int)sv.count, sv.items);
+}
+inline static void string_list_print_big(int indent, const char* label, const StringList* list) {
+	if (list->count == 0) return;
+
+	indent_label(indent, label);
+	for (size_t i = 0; i < list->count; ++i) {
+		const StringView* sv = &list->items[i];
+		printf("%.*s", (int)sv->count, sv->items);
+		if (i + 1 < list->count) {
+			printf(", ");
+		}
+	}
+	printf("\n");
+}
+
+inline static void option_list_print_big(int indent, const char* label, const OptionList* list) {
+	if (list->count == 0) return;
+
+	indent_label(indent, label);
+	for (size_t i = 0; i < list->count; ++i) {
+		StringView sv = option_list_at(list, i);
+		printf("%.*s", (int)sv.count, sv.items);
+		if (i + 1 < list->count) {
+			printf(", ");
+		}
+	}
+	printf("\n");
+}
+
+inline static void target_list_print_pretty(size_t indent, TargetList list) {
+	if (list.count == 0) return;
+
+	indent_label(indent, "targets");
+	printf("\n");
+
+	for (size_t i = 0; i <  list.count; ++i) {
+		Target* t = &list.items[i];
+		indent_label_sv(indent+1, t->name);
+		StringView input = path_get(t->input), output = path_get(t->output);
+		printf("input: %-25.*s ", (int)input.count, input.items);
+		printf("output: %-25.*s ", (int)output.count, output.items);
+		if (t->dirty) printf("[dirty]");
+		printf("\n");
+	}
+}
+
+void build_command_print(BuildCommand* bc, size_t indent) {
+	if (!bc) {
+		return;
+	}
+	size_t ni = indent + 1;
+
+	indent_label(ni, "build command");
+	if (bc->dirty) printf("[dirty]");
+	printf("\n");
+
+
+	if (bc->compiler.count > 0) {
+		indent_label(ni, "compiler");
+		printf("%.*s\n", (int)bc->compiler.count, bc->compiler.items);
+	}
+
+	indent_label(ni, "build type");
+	build_type_print(bc->build_type);
+	printf("\n");
+
+	target_list_print_pretty(ni, bc->targets);
+	string_list_print_big(ni, "input files", &bc->input_files);
+	string_list_print_big(ni, "input objects", &bc->input_objects);
+	option_list_print_big(ni, "include dirs", &bc->include_dirs);
+	string_list_print_big(ni, "include files", &bc->include_files);
+	option_list_print_big(ni, "library dirs", &bc->library_dirs);
+	option_list_print_big(ni, "library links", &bc->library_links);
+	option_list_print_big(ni, "cflags", &bc->cflags);
+	option_list_print_big(ni, "ldflags", &bc->ldflags);
+
+	if (bc->source_dir.count > 0) {
+		indent_label(ni, "source dir");
+		printf("%.*s\n", (int)bc->source_dir.count, bc->source_dir.items);
+	}
+	if (bc->output_dir.count > 0) {
+		indent_label(ni, "output dir");
+		printf("%.*s\n", (int)bc->output_dir.count, bc->output_dir.items);
+	}
+
+	if (bc->children.count > 0) {
+		indent_label(ni, "children");
+		printf("%zu\n", bc->children.count);
+		for (size_t i = 0; i < bc->children.count; ++i) {
+			indent_label(indent + 2, "child");
+			printf("%zu\n", i);
+			build_command_print(bc->children.items[i], indent + 2);
+		}
+	}
+}
+
+
+
+// local time with nanoseconds, mtimes that differ by less than a second are common
+static void explain_time(FILE* stream, uint64_t ns) {
+	time_t seconds = (time_t)(ns / 1000000000ull);
+	struct tm* tm = localtime(&seconds);
+	char buffer[32] = "?";
+	if (tm) strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", tm);
+	fprintf(stream, "%s.%09llu", buffer, (unsigned long long)(ns % 1000000000ull));
+}
+
+static void explain_build_command(FILE* stream, BuildCommand* bc) {
+	StringView name = bc->targets.count > 0 ? bc->targets.items[0].name : (StringView){0};
+	if (bc->marked_dirty_explicitly) {
+		fprintf(stream, "dirty() in build(%.*s)\n", (int)name.count, name.items);
+	} else {
+		fprintf(stream, "build(%.*s) is dirty\n", (int)name.count, name.items);
+	}
+}
+
+static void explain_target(FILE* stream, Target* t) {
+	StringView output = path_get(t->output);
+	fprintf(stream, "[explain] %.*s: ", (int)output.count, output.items);
+
+	// the chain of targets the dirtiness came up through, down to what started it
+	DirtyCause* cause = &t->cause;
+	while (cause->reason == DIRTY_CHILD && cause->from_target) {
+		Target* from = cause->from_target;
+		StringView from_output = path_get(from->output);
+		fprintf(stream, "needs %.*s <- ", (int)from_output.count, from_output.items);
+		cause = &from->cause;
+	}
+
+	switch (cause->reason) {
+		case DIRTY_NONE:
+			fprintf(stream, "marked dirty\n");
+			break;
+		case DIRTY_OUTPUT_MISSING:
+			fprintf(stream, "output does not exist\n");
+			break;
+		case DIRTY_INPUT_CHANGED:
+			fprintf(stream, "%s changed, mtime ", path_get(cause->input).items);
+			explain_time(stream, cause->input_time);
+			fprintf(stream, ", output mtime ");
+			explain_time(stream, cause->output_time);
+			fprintf(stream, "\n");
+			break;
+		case DIRTY_DEPS_UNKNOWN:
+			fprintf(stream, "no recorded header dependencies\n");
+			break;
+		case DIRTY_COMMAND_CHANGED:
+			fprintf(stream, "command line differs from the one in the build log\n");
+			break;
+		case DIRTY_CHILD:
+			explain_build_command(stream, cause->from);
+			break;
+		case DIRTY_FORCED:
+			fprintf(stream, "building all (-B)\n");
+			break;
+	}
+}
+
+// prints why every dirty target is dirty, for --explain
+void build_command_explain(BuildCommand* bc, FILE* stream) {
+	if (!bc || !bc->dirty) return;
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		build_command_explain(bc->children.items[i], stream);
+	}
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		if (bc->targets.items[i].dirty) explain_target(stream, &bc->targets.items[i]);
+	}
+}
+
+void build_command_dump(Arena* arena, BuildCommand* bc, FILE* stream, size_t target_to_build) {
+	if (!bc || !bc->dirty) {
+		return;
+	}
+
+	// skip root bc
+	if (!bc->parent) {
+		for (size_t i = 0; i < bc->children.count; ++i) {
+			build_command_dump(arena, bc->children.items[i], stream, 0);
+		}
+		return;
+	}
+
+	// recurse into children
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		build_command_dump(arena, bc->children.items[i], stream, 0);
+	}
+
+	if (bc->targets.count == 0) {
+		return;
+	}
+	if (bc->targets.count <= target_to_build) {
+		return;
+	}
+
+	Target* t = &bc->targets.items[target_to_build];
+	if (!t->built) {
+		StringBuilder sb = target_generate_cmdline(arena, bc, t);
+		printf("%.*s\n", (int)sb.count, sb.items);
+		t->built = true;
+	}
+
+	if (target_to_build == 0) {
+		for (size_t i = 1; i < bc->targets.count; ++i) {
+			build_command_dump(arena, bc, stream, i);
+		}
+	}
+}
+
+void build_type_print(BuildType type) {
+	switch (type) {
+		case BUILD_EXECUTABLE: printf("executable"); return;
+		case BUILD_OBJECT:     printf("object");     return;
+		case BUILD_LIB:        printf("lib");        return;
+	}
+}
+
+void build_command_mark_all_targets_dirty(BuildCommand* bc, bool dirty) {
+	if (!bc || (bc->marked_clean_explicitly==dirty)) return;
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		Target* t = &bc->targets.items[i];
+		t->dirty = dirty;
+		if (!dirty) {
+			t->cause = (DirtyCause){0};
+		} else if (t->cause.reason == DIRTY_NONE) {
+			t->cause.reason = DIRTY_FORCED;
+		}
+	}
+}
+void build_command_mark_all_children_dirty(BuildCommand* bc, bool dirty) {
+	if (!bc || (bc->marked_clean_explicitly==dirty)) return;
+	bc->dirty = dirty;
+	build_command_mark_all_targets_dirty(bc, dirty);
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		build_command_mark_all_children_dirty(bc->children.items[i], dirty);
+	}
+}
+
+inline static bool compiler_is_version(const char* s, size_t count) {
+	if (count == 0) return false;
+	for (size_t i = 0; i < count; ++i) {
+		if (!isdigit((unsigned char)s[i]) && s[i] != '.') return false;
+	}
+	return true;
+}
+
+StringView build_command_compiler_family(BuildCommand* bc) {
+	static const char* families[] = { "cc", "gcc", "g++", "c++", "clang", "clang++" };
+	StringView name = bc->compiler;
+	for (size_t i = name.count; i > 0; --i) {
+		if (name.items[i - 1] == '/' || name.items[i - 1] == '\\') {
+			name.items += i;
+			name.count -= i;
+			break;
+		}
+	}
+	if (name.count > 4 && strncmp(name.items + name.count - 4, ".exe", 4) == 0) {
+		name.count -= 4;
+	}
+
+	// the family is one of the dash separated parts, only version numbers may follow it
+	size_t end = name.count;
+	for (size_t i = name.count; ; --i) {
+		if (i > 0 && name.items[i - 1] != '-') continue;
+
+		const char* part = name.items + i;
+		size_t count = end - i;
+		for (size_t f = 0; f < sizeof(families)/sizeof(families[0]); ++f) {
+			if (count == strlen(families[f]) && strncmp(part, families[f], count) == 0) {
+				return (StringView){ .items = families[f], .count = count };
+			}
+		}
+		if (i == 0 || !compiler_is_version(part, count)) break;
+		end = i - 1;
+	}
+	return (StringView){0};
+}
+
+// compilers that understand `-MMD -MF <file>`
+bool build_command_supports_depfile(BuildCommand* bc) {
+	return build_command_compiler_family(bc).count > 0;
+}
+
+bool bc_string_view_same(StringView* a, StringView* b) {
+	if (a->count != b->count) return false;
+	if (strncmp(a->items, b->items, a->count) != 0) return false;
+	return true;
+}
+bool bc_string_list_same(StringList* a, StringList* b) {
+	if (a->count != b->count) return false;
+	for (size_t i = 0; i < a->count; ++i) {
+		if (!bc_string_view_same(&a->items[i], &b->items[i])) return false;
+	}
+	return true;
+}
+
+
+// the length goes first, so ("ab", "c") and ("a", "bc") differ
+inline static uint64_t fingerprint_bytes(uint64_t h, const char* items, size_t count) {
+	h = hash_bytes(&count, sizeof(count), h);
+	return hash_bytes(items, count, h);
+}
+
+inline static uint64_t fingerprint_list(uint64_t h, StringList* list) {
+	h = hash_bytes(&list->count, sizeof(list->count), h);
+	for (size_t i = 0; i < list->count; ++i) {
+		h = fingerprint_bytes(h, list->items[i].items, list->items[i].count);
+	}
+	return h;
+}
+
+inline static uint64_t fingerprint_options(uint64_t h, OptionList* list) {
+	h = hash_bytes(&list->count, sizeof(list->count), h);
+	for (size_t i = 0; i < list->count; ++i) {
+		StringView sv = option_list_at(list, i);
+		h = fingerprint_bytes(h, sv.items, sv.count);
+	}
+	return h;
+}
+
+static uint64_t target_fingerprint(Target* t) {
+	uint64_t h = HASH_SEED;
+	h = fingerprint_bytes(h, t->name.items, t->name.count);
+	// equal paths have equal ids
+	h = hash_bytes(&t->input,  sizeof(PathId), h);
+	h = hash_bytes(&t->output, sizeof(PathId), h);
+	h = hash_bytes(&t->header, sizeof(PathId), h);
+	return h;
+}
+
+void build_command_prepare_cmd(Arena* arena, BuildCommand* bc) {
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		build_command_prepare_cmd(arena, bc->children.items[i]);
+	}
+	if (bc->targets.count > 0) {
+		bc->cmd = cmd_template_new(arena, bc);
+	}
+}
+
+void build_command_fingerprint(BuildCommand* bc) {
+	uint64_t h = HASH_SEED;
+	h = hash_bytes(&bc->children.count, sizeof(bc->children.count), h);
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		build_command_fingerprint(bc->children.items[i]);
+		h = hash_bytes(&bc->children.items[i]->fingerprint, sizeof(uint64_t), h);
+	}
+
+	h = hash_bytes(&bc->build_type, sizeof(bc->build_type), h);
+	h = hash_bytes(&bc->targets.count, sizeof(bc->targets.count), h);
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		Target* t = &bc->targets.items[i];
+		t->fingerprint = target_fingerprint(t);
+		h = hash_bytes(&t->fingerprint, sizeof(uint64_t), h);
+	}
+
+	h = fingerprint_bytes(h, bc->compiler.items,   bc->compiler.count);
+	h = fingerprint_bytes(h, bc->source_dir.items, bc->source_dir.count);
+	h = fingerprint_bytes(h, bc->output_dir.items, bc->output_dir.count);
+	h = fingerprint_list(h, &bc->input_files);
+	h = fingerprint_list(h, &bc->input_objects);
+	h = fingerprint_options(h, &bc->include_dirs);
+	h = fingerprint_list(h, &bc->include_files);
+	h = fingerprint_options(h, &bc->library_dirs);
+	h = fingerprint_options(h, &bc->library_links);
+	h = fingerprint_options(h, &bc->cflags);
+	h = fingerprint_options(h, &bc->ldflags);
+	bc->fingerprint = h;
+}
+
+bool target_is_same(Target* a, Target* b) {
+	if (a->fingerprint != b->fingerprint) return false;
+	if (!bc_string_view_same(&a->name, &b->name)) return false;
+	if (a->input != b->input || a->output != b->output || a->header != b->header) return false;
+	return true;
+}
+
+
+
+bool build_command_is_same(BuildCommand* a, BuildCommand* b) {
+	if (a->fingerprint != b->fingerprint) return false;
+	if (a->children.count != b->children.count) return false;
+	// NOTE: not sure about this, what if the order is different?
+	for (size_t i = 0; i < a->children.count; ++i) {
+		BuildCommand* abc = a->children.items[i];
+		BuildCommand* bbc = b->children.items[i];
+		if (!build_command_is_same(abc, bbc)) return false;
+	}
+
+	if (a->build_type != b->build_type) return false;
+
+	if (a->targets.count != b->targets.count) return false;
+	for (size_t i = 0; i < a->targets.count; ++i) {
+		if (!target_is_same(&a->targets.items[i], &b->targets.items[i])) return false;
+	}
+
+	if (!bc_string_view_same(&a->compiler,      &b->compiler))      return false;
+	if (!bc_string_view_same(&a->source_dir,    &b->source_dir))    return false;
+	if (!bc_string_view_same(&a->output_dir,    &b->output_dir))    return false;
+	if (!bc_string_list_same(&a->input_files,   &b->input_files))   return false;
+	if (!bc_string_list_same(&a->input_objects, &b->input_objects)) return false;
+	if (!option_list_same(&a->include_dirs,  &b->include_dirs))  return false;
+	if (!bc_string_list_same(&a->include_files, &b->include_files)) return false;
+	if (!option_list_same(&a->library_dirs,  &b->library_dirs))  return false;
+	if (!option_list_same(&a->library_links, &b->library_links)) return false;
+	if (!option_list_same(&a->cflags,        &b->cflags))        return false;
+	if (!option_list_same(&a->ldflags,       &b->ldflags))       return false;
+
+	return true;
+}
+
+
+
+
+
+
+typedef struct {
+	Arena arena;
+	Arena scratch;  // temporaries of the dirty analysis
+	bool had_error;
+	Environment*  current_environment;
+	BuildCommand* current_build_command;
+	Statement*    current_statement;
+	BuildState*   state;
+
+	// set by cache(), applies to the whole build
+	StringView cache_dir;
+	uint64_t   cache_size;
+} Constructor;
+
+// a target together with the build command it belongs to
+typedef struct {
+	BuildCommand* bc;
+	Target* target;
+} TargetRef;
+
+typedef struct {
+	TargetRef* items;
+	size_t count;
+	size_t capacity;
+} TargetRefList;
+// TODO: keep track of the current Cookfile, for better error messages
+
+Constructor constructor_new(Statement*);
+
+BuildCommand* constructor_construct_build_command(Constructor*);
+
+void constructor_analyze(Constructor*, BuildCommand*);
+void constructor_settle(BuildCommand* root);
+void constructor_reanalyze(Constructor*, BuildCommand* root, TargetRef* refs, size_t count);
+
+
+void constructor_error(Constructor* con, Token token, const char* error_cstr);
+
+SymbolValue constructor_evaluate(Constructor* con, Expression* e);
+SymbolValue constructor_execute (Constructor* con, Statement*  s);
+
+SymbolValue constructor_lookup_variable(Constructor* con, StringView sv, Expression* e);
+
+SymbolValue constructor_interpret_block       (Constructor* con, StatementBlock*  s);
+SymbolValue constructor_interpret_call        (Constructor* con, ExpressionCall*  e);
+SymbolValue constructor_interpret_chain       (Constructor* con, ExpressionChain* e);
+SymbolValue constructor_interpret_description (Constructor* con, StatementDescription* s);
+SymbolValue constructor_interpret_method_build(Constructor* con, ExpressionCall* e);
+
+void constructor_expand_build_command_targets(Constructor* con, BuildCommand* bc);
+
+#include <signal.h>
+#include <stdint.h>
+
+static const SymbolValue nill = { .type = SYMBOL_VALUE_NIL };
+
+Constructor constructor_new(Statement* root_statement) {
+	Constructor con = {0};
+	con.current_statement = root_statement;
+	con.current_environment = environment_new(&con.arena, NULL);
+	con.current_build_command = build_command_new(&con.arena);
+	return con;
+}
+
+// points every body statement back at its build command, so the interpreter doesn't
+// have to search the tree. a statement shared by a chain keeps the first one in preorder.
+static void constructor_attach_statements(BuildCommand* bc) {
+	if (bc->body && !bc->body->attached) {
+		bc->body->attached = bc;
+	}
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		constructor_attach_statements(bc->children.items[i]);
+	}
+}
+
+BuildCommand* constructor_construct_build_command(Constructor* con) {
+	Statement* root = con->current_statement;
+	con->current_build_command->body = root;
+
+	PhaseStart start = stats_phase_begin();
+	constructor_execute(con, root);
+	constructor_expand_build_command_targets(con, con->current_build_command);
+	build_command_fingerprint(con->current_build_command);
+	build_command_prepare_cmd(&con->arena, con->current_build_command);
+	constructor_attach_statements(con->current_build_command);
+	stats_phase_end(PHASE_CONSTRUCT, start);
+
+	if (con->state) {
+		start = stats_phase_begin();
+		build_state_load(con->state, con->current_build_command->output_dir);
+		stats_phase_end(PHASE_LOAD_STATE, start);
+	}
+
+	start = stats_phase_begin();
+	constructor_analyze(con, con->current_build_command);
+	stats_phase_end(PHASE_ANALYZE, start);
+	con->current_build_command->dirty = true; // root build command is always dirty
+	return con->current_build_command;
+}
+
+
+inline static Target* build_command_first_dirty_target(BuildCommand* bc) {
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		if (bc->targets.items[i].dirty) return &bc->targets.items[i];
+	}
+	return NULL;
+}
+
+// the targets of every parent are built from the outputs of bc, they follow it
+static void constructor_dirty_parents(BuildCommand* bc, DirtyCause cause) {
+	for (BuildCommand* p = bc->parent; p; p = p->parent) {
+		for (size_t i = 0; i < p->targets.count; ++i) {
+			Target* t = &p->targets.items[i];
+			if (!t->dirty) t->cause = cause;
+		}
+		build_command_mark_all_targets_dirty(p, true);
+	}
+}
+
+void constructor_analyze(Constructor* con, BuildCommand* bc) {
+	if (!con || !bc) return;
+
+	// what made bc dirty first, handed up to the targets of its parents
+	DirtyCause cause = { .reason = DIRTY_CHILD };
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		BuildCommand* child = bc->children.items[i];
+		constructor_analyze(con, child);
+		if (child->dirty && !cause.from) {
+			cause.from = child;
+			cause.from_target = build_command_first_dirty_target(child);
+		}
+	}
 
 	for (size_t i = 0; i < bc->targets.count; ++i) {
-		if (target_check_dirty(bc, &bc->targets.items[i])) {
-			dirty_child = true;
+		Target* t = &bc->targets.items[i];
+		if (target_check_dirty(&con->scratch, con->state, bc, t) && !cause.from_target) {
+			cause.from = bc;
+			cause.from_target = t;
 		}
 	}
 
-	if (dirty_child && !bc->marked_clean_explicitly) {
+	if (cause.from && !bc->marked_clean_explicitly) {
 		bc->dirty = true;
-		BuildCommand* p = bc->parent;
-		while (p) {
-			build_command_mark_all_targets_dirty(p, true);
-			p = p->parent;
+		constructor_dirty_parents(bc, cause);
+	}
+}
+
+// bc is dirty while one of its targets, or anything below it, still has to be built
+static bool constructor_settle_dirty(BuildCommand* bc) {
+	bool dirty = bc->marked_dirty_explicitly;
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		if (constructor_settle_dirty(bc->children.items[i])) dirty = true;
+	}
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		if (bc->targets.items[i].dirty) dirty = true;
+	}
+	bc->dirty = dirty;
+	return dirty;
+}
+
+// --watch: the caller cleared the targets that were built, the rest stay dirty
+void constructor_settle(BuildCommand* root) {
+	constructor_settle_dirty(root);
+	root->dirty = true;
+}
+
+// --watch: checks again only the targets that read a file that changed,
+// and hands their dirtiness up like constructor_analyze does
+void constructor_reanalyze(Constructor* con, BuildCommand* root, TargetRef* refs, size_t count) {
+	PhaseStart start = stats_phase_begin();
+	arena_clean(&con->scratch);
+	for (size_t i = 0; i < count; ++i) {
+		BuildCommand* bc = refs[i].bc;
+		Target* t = refs[i].target;
+		if (t->dirty) continue;
+		if (!target_check_dirty(&con->scratch, con->state, bc, t)) continue;
+		for (BuildCommand* p = bc; p; p = p->parent) {
+			p->dirty = true;
 		}
+		constructor_dirty_parents(bc, (DirtyCause){ .reason = DIRTY_CHILD, .from = bc, .from_target = t });
 	}
+	root->dirty = true;
+	stats_phase_end(PHASE_ANALYZE, start);
 }
 
 void constructor_error(Constructor* con, Token token, const char* error_cstr) {
@@ -2366,6 +5544,16 @@ SymbolValue constructor_evaluate(Constructor* con, Expression* e) {
 
 	switch (e->type) {
 		case EXPR_VARIABLE: return constructor_lookup_variable(con, e->variable.name.str, e);
+		case EXPR_ASSIGNMENT: {
+			// a variable is looked up before the methods, it would hide the method for the whole scope
+			if (method_extract(e->assignment.name.str) != METHOD_NONE) {
+				constructor_error(con, e->assignment.name, "Cannot assign to the name of a method.");
+				return nill;
+			}
+			SymbolValue value = constructor_evaluate(con, e->assignment.value);
+			environment_define(&con->arena, con->current_environment, e->assignment.id, value);
+			return value;
+		}
 		case EXPR_CALL:     return constructor_interpret_call(con, &e->call);
 		case EXPR_CHAIN:    return constructor_interpret_chain(con, &e->chain);
 		case EXPR_LITERAL_STRING: {
@@ -2407,9 +5595,12 @@ SymbolValue constructor_interpret_description(Constructor* con, StatementDescrip
 		con->current_build_command->body = outer;
 	}
 
+	Environment* scope = con->current_environment;
+	con->current_environment = environment_new(&con->arena, scope);
 	for (size_t i = 0; i < s->block->block.statement_count; ++i) {
 		constructor_execute(con, s->block->block.statements[i]);
 	}
+	con->current_environment = scope;
 
 	con->current_build_command = enclosing;
 	return left;
@@ -2481,7 +5672,7 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->cflags, arg.string);
+				option_list_append(&con->arena, &bc->cflags, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_LDFLAGS) {
@@ -2489,7 +5680,7 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->ldflags, arg.string);
+				option_list_append(&con->arena, &bc->ldflags, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_SOURCE_DIR) {
@@ -2513,7 +5704,7 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->include_dirs, arg.string);
+				option_list_append(&con->arena, &bc->include_dirs, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_LIBRARY_DIR) {
@@ -2521,7 +5712,7 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->library_dirs, arg.string);
+				option_list_append(&con->arena, &bc->library_dirs, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_LINK) {
@@ -2529,11 +5720,12 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->library_links, arg.string);
+				option_list_append(&con->arena, &bc->library_links, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_DIRTY) {
 		BuildCommand* bc = con->current_build_command;
+		bc->marked_dirty_explicitly = true;
 		bc->dirty = true;
 		while (bc->parent) {
 			bc->parent->dirty = true;
@@ -2542,12 +5734,32 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 	} else if (callee.method_type == METHOD_MARK_CLEAN) {
 		con->current_build_command->marked_clean_explicitly = true;
 		build_command_mark_all_children_dirty(con->current_build_command, false);
+	} else if (callee.method_type == METHOD_CACHE) {
+		if (e->argc < 1 || e->argc > 2) {
+			constructor_error(con, e->token, "cache method takes a directory and an optional size");
+			return nill;
+		}
+		SymbolValue dir = constructor_evaluate(con, e->args[0]);
+		con->cache_dir = dir.string;
+		if (e->argc == 2) {
+			SymbolValue size = constructor_evaluate(con, e->args[1]);
+			if (size.type != SYMBOL_VALUE_STRING || !compile_cache_parse_size(size.string, &con->cache_size)) {
+				constructor_error(con, e->token, "invalid cache size, expected bytes or a K, M or G suffix");
+				return nill;
+			}
+		}
 	}
 	return nill;
 }
 
 
 SymbolValue constructor_lookup_variable(Constructor* con, StringView sv, Expression* e) {
+	SymbolValue* variable = e ? environment_lookup(con->current_environment, e->variable.id) : NULL;
+	if (variable) {
+		return *variable;
+	}
+
+	// not assigned anywhere, a bare word is a method or a string
 	SymbolValue val = {0};
 	val.string.items = sv.items;
 	val.string.count = sv.count;
@@ -2578,347 +5790,1450 @@ SymbolValue constructor_interpret_method_build(Constructor* con, ExpressionCall*
 	}
 
 
-	con->current_build_command->body = outer;
-	con->current_build_command = enclosing;
+	con->current_build_command->body = outer;
+	con->current_build_command = enclosing;
+
+	return (SymbolValue){
+		.type = SYMBOL_VALUE_BUILD_COMMAND,
+		.bc = bc
+	};
+}
+
+inline static void path_start(StringBuilder* path, StringView dir, StringView name) {
+	path->count = 0;
+	if (dir.count > 0) {
+		da_append_many(path, dir.items, dir.count);
+		da_append(path, '/');
+	}
+	da_append_many(path, name.items, name.count);
+}
+
+inline static PathId path_intern_with(StringBuilder* path, const char* suffix) {
+	StringView sv = { .items = path->items, .count = path->count };
+	if (!suffix) return path_intern(sv);
+	size_t base = path->count;
+	da_append_many(path, suffix, strlen(suffix));
+	PathId id = path_intern(sv_from_sb(*path));
+	path->count = base;
+	return id;
+}
+
+static void constructor_expand_targets(Constructor* con, BuildCommand* bc, StringBuilder* path) {
+	const char* source_ext = NULL;
+	const char* header_ext = NULL;
+	StringView family = build_command_compiler_family(bc);
+	if ((family.count == 2 && strncmp(family.items, "cc", 2) == 0) ||
+		(family.count == 3 && strncmp(family.items, "gcc", 3) == 0) ||
+		(family.count == 5 && strncmp(family.items, "clang", 5) == 0)
+	) {
+		source_ext = ".c";
+		// TODO: check if it exists first
+		header_ext = ".h";
+	} else if (family.count == 3 && strncmp(family.items, "g++", 3) == 0) {
+		source_ext = ".cpp";
+		// TODO: check if it exists first, it could also be .hpp
+		header_ext = ".h";
+	}
+	bool depfile = bc->build_type == BUILD_OBJECT && build_command_supports_depfile(bc);
+
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		Target* t = &bc->targets.items[i];
+
+		path_start(path, bc->source_dir, t->name);
+		t->input = path_intern_with(path, source_ext);
+		t->header = path_intern_with(path, header_ext);
+
+		path_start(path, bc->output_dir, t->name);
+		t->depfile = depfile ? path_intern_with(path, ".d") : PATH_NONE;
+		t->output = path_intern_with(path, bc->build_type == BUILD_OBJECT ? ".o" : NULL);
+
+		if (bc->parent) {
+			da_append_arena(&con->arena, &bc->parent->input_objects, path_get(t->output));
+		}
+	}
+
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		constructor_expand_targets(con, bc->children.items[i], path);
+	}
+}
+
+// NOTE: we have to wait for all the descriptions to end to run this,
+// otherwise we might miss the compiler change
+void constructor_expand_build_command_targets(Constructor* con, BuildCommand* bc) {
+	StringBuilder path = {0};
+	constructor_expand_targets(con, bc, &path);
+	sb_free(&path);
+}
+
+
+
+
+
+
+
+
+typedef struct {
+	Arena arena;
+	int verbose;
+	bool had_error;
+	BuildCommand* root_build_command;
+	Environment* current_environment;
+} Interpreter;
+
+Interpreter interpreter_new(BuildCommand*);
+void interpreter_interpret (Interpreter*);
+
+void interpreter_error(Interpreter* in, Token token, const char* error_cstr);
+
+SymbolValue interpreter_evaluate (Interpreter* in, Expression* e);
+SymbolValue interpreter_execute  (Interpreter* in, Statement*  s);
+SymbolValue interpret_block      (Interpreter* in, StatementBlock*  s);
+SymbolValue interpret_call       (Interpreter* in, ExpressionCall*  e);
+SymbolValue interpret_chain      (Interpreter* in, ExpressionChain* e);
+SymbolValue interpret_description(Interpreter* in, StatementDescription* s);
+
+SymbolValue interpreter_lookup_variable(Interpreter* in, StringView sv, Expression* e);
+
+
+SymbolValue interpret_method_build(Interpreter* in, ExpressionCall* e);
+
+void interpreter_expand_build_command_targets(Interpreter* in, BuildCommand* bc);
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const SymbolValue nil = { .type = SYMBOL_VALUE_NIL };
+
+
+Interpreter interpreter_new(BuildCommand* bc) {
+	Interpreter in = {0};
+	in.root_build_command = bc;
+	in.current_environment = environment_new(&in.arena, NULL);
+	return in;
+}
+
+void interpreter_interpret(Interpreter* in) {
+	assert(in->root_build_command && in->root_build_command->body && "root bc body must not be null");
+
+	interpreter_execute(in, in->root_build_command->body);
+}
+
+void interpreter_error(Interpreter* in, Token token, const char* error_cstr) {
+	in->had_error = true;
+	fprintf(stderr,"[ERROR][interpreter] %zu:%zu %s\n\t%s %.*s\n",
+		 token.line + 1, token.column,
+		 error_cstr, token_name_cstr(token), (int)token.str.count, token.str.items);
+	raise(1);
+}
+
+
+
+SymbolValue interpreter_evaluate(Interpreter* in, Expression* e) {
+	if (!e) { return (SymbolValue){0}; }
+
+	switch (e->type) {
+		case EXPR_VARIABLE: return interpreter_lookup_variable(in, e->variable.name.str, e);
+		case EXPR_ASSIGNMENT: {
+			SymbolValue value = interpreter_evaluate(in, e->assignment.value);
+			environment_define(&in->arena, in->current_environment, e->assignment.id, value);
+			return value;
+		}
+		case EXPR_CALL:     return interpret_call(in, &e->call);
+		case EXPR_CHAIN:    return interpret_chain(in, &e->chain);
+		case EXPR_LITERAL_STRING: {
+			return (SymbolValue){
+				.type = SYMBOL_VALUE_STRING,
+				.string = e->literal_string.str,
+			};
+		}
+		default: break;
+	}
+	return (SymbolValue){0};
+}
+
+SymbolValue interpreter_execute(Interpreter* in, Statement* s) {
+	BuildCommand* bc = s->attached;
+	if (bc && !bc->dirty && bc->parent != NULL) return nil;
+	//if (bc != in->root_build_command) return nil;
+
+	switch (s->type) {
+		case STATEMENT_BLOCK:       interpret_block(in, &s->block); break;
+		case STATEMENT_DESCRIPTION: interpret_description(in, &s->description); break;
+		case STATEMENT_EXPRESSION:  interpreter_evaluate(in, s->expression.expression); break;
+	}
+
+	return nil;
+}
+
+SymbolValue interpret_block(Interpreter* in, StatementBlock*  s) {
+	for (size_t i = 0; i < s->statement_count; ++i) {
+		interpreter_execute(in, s->statements[i]);
+	}
+	return nil;
+}
+
+SymbolValue interpret_description(Interpreter* in, StatementDescription* s) {
+	SymbolValue left = interpreter_execute(in, s->statement);
+
+	Environment* scope = in->current_environment;
+	in->current_environment = environment_new(&in->arena, scope);
+	for (size_t i = 0; i < s->block->block.statement_count; ++i) {
+		interpreter_execute(in, s->block->block.statements[i]);
+	}
+	in->current_environment = scope;
+
+	return left;
+}
+
+SymbolValue interpret_chain(Interpreter* in, ExpressionChain* e) {
+	SymbolValue left = interpreter_evaluate(in, e->left);
+	interpreter_evaluate(in, e->right);
+	return left;
+}
+
+SymbolValue interpret_call(Interpreter* in, ExpressionCall* e) {
+	SymbolValue callee = interpreter_evaluate(in, e->callee);
+	Token callee_token = {
+		.type = TOKEN_IDENTIFIER,
+		.str.count = callee.string.count,
+		.str.items = callee.string.items,
+		.line = e->token.line,
+		.column = e->token.column,
+	};
+
+	if (callee.type == SYMBOL_VALUE_NIL) {
+		interpreter_error(in, callee_token, "callee is nil");
+		return nil;
+	}
+	
+	if (callee.type != SYMBOL_VALUE_METHOD) {
+		interpreter_error(in, callee_token, "callee is not a method");
+		return nil;
+	}
+
+	if (callee.method_type == METHOD_ECHO) {
+		SymbolValue arg = interpreter_evaluate(in, e->args[0]);
+		printf("%.*s\n",(int)arg.string.count, arg.string.items);
+	}
+	return nil;
+}
+
+
+SymbolValue interpreter_lookup_variable(Interpreter* in, StringView sv, Expression* e) {
+	SymbolValue* variable = e ? environment_lookup(in->current_environment, e->variable.id) : NULL;
+	if (variable) {
+		return *variable;
+	}
+
+	// not assigned anywhere, a bare word is a method or a string
+	SymbolValue val = {0};
+	val.string.items = sv.items;
+	val.string.count = sv.count;
+	val.type = SYMBOL_VALUE_STRING;
+
+	MethodType m = method_extract(sv);
+	if (m != METHOD_NONE) {
+		val.type = SYMBOL_VALUE_METHOD;
+		val.method_type = m;
+	}
+
+	return val;
+}
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+#endif
+
+// share of the time some task waited for a cpu, above HIGH the job limit goes
+// down by a quarter, below LOW it goes up by one
+#define LOAD_PRESSURE_HIGH 0.5
+#define LOAD_PRESSURE_LOW  0.2
+
+#ifdef __linux__
+static bool load_read_file(const char* path, char* buffer, size_t size) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+	size_t n = fread(buffer, 1, size - 1, f);
+	fclose(f);
+	buffer[n] = '\0';
+	return n > 0;
+}
+
+// "0-3,8-11" from Cpus_allowed_list
+static size_t load_affinity_count(void) {
+	char status[8192];
+	if (!load_read_file("/proc/self/status", status, sizeof(status))) return 0;
+	const char* list = strstr(status, "Cpus_allowed_list:");
+	if (!list) return 0;
+	list += strlen("Cpus_allowed_list:");
+
+	size_t count = 0;
+	while (*list && *list != '\n') {
+		char* end;
+		long first = strtol(list, &end, 10);
+		if (end == list) {
+			list++;
+			continue;
+		}
+		long last = first;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+		}
+		if (last >= first) count += (size_t)(last - first + 1);
+		list = end;
+	}
+	return count;
+}
+
+// cpus allowed by a "quota period" quota, 0 when unlimited
+static size_t load_quota_cpus(long long quota, long long period) {
+	if (quota <= 0 || period <= 0) return 0;
+	size_t cpus = (size_t)((quota + period - 1) / period);
+	return cpus > 0 ? cpus : 1;
+}
+
+// the smallest cpu.max of cook's cgroup and its parents, cgroup v2 and then v1
+static size_t load_cgroup_count(void) {
+	char buffer[4096];
+	size_t best = 0;
+
+	char path[4096] = "";
+	if (load_read_file("/proc/self/cgroup", buffer, sizeof(buffer))) {
+		char* v2 = strstr(buffer, "0::");
+		if (v2 == buffer || (v2 && v2[-1] == '\n')) {
+			v2 += 3;
+			size_t len = strcspn(v2, "\n");
+			if (len < sizeof(path)) {
+				memcpy(path, v2, len);
+				path[len] = '\0';
+			}
+		}
+	}
+	while (true) {
+		char file[4200];
+		snprintf(file, sizeof(file), "/sys/fs/cgroup%s/cpu.max", strcmp(path, "/") == 0 ? "" : path);
+		long long quota = 0, period = 0;
+		if (load_read_file(file, buffer, sizeof(buffer)) && sscanf(buffer, "%lld %lld", &quota, &period) == 2) {
+			size_t cpus = load_quota_cpus(quota, period);
+			if (cpus > 0 && (best == 0 || cpus < best)) best = cpus;
+		}
+		char* slash = strrchr(path, '/');
+		if (!slash || path[0] == '\0' || strcmp(path, "/") == 0) break;
+		*slash = '\0';
+	}
+
+	char quota[64], period[64];
+	if (best == 0
+		&& load_read_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", quota, sizeof(quota))
+		&& load_read_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us", period, sizeof(period))) {
+		best = load_quota_cpus(atoll(quota), atoll(period));
+	}
+	return best;
+}
+
+// the "total" of the "some" line, µs some task waited for a cpu
+static bool load_cpu_pressure(uint64_t* stalled) {
+	char buffer[512];
+	if (!load_read_file("/proc/pressure/cpu", buffer, sizeof(buffer))) return false;
+	const char* total = strstr(buffer, "total=");
+	if (strncmp(buffer, "some", 4) != 0 || !total) return false;
+	*stalled = strtoull(total + strlen("total="), NULL, 10);
+	return true;
+}
+#else
+static bool load_cpu_pressure(uint64_t* stalled) {
+	(void)stalled;
+	return false;
+}
+#endif
 
-	return (SymbolValue){
-		.type = SYMBOL_VALUE_BUILD_COMMAND,
-		.bc = bc
+size_t load_cpu_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (size_t)info.dwNumberOfProcessors : 1;
+#else
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t count = online > 0 ? (size_t)online : 1;
+#ifdef __linux__
+	size_t affinity = load_affinity_count();
+	if (affinity > 0 && affinity < count) count = affinity;
+	size_t cgroup = load_cgroup_count();
+	if (cgroup > 0 && cgroup < count) count = cgroup;
+#endif
+	return count;
+#endif
+}
+
+static bool load_average(double* load) {
+#ifdef _WIN32
+	(void)load;
+	return false;
+#else
+	return getloadavg(load, 1) == 1;
+#endif
+}
+
+LoadController load_controller_new(size_t max, double max_load, bool adaptive) {
+	return (LoadController){
+		.max = max,
+		.limit = max,
+		.max_load = max_load,
+		.adaptive = adaptive,
 	};
 }
 
-// NOTE: we have to wait for all the descriptions to end to run this,
-// otherwise we might miss the compiler change
-void constructor_expand_build_command_targets(Constructor* con, BuildCommand* bc) {
-	for (size_t i = 0; i < bc->targets.count; ++i) {
-		Target* t = &bc->targets.items[i];
+size_t load_controller_update(LoadController* lc) {
+	if (!lc->adaptive && lc->max_load <= 0) return lc->limit;
 
-		t->input_name.count = 0;
-		if (bc->source_dir.count > 0) {
-			da_append_many_arena(&con->arena, &t->input_name, bc->source_dir.items, bc->source_dir.count);
-			da_append_arena(&con->arena, &t->input_name, '/');
-		}
-		da_append_many_arena(&con->arena, &t->input_name, t->name.items, t->name.count);
-		da_append_many_arena(&con->arena, &t->header_file, t->input_name.items, t->input_name.count);
-		if ((bc->compiler.count == 3 && strncmp(bc->compiler.items, "cc", 2) == 0) ||
-			(bc->compiler.count == 3 && strncmp(bc->compiler.items, "gcc", 3) == 0) ||
-			(bc->compiler.count == 5 && strncmp(bc->compiler.items, "clang", 5) == 0)
-		) {
-			da_append_many_arena(&con->arena, &t->input_name, ".c", 2);
-			// TODO: check if it exists first
-			da_append_many_arena(&con->arena, &t->header_file, ".h", 2);
-		} else if (bc->compiler.count == 3 && strncmp(bc->compiler.items, "g++", 3) == 0) {
-			da_append_many_arena(&con->arena, &t->input_name, ".cpp", 4);
-			// TODO: check if it exists first, it could also be .hpp
-			da_append_many_arena(&con->arena, &t->header_file, ".h", 2);
-		}
+	uint64_t now = stats_clock();
+	uint64_t interval = (uint64_t)LOAD_SAMPLE_INTERVAL_MS * 1000000ull;
+	if (lc->sampled != 0 && now - lc->sampled < interval) return lc->limit;
+	uint64_t elapsed_us = (now - lc->sampled) / 1000;
+	bool first = lc->sampled == 0;
+	lc->sampled = now;
 
-		t->output_name.count = 0;
+	bool contended = false;
+	bool idle = true;
 
-		if (bc->output_dir.count > 0) {
-			da_append_many_arena(&con->arena, &t->output_name, bc->output_dir.items, bc->output_dir.count);
-			da_append_arena(&con->arena, &t->output_name, '/');
-		}
-		da_append_many_arena(&con->arena, &t->output_name, t->name.items, t->name.count);
-		if (bc->build_type == BUILD_OBJECT) {
-			da_append_many_arena(&con->arena, &t->output_name, ".o", 2);
-		}
+	double load = 0;
+	if (lc->max_load > 0 && load_average(&load)) {
+		if (load >= lc->max_load) contended = true;
+		else if (load + 1 > lc->max_load) idle = false;
+	}
 
-		if (bc->parent) {
-			da_append_arena(&con->arena, &bc->parent->input_objects, sv_from_sb(t->output_name));
+	uint64_t stalled = 0;
+	if (lc->adaptive && load_cpu_pressure(&stalled)) {
+		if (lc->has_stalled && !first && elapsed_us > 0) {
+			double pressure = (double)(stalled - lc->stalled) / (double)elapsed_us;
+			if (pressure > LOAD_PRESSURE_HIGH) contended = true;
+			else if (pressure > LOAD_PRESSURE_LOW) idle = false;
 		}
+		lc->stalled = stalled;
+		lc->has_stalled = true;
 	}
 
-	for (size_t i = 0; i < bc->children.count; ++i) {
-		constructor_expand_build_command_targets(con, bc->children.items[i]);
+	if (contended) {
+		size_t step = lc->limit / 4 > 0 ? lc->limit / 4 : 1;
+		lc->limit = lc->limit > step ? lc->limit - step : 1;
+	} else if (idle && lc->limit < lc->max) {
+		lc->limit++;
 	}
+	return lc->limit;
 }
 
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
+#ifdef _WIN32
+	#include <windows.h>
+	#include <sys/types.h>
+	#include <sys/stat.h>
+#else
+	#include <sys/stat.h>
+	#include <time.h>
+#endif
 
+#ifdef _WIN32
+#define CMD_LINE_MAX 2000
+// gcc and clang read more arguments from an @file, a build command whose shared
+// arguments render longer than this passes them through one, and so does any command
+// that would not fit in CMD_LINE_MAX otherwise. only those move, the compiler, cflags
+// and the target's own paths stay in the command line.
+#define RESPONSE_FILE_THRESHOLD (CMD_LINE_MAX / 2)
 
+// the caller made sure line fits, a cut command is never run
+static inline int execute_line(const char* line) {
+	char full_command[CMD_LINE_MAX + 16];
+	int n = snprintf(full_command, sizeof(full_command), "cmd /C \"%s\"", line);
+	if (n < 0 || (size_t)n >= sizeof(full_command)) return -1;
+	return system(full_command);
+}
+#else
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <signal.h>
+	#include <spawn.h>
+	#include <sys/resource.h>
+	#include <sys/wait.h>
+
+extern char** environ;
+
+// far below ARG_MAX, long link lines stop being copied into every spawn. shorter
+// shared arguments are still passed in the argv, like the compiler and cflags.
+#define RESPONSE_FILE_THRESHOLD (32 * 1024)
+
+// no shell in between, the compiler is started straight from the argv. its stdout
+// and stderr share one pipe, so what it prints can be shown in one piece.
+// with own_group it leads a new process group, which a cancel kills as a whole.
+static inline long execute_cmd_async(Cmd cmd, bool own_group, int* output_fd) {
+	int fds[2];
+	if (pipe(fds) != 0) return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	if (own_group) {
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+		posix_spawnattr_setpgroup(&attr, 0);
+	}
+
+	pid_t pid = 0;
+	int err = posix_spawnp(&pid, cmd.items[0], &actions, &attr, (char* const*)cmd.items, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+	if (err != 0) {
+		close(fds[0]);
+		errno = err;
+		return -1;
+	}
+	*output_fd = fds[0];
+	return (long)pid;
+}
+#endif
 
+// max_jobs 0 sizes the build from the cpus and lets it adapt to the load
+Executer executer_new(Arena* arena, size_t max_jobs, double max_load) {
+	Executer e = {0};
+	e.arena = arena;
+	e.max_jobs = max_jobs > 0 ? max_jobs : load_cpu_count();
+	e.load = load_controller_new(e.max_jobs, max_load, max_jobs == 0);
+	e.watch_fd = -1;
+#ifndef _WIN32
+	const char* term = getenv("TERM");
+	bool terminal = term && strcmp(term, "dumb") != 0;
+	e.progress = terminal && isatty(STDOUT_FILENO);
+	e.color = e.progress && isatty(STDERR_FILENO) && getenv("NO_COLOR") == NULL;
+#endif
+	return e;
+}
 
 
+inline static void job_index_list_add_unique(Arena* arena, JobIndexList* list, size_t index) {
+	for (size_t i = 0; i < list->count; ++i) {
+		if (list->items[i] == index) return;
+	}
+	da_append_arena(arena, list, index);
+}
+
+static void fingerprint_set_add(Arena* arena, FingerprintSet* set, uint64_t fingerprint, size_t index) {
+	// keep the load factor under a half
+	if ((set->count + 1) * 2 > set->slot_count) {
+		size_t slot_count = set->slot_count == 0 ? 256 : set->slot_count * 2;
+		FingerprintSlot* slots = arena_alloc(arena, slot_count * sizeof(FingerprintSlot));
+		memset(slots, 0, slot_count * sizeof(FingerprintSlot));
+		for (size_t i = 0; i < set->slot_count; ++i) {
+			FingerprintSlot slot = set->slots[i];
+			if (slot.index == 0) continue;
+			size_t j = slot.fingerprint & (slot_count - 1);
+			while (slots[j].index != 0) j = (j + 1) & (slot_count - 1);
+			slots[j] = slot;
+		}
+		set->slots = slots;
+		set->slot_count = slot_count;
+	}
 
-typedef struct {
-	Arena arena;
-	int verbose;
-	bool had_error;
-	BuildCommand* root_build_command;
-	Environment* current_environment;
-} Interpreter;
+	size_t i = fingerprint & (set->slot_count - 1);
+	while (set->slots[i].index != 0) i = (i + 1) & (set->slot_count - 1);
+	set->slots[i] = (FingerprintSlot){ .fingerprint = fingerprint, .index = index + 1 };
+	set->count++;
+}
 
-Interpreter interpreter_new(BuildCommand*);
-void interpreter_interpret (Interpreter*);
+// the next slot after *cursor with this fingerprint, NULL once there is none.
+// *cursor starts at SIZE_MAX.
+static FingerprintSlot* fingerprint_set_next(FingerprintSet* set, uint64_t fingerprint, size_t* cursor) {
+	if (set->slot_count == 0) return NULL;
+	size_t i = *cursor == SIZE_MAX ? fingerprint & (set->slot_count - 1) : (*cursor + 1) & (set->slot_count - 1);
+	for (; set->slots[i].index != 0; i = (i + 1) & (set->slot_count - 1)) {
+		if (set->slots[i].fingerprint == fingerprint) {
+			*cursor = i;
+			return &set->slots[i];
+		}
+	}
+	return NULL;
+}
 
-void interpreter_error(Interpreter* in, Token token, const char* error_cstr);
+static bool executer_was_executed(Executer* e, BuildCommand* bc) {
+	size_t cursor = SIZE_MAX;
+	FingerprintSlot* slot;
+	while ((slot = fingerprint_set_next(&e->executed_set, bc->fingerprint, &cursor))) {
+		if (build_command_is_same(bc, e->executed.items[slot->index - 1])) return true;
+	}
+	return false;
+}
 
-SymbolValue interpreter_evaluate (Interpreter* in, Expression* e);
-SymbolValue interpreter_execute  (Interpreter* in, Statement*  s);
-SymbolValue interpret_block      (Interpreter* in, StatementBlock*  s);
-SymbolValue interpret_call       (Interpreter* in, ExpressionCall*  e);
-SymbolValue interpret_chain      (Interpreter* in, ExpressionChain* e);
-SymbolValue interpret_description(Interpreter* in, StatementDescription* s);
+// the job that already builds t, or SIZE_MAX
+static size_t executer_find_built(Executer* e, Target* t) {
+	size_t cursor = SIZE_MAX;
+	FingerprintSlot* slot;
+	while ((slot = fingerprint_set_next(&e->built_set, t->fingerprint, &cursor))) {
+		if (target_is_same(t, e->built.items[slot->index - 1])) return slot->index - 1;
+	}
+	return SIZE_MAX;
+}
 
-SymbolValue interpreter_lookup_variable(Interpreter* in, StringView sv, Expression* e);
+// walks the build command tree in the old serial order and turns every dirty target
+// into a job. the jobs of the children become the dependencies of the parent's targets.
+// `frontier` receives the jobs that a parent of bc has to wait for.
+void executer_plan(Executer* e, BuildCommand* bc, JobIndexList* frontier, bool create_dirs) {
+	if (!bc || !bc->dirty) {
+		return;
+	}
 
+	// create output dir
+	if (create_dirs) {
+		StringBuilder sb = {0};
+		da_append_many(&sb, bc->output_dir.items, bc->output_dir.count);
+		da_append(&sb,'\0');
+		if (access(sb.items, F_OK) != 0) {
+			MKDIR(sb.items);
+		}
+		free(sb.items);
+	}
 
-SymbolValue interpret_method_build(Interpreter* in, ExpressionCall* e);
+	JobIndexList deps = {0};
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		executer_plan(e, bc->children.items[i], &deps, create_dirs);
+	}
 
-void interpreter_expand_build_command_targets(Interpreter* in, BuildCommand* bc);
+	size_t frontier_before = frontier->count;
 
+	bool already_executed = executer_was_executed(e, bc);
+	if (!already_executed) {
+		fingerprint_set_add(e->arena, &e->executed_set, bc->fingerprint, e->executed.count);
+		da_append(&e->executed, bc);
+	}
 
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		Target* t = &bc->targets.items[i];
+		if (!t->dirty) continue;
 
+		// e->built and e->jobs grow together, so the index of a built target is its job
+		size_t built = executer_find_built(e, t);
+		if (built != SIZE_MAX) {
+			job_index_list_add_unique(e->arena, frontier, built);
+			continue;
+		}
+		if (already_executed) continue;
+		fingerprint_set_add(e->arena, &e->built_set, t->fingerprint, e->built.count);
+		da_append(&e->built, t);
 
+		Job job = {
+			.bc = bc,
+			.target = t,
+			.state = JOB_WAITING,
+			.pending = deps.count,
+			.output_fd = -1,
+		};
+		size_t index = e->jobs.count;
+		da_append(&e->jobs, job);
+		for (size_t d = 0; d < deps.count; ++d) {
+			da_append_arena(e->arena, &e->jobs.items[deps.items[d]].dependents, index);
+		}
+		job_index_list_add_unique(e->arena, frontier, index);
+	}
 
+	// a build command without work of its own still has to hand its children over
+	if (frontier->count == frontier_before) {
+		for (size_t d = 0; d < deps.count; ++d) {
+			job_index_list_add_unique(e->arena, frontier, deps.items[d]);
+		}
+	}
+}
 
-#include <signal.h>
-#include <stdio.h>
-#include <string.h>
-#include <unistd.h>
+// without a recorded duration, a job is guessed from the size of its source
+#define JOB_GUESS_US_PER_BYTE 20
+#define JOB_GUESS_MIN_US      50000
 
-static const SymbolValue nil = { .type = SYMBOL_VALUE_NIL };
+static uint64_t executer_estimate(Executer* e, Job* job) {
+	if (e->state) {
+		BuildLogEntry* entry = build_log_find(&e->state->log, path_get(job->target->output));
+		if (entry && entry->usage.exit_code == 0 && entry->usage.wall > 0) {
+			return entry->usage.wall;
+		}
+	}
+	uint64_t guess = stat_cache_state_id(job->target->input).size * JOB_GUESS_US_PER_BYTE;
+	return guess > JOB_GUESS_MIN_US ? guess : JOB_GUESS_MIN_US;
+}
 
+// the longest chain of estimated durations from each job to the end of the build.
+// a job is always planned after the jobs it depends on, so one backwards pass does it.
+static void executer_prioritize(Executer* e) {
+	for (size_t i = e->jobs.count; i-- > 0;) {
+		Job* job = &e->jobs.items[i];
+		uint64_t longest = 0;
+		for (size_t d = 0; d < job->dependents.count; ++d) {
+			assert(job->dependents.items[d] > i);
+			Job* dependent = &e->jobs.items[job->dependents.items[d]];
+			if (dependent->priority > longest) longest = dependent->priority;
+		}
+		job->priority = executer_estimate(e, job) + longest;
+	}
+}
 
-Interpreter interpreter_new(BuildCommand* bc) {
-	Interpreter in = {0};
-	in.root_build_command = bc;
-	in.current_environment = environment_new(&in.arena);
-	return in;
+// the job on the longest path goes first, ties keep the planned order
+inline static bool executer_ready_before(Executer* e, size_t a, size_t b) {
+	uint64_t pa = e->jobs.items[a].priority, pb = e->jobs.items[b].priority;
+	return pa != pb ? pa > pb : a < b;
 }
 
-void interpreter_interpret(Interpreter* in) {
-	assert(in->root_build_command && in->root_build_command->body && "root bc body must not be null");
+static void executer_ready_push(Executer* e, size_t index) {
+	JobIndexList* h = &e->ready;
+	da_append_arena(e->arena, h, index);
+	size_t i = h->count - 1;
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!executer_ready_before(e, h->items[i], h->items[parent])) break;
+		size_t tmp = h->items[parent];
+		h->items[parent] = h->items[i];
+		h->items[i] = tmp;
+		i = parent;
+	}
+}
 
-	interpreter_execute(in, in->root_build_command->body);
+static size_t executer_ready_pop(Executer* e) {
+	JobIndexList* h = &e->ready;
+	assert(h->count > 0);
+	size_t top = h->items[0];
+	h->items[0] = h->items[--h->count];
+	size_t i = 0;
+	while (true) {
+		size_t l = 2 * i + 1, r = l + 1, m = i;
+		if (l < h->count && executer_ready_before(e, h->items[l], h->items[m])) m = l;
+		if (r < h->count && executer_ready_before(e, h->items[r], h->items[m])) m = r;
+		if (m == i) break;
+		size_t tmp = h->items[m];
+		h->items[m] = h->items[i];
+		h->items[i] = tmp;
+		i = m;
+	}
+	return top;
+}
+
+// pooled paths are NUL terminated
+static const char* executer_output_cstr(Job* job) {
+	return path_get(job->target->output).items;
+}
+
+// folds the depfile the compiler just wrote into the deps log
+static void executer_record_deps(Executer* e, Job* job) {
+	Target* t = job->target;
+	if (!e->state || t->depfile == PATH_NONE) return;
+
+	// the log copies what it keeps, the parsed depfile is thrown away
+	ArenaMark mark = arena_save(e->arena);
+	StringList deps = {0};
+	if (depfile_read(e->arena, path_get(t->depfile), &deps)) {
+		uint64_t mtime = stat_cache_mtime_id(t->output);
+		if (deps_log_record(&e->state->deps, path_get(t->output), mtime, &deps)) {
+			remove(path_get(t->depfile).items);
+		}
+	}
+	arena_restore(e->arena, mark);
 }
 
-void interpreter_error(Interpreter* in, Token token, const char* error_cstr) {
-	in->had_error = true;
-	fprintf(stderr,"[ERROR][interpreter] %zu:%zu %s\n\t%s %.*s\n",
-		 token.line + 1, token.column,
-		 error_cstr, token_name_cstr(token), (int)token.str.count, token.str.items);
-	raise(1);
+static size_t build_command_depth(BuildCommand* bc) {
+	size_t depth = 0;
+	for (BuildCommand* p = bc->parent; p; p = p->parent) depth++;
+	return depth;
 }
 
+static void executer_release_slot(Executer* e, Job* job, int exit_code) {
+	trace_command(job->start_time, job->slot, path_get(job->target->output), job->target->name,
+		build_command_depth(job->bc), exit_code, job->cached);
+	da_append_arena(e->arena, &e->free_slots, job->slot);
+	e->slot_jobs[job->slot] = SIZE_MAX;
+}
 
+static void executer_clear_status(Executer* e) {
+	if (!e->status_shown) return;
+	printf("\r\x1b[K");
+	e->status_shown = false;
+}
 
-SymbolValue interpreter_evaluate(Interpreter* in, Expression* e) {
-	if (!e) { return (SymbolValue){0}; }
+// the progress line on a terminal, the job that started or ended last
+static void executer_show_status(Executer* e, Job* job) {
+	StringView output = path_get(job->target->output);
+	printf("\r[%zu/%zu] %.*s\x1b[K", e->finished, e->total, (int)output.count, output.items);
+	fflush(stdout);
+	e->status_shown = true;
+}
 
-	switch (e->type) {
-		case EXPR_VARIABLE: return interpreter_lookup_variable(in, e->variable.name.str, e);
-		case EXPR_CALL:     return interpret_call(in, &e->call);
-		case EXPR_CHAIN:    return interpret_chain(in, &e->chain);
-		case EXPR_LITERAL_STRING: {
-			return (SymbolValue){
-				.type = SYMBOL_VALUE_STRING,
-				.string = e->literal_string.str,
-			};
+// a job's output is printed all at once when it ends, so parallel jobs don't mix
+static void executer_report_job(Executer* e, Job* job, int exit_code) {
+	e->finished++;
+	StringView output = path_get(job->target->output);
+	if (exit_code != 0) {
+		executer_clear_status(e);
+		fflush(stdout);
+		fprintf(stderr, "[ERROR][executer] %.*s failed with exit code %d\n$ %.*s\n",
+			(int)output.count, output.items, exit_code, (int)job->cmdline.count, job->cmdline.items);
+		if (job->output.count > 0) {
+			fwrite(job->output.items, 1, job->output.count, stderr);
+		}
+		fflush(stderr);
+	} else {
+		if (e->verbose == 0 && (!e->progress || job->output.count > 0)) {
+			executer_clear_status(e);
+			printf("[%zu/%zu] %.*s\n", e->finished, e->total, (int)output.count, output.items);
+		}
+		if (job->output.count > 0) {
+			fwrite(job->output.items, 1, job->output.count, stdout);
 		}
-		default: break;
 	}
-	return (SymbolValue){0};
+	if (e->verbose == 0 && e->progress) {
+		executer_show_status(e, job);
+	}
+	fflush(stdout);
+	job->output = (StringBuilder){0};
 }
 
-BuildCommand* statement_find_attached_build_command(Statement* s, BuildCommand* bc) {
-	if (!bc || !s || !bc->body) return NULL;
-	if (bc->body == s)          return bc;
-	for (size_t i = 0; i < bc->children.count; ++i) {
-		BuildCommand* bcc = statement_find_attached_build_command(s, bc->children.items[i]);
-		if (bcc) return bcc;
+// everything that depends on a failed job can't be built anymore
+static void executer_skip_dependents(Executer* e, Job* job) {
+	for (size_t i = 0; i < job->dependents.count; ++i) {
+		Job* d = &e->jobs.items[job->dependents.items[i]];
+		if (d->state != JOB_WAITING) continue;
+		d->state = JOB_SKIPPED;
+		executer_skip_dependents(e, d);
 	}
-	return NULL;
 }
 
-SymbolValue interpreter_execute(Interpreter* in, Statement* s) {
-	BuildCommand* bc = statement_find_attached_build_command(s, in->root_build_command);
-	if (bc && !bc->dirty && bc->parent != NULL) return nil;
-	//if (bc != in->root_build_command) return nil;
+// fail fast, the running jobs are killed and leave nothing behind
+static void executer_cancel_running(Executer* e) {
+	for (size_t s = 0; s < e->max_jobs; ++s) {
+		if (e->slot_jobs[s] != SIZE_MAX) {
+			executer_cancel_job(e, e->slot_jobs[s]);
+		}
+	}
+}
 
-	switch (s->type) {
-		case STATEMENT_BLOCK:       interpret_block(in, &s->block); break;
-		case STATEMENT_DESCRIPTION: interpret_description(in, &s->description); break;
-		case STATEMENT_EXPRESSION:  interpreter_evaluate(in, s->expression.expression); break;
+static void executer_finish_job(Executer* e, size_t index, int exit_code) {
+	Job* job = &e->jobs.items[index];
+	executer_release_slot(e, job, exit_code);
+	executer_report_job(e, job, exit_code);
+	stat_cache_invalidate_id(job->target->output);
+	job->usage.wall = (stats_clock() - job->started) / 1000;
+	job->usage.exit_code = exit_code;
+	if (exit_code != 0) {
+		job->state = JOB_FAILED;
+		e->failed = true;
+		e->failures++;
+		if (e->state) {
+			build_log_record(&e->state->log, path_get(job->target->output), 0, job->usage);
+		}
+		executer_skip_dependents(e, job);
+		if (!e->keep_going) {
+			executer_cancel_running(e);
+		}
+		return;
+	}
+	job->state = JOB_DONE;
+	if (job->cacheable && job->phase == JOB_PHASE_COMPILE) {
+		compile_cache_store(e->cache, job->cache_key, executer_output_cstr(job));
+	}
+	executer_record_deps(e, job);
+	if (e->state) {
+		build_log_record(&e->state->log, path_get(job->target->output), job->command_hash, job->usage);
 	}
+	for (size_t i = 0; i < job->dependents.count; ++i) {
+		Job* d = &e->jobs.items[job->dependents.items[i]];
+		if (--d->pending == 0) {
+			executer_ready_push(e, job->dependents.items[i]);
+		}
+	}
+}
 
-	return nil;
+static void executer_job_exited(Executer* e, size_t index, int exit_code);
+
+// compilers only color what goes to a terminal, the pipe has to ask for it.
+// the flag is left out of the command line, so it doesn't cause rebuilds.
+static Cmd executer_color_cmd(Executer* e, Job* job, Cmd cmd) {
+	if (!e->color || !build_command_supports_depfile(job->bc)) return cmd;
+	Cmd colored = {0};
+	da_reserve_arena(e->arena, &colored, cmd.count + 2);
+	memcpy(colored.items, cmd.items, cmd.count * sizeof(*cmd.items));
+	colored.count = cmd.count;
+	colored.items[colored.count++] = "-fdiagnostics-color=always";
+	colored.items[colored.count] = NULL;
+	return colored;
 }
 
-SymbolValue interpret_block(Interpreter* in, StatementBlock*  s) {
-	for (size_t i = 0; i < s->statement_count; ++i) {
-		interpreter_execute(in, s->statements[i]);
-	}
-	return nil;
+// a response file that already holds these bytes is left alone, so its mtime
+// only changes along with the arguments
+static bool executer_file_holds(const char* path, StringView content) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+	char* buffer = malloc(content.count + 1);
+	size_t n = fread(buffer, 1, content.count + 1, f);
+	fclose(f);
+	bool same = n == content.count && memcmp(buffer, content.items, content.count) == 0;
+	free(buffer);
+	return same;
 }
 
-SymbolValue interpret_description(Interpreter* in, StatementDescription* s) {
-	SymbolValue left = interpreter_execute(in, s->statement);
+// the @file with the tail of bc's commands, written once per build and shared by
+// all of its targets. it is named after bc's first output, so changed arguments
+// overwrite it instead of leaving the old one behind.
+static const char* executer_response_file(Executer* e, BuildCommand* bc) {
+	size_t cursor = SIZE_MAX;
+	FingerprintSlot* slot;
+	while ((slot = fingerprint_set_next(&e->response_set, bc->fingerprint, &cursor))) {
+		ResponseFile* r = &e->responses.items[slot->index - 1];
+		if (r->bc == bc || build_command_is_same(r->bc, bc)) return r->arg;
+	}
 
-	for (size_t i = 0; i < s->block->block.statement_count; ++i) {
-		interpreter_execute(in, s->block->block.statements[i]);
+	StringView output = path_get(bc->targets.items[0].output);
+	StringBuilder sb = {0};
+	da_append_arena(e->arena, &sb, '@');
+	da_append_many_arena(e->arena, &sb, output.items, output.count);
+	da_append_many_arena(e->arena, &sb, ".rsp", 5);
+
+	const char* path = sb.items + 1;
+	StringView tail = bc->cmd.tail_line;
+	if (!executer_file_holds(path, tail)) {
+		FILE* f = fopen(path, "wb");
+		if (!f) {
+			fprintf(stderr, "[ERROR][executer] could not open %s: %s\n", path, strerror(errno));
+			return NULL;
+		}
+		bool ok = fwrite(tail.items, 1, tail.count, f) == tail.count;
+		ok = fclose(f) == 0 && ok;
+		if (!ok) {
+			fprintf(stderr, "[ERROR][executer] could not write %s: %s\n", path, strerror(errno));
+			return NULL;
+		}
 	}
 
-	return left;
+	fingerprint_set_add(e->arena, &e->response_set, bc->fingerprint, e->responses.count);
+	da_append_arena(e->arena, &e->responses, ((ResponseFile){ .bc = bc, .arg = sb.items }));
+	return sb.items;
 }
 
-SymbolValue interpret_chain(Interpreter* in, ExpressionChain* e) {
-	SymbolValue left = interpreter_evaluate(in, e->left);
-	interpreter_evaluate(in, e->right);
-	return left;
+// the tail of every command of bc comes last, even with -E put in front,
+// so it can be swapped for the response file
+static Cmd executer_response_cmd(Executer* e, Job* job, Cmd cmd, bool force) {
+	CmdTemplate* tmpl = &job->bc->cmd;
+	if (!tmpl->ready || (!force && tmpl->tail_line.count < RESPONSE_FILE_THRESHOLD)) return cmd;
+	if (!build_command_supports_depfile(job->bc)) return cmd;
+	assert(cmd.count >= tmpl->tail.count);
+
+	const char* response = executer_response_file(e, job->bc);
+	if (!response) return cmd;
+
+	Cmd shorter = {0};
+	size_t keep = cmd.count - tmpl->tail.count;
+	da_reserve_arena(e->arena, &shorter, keep + 2);
+	memcpy(shorter.items, cmd.items, keep * sizeof(*cmd.items));
+	shorter.count = keep;
+	shorter.items[shorter.count++] = response;
+	shorter.items[shorter.count] = NULL;
+	return shorter;
 }
 
-SymbolValue interpret_call(Interpreter* in, ExpressionCall* e) {
-	SymbolValue callee = interpreter_evaluate(in, e->callee);
-	Token callee_token = {
-		.type = TOKEN_IDENTIFIER,
-		.str.count = callee.string.count,
-		.str.items = callee.string.items,
-		.line = e->token.line,
-		.column = e->token.column,
-	};
+// the driver forks cc1, as and ld, killing only the driver leaves them running.
+// --watch handles SIGINT itself and kills every job, so there each job gets its own
+// process group. otherwise the jobs stay in cook's group, where ctrl-c reaches them.
+static inline bool executer_groups_jobs(Executer* e) {
+	return e->watch_fd >= 0;
+}
 
-	if (callee.type == SYMBOL_VALUE_NIL) {
-		interpreter_error(in, callee_token, "callee is nil");
-		return nil;
+static void executer_spawn(Executer* e, size_t index, Cmd cmd) {
+	Job* job = &e->jobs.items[index];
+	stats.spawns++;
+	Cmd full = cmd;
+	cmd = executer_response_cmd(e, job, full, false);
+	// a preprocessor that ran first was only looking for the cache key
+	job->output.count = 0;
+#ifdef _WIN32
+	StringBuilder sb = cmd_render(e->arena, cmd);
+	if (sb.count > CMD_LINE_MAX) {
+		cmd = executer_response_cmd(e, job, full, true);
+		sb = cmd_render(e->arena, cmd);
+	}
+	if (sb.count > CMD_LINE_MAX) {
+		StringView output = path_get(job->target->output);
+		fprintf(stderr, "[ERROR][executer] the command for %.*s is %zu characters long, cmd.exe takes %d\n",
+			(int)output.count, output.items, sb.count, CMD_LINE_MAX);
+		executer_job_exited(e, index, -1);
+		return;
 	}
-	
-	if (callee.type != SYMBOL_VALUE_METHOD) {
-		interpreter_error(in, callee_token, "callee is not a method");
-		return nil;
+	da_append_arena(e->arena, &sb, '\0');
+	executer_job_exited(e, index, execute_line(sb.items));
+#else
+	job->pid = execute_cmd_async(executer_color_cmd(e, job, cmd), executer_groups_jobs(e), &job->output_fd);
+	if (job->pid < 0) {
+		fprintf(stderr, "[ERROR][executer] could not run %s: %s\n", cmd.items[0], strerror(errno));
+		executer_finish_job(e, index, -1);
+		return;
+	}
+	job->state = JOB_RUNNING;
+	e->running++;
+#endif
+}
+
+// the compile command with -E in front and the object swapped for `output`
+static Cmd executer_preprocess_cmd(Executer* e, Cmd cmd, const char* output) {
+	Cmd pp = {0};
+	da_reserve_arena(e->arena, &pp, cmd.count + 2);
+	for (size_t i = 0; i < cmd.count; ++i) {
+		pp.items[pp.count++] = cmd.items[i];
+		if (i == 0) {
+			pp.items[pp.count++] = "-E";
+		} else if (strcmp(cmd.items[i], "-o") == 0 && i + 1 < cmd.count) {
+			pp.items[pp.count++] = output;
+			++i;
+		}
+	}
+	pp.items[pp.count] = NULL;
+	return pp;
+}
+
+// .i for c and .ii for c++, the compiler picks the language of a preprocessed file
+// by its extension. NULL for other sources, those are not cached.
+static const char* executer_preprocessed_ext(Job* job) {
+	StringView input = path_get(job->target->input);
+	static const char* cxx[] = { ".cpp", ".cc", ".cxx", ".c++", ".C" };
+	if (input.count > 2 && strcmp(input.items + input.count - 2, ".c") == 0) return ".i";
+	for (size_t i = 0; i < sizeof(cxx)/sizeof(cxx[0]); ++i) {
+		size_t len = strlen(cxx[i]);
+		if (input.count > len && strcmp(input.items + input.count - len, cxx[i]) == 0) return ".ii";
+	}
+	return NULL;
+}
+
+static const char* executer_preprocessed_cstr(Executer* e, Job* job) {
+	StringBuilder sb = {0};
+	StringView output = path_get(job->target->output);
+	const char* ext = executer_preprocessed_ext(job);
+	da_append_many_arena(e->arena, &sb, output.items, output.count);
+	da_append_many_arena(e->arena, &sb, ext, strlen(ext) + 1);
+	return sb.items;
+}
+
+// the compile command with the source swapped for the preprocessed file that was
+// hashed, so the object always matches its key even if the source or a header
+// changes in between. the preprocessor already wrote the depfile.
+static Cmd executer_compile_preprocessed_cmd(Executer* e, Job* job, const char* preprocessed) {
+	const char* input = path_get(job->target->input).items;
+	Cmd cmd = {0};
+	da_reserve_arena(e->arena, &cmd, job->cmd.count + 1);
+	for (size_t i = 0; i < job->cmd.count; ++i) {
+		const char* arg = job->cmd.items[i];
+		if (arg == input) {
+			arg = preprocessed;
+		} else if (job->target->depfile != PATH_NONE && strcmp(arg, "-MMD") == 0
+			&& i + 2 < job->cmd.count && strcmp(job->cmd.items[i + 1], "-MF") == 0) {
+			i += 2;
+			continue;
+		}
+		cmd.items[cmd.count++] = arg;
+	}
+	cmd.items[cmd.count] = NULL;
+	return cmd;
+}
+
+static void executer_start_job(Executer* e, size_t index) {
+	Job* job = &e->jobs.items[index];
+	assert(e->free_slots.count > 0);
+	job->slot = e->free_slots.items[--e->free_slots.count];
+	e->slot_jobs[job->slot] = index;
+	job->start_time = trace_now();
+	job->started = stats_clock();
+	job->usage = (CommandUsage){0};
+	job->cacheable = false;
+	job->cmd = target_generate_cmd(e->arena, job->bc, job->target);
+	StringBuilder sb = target_generate_cmdline(e->arena, job->bc, job->target);
+	job->command_hash = hash_bytes(sb.items, sb.count, HASH_SEED);
+	job->cmdline = (StringView){ .items = sb.items, .count = sb.count };
+	if (e->verbose > 0) {
+		executer_clear_status(e);
+		printf("$ %.*s\n", (int)sb.count, sb.items);
+		fflush(stdout);
+	} else if (e->progress) {
+		executer_show_status(e, job);
+	}
+
+	if (job->cmd.count == 0) {
+		executer_finish_job(e, index, -1);
+		return;
 	}
 
-	if (callee.method_type == METHOD_ECHO) {
-		SymbolValue arg = interpreter_evaluate(in, e->args[0]);
-		printf("%.*s\n",(int)arg.string.count, arg.string.items);
+	// only compilers that understand -E and -MMD can be cached
+	if (e->cache && job->bc->build_type == BUILD_OBJECT && build_command_supports_depfile(job->bc)
+		&& executer_preprocessed_ext(job)) {
+		job->phase = JOB_PHASE_PREPROCESS;
+		executer_spawn(e, index, executer_preprocess_cmd(e, job->cmd, executer_preprocessed_cstr(e, job)));
+		return;
 	}
-	return nil;
+	job->phase = JOB_PHASE_COMPILE;
+	executer_spawn(e, index, job->cmd);
 }
 
+// the preprocessor also wrote the depfile, so a hit is a finished job.
+// on a miss or a preprocessor error the real compile runs and reports as usual.
+static void executer_finish_preprocess(Executer* e, size_t index, int exit_code) {
+	Job* job = &e->jobs.items[index];
+	const char* preprocessed = executer_preprocessed_cstr(e, job);
 
-SymbolValue interpreter_lookup_variable(Interpreter* in, StringView sv, Expression* e) {
-	SymbolValue val = {0};
-	val.string.items = sv.items;
-	val.string.count = sv.count;
-	val.type = SYMBOL_VALUE_STRING;
+	bool hit = false;
+	if (exit_code == 0 && compile_cache_key(e->cache, job->cmd, preprocessed, &job->cache_key)) {
+		job->cacheable = true;
+		hit = compile_cache_fetch(e->cache, job->cache_key, executer_output_cstr(job));
+	} else {
+		e->cache->misses++;
+	}
 
-	MethodType m = method_extract(sv);
-	if (m != METHOD_NONE) {
-		val.type = SYMBOL_VALUE_METHOD;
-		val.method_type = m;
+	if (hit) {
+		remove(preprocessed);
+		job->cached = true;
+		executer_finish_job(e, index, 0);
+		return;
+	}
+	job->phase = JOB_PHASE_COMPILE;
+	if (job->cacheable) {
+		executer_spawn(e, index, executer_compile_preprocessed_cmd(e, job, preprocessed));
+		return;
 	}
+	remove(preprocessed);
+	executer_spawn(e, index, job->cmd);
+}
 
-	return val;
+static void executer_job_exited(Executer* e, size_t index, int exit_code) {
+	Job* job = &e->jobs.items[index];
+	if (job->cancelled) {
+		executer_release_slot(e, job, exit_code);
+		job->output = (StringBuilder){0};
+		// whatever it left behind was built from stale inputs
+		if (job->phase == JOB_PHASE_PREPROCESS || job->cacheable) {
+			remove(executer_preprocessed_cstr(e, job));
+		}
+		remove(executer_output_cstr(job));
+		stat_cache_invalidate_id(job->target->output);
+		job->state = JOB_WAITING;
+		return;
+	}
+	if (job->phase == JOB_PHASE_PREPROCESS) {
+		executer_finish_preprocess(e, index, exit_code);
+	} else {
+		if (job->cacheable) {
+			remove(executer_preprocessed_cstr(e, job));
+		}
+		executer_finish_job(e, index, exit_code);
+	}
 }
 
+#ifndef _WIN32
+inline static uint64_t timeval_us(struct timeval tv) {
+	return (uint64_t)tv.tv_sec * 1000000ull + (uint64_t)tv.tv_usec;
+}
+
+// reads what the job printed so far, the pipe is closed once it hits the end
+static void executer_read_output(Executer* e, Job* job) {
+	char buffer[4096];
+	while (job->output_fd >= 0) {
+		ssize_t n = read(job->output_fd, buffer, sizeof(buffer));
+		if (n > 0) {
+			da_append_many_arena(e->arena, &job->output, buffer, (size_t)n);
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			if (n == 0 || errno != EAGAIN) {
+				close(job->output_fd);
+				job->output_fd = -1;
+			}
+			return;
+		}
+	}
+}
 
+static void executer_reap(Executer* e, pid_t pid, int status, struct rusage* ru) {
+	for (size_t s = 0; s < e->max_jobs; ++s) {
+		size_t i = e->slot_jobs[s];
+		if (i == SIZE_MAX) continue;
+		Job* job = &e->jobs.items[i];
+		if (job->state != JOB_RUNNING || job->pid != (long)pid) continue;
+		e->running--;
 
+		// whatever is left, a process it started may still hold the pipe open
+		executer_read_output(e, job);
+		if (job->output_fd >= 0) {
+			close(job->output_fd);
+			job->output_fd = -1;
+		}
 
+		job->usage.user += timeval_us(ru->ru_utime);
+		job->usage.system += timeval_us(ru->ru_stime);
+#ifdef __APPLE__
+		uint64_t max_rss = (uint64_t)ru->ru_maxrss / 1024;
+#else
+		uint64_t max_rss = (uint64_t)ru->ru_maxrss;
+#endif
+		if (max_rss > job->usage.max_rss) job->usage.max_rss = max_rss;
 
-#include <stdio.h>
-#include <string.h>
-#include <unistd.h>
+		int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		executer_job_exited(e, i, exit_code);
+		return;
+	}
+}
 
-#define CMD_LINE_MAX 2000
+// SIGCHLD is turned into a readable pipe, so exits can be polled next to the
+// outputs of the running jobs and watch_fd
+static int executer_sigchld_pipe[2] = { -1, -1 };
 
-static inline int execute_line(const char* line) {
-#ifdef _WIN32
-		char full_command[CMD_LINE_MAX + 16];
-		snprintf(full_command, sizeof(full_command), "cmd /C \"%s\"", line);
-		return system(full_command);
-#else
-	return system(line);
-#endif
+static void executer_on_sigchld(int sig) {
+	(void)sig;
+	int saved = errno;
+	char c = 0;
+	ssize_t n = write(executer_sigchld_pipe[1], &c, 1);
+	(void)n;
+	errno = saved;
 }
 
-Executer executer_new(Arena* arena) {
-	Executer e = {0};
-	e.arena = arena;
-	return e;
+// in watch mode SIGINT and SIGTERM are written to the same pipe, so the build or
+// the wait for changes wakes up and cook can stop and clean up normally
+static volatile sig_atomic_t executer_stop_signal = 0;
+
+static void executer_on_stop(int sig) {
+	executer_stop_signal = sig;
+	executer_on_sigchld(sig);
 }
 
-void execute_build_command(Executer* e, BuildCommand* bc, bool execute_lines) {
-	if (!bc || !bc->dirty) {
-		return;
+static bool executer_sigchld_open(void) {
+	if (executer_sigchld_pipe[0] >= 0) return true;
+	if (pipe(executer_sigchld_pipe) != 0) {
+		fprintf(stderr, "[ERROR][executer] pipe failed: %s\n", strerror(errno));
+		return false;
 	}
+	for (int i = 0; i < 2; ++i) {
+		fcntl(executer_sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+		fcntl(executer_sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	struct sigaction sa = {0};
+	sa.sa_handler = executer_on_sigchld;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+	return true;
+}
 
-	// create output dir
-	if (execute_lines) {
-		StringBuilder sb = {0};
-		da_append_many(&sb, bc->output_dir.items, bc->output_dir.count);
-		da_append(&sb,'\0');
-		if (access(sb.items, F_OK) != 0) {
-			MKDIR(sb.items);
+// waits until a job exits, a job prints something or, with `watch`, watch_fd changes.
+// while the load controller holds jobs back, it also wakes up to sample again.
+static void executer_wait(Executer* e, bool watch) {
+	struct pollfd* fds = e->pollfds;
+	fds[0] = (struct pollfd){ .fd = executer_sigchld_pipe[0], .events = POLLIN };
+	fds[1] = (struct pollfd){ .fd = watch ? e->watch_fd : -1, .events = POLLIN };
+	for (size_t s = 0; s < e->max_jobs; ++s) {
+		size_t i = e->slot_jobs[s];
+		int fd = i == SIZE_MAX ? -1 : e->jobs.items[i].output_fd;
+		fds[2 + s] = (struct pollfd){ .fd = fd, .events = POLLIN };
+	}
+
+	// jobs are ready but the load limit keeps them waiting, wake up to sample again
+	bool held_back = (e->keep_going || !e->failed) && e->ready.count > 0 && e->running >= e->load.limit;
+	int timeout = held_back ? LOAD_SAMPLE_INTERVAL_MS : -1;
+	if (poll(fds, (nfds_t)(e->max_jobs + 2), timeout) < 0) {
+		if (errno == EINTR) return;
+		fprintf(stderr, "[ERROR][executer] poll failed: %s\n", strerror(errno));
+		e->running = 0;
+		e->failed = true;
+		return;
+	}
+	for (size_t s = 0; s < e->max_jobs; ++s) {
+		if (fds[2 + s].revents != 0) {
+			executer_read_output(e, &e->jobs.items[e->slot_jobs[s]]);
 		}
-		free(sb.items);
 	}
-
-	for (size_t i = 0; i < bc->children.count; ++i) {
-		execute_build_command(e, bc->children.items[i], execute_lines);
+	if (fds[0].revents & POLLIN) {
+		char buffer[64];
+		while (read(executer_sigchld_pipe[0], buffer, sizeof(buffer)) > 0) {}
+		int status = 0;
+		struct rusage ru = {0};
+		pid_t pid;
+		while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+			executer_reap(e, pid, status, &ru);
+		}
+		if (executer_stop_signal) {
+			e->interrupted = true;
+		}
 	}
-
-	bool already_executed = false;
-	for (size_t b = 0; b < e->executed.count; ++b) {
-		if (build_command_is_same(bc, e->executed.items[b])) already_executed = true;
+	if ((fds[1].revents & POLLIN) && e->watch_changed(e->watch_ctx)) {
+		e->interrupted = true;
 	}
-	if (already_executed) return;
-	da_append(&e->executed, bc);
+}
+#endif
 
-	
-	for (size_t i = 0; i < bc->targets.count; ++i) {
-		Target* t = &bc->targets.items[i];
-		if (!t->dirty) continue;
+void executer_watch(Executer* e, int fd, bool (*changed)(void* ctx), void* ctx) {
+#ifdef _WIN32
+	(void)e; (void)fd; (void)changed; (void)ctx;
+#else
+	if (!executer_sigchld_open()) return;
+	e->watch_fd = fd;
+	e->watch_changed = changed;
+	e->watch_ctx = ctx;
+
+	struct sigaction sa = {0};
+	sa.sa_handler = executer_on_stop;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+#endif
+}
 
-		bool already_built = false;
-		for (size_t b = 0; b < e->built.count; ++b) {
-			if (target_is_same(t, e->built.items[b])) already_built = true;
-		}
-		if (already_built) continue;
-		da_append(&e->built, t);
+bool executer_stopped(void) {
+#ifdef _WIN32
+	return false;
+#else
+	return executer_stop_signal != 0;
+#endif
+}
 
-		StringBuilder sb = target_generate_cmdline_cstr(e->arena, bc, t);
+int executer_signal_fd(void) {
+#ifdef _WIN32
+	return -1;
+#else
+	return executer_sigchld_pipe[0];
+#endif
+}
 
-		if (execute_lines) {
-			printf("$ %.*s\n", (int)sb.count, sb.items);
-			int ret = execute_line(sb.items);
-			if (ret != 0) break;
-		} else {
-			printf("%.*s\n", (int)sb.count, sb.items);
-		}
-	}
+void executer_cancel_job(Executer* e, size_t index) {
+	Job* job = &e->jobs.items[index];
+	if (job->state != JOB_RUNNING || job->cancelled) return;
+	job->cancelled = true;
+#ifndef _WIN32
+	pid_t pid = (pid_t)job->pid;
+	kill(executer_groups_jobs(e) ? -pid : pid, SIGTERM);
+#endif
 }
 
-void executer_dry_run(Executer* e, BuildCommand* root) {
-	e->built.count = 0;
-	e->executed.count = 0;
-	execute_build_command(e, root, false);
+void executer_drain(Executer* e) {
+#ifndef _WIN32
+	while (e->running > 0) {
+		executer_wait(e, false);
+	}
+#else
+	(void)e;
+#endif
 }
 
-void executer_execute(Executer* e, BuildCommand* root) {
+static void executer_reset(Executer* e) {
 	e->built.count = 0;
 	e->executed.count = 0;
-	execute_build_command(e, root, true);
+	e->jobs.count = 0;
+	// these live in the arena, which --watch cleans between builds
+	e->executed_set = (FingerprintSet){0};
+	e->built_set = (FingerprintSet){0};
+	e->responses = (ResponseFileList){0};
+	e->response_set = (FingerprintSet){0};
+	e->ready = (JobIndexList){0};
+	e->free_slots = (JobIndexList){0};
+	e->running = 0;
+	e->failed = false;
+	e->failures = 0;
+	e->interrupted = false;
 }
 
+void executer_dry_run(Executer* e, BuildCommand* root) {
+	executer_reset(e);
+	JobIndexList frontier = {0};
+	executer_plan(e, root, &frontier, false);
 
+	for (size_t i = 0; i < e->jobs.count; ++i) {
+		Job* job = &e->jobs.items[i];
+		StringBuilder sb = target_generate_cmdline_cstr(e->arena, job->bc, job->target);
+		printf("%.*s\n", (int)sb.count, sb.items);
+	}
+}
 
+bool executer_execute(Executer* e, BuildCommand* root) {
+	executer_reset(e);
+	PhaseStart start = stats_phase_begin();
+	JobIndexList frontier = {0};
+	executer_plan(e, root, &frontier, true);
+	executer_prioritize(e);
+	stats_phase_end(PHASE_PLAN, start);
 
+	// popped from the back, slot 0 goes out first
+	e->slot_jobs = arena_alloc(e->arena, e->max_jobs * sizeof(*e->slot_jobs));
+	for (size_t s = e->max_jobs; s-- > 0;) {
+		da_append_arena(e->arena, &e->free_slots, s);
+		e->slot_jobs[s] = SIZE_MAX;
+	}
+#ifndef _WIN32
+	e->pollfds = arena_alloc(e->arena, (e->max_jobs + 2) * sizeof(*e->pollfds));
+	if (!executer_sigchld_open()) return false;
+#endif
+	e->total = e->jobs.count;
+	e->finished = 0;
+	e->status_shown = false;
+
+	start = stats_phase_begin();
+	for (size_t i = 0; i < e->jobs.count; ++i) {
+		if (e->jobs.items[i].pending == 0) {
+			executer_ready_push(e, i);
+		}
+	}
 
-#ifdef _WIN32
-	#include <windows.h>
-	#include <sys/types.h>
-	#include <sys/stat.h>
-#else
-	#include <sys/stat.h>
-	#include <time.h>
+	while (true) {
+		// without -k no new work is handed out after the first failure, the jobs
+		// that were running are killed and waited for
+		size_t limit = load_controller_update(&e->load);
+		while ((e->keep_going || !e->failed) && !e->interrupted
+			&& e->ready.count > 0 && e->running < limit) {
+			executer_start_job(e, executer_ready_pop(e));
+		}
+		if (e->running == 0 || e->interrupted) break;
+#ifndef _WIN32
+		executer_wait(e, e->watch_fd >= 0);
 #endif
+	}
 
-uint64_t get_modification_time(const char *path_cstr) {
+	stats_phase_end(PHASE_EXECUTE, start);
+	if (e->status_shown) {
+		printf("\n");
+		e->status_shown = false;
+	}
+	if (e->failed) {
+		size_t not_built = 0;
+		for (size_t i = 0; i < e->jobs.count; ++i) {
+			JobState state = e->jobs.items[i].state;
+			if (state != JOB_DONE && state != JOB_FAILED) not_built++;
+		}
+		fprintf(stderr, "[ERROR][executer] %zu command%s failed, %zu target%s not built%s\n",
+			e->failures, e->failures == 1 ? "" : "s", not_built, not_built == 1 ? "" : "s",
+			e->keep_going ? "" : ", use -k to build everything that doesn't depend on a failure");
+	}
+	return !e->failed && !e->interrupted;
+}
+
+
+FileState get_file_state(const char *path_cstr) {
+	FileState fs = {0};
+	stats.stat_calls++;
 #ifdef _WIN32
 	WIN32_FILE_ATTRIBUTE_DATA attr;
 	if (!GetFileAttributesExA(path_cstr, GetFileExInfoStandard, &attr)) {
-		return 0;
+		return fs;
 	}
 
 	FILETIME ft = attr.ftLastWriteTime;
@@ -2926,33 +7241,57 @@ uint64_t get_modification_time(const char *path_cstr) {
 	ull.LowPart  = ft.dwLowDateTime;
 	ull.HighPart = ft.dwHighDateTime;
 
-	return (ull.QuadPart - 116444736000000000ULL) / 10000000ULL;
+	// 100ns intervals since 1601
+	fs.mtime = (ull.QuadPart - 116444736000000000ULL) * 100ULL;
+	fs.size  = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
 #else
 	struct stat st;
 	if (stat(path_cstr, &st) != 0) {
-		return 0;
+		return fs;
 	}
-	return (uint64_t)st.st_mtime;
+#ifdef __APPLE__
+	fs.mtime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ULL + (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+	fs.mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+	fs.size  = (uint64_t)st.st_size;
+	fs.inode = (uint64_t)st.st_ino;
 #endif
+	return fs;
+}
+
+// in nanoseconds, 0 if the file does not exist
+uint64_t get_modification_time(const char *path_cstr) {
+	return get_file_state(path_cstr).mtime;
 }
 
 uint64_t get_modification_time_sv(StringView path) {
-	char buf[512];
-	assert(path.count < sizeof(buf));
-	memcpy(buf, path.items, path.count);
-	buf[path.count] = '\0';
-	return get_modification_time(buf);
+	return stat_cache_mtime(path);
 }
 
 
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct CookOptions {
 	StringView source;
+	const char* cookfile;  // where source was read from
 	int verbose;
 	bool dry_run;
 	bool build_all;
+	bool stats;
+	const char* stats_json; // --stats-json output file, NULL if not wanted
+	bool watch;
+	bool report;           // print what the build log knows instead of building
+	bool deps;             // print what the deps log knows instead of building
+	bool explain;          // print why each dirty target is dirty before building
+	bool keep_going;       // -k: build everything that doesn't depend on a failed command
+	const char* trace;     // --trace output file, NULL if not tracing
+	size_t jobs; // 0 means one per cpu cook may use, adjusted to the load while building
+	double max_load;       // -l: start fewer jobs while the load average is above it, 0 for no cap
+	StringView cache_dir;  // overrides cache() from the Cookfile
+	uint64_t cache_size;   // 0 means the Cookfile's or the default cap
 } CookOptions;
 
 static inline CookOptions cook_options_default(void) {
@@ -2960,6 +7299,18 @@ static inline CookOptions cook_options_default(void) {
 		.verbose = 0,
 		.dry_run = false,
 		.build_all = false,
+		.stats = false,
+		.stats_json = NULL,
+		.watch = false,
+		.report = false,
+		.deps = false,
+		.explain = false,
+		.keep_going = false,
+		.trace = NULL,
+		.jobs = 0,
+		.max_load = 0,
+		.cache_dir = {0},
+		.cache_size = 0,
 	};
 }
 
@@ -2967,16 +7318,34 @@ int cook(CookOptions op);
 
 
 
+// rows of each table of --report
+#define COOK_REPORT_COUNT 10
 
-
-
-
-
-
-
-
-int cook(CookOptions op) {
-	Lexer lexer = lexer_new(op.source);
+// --watch: for every file id of the watcher, the targets that are built from it
+typedef struct Dependents {
+	TargetRefList* items;
+	size_t count;
+	size_t capacity;
+} Dependents;
+
+// everything one evaluation of the Cookfile produces, --watch keeps it between builds
+typedef struct Cook {
+	CookOptions op;
+	StringBuilder source;  // the Cookfile as re-read by --watch
+	Lexer lexer;
+	Parser parser;
+	Constructor constructor;
+	BuildState state;
+	BuildCommand* root;
+	CompileCache cache;
+	Executer e;
+	Watcher* watcher;
+	Dependents dependents;
+} Cook;
+
+static void cook_load(Cook* c) {
+	CookOptions op = c->op;
+	c->lexer = lexer_new(op.source);
 
 	if (op.verbose > 3) {
 		printf("[file] dump:\n");
@@ -2984,53 +7353,332 @@ int cook(CookOptions op) {
 	}
 	if (op.verbose > 2) {
 		printf("[lexer] dump:\n");
-		lexer_dump(&lexer);
+		lexer_dump(&c->lexer);
 	}
 
-	Parser parser = parser_new(&lexer);
-	Statement* root_statement = parser_parse_all(&parser);
+	// the lexer runs on demand of the parser, so both are one phase
+	PhaseStart start = stats_phase_begin();
+	c->parser = parser_new(&c->lexer);
+	Statement* root_statement = parser_parse_all(&c->parser);
+	stats_phase_end(PHASE_PARSE, start);
 
 	if (op.verbose > 1) {
 		printf("[parser] dump:\n");
 		statement_print(root_statement, 1);
 	}
 
-	Constructor constructor = constructor_new(root_statement);
-	BuildCommand* root_build_command = constructor_construct_build_command(&constructor);
+	c->state = (BuildState){0};
+	c->constructor = constructor_new(root_statement);
+	c->constructor.state = &c->state;
+	c->root = constructor_construct_build_command(&c->constructor);
 
 	if (op.build_all) {
-		build_command_mark_all_children_dirty(root_build_command, true);
+		build_command_mark_all_children_dirty(c->root, true);
 	}
 
 	if (op.verbose > 0) {
 		printf("[cook] build command pretty:\n");
-		build_command_print(root_build_command, 0);
+		build_command_print(c->root, 0);
+	}
+
+	c->e = executer_new(NULL, op.jobs, op.max_load);
+	c->e.state = &c->state;
+	c->e.keep_going = op.keep_going;
+	c->e.verbose = op.verbose;
+
+	c->cache = (CompileCache){0};
+	StringView cache_dir = op.cache_dir.count > 0 ? op.cache_dir : c->constructor.cache_dir;
+	uint64_t cache_size = op.cache_size > 0 ? op.cache_size : c->constructor.cache_size;
+	if (!op.dry_run && cache_dir.count > 0 && compile_cache_open(&c->cache, cache_dir, cache_size)) {
+		c->e.cache = &c->cache;
+	}
+}
+
+static void cook_unload(Cook* c) {
+	compile_cache_close(&c->cache);
+	build_state_close(&c->state);
+	arena_free(&c->parser.arena);
+	intern_free(&c->parser.names);
+	arena_free(&c->constructor.arena);
+	arena_free(&c->constructor.scratch);
+	free(c->e.executed.items);
+	free(c->e.built.items);
+	free(c->e.jobs.items);
+}
+
+typedef bool (*InputVisitor)(Cook* c, BuildCommand* bc, Target* t, StringView path);
+
+// visits every file t is built from, stops as soon as visit returns true
+static bool cook_visit_inputs(Cook* c, BuildCommand* bc, Target* t, InputVisitor visit) {
+	if (visit(c, bc, t, path_get(t->input))) return true;
+	for (size_t i = 0; i < bc->input_files.count; ++i) {
+		if (visit(c, bc, t, bc->input_files.items[i])) return true;
+	}
+	if (t->header != PATH_NONE && visit(c, bc, t, path_get(t->header))) return true;
+
+	DepsRecord* record = deps_log_find(&c->state.deps, path_get(t->output));
+	for (uint32_t i = 0; record && i < record->count; ++i) {
+		if (visit(c, bc, t, intern_get(&c->state.deps.paths, record->inputs[i]))) return true;
+	}
+	return false;
+}
+
+static bool cook_input_changed(Cook* c, BuildCommand* bc, Target* t, StringView path) {
+	(void)bc; (void)t;
+	return watcher_changed(c->watcher, path);
+}
+
+static bool cook_watch_input(Cook* c, BuildCommand* bc, Target* t, StringView path) {
+	uint32_t id = watcher_add(c->watcher, path);
+	if (id == INTERN_NONE) return false;
+
+	while (c->dependents.count <= id) {
+		da_append(&c->dependents, (TargetRefList){0});
+	}
+	TargetRefList* refs = &c->dependents.items[id];
+	// the deps log lists the source again
+	if (refs->count > 0 && refs->items[refs->count - 1].target == t) return false;
+	da_append(refs, ((TargetRef){ .bc = bc, .target = t }));
+	return false;
+}
+
+static void cook_watch_targets(Cook* c, BuildCommand* bc) {
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		cook_visit_inputs(c, bc, &bc->targets.items[i], cook_watch_input);
+	}
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		cook_watch_targets(c, bc->children.items[i]);
+	}
+}
+
+// watches every input of the tree and indexes which targets read it
+static void cook_watch_tree(Cook* c, BuildCommand* root) {
+	for (size_t i = 0; i < c->dependents.count; ++i) {
+		c->dependents.items[i].count = 0;
+	}
+	cook_watch_targets(c, root);
+}
+
+static void cook_free_dependents(Cook* c) {
+	for (size_t i = 0; i < c->dependents.count; ++i) {
+		free(c->dependents.items[i].items);
+	}
+	free(c->dependents.items);
+	c->dependents = (Dependents){0};
+}
+
+// checks again only the targets that read one of the changed files
+static void cook_reanalyze(Cook* c) {
+	TargetRefList refs = {0};
+	for (size_t i = 0; i < c->watcher->changed.count; ++i) {
+		uint32_t id = intern_find(&c->watcher->files, c->watcher->changed.items[i]);
+		if (id >= c->dependents.count) continue;
+		TargetRefList* dependents = &c->dependents.items[id];
+		da_append_many(&refs, dependents->items, dependents->count);
+	}
+	constructor_reanalyze(&c->constructor, c->root, refs.items, refs.count);
+	free(refs.items);
+}
+
+// the targets whose jobs finished are up to date, failed and cancelled ones stay dirty
+static void cook_settle(Cook* c) {
+	for (size_t i = 0; i < c->e.jobs.count; ++i) {
+		Job* job = &c->e.jobs.items[i];
+		if (job->state != JOB_DONE) continue;
+		job->target->dirty = false;
+		job->target->cause = (DirtyCause){0};
+	}
+	constructor_settle(c->root);
+}
+
+static bool cook_watch_changed(void* ctx) {
+	return watcher_read((Watcher*)ctx);
+}
+
+// a change arrived mid build, the jobs that compile an old version of a changed
+// file are killed, the others are left to finish. a stop signal kills them all.
+static void cook_cancel_stale_jobs(Cook* c) {
+	for (size_t i = 0; i < c->watcher->changed.count; ++i) {
+		stat_cache_invalidate(c->watcher->changed.items[i]);
+	}
+	for (size_t i = 0; i < c->e.jobs.count; ++i) {
+		Job* job = &c->e.jobs.items[i];
+		if (job->state != JOB_RUNNING) continue;
+		if (executer_stopped() || cook_visit_inputs(c, job->bc, job->target, cook_input_changed)) {
+			executer_cancel_job(&c->e, i);
+		}
+	}
+	executer_drain(&c->e);
+}
+
+static bool cook_build(Cook* c) {
+	if (c->op.explain) {
+		build_command_explain(c->root, stdout);
 	}
 
-	Interpreter interpreter = interpreter_new(root_build_command);
+	PhaseStart start = stats_phase_begin();
+	Interpreter interpreter = interpreter_new(c->root);
 	interpreter_interpret(&interpreter);
+	stats_phase_end(PHASE_INTERPRET, start);
 
-	Executer e = executer_new(&interpreter.arena);
+	c->e.arena = &interpreter.arena;
+	bool success = true;
 
-	if (op.dry_run) {
-		if (op.verbose > 0) {
+	if (c->op.dry_run) {
+		if (c->op.verbose > 0) {
 			printf("[cook] build command dump:\n");
 		}
-		build_command_mark_all_children_dirty(root_build_command, true);
-		executer_dry_run(&e, root_build_command);
+		build_command_mark_all_children_dirty(c->root, true);
+		executer_dry_run(&c->e, c->root);
 	} else {
-		executer_execute(&e, root_build_command);
+		success = executer_execute(&c->e, c->root);
+		if (c->e.interrupted) {
+			start = stats_phase_begin();
+			cook_cancel_stale_jobs(c);
+			stats_phase_end(PHASE_EXECUTE, start);
+		}
+		if (c->watcher) {
+			cook_settle(c);
+		}
+
+		if (!c->e.interrupted && success) {
+			start = stats_phase_begin();
+			file_state_save(&c->state.files);
+			stats_phase_end(PHASE_SAVE_STATE, start);
+		}
 	}
+	trace_flush();
 
+	stats_arena("interpreter", &interpreter.arena);
+	c->e.arena = NULL;
 	arena_free(&interpreter.arena);
-	arena_free(&parser.arena);
-	arena_free(&constructor.arena);
-	free(e.executed.items);
-	free(e.built.items);
+	return success;
+}
+
+// takes what --stats needs from the parts that are about to be freed
+static void cook_collect_stats(Cook* c) {
+	stats_arena("parser", &c->parser.arena);
+	stats_arena("constructor", &c->constructor.arena);
+	stats_arena("analysis", &c->constructor.scratch);
+	stats_arena("deps log", &c->state.deps.arena);
+	stats_arena("deps paths", &c->state.deps.paths.arena);
+	stats_arena("build log", &c->state.log.outputs.arena);
+	stats_arena("file state", &c->state.files.paths.arena);
+	stats_arena("paths", path_arena());
+	StatCacheStats sc = stat_cache_stats();
+	stats.stat_cache_hits = sc.hits;
+	stats.stat_cache_misses = sc.misses;
+	stats.compile_cache_enabled = c->e.cache != NULL;
+	stats.compile_cache_hits = c->cache.hits;
+	stats.compile_cache_misses = c->cache.misses;
+}
+
+static void cook_report(Cook* c) {
+	if (c->op.stats) {
+		stats_print(stdout);
+	}
+	if (c->op.stats_json) {
+		stats_write_json(c->op.stats_json);
+	}
+}
+
+// keeps the graph in memory and builds again whenever one of its files changes.
+// a change to the Cookfile itself starts over from lexing it.
+static int cook_watch(Cook* c) {
+	Watcher w = {0};
+	if (!watcher_open(&w)) {
+		return 1;
+	}
+	c->watcher = &w;
+	StringView cookfile = { .items = c->op.cookfile, .count = strlen(c->op.cookfile) };
+
+	executer_watch(&c->e, w.fd, cook_watch_changed, &w);
+	watcher_add(&w, cookfile);
+	cook_watch_tree(c, c->root);
+	cook_build(c);
+	cook_collect_stats(c);
+	cook_report(c);
+
+	// SIGINT and SIGTERM end the loop, the caller cleans up as usual
+	while (!executer_stopped()) {
+		if (!c->e.interrupted) {
+			// the build may have come across new headers
+			cook_watch_tree(c, c->root);
+			printf("[watch] waiting for changes\n");
+			fflush(stdout);
+			bool changed = false;
+			while (!changed && !executer_stopped()) {
+				changed = watcher_wait(&w, executer_signal_fd(), -1);
+			}
+			if (!changed) break;
+		}
+
+		for (size_t i = 0; i < w.changed.count; ++i) {
+			printf("[watch] changed: %.*s\n", (int)w.changed.items[i].count, w.changed.items[i].items);
+			stat_cache_invalidate(w.changed.items[i]);
+		}
+
+		if (watcher_changed(&w, cookfile)) {
+			StringBuilder source = {0};
+			if (!read_entire_file(c->op.cookfile, &source)) {
+				watcher_clear(&w);
+				c->e.interrupted = false;
+				continue;
+			}
+			cook_unload(c);
+			sb_free(&c->source);
+			c->source = source;
+			c->op.source = sv_from_sb(c->source);
+			cook_load(c);
+			executer_watch(&c->e, w.fd, cook_watch_changed, &w);
+			cook_watch_tree(c, c->root);
+		} else {
+			cook_reanalyze(c);
+		}
+
+		watcher_clear(&w);
+		cook_build(c);
+		cook_collect_stats(c);
+		cook_report(c);
+	}
+
+	cook_free_dependents(c);
+	watcher_close(&w);
+	c->watcher = NULL;
 	return 0;
 }
 
+int cook(CookOptions op) {
+	if (op.trace && !trace_open(op.trace)) {
+		return 1;
+	}
+
+	Cook c = { .op = op };
+	cook_load(&c);
+
+	int result = 0;
+	if (op.report) {
+		build_log_report(&c.state.log, stdout, COOK_REPORT_COUNT);
+	} else if (op.deps) {
+		deps_log_report(&c.state.deps, stdout);
+	} else if (op.watch && !op.dry_run) {
+		result = cook_watch(&c);
+	} else {
+		result = cook_build(&c) ? 0 : 1;
+	}
 
+	cook_collect_stats(&c);
+	PhaseStart start = stats_phase_begin();
+	cook_unload(&c);
+	sb_free(&c.source);
+	stat_cache_free();
+	path_pool_free();
+	stats_phase_end(PHASE_CLEANUP, start);
+
+	cook_report(&c);
+	trace_close();
+	return result;
+}
 
 #include <stdio.h>
 #include <unistd.h>
@@ -3041,11 +7689,24 @@ void print_usage(const char* pname) {
 		"usage: %s [options]\n"
 		"\n"
 		"options:\n"
-		"  -h, --help      show this help message\n"
-		"  -f <file>       use specified cookfile\n"
-		"  -B              unconditionally build all\n"
-		"  --verbose       verbose printing\n"
-		"  --dry-run       show the commands that would be run, but don't execute them\n",
+		"  -h, --help            show this help message\n"
+		"  -f <file>             use specified cookfile\n"
+		"  -B                    unconditionally build all\n"
+		"  -j <n>                run <n> jobs in parallel, defaults to the cpus cook may use\n"
+		"                        and follows the load of the machine while building\n"
+		"  -l <load>             start fewer jobs while the load average is above <load>\n"
+		"  -k                    keep going, build everything that doesn't depend on a failed command\n"
+		"  --verbose             verbose printing\n"
+		"  --dry-run             show the commands that would be run, but don't execute them\n"
+		"  --stats               print timings and counters of cook itself at exit\n"
+		"  --stats-json=<file>   write the same statistics to <file> as json\n"
+		"  --watch               stay running and build again whenever an input changes\n"
+		"  --explain             print why each target that gets built is out of date\n"
+		"  --report              list the slowest and most memory hungry targets of past builds\n"
+		"  --deps                list the headers each object depended on when it was last built\n"
+		"  --trace=<file>        write a chrome trace of cook's phases and commands to <file>\n"
+		"  --cache-dir <dir>     reuse object files from a compile cache in <dir>\n"
+		"  --cache-size <size>   cap the compile cache at <size> bytes, K, M or G suffix\n",
 		pname
 	);
 }
@@ -3082,10 +7743,78 @@ int main(int argc, char** argv) {
 				return 1;
 			}
 			filepath = shift(argv, argc);
+		} else if (strncmp(arg, "-j", 2) == 0) {
+			const char* n = arg + 2;
+			if (*n == '\0') {
+				if (argc == 0) {
+					fprintf(stderr, "[ERROR] expected a job count after -j\n");
+					print_usage(pname);
+					return 1;
+				}
+				n = shift(argv, argc);
+			}
+			int jobs = atoi(n);
+			if (jobs <= 0) {
+				fprintf(stderr, "[ERROR] invalid job count: %s\n", n);
+				return 1;
+			}
+			op.jobs = (size_t)jobs;
+		} else if (strncmp(arg, "-l", 2) == 0) {
+			const char* n = arg + 2;
+			if (*n == '\0') {
+				if (argc == 0) {
+					fprintf(stderr, "[ERROR] expected a load average after -l\n");
+					print_usage(pname);
+					return 1;
+				}
+				n = shift(argv, argc);
+			}
+			char* end = NULL;
+			double load = strtod(n, &end);
+			if (end == n || *end != '\0' || load <= 0) {
+				fprintf(stderr, "[ERROR] invalid load average: %s\n", n);
+				return 1;
+			}
+			op.max_load = load;
+		} else if (strcmp(arg, "-k") == 0) {
+			op.keep_going = true;
 		} else if (strcmp(arg, "-B") == 0) {
 			op.build_all = true;
 		} else if (strcmp(arg, "--dry-run") == 0) {
 			op.dry_run = true;
+		} else if (strcmp(arg, "--stats") == 0) {
+			op.stats = true;
+		} else if (strncmp(arg, "--stats-json=", 13) == 0 && arg[13] != '\0') {
+			op.stats_json = arg + 13;
+		} else if (strcmp(arg, "--watch") == 0) {
+			op.watch = true;
+		} else if (strcmp(arg, "--explain") == 0) {
+			op.explain = true;
+		} else if (strcmp(arg, "--report") == 0) {
+			op.report = true;
+		} else if (strcmp(arg, "--deps") == 0) {
+			op.deps = true;
+		} else if (strncmp(arg, "--trace=", 8) == 0 && arg[8] != '\0') {
+			op.trace = arg + 8;
+		} else if (strcmp(arg, "--cache-dir") == 0) {
+			if (argc == 0) {
+				fprintf(stderr, "[ERROR] expected a directory after --cache-dir\n");
+				print_usage(pname);
+				return 1;
+			}
+			const char* dir = shift(argv, argc);
+			op.cache_dir = (StringView){ .items = dir, .count = strlen(dir) };
+		} else if (strcmp(arg, "--cache-size") == 0) {
+			if (argc == 0) {
+				fprintf(stderr, "[ERROR] expected a size after --cache-size\n");
+				print_usage(pname);
+				return 1;
+			}
+			const char* size = shift(argv, argc);
+			if (!compile_cache_parse_size((StringView){ .items = size, .count = strlen(size) }, &op.cache_size)) {
+				fprintf(stderr, "[ERROR] invalid cache size: %s\n", size);
+				return 1;
+			}
 		} else if (strncmp(arg, "--verbose=", 10) == 0) {
 			op.verbose = arg[10] - '0';
 		} else if (strcmp(arg, "--verbose") == 0) {
@@ -3104,15 +7833,18 @@ int main(int argc, char** argv) {
 			return 1;
 		}
 		op.source = sv_from_sb(source);
+		op.cookfile = filepath;
 	} else if (access("./Cookfile", F_OK) == 0 && read_entire_file("./Cookfile", &source)) {
 		op.source = sv_from_sb(source);
+		op.cookfile = "./Cookfile";
 	} else {
 		print_usage(pname);
 		return 1;
 	}
 
-	bool result = cook(op);
+	int result = cook(op);
 
 	sb_free(&source);
 	return result;
 }
+
@@ -5,20 +5,65 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#if !defined(_WIN32) && !defined(ARENA_NO_MMAP)
+	#include <sys/mman.h>
+	#define ARENA_MMAP
+	// regions this big are mapped directly, the kernel hands out zeroed pages lazily
+	#define ARENA_MMAP_THRESHOLD (1024 * 1024)
+	#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
 Region *region_new(size_t capacity) {
 	const size_t region_size = sizeof(Region) + capacity;
+#ifdef ARENA_MMAP
+	if (region_size >= ARENA_MMAP_THRESHOLD) {
+		void *mem = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+			if (region_size >= ARENA_HUGE_PAGE_SIZE) {
+				madvise(mem, region_size, MADV_HUGEPAGE);
+			}
+#endif
+			Region *region = mem;
+			region->capacity = capacity;
+			region->mapped = 1;
+			return region;
+		}
+	}
+#endif
+	// allocations are zeroed one by one, so only the header needs it here
 	Region *region = malloc(region_size);
-	memset(region, 0, region_size);
+	assert(region != NULL);
+	memset(region, 0, sizeof(Region));
 	region->capacity = capacity;
 	return region;
 }
 
+static void region_free(Region *region) {
+#ifdef ARENA_MMAP
+	if (region->mapped) {
+		munmap(region, sizeof(Region) + region->capacity);
+		return;
+	}
+#endif
+	free(region);
+}
+
+static size_t arena_next_capacity(Arena *arena, size_t size) {
+	size_t capacity = ARENA_DEFAULT_CAPACITY;
+	if (arena->last && arena->last->capacity * 2 <= ARENA_MAX_REGION_CAPACITY) {
+		capacity = arena->last->capacity * 2;
+	} else if (arena->last) {
+		capacity = ARENA_MAX_REGION_CAPACITY;
+	}
+	return size > capacity ? size : capacity;
+}
+
 void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 	if (arena->last == NULL) {
 		assert(arena->first == NULL);
 
-		Region *region = region_new(
-			size > ARENA_DEFAULT_CAPACITY ? size : ARENA_DEFAULT_CAPACITY);
+		Region *region = region_new(arena_next_capacity(arena, size));
 
 		arena->last = region;
 		arena->first = region;
@@ -32,6 +77,7 @@ void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 
 	// alignment must be a power of two.
 	assert((alignment & (alignment - 1)) == 0);
+	arena->requested += size;
 
 	Region *cur = arena->last;
 	while (true) {
@@ -41,7 +87,10 @@ void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 
 		if (cur->size + real_size > cur->capacity) {
 			if (cur->next) {
+				// left over by arena_clean or arena_restore, reuse it
 				cur = cur->next;
+				cur->size = 0;
+				arena->last = cur;
 				continue;
 			} else {
 				// out of space, make a new one. even though we are making a new region, there
@@ -49,9 +98,7 @@ void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 				// so, allocate enough extra bytes to fix the 'worst case' alignment.
 				size_t worst_case = size + (alignment - 1);
 
-				Region *region = region_new(worst_case > ARENA_DEFAULT_CAPACITY
-								   ? worst_case
-								   : ARENA_DEFAULT_CAPACITY);
+				Region *region = region_new(arena_next_capacity(arena, worst_case));
 
 				arena->last->next = region;
 				arena->last = region;
@@ -76,22 +123,49 @@ void *arena_alloc(Arena *arena, size_t size) {
 }
 
 void *arena_realloc(Arena *arena, void *old_ptr, size_t old_size, size_t new_size) {
-	if (old_size < new_size) {
-		void *new_ptr = arena_alloc(arena, new_size);
-		memcpy(new_ptr, old_ptr, old_size);
-		return new_ptr;
-	} else {
+	if (old_size >= new_size) {
 		return old_ptr;
 	}
+
+	// the last allocation of the current region grows in place, like a doubling da
+	Region *cur = arena->last;
+	if (old_ptr && cur && (char*)old_ptr + old_size == cur->buffer + cur->size
+		&& cur->size + (new_size - old_size) <= cur->capacity) {
+		memset(cur->buffer + cur->size, 0, new_size - old_size);
+		cur->size += new_size - old_size;
+		arena->requested += new_size - old_size;
+		return old_ptr;
+	}
+
+	void *new_ptr = arena_alloc(arena, new_size);
+	if (old_size > 0) {
+		memcpy(new_ptr, old_ptr, old_size);
+	}
+	arena->abandoned += old_size;
+	return new_ptr;
 }
 
-void arena_clean(Arena *arena) {
-	for (Region *iter = arena->first;
-	iter != NULL;
-	iter = iter->next) {
-		iter->size = 0;
+ArenaMark arena_save(Arena *arena) {
+	return (ArenaMark){
+		.region = arena->last,
+		.size = arena->last ? arena->last->size : 0,
+	};
+}
+
+// the regions after the mark stay around and are reused by the next allocations
+void arena_restore(Arena *arena, ArenaMark mark) {
+	if (mark.region == NULL) {
+		arena_clean(arena);
+		return;
 	}
+	mark.region->size = mark.size;
+	arena->last = mark.region;
+}
 
+void arena_clean(Arena *arena) {
+	if (arena->first) {
+		arena->first->size = 0;
+	}
 	arena->last = arena->first;
 }
 
@@ -99,23 +173,24 @@ void arena_free(Arena *arena) {
 	Region *iter = arena->first;
 	while (iter != NULL) {
 		Region *next = iter->next;
-		free(iter);
+		region_free(iter);
 		iter = next;
 	}
-	arena->first = NULL;
-	arena->last = NULL;
+	*arena = (Arena){0};
 }
 
-void arena_summary(Arena *arena) {
-	if (arena->first == NULL) {
-		printf("[empty]");
+ArenaSummary arena_summary(Arena *arena) {
+	ArenaSummary summary = {
+		.requested = arena->requested,
+		.abandoned = arena->abandoned,
+	};
+	bool in_use = arena->last != NULL;
+	for (Region *iter = arena->first; iter != NULL; iter = iter->next) {
+		// regions after last only hold what a clean or restore released
+		if (in_use) summary.used += iter->size;
+		if (iter == arena->last) in_use = false;
+		summary.capacity += iter->capacity;
+		summary.regions++;
 	}
-
-	for (Region *iter = arena->first;
-	iter != NULL;
-	iter = iter->next) {
-		printf("[%zu/%zu] -> ", iter->size, iter->capacity);
-	}
-	printf("\n");
+	return summary;
 }
-
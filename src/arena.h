@@ -8,22 +8,43 @@ typedef struct Region {
 	struct Region *next;
 	size_t capacity;
 	size_t size;
+	int mapped;        // allocated with mmap instead of malloc
 	char buffer[];
 } Region;
 
 Region *region_new(size_t capacity);
 
 #define ARENA_DEFAULT_CAPACITY (640 * 1000)
+// every new region doubles the last one up to this, so big graphs don't end up
+// with thousands of small regions and can use huge pages
+#define ARENA_MAX_REGION_CAPACITY (64 * 1024 * 1024)
 
 typedef struct {
     Region *first;
     Region *last;
+    size_t requested;  // bytes asked for over the arena's lifetime
+    size_t abandoned;  // bytes left behind by arena_realloc moving an allocation
 } Arena;
 
+// a position to go back to, everything allocated after it is released at once
+typedef struct ArenaMark {
+	Region *region;
+	size_t size;
+} ArenaMark;
+
+typedef struct ArenaSummary {
+	size_t used;
+	size_t capacity;
+	size_t requested;
+	size_t abandoned;
+	size_t regions;
+} ArenaSummary;
+
 void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment);
 void *arena_alloc(Arena *arena, size_t size);
 void *arena_realloc(Arena *arena, void *old_ptr, size_t old_size, size_t new_size);
+ArenaMark arena_save(Arena *arena);
+void arena_restore(Arena *arena, ArenaMark mark);
 void arena_clean(Arena *arena);
 void arena_free(Arena *arena);
-void arena_summary(Arena *arena);
-
+ArenaSummary arena_summary(Arena *arena);
@@ -1,16 +1,21 @@
 #include "build_command.h"
 #include "da.h"
+#include "hash.h"
+#include "stats.h"
+#include <ctype.h>
+#include <time.h>
 
 #define INDENT_MULTIPLIER 4
 
 BuildCommand* build_command_new(Arena* arena) {
 	BuildCommand* bc = (BuildCommand*)arena_alloc(arena, sizeof(BuildCommand));
 	*bc = build_command_default();
+	stats.build_commands++;
 	return bc;
 }
 
 BuildCommand build_command_default(void) {
-	static const StringView cc = { .items = "cc", .count = 3 };
+	static const StringView cc = { .items = "cc", .count = 2 };
 
 	BuildCommand bc = {0};
 	bc.compiler = cc;
@@ -26,11 +31,11 @@ BuildCommand* build_command_inherit(Arena* arena, BuildCommand* parent) {
 
 	bc->parent = parent;
 	bc->compiler = parent->compiler;
-	bc->include_dirs = parent->include_dirs;
-	bc->library_dirs = parent->library_dirs;
-	bc->library_links = parent->library_links;
-	bc->cflags = parent->cflags;
-	bc->ldflags = parent->ldflags;
+	bc->include_dirs = option_list_inherit(&parent->include_dirs);
+	bc->library_dirs = option_list_inherit(&parent->library_dirs);
+	bc->library_links = option_list_inherit(&parent->library_links);
+	bc->cflags = option_list_inherit(&parent->cflags);
+	bc->ldflags = option_list_inherit(&parent->ldflags);
 	bc->source_dir = parent->source_dir;
 	bc->output_dir = parent->output_dir;
 
@@ -63,6 +68,20 @@ inline static void string_list_print_big(int indent, const char* label, const St
 	printf("\n");
 }
 
+inline static void option_list_print_big(int indent, const char* label, const OptionList* list) {
+	if (list->count == 0) return;
+
+	indent_label(indent, label);
+	for (size_t i = 0; i < list->count; ++i) {
+		StringView sv = option_list_at(list, i);
+		printf("%.*s", (int)sv.count, sv.items);
+		if (i + 1 < list->count) {
+			printf(", ");
+		}
+	}
+	printf("\n");
+}
+
 inline static void target_list_print_pretty(size_t indent, TargetList list) {
 	if (list.count == 0) return;
 
@@ -72,8 +91,9 @@ inline static void target_list_print_pretty(size_t indent, TargetList list) {
 	for (size_t i = 0; i <  list.count; ++i) {
 		Target* t = &list.items[i];
 		indent_label_sv(indent+1, t->name);
-		printf("input: %-25.*s ", (int)t->input_name.count, t->input_name.items);
-		printf("output: %-25.*s ", (int)t->output_name.count, t->output_name.items);
+		StringView input = path_get(t->input), output = path_get(t->output);
+		printf("input: %-25.*s ", (int)input.count, input.items);
+		printf("output: %-25.*s ", (int)output.count, output.items);
 		if (t->dirty) printf("[dirty]");
 		printf("\n");
 	}
@@ -102,12 +122,12 @@ void build_command_print(BuildCommand* bc, size_t indent) {
 	target_list_print_pretty(ni, bc->targets);
 	string_list_print_big(ni, "input files", &bc->input_files);
 	string_list_print_big(ni, "input objects", &bc->input_objects);
-	string_list_print_big(ni, "include dirs", &bc->include_dirs);
+	option_list_print_big(ni, "include dirs", &bc->include_dirs);
 	string_list_print_big(ni, "include files", &bc->include_files);
-	string_list_print_big(ni, "library dirs", &bc->library_dirs);
-	string_list_print_big(ni, "library links", &bc->library_links);
-	string_list_print_big(ni, "cflags", &bc->cflags);
-	string_list_print_big(ni, "ldflags", &bc->ldflags);
+	option_list_print_big(ni, "library dirs", &bc->library_dirs);
+	option_list_print_big(ni, "library links", &bc->library_links);
+	option_list_print_big(ni, "cflags", &bc->cflags);
+	option_list_print_big(ni, "ldflags", &bc->ldflags);
 
 	if (bc->source_dir.count > 0) {
 		indent_label(ni, "source dir");
@@ -131,6 +151,77 @@ void build_command_print(BuildCommand* bc, size_t indent) {
 
 
 
+// local time with nanoseconds, mtimes that differ by less than a second are common
+static void explain_time(FILE* stream, uint64_t ns) {
+	time_t seconds = (time_t)(ns / 1000000000ull);
+	struct tm* tm = localtime(&seconds);
+	char buffer[32] = "?";
+	if (tm) strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", tm);
+	fprintf(stream, "%s.%09llu", buffer, (unsigned long long)(ns % 1000000000ull));
+}
+
+static void explain_build_command(FILE* stream, BuildCommand* bc) {
+	StringView name = bc->targets.count > 0 ? bc->targets.items[0].name : (StringView){0};
+	if (bc->marked_dirty_explicitly) {
+		fprintf(stream, "dirty() in build(%.*s)\n", (int)name.count, name.items);
+	} else {
+		fprintf(stream, "build(%.*s) is dirty\n", (int)name.count, name.items);
+	}
+}
+
+static void explain_target(FILE* stream, Target* t) {
+	StringView output = path_get(t->output);
+	fprintf(stream, "[explain] %.*s: ", (int)output.count, output.items);
+
+	// the chain of targets the dirtiness came up through, down to what started it
+	DirtyCause* cause = &t->cause;
+	while (cause->reason == DIRTY_CHILD && cause->from_target) {
+		Target* from = cause->from_target;
+		StringView from_output = path_get(from->output);
+		fprintf(stream, "needs %.*s <- ", (int)from_output.count, from_output.items);
+		cause = &from->cause;
+	}
+
+	switch (cause->reason) {
+		case DIRTY_NONE:
+			fprintf(stream, "marked dirty\n");
+			break;
+		case DIRTY_OUTPUT_MISSING:
+			fprintf(stream, "output does not exist\n");
+			break;
+		case DIRTY_INPUT_CHANGED:
+			fprintf(stream, "%s changed, mtime ", path_get(cause->input).items);
+			explain_time(stream, cause->input_time);
+			fprintf(stream, ", output mtime ");
+			explain_time(stream, cause->output_time);
+			fprintf(stream, "\n");
+			break;
+		case DIRTY_DEPS_UNKNOWN:
+			fprintf(stream, "no recorded header dependencies\n");
+			break;
+		case DIRTY_COMMAND_CHANGED:
+			fprintf(stream, "command line differs from the one in the build log\n");
+			break;
+		case DIRTY_CHILD:
+			explain_build_command(stream, cause->from);
+			break;
+		case DIRTY_FORCED:
+			fprintf(stream, "building all (-B)\n");
+			break;
+	}
+}
+
+// prints why every dirty target is dirty, for --explain
+void build_command_explain(BuildCommand* bc, FILE* stream) {
+	if (!bc || !bc->dirty) return;
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		build_command_explain(bc->children.items[i], stream);
+	}
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		if (bc->targets.items[i].dirty) explain_target(stream, &bc->targets.items[i]);
+	}
+}
+
 void build_command_dump(Arena* arena, BuildCommand* bc, FILE* stream, size_t target_to_build) {
 	if (!bc || !bc->dirty) {
 		return;
@@ -181,7 +272,13 @@ void build_type_print(BuildType type) {
 void build_command_mark_all_targets_dirty(BuildCommand* bc, bool dirty) {
 	if (!bc || (bc->marked_clean_explicitly==dirty)) return;
 	for (size_t i = 0; i < bc->targets.count; ++i) {
-		bc->targets.items[i].dirty = dirty;
+		Target* t = &bc->targets.items[i];
+		t->dirty = dirty;
+		if (!dirty) {
+			t->cause = (DirtyCause){0};
+		} else if (t->cause.reason == DIRTY_NONE) {
+			t->cause.reason = DIRTY_FORCED;
+		}
 	}
 }
 void build_command_mark_all_children_dirty(BuildCommand* bc, bool dirty) {
@@ -193,12 +290,52 @@ void build_command_mark_all_children_dirty(BuildCommand* bc, bool dirty) {
 	}
 }
 
-bool bc_string_view_same(StringView* a, StringView* b) {
-	if (a->count != b->count) return false;
-	if (strncmp(a->items, b->items, a->count) != 0) return false;
+inline static bool compiler_is_version(const char* s, size_t count) {
+	if (count == 0) return false;
+	for (size_t i = 0; i < count; ++i) {
+		if (!isdigit((unsigned char)s[i]) && s[i] != '.') return false;
+	}
 	return true;
 }
-bool bc_string_builder_same(StringBuilder* a, StringBuilder* b) {
+
+StringView build_command_compiler_family(BuildCommand* bc) {
+	static const char* families[] = { "cc", "gcc", "g++", "c++", "clang", "clang++" };
+	StringView name = bc->compiler;
+	for (size_t i = name.count; i > 0; --i) {
+		if (name.items[i - 1] == '/' || name.items[i - 1] == '\\') {
+			name.items += i;
+			name.count -= i;
+			break;
+		}
+	}
+	if (name.count > 4 && strncmp(name.items + name.count - 4, ".exe", 4) == 0) {
+		name.count -= 4;
+	}
+
+	// the family is one of the dash separated parts, only version numbers may follow it
+	size_t end = name.count;
+	for (size_t i = name.count; ; --i) {
+		if (i > 0 && name.items[i - 1] != '-') continue;
+
+		const char* part = name.items + i;
+		size_t count = end - i;
+		for (size_t f = 0; f < sizeof(families)/sizeof(families[0]); ++f) {
+			if (count == strlen(families[f]) && strncmp(part, families[f], count) == 0) {
+				return (StringView){ .items = families[f], .count = count };
+			}
+		}
+		if (i == 0 || !compiler_is_version(part, count)) break;
+		end = i - 1;
+	}
+	return (StringView){0};
+}
+
+// compilers that understand `-MMD -MF <file>`
+bool build_command_supports_depfile(BuildCommand* bc) {
+	return build_command_compiler_family(bc).count > 0;
+}
+
+bool bc_string_view_same(StringView* a, StringView* b) {
 	if (a->count != b->count) return false;
 	if (strncmp(a->items, b->items, a->count) != 0) return false;
 	return true;
@@ -212,17 +349,89 @@ bool bc_string_list_same(StringList* a, StringList* b) {
 }
 
 
+// the length goes first, so ("ab", "c") and ("a", "bc") differ
+inline static uint64_t fingerprint_bytes(uint64_t h, const char* items, size_t count) {
+	h = hash_bytes(&count, sizeof(count), h);
+	return hash_bytes(items, count, h);
+}
+
+inline static uint64_t fingerprint_list(uint64_t h, StringList* list) {
+	h = hash_bytes(&list->count, sizeof(list->count), h);
+	for (size_t i = 0; i < list->count; ++i) {
+		h = fingerprint_bytes(h, list->items[i].items, list->items[i].count);
+	}
+	return h;
+}
+
+inline static uint64_t fingerprint_options(uint64_t h, OptionList* list) {
+	h = hash_bytes(&list->count, sizeof(list->count), h);
+	for (size_t i = 0; i < list->count; ++i) {
+		StringView sv = option_list_at(list, i);
+		h = fingerprint_bytes(h, sv.items, sv.count);
+	}
+	return h;
+}
+
+static uint64_t target_fingerprint(Target* t) {
+	uint64_t h = HASH_SEED;
+	h = fingerprint_bytes(h, t->name.items, t->name.count);
+	// equal paths have equal ids
+	h = hash_bytes(&t->input,  sizeof(PathId), h);
+	h = hash_bytes(&t->output, sizeof(PathId), h);
+	h = hash_bytes(&t->header, sizeof(PathId), h);
+	return h;
+}
+
+void build_command_prepare_cmd(Arena* arena, BuildCommand* bc) {
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		build_command_prepare_cmd(arena, bc->children.items[i]);
+	}
+	if (bc->targets.count > 0) {
+		bc->cmd = cmd_template_new(arena, bc);
+	}
+}
+
+void build_command_fingerprint(BuildCommand* bc) {
+	uint64_t h = HASH_SEED;
+	h = hash_bytes(&bc->children.count, sizeof(bc->children.count), h);
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		build_command_fingerprint(bc->children.items[i]);
+		h = hash_bytes(&bc->children.items[i]->fingerprint, sizeof(uint64_t), h);
+	}
+
+	h = hash_bytes(&bc->build_type, sizeof(bc->build_type), h);
+	h = hash_bytes(&bc->targets.count, sizeof(bc->targets.count), h);
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		Target* t = &bc->targets.items[i];
+		t->fingerprint = target_fingerprint(t);
+		h = hash_bytes(&t->fingerprint, sizeof(uint64_t), h);
+	}
+
+	h = fingerprint_bytes(h, bc->compiler.items,   bc->compiler.count);
+	h = fingerprint_bytes(h, bc->source_dir.items, bc->source_dir.count);
+	h = fingerprint_bytes(h, bc->output_dir.items, bc->output_dir.count);
+	h = fingerprint_list(h, &bc->input_files);
+	h = fingerprint_list(h, &bc->input_objects);
+	h = fingerprint_options(h, &bc->include_dirs);
+	h = fingerprint_list(h, &bc->include_files);
+	h = fingerprint_options(h, &bc->library_dirs);
+	h = fingerprint_options(h, &bc->library_links);
+	h = fingerprint_options(h, &bc->cflags);
+	h = fingerprint_options(h, &bc->ldflags);
+	bc->fingerprint = h;
+}
+
 bool target_is_same(Target* a, Target* b) {
+	if (a->fingerprint != b->fingerprint) return false;
 	if (!bc_string_view_same(&a->name, &b->name)) return false;
-	if (!bc_string_builder_same(&a->input_name,  &b->input_name)) return false;
-	if (!bc_string_builder_same(&a->output_name, &b->output_name)) return false;
-	if (!bc_string_builder_same(&a->header_file, &b->header_file)) return false;
+	if (a->input != b->input || a->output != b->output || a->header != b->header) return false;
 	return true;
 }
 
 
 
 bool build_command_is_same(BuildCommand* a, BuildCommand* b) {
+	if (a->fingerprint != b->fingerprint) return false;
 	if (a->children.count != b->children.count) return false;
 	// NOTE: not sure about this, what if the order is different?
 	for (size_t i = 0; i < a->children.count; ++i) {
@@ -243,12 +452,12 @@ bool build_command_is_same(BuildCommand* a, BuildCommand* b) {
 	if (!bc_string_view_same(&a->output_dir,    &b->output_dir))    return false;
 	if (!bc_string_list_same(&a->input_files,   &b->input_files))   return false;
 	if (!bc_string_list_same(&a->input_objects, &b->input_objects)) return false;
-	if (!bc_string_list_same(&a->include_dirs,  &b->include_dirs))  return false;
+	if (!option_list_same(&a->include_dirs,  &b->include_dirs))  return false;
 	if (!bc_string_list_same(&a->include_files, &b->include_files)) return false;
-	if (!bc_string_list_same(&a->library_dirs,  &b->library_dirs))  return false;
-	if (!bc_string_list_same(&a->library_links, &b->library_links)) return false;
-	if (!bc_string_list_same(&a->cflags,        &b->cflags))        return false;
-	if (!bc_string_list_same(&a->ldflags,       &b->ldflags))       return false;
+	if (!option_list_same(&a->library_dirs,  &b->library_dirs))  return false;
+	if (!option_list_same(&a->library_links, &b->library_links)) return false;
+	if (!option_list_same(&a->cflags,        &b->cflags))        return false;
+	if (!option_list_same(&a->ldflags,       &b->ldflags))       return false;
 
 	return true;
 }
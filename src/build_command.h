@@ -1,6 +1,7 @@
 #pragma once
 #include "arena.h"
 #include "da.h"
+#include "option_list.h"
 #include "statement.h"
 #include "symbol.h"
 #include <stdio.h>
@@ -36,14 +37,14 @@ struct BuildCommand {
 	StringList input_files;
 	StringList input_objects;
 
-	StringList include_dirs;
+	OptionList include_dirs;
 	StringList include_files;
 
-	StringList library_dirs;
-	StringList library_links;
+	OptionList library_dirs;
+	OptionList library_links;
 
-	StringList cflags;
-	StringList ldflags;
+	OptionList cflags;
+	OptionList ldflags;
 
 	StringView source_dir;
 	StringView output_dir;
@@ -51,7 +52,10 @@ struct BuildCommand {
 	// StringList defines;
 
 	Statement* body;
+	CmdTemplate cmd;       // see build_command_prepare_cmd
+	uint64_t fingerprint;  // of its fields, targets and children, see build_command_fingerprint
 	bool dirty;
+	bool marked_dirty_explicitly;
 	bool marked_clean_explicitly;
 };
 
@@ -60,6 +64,7 @@ BuildCommand* build_command_new(Arena*);
 BuildCommand build_command_default(void);
 void         build_command_print  (BuildCommand* bc, size_t indent);
 void         build_command_dump   (Arena* arena, BuildCommand* bc, FILE* stream, size_t target_to_build);
+void         build_command_explain(BuildCommand* bc, FILE* stream);
 
 BuildCommand* build_command_inherit(Arena* arena, BuildCommand* parent);
 
@@ -68,6 +73,19 @@ void build_type_print(BuildType type);
 void build_command_mark_all_targets_dirty (BuildCommand* bc, bool dirty);
 void build_command_mark_all_children_dirty(BuildCommand* bc, bool dirty);
 
+// the gcc or clang driver the compiler is, without its directory, target prefix
+// and version suffix: /usr/bin/gcc, gcc-12 and x86_64-w64-mingw32-gcc are all "gcc".
+// empty for any other compiler.
+StringView build_command_compiler_family(BuildCommand* bc);
+bool       build_command_supports_depfile(BuildCommand* bc);
+
+// hashes bottom up what the *_is_same functions compare, once the targets are
+// expanded. equal fingerprints still need the full comparison to rule out collisions.
+void build_command_fingerprint(BuildCommand* bc);
+
+// renders the arguments its targets share once, the tree must not change after this
+void build_command_prepare_cmd(Arena* arena, BuildCommand* bc);
+
 bool target_is_same(Target* a, Target* b);
 bool build_command_is_same(BuildCommand* a, BuildCommand* b);
 
@@ -0,0 +1,257 @@
+#include "build_log.h"
+#include "file.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#define BUILD_LOG_SIGNATURE "# cook log v2\n"
+#define BUILD_LOG_SIGNATURE_SIZE (sizeof(BUILD_LOG_SIGNATURE) - 1)
+// v1 lines only have the hash, they are read and rewritten as v2
+#define BUILD_LOG_SIGNATURE_V1 "# cook log v1\n"
+// hash, exit code, wall, user, system, max rss
+#define BUILD_LOG_FIELDS 6
+// don't bother compacting small logs
+#define BUILD_LOG_MIN_LINES_TO_COMPACT 1000
+
+static BuildLogEntry* build_log_entry(BuildLog* log, uint32_t id) {
+	if (id >= log->capacity) {
+		size_t capacity = log->capacity == 0 ? 256 : log->capacity;
+		while (id >= capacity) capacity *= 2;
+		log->items = realloc(log->items, capacity * sizeof(BuildLogEntry));
+		assert(log->items != NULL);
+		memset(log->items + log->capacity, 0, (capacity - log->capacity) * sizeof(BuildLogEntry));
+		log->capacity = capacity;
+	}
+	return &log->items[id];
+}
+
+static void build_log_set(BuildLog* log, StringView output, BuildLogEntry entry) {
+	BuildLogEntry* e = build_log_entry(log, intern(&log->outputs, output));
+	if (!e->valid) log->live_count++;
+	*e = entry;
+	e->valid = true;
+}
+
+// a number in `base` followed by a tab, `c` is left after the tab
+static bool build_log_parse_field(const char** c, const char* end, int base, uint64_t* value) {
+	const char* p = *c;
+	uint64_t v = 0;
+	for (; p < end && *p != '\t'; ++p) {
+		int digit = (*p >= '0' && *p <= '9') ? *p - '0'
+		          : (base == 16 && *p >= 'a' && *p <= 'f') ? *p - 'a' + 10 : -1;
+		if (digit < 0) return false;
+		v = v * (uint64_t)base + (uint64_t)digit;
+	}
+	if (p == *c || p == end) return false;
+	*value = v;
+	*c = p + 1;
+	return true;
+}
+
+bool build_log_load(BuildLog* log, StringView output_dir) {
+	StringBuilder path = {0};
+	if (output_dir.count > 0) {
+		da_append_many(&path, output_dir.items, output_dir.count);
+		da_append(&path, '/');
+	}
+	da_append_many(&path, BUILD_LOG_FILENAME, strlen(BUILD_LOG_FILENAME));
+	da_append(&path, '\0');
+	log->filepath = path.items;
+
+	if (access(log->filepath, F_OK) != 0) {
+		return true;
+	}
+
+	StringBuilder content = {0};
+	if (!read_entire_file(log->filepath, &content)) {
+		return false;
+	}
+
+	size_t fields = BUILD_LOG_FIELDS;
+	if (content.count >= BUILD_LOG_SIGNATURE_SIZE
+		&& memcmp(content.items, BUILD_LOG_SIGNATURE_V1, BUILD_LOG_SIGNATURE_SIZE) == 0) {
+		fields = 1;
+		log->needs_recompact = true;
+	} else if (content.count < BUILD_LOG_SIGNATURE_SIZE
+		|| memcmp(content.items, BUILD_LOG_SIGNATURE, BUILD_LOG_SIGNATURE_SIZE) != 0) {
+		log->needs_recompact = true;
+		sb_free(&content);
+		return true;
+	}
+
+	const char* c = content.items + BUILD_LOG_SIGNATURE_SIZE;
+	const char* end = content.items + content.count;
+	while (c < end) {
+		const char* line_end = memchr(c, '\n', end - c);
+		if (!line_end) {
+			// cut off while writing
+			log->needs_recompact = true;
+			break;
+		}
+
+		uint64_t values[BUILD_LOG_FIELDS] = {0};
+		const char* field = c;
+		bool ok = true;
+		for (size_t f = 0; ok && f < fields; ++f) {
+			ok = build_log_parse_field(&field, line_end, f == 0 ? 16 : 10, &values[f]);
+		}
+		StringView output = { .items = field, .count = line_end - field };
+		if (ok && output.count > 0) {
+			BuildLogEntry entry = {
+				.command_hash = values[0],
+				.usage = {
+					.exit_code = (int)(uint32_t)values[1],
+					.wall = values[2],
+					.user = values[3],
+					.system = values[4],
+					.max_rss = values[5],
+				},
+			};
+			build_log_set(log, output, entry);
+		}
+		log->line_count++;
+		c = line_end + 1;
+	}
+
+	if (log->line_count > BUILD_LOG_MIN_LINES_TO_COMPACT && log->line_count > 3 * log->live_count) {
+		log->needs_recompact = true;
+	}
+
+	sb_free(&content);
+	return true;
+}
+
+BuildLogEntry* build_log_find(BuildLog* log, StringView output) {
+	uint32_t id = intern_find(&log->outputs, output);
+	if (id == INTERN_NONE || id >= log->capacity || !log->items[id].valid) return NULL;
+	return &log->items[id];
+}
+
+inline static bool build_log_write_entry(FILE* f, StringView output, BuildLogEntry* entry) {
+	CommandUsage* u = &entry->usage;
+	return fprintf(f, "%016" PRIx64 "\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%.*s\n",
+		entry->command_hash, (unsigned)u->exit_code, u->wall, u->user, u->system, u->max_rss,
+		(int)output.count, output.items) > 0;
+}
+
+static bool build_log_recompact(BuildLog* log) {
+	StringBuilder tmp = {0};
+	da_append_many(&tmp, log->filepath, strlen(log->filepath));
+	da_append_many(&tmp, ".tmp", 5);
+
+	FILE* f = fopen(tmp.items, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][build_log] could not open %s: %s\n", tmp.items, strerror(errno));
+		free(tmp.items);
+		return false;
+	}
+
+	bool ok = fwrite(BUILD_LOG_SIGNATURE, 1, BUILD_LOG_SIGNATURE_SIZE, f) == BUILD_LOG_SIGNATURE_SIZE;
+	for (size_t id = 0; ok && id < log->outputs.strings.count; ++id) {
+		if (id >= log->capacity || !log->items[id].valid) continue;
+		ok = build_log_write_entry(f, log->outputs.strings.items[id], &log->items[id]);
+	}
+
+	if (fclose(f) != 0) ok = false;
+	if (ok) {
+#ifdef _WIN32
+		remove(log->filepath);
+#endif
+		ok = rename(tmp.items, log->filepath) == 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "[ERROR][build_log] could not write %s: %s\n", log->filepath, strerror(errno));
+	}
+	log->line_count = log->live_count;
+	log->needs_recompact = false;
+	free(tmp.items);
+	return ok;
+}
+
+bool build_log_record(BuildLog* log, StringView output, uint64_t command_hash, CommandUsage usage) {
+	if (!log->file) {
+		if (!log->filepath) return false;
+		if (log->needs_recompact || access(log->filepath, F_OK) != 0) {
+			if (!build_log_recompact(log)) return false;
+		}
+		log->file = fopen(log->filepath, "ab");
+		if (!log->file) {
+			fprintf(stderr, "[ERROR][build_log] could not open %s: %s\n", log->filepath, strerror(errno));
+			return false;
+		}
+	}
+
+	BuildLogEntry entry = { .command_hash = command_hash, .usage = usage };
+	build_log_set(log, output, entry);
+	log->line_count++;
+
+	bool ok = build_log_write_entry(log->file, output, &entry);
+	return fflush(log->file) == 0 && ok;
+}
+
+void build_log_close(BuildLog* log) {
+	if (log->file) {
+		fclose(log->file);
+	}
+	intern_free(&log->outputs);
+	free(log->items);
+	free(log->filepath);
+	*log = (BuildLog){0};
+}
+
+typedef struct BuildLogRow {
+	StringView output;
+	CommandUsage* usage;
+} BuildLogRow;
+
+static int build_log_by_wall(const void* a, const void* b) {
+	uint64_t x = ((const BuildLogRow*)a)->usage->wall, y = ((const BuildLogRow*)b)->usage->wall;
+	return (x < y) - (x > y);
+}
+
+static int build_log_by_rss(const void* a, const void* b) {
+	uint64_t x = ((const BuildLogRow*)a)->usage->max_rss, y = ((const BuildLogRow*)b)->usage->max_rss;
+	return (x < y) - (x > y);
+}
+
+static void build_log_print_rows(FILE* stream, BuildLogRow* rows, size_t count) {
+	fprintf(stream, "%10s %10s %10s %10s %5s  %s\n", "wall ms", "user ms", "sys ms", "rss KiB", "exit", "output");
+	for (size_t i = 0; i < count; ++i) {
+		CommandUsage* u = rows[i].usage;
+		fprintf(stream, "%10.1f %10.1f %10.1f %10" PRIu64 " %5d  %.*s\n",
+			(double)u->wall / 1000.0, (double)u->user / 1000.0, (double)u->system / 1000.0,
+			u->max_rss, u->exit_code, (int)rows[i].output.count, rows[i].output.items);
+	}
+}
+
+void build_log_report(BuildLog* log, FILE* stream, size_t count) {
+	BuildLogRow* rows = malloc((log->live_count + 1) * sizeof(BuildLogRow));
+	assert(rows != NULL);
+	size_t n = 0;
+	uint64_t wall = 0, cpu = 0;
+	for (size_t id = 0; id < log->outputs.strings.count; ++id) {
+		if (id >= log->capacity || !log->items[id].valid) continue;
+		CommandUsage* u = &log->items[id].usage;
+		rows[n++] = (BuildLogRow){ .output = log->outputs.strings.items[id], .usage = u };
+		wall += u->wall;
+		cpu += u->user + u->system;
+	}
+	if (n == 0) {
+		fprintf(stream, "[report] %s has no finished commands yet\n", log->filepath ? log->filepath : BUILD_LOG_FILENAME);
+		free(rows);
+		return;
+	}
+	if (count > n) count = n;
+
+	fprintf(stream, "[report] %zu outputs, %.1f ms of commands, %.1f ms of cpu\n",
+		n, (double)wall / 1000.0, (double)cpu / 1000.0);
+
+	qsort(rows, n, sizeof(BuildLogRow), build_log_by_wall);
+	fprintf(stream, "[report] slowest:\n");
+	build_log_print_rows(stream, rows, count);
+
+	qsort(rows, n, sizeof(BuildLogRow), build_log_by_rss);
+	fprintf(stream, "[report] most memory:\n");
+	build_log_print_rows(stream, rows, count);
+	free(rows);
+}
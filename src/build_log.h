@@ -0,0 +1,43 @@
+#pragma once
+#include "intern.h"
+#include <stdio.h>
+
+#define BUILD_LOG_FILENAME ".cook_log"
+
+// what a command cost, as measured when it was reaped
+typedef struct CommandUsage {
+	uint64_t wall;     // microseconds
+	uint64_t user;     // microseconds of cpu
+	uint64_t system;
+	uint64_t max_rss;  // kilobytes
+	int exit_code;
+} CommandUsage;
+
+// one line per finished job, appended to a text file in the output dir:
+//   <command hash> <exit code> <wall> <user> <system> <max rss> <output path>
+// tab separated, the hash in hex. a later line for the same output replaces an
+// earlier one. a failed job is logged with hash 0, which keeps it dirty.
+typedef struct BuildLogEntry {
+	uint64_t command_hash;
+	CommandUsage usage;
+	bool valid;
+} BuildLogEntry;
+
+typedef struct BuildLog {
+	InternPool outputs;
+	BuildLogEntry* items;  // output id -> entry
+	size_t capacity;
+	size_t line_count;     // stale lines included
+	size_t live_count;
+	char* filepath;
+	FILE* file;
+	bool needs_recompact;
+} BuildLog;
+
+bool           build_log_load  (BuildLog* log, StringView output_dir);
+BuildLogEntry* build_log_find  (BuildLog* log, StringView output);
+bool           build_log_record(BuildLog* log, StringView output, uint64_t command_hash, CommandUsage usage);
+void           build_log_close (BuildLog* log);
+
+// the `count` slowest and most memory hungry outputs of the last builds
+void build_log_report(BuildLog* log, FILE* stream, size_t count);
@@ -0,0 +1,14 @@
+#include "build_state.h"
+
+bool build_state_load(BuildState* state, StringView output_dir) {
+	bool ok = deps_log_load(&state->deps, output_dir);
+	ok = build_log_load(&state->log, output_dir) && ok;
+	ok = file_state_load(&state->files, output_dir) && ok;
+	return ok;
+}
+
+void build_state_close(BuildState* state) {
+	deps_log_close(&state->deps);
+	build_log_close(&state->log);
+	file_state_close(&state->files);
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "build_log.h"
+#include "deps_log.h"
+#include "file_state.h"
+
+// everything cook remembers between runs, kept in the root output dir
+typedef struct BuildState {
+	DepsLog deps;
+	BuildLog log;
+	FileStateDb files;
+} BuildState;
+
+bool build_state_load (BuildState* state, StringView output_dir);
+void build_state_close(BuildState* state);
@@ -0,0 +1,346 @@
+#include "compile_cache.h"
+#include "executer.h"
+#include "file.h"
+#include "hash.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/file.h>
+	#include <time.h>
+	#include <utime.h>
+#endif
+
+#define COMPILE_CACHE_VERSION "cook cache 1"
+#define COMPILE_CACHE_SEED_B (HASH_SEED ^ 0x9e3779b97f4a7c15ull)
+#define COMPILE_CACHE_STALE_TMP (60ull * 60 * 1000000000ull)
+
+bool compile_cache_parse_size(StringView sv, uint64_t* size) {
+	if (sv.count == 0) return false;
+	uint64_t n = 0;
+	size_t i = 0;
+	for (; i < sv.count && sv.items[i] >= '0' && sv.items[i] <= '9'; ++i) {
+		n = n * 10 + (uint64_t)(sv.items[i] - '0');
+	}
+	if (i == 0) return false;
+	if (i < sv.count) {
+		if (i + 1 != sv.count) return false;
+		switch (sv.items[i]) {
+			case 'k': case 'K': n *= 1024ull; break;
+			case 'm': case 'M': n *= 1024ull * 1024; break;
+			case 'g': case 'G': n *= 1024ull * 1024 * 1024; break;
+			default: return false;
+		}
+	}
+	*size = n;
+	return n > 0;
+}
+
+#ifdef _WIN32
+
+bool compile_cache_open(CompileCache* cache, StringView dir, uint64_t max_size) {
+	(void)cache; (void)dir; (void)max_size;
+	fprintf(stderr, "[WARNING][cache] the compile cache is not supported on windows\n");
+	return false;
+}
+void compile_cache_close(CompileCache* cache) { (void)cache; }
+bool compile_cache_key(CompileCache* cache, Cmd cmd, const char* preprocessed, CacheKey* key) {
+	(void)cache; (void)cmd; (void)preprocessed; (void)key;
+	return false;
+}
+bool compile_cache_fetch(CompileCache* cache, CacheKey key, const char* output) {
+	(void)cache; (void)key; (void)output;
+	return false;
+}
+void compile_cache_store(CompileCache* cache, CacheKey key, const char* output) {
+	(void)cache; (void)key; (void)output;
+}
+void compile_cache_evict(CompileCache* cache) { (void)cache; }
+
+#else
+
+bool compile_cache_open(CompileCache* cache, StringView dir, uint64_t max_size) {
+	memset(cache, 0, sizeof(*cache));
+	cache->max_size = max_size > 0 ? max_size : COMPILE_CACHE_DEFAULT_SIZE;
+	cache->dir = malloc(dir.count + 1);
+	assert(cache->dir != NULL);
+	memcpy(cache->dir, dir.items, dir.count);
+	cache->dir[dir.count] = '\0';
+
+	if (MKDIR(cache->dir) != 0 && errno != EEXIST) {
+		fprintf(stderr, "[ERROR][cache] could not create %s: %s\n", cache->dir, strerror(errno));
+		free(cache->dir);
+		cache->dir = NULL;
+		return false;
+	}
+	return true;
+}
+
+void compile_cache_close(CompileCache* cache) {
+	if (!cache->dir) return;
+	// also runs without new entries, the cap may have been lowered
+	compile_cache_evict(cache);
+	free(cache->dir);
+	for (size_t i = 0; i < cache->compilers.count; ++i) {
+		free((char*)cache->compilers.items[i].name.items);
+	}
+	free(cache->compilers.items);
+	cache->dir = NULL;
+}
+
+inline static void cache_key_update(CacheKey* key, const void* data, size_t size) {
+	key->a = hash_bytes(data, size, key->a);
+	key->b = hash_bytes(data, size, key->b);
+}
+
+// resolves the compiler like posix_spawnp does and identifies it by the binary it
+// points to, so upgrading the compiler does not hand out stale objects
+static uint64_t compile_cache_compiler_id(CompileCache* cache, const char* name) {
+	StringView sv = { .items = name, .count = strlen(name) };
+	for (size_t i = 0; i < cache->compilers.count; ++i) {
+		CompilerId* c = &cache->compilers.items[i];
+		if (c->name.count == sv.count && memcmp(c->name.items, sv.items, sv.count) == 0) {
+			return c->id;
+		}
+	}
+
+	uint64_t id = hash_bytes(name, sv.count, HASH_SEED);
+	char path[4096] = {0};
+	if (strchr(name, '/')) {
+		snprintf(path, sizeof(path), "%s", name);
+	} else {
+		const char* dirs = getenv("PATH");
+		while (dirs && *dirs) {
+			const char* end = strchr(dirs, ':');
+			size_t len = end ? (size_t)(end - dirs) : strlen(dirs);
+			snprintf(path, sizeof(path), "%.*s/%s", (int)len, len ? dirs : ".", name);
+			if (access(path, X_OK) == 0) break;
+			path[0] = '\0';
+			dirs = end ? end + 1 : NULL;
+		}
+	}
+	if (path[0] != '\0') {
+		FileState fs = get_file_state(path);
+		id = hash_bytes(path, strlen(path), id);
+		id = hash_bytes(&fs.mtime, sizeof(fs.mtime), id);
+		id = hash_bytes(&fs.size, sizeof(fs.size), id);
+	}
+
+	// the argv lives in an arena that --watch cleans between builds
+	CompilerId c = { .name = { .items = strdup(name), .count = sv.count }, .id = id };
+	da_append(&cache->compilers, c);
+	return id;
+}
+
+bool compile_cache_key(CompileCache* cache, Cmd cmd, const char* preprocessed, CacheKey* key) {
+	if (cmd.count == 0) return false;
+
+	StringBuilder content = {0};
+	if (!read_entire_file(preprocessed, &content)) {
+		return false;
+	}
+
+	CacheKey k = { .a = HASH_SEED, .b = COMPILE_CACHE_SEED_B };
+	cache_key_update(&k, COMPILE_CACHE_VERSION, sizeof(COMPILE_CACHE_VERSION));
+
+	uint64_t compiler = compile_cache_compiler_id(cache, cmd.items[0]);
+	cache_key_update(&k, &compiler, sizeof(compiler));
+
+	// where the results are written does not change them
+	for (size_t i = 1; i < cmd.count; ++i) {
+		if (strcmp(cmd.items[i], "-o") == 0 || strcmp(cmd.items[i], "-MF") == 0) {
+			++i;
+			continue;
+		}
+		cache_key_update(&k, cmd.items[i], strlen(cmd.items[i]) + 1);
+	}
+
+	uint64_t size = content.count;
+	cache_key_update(&k, &size, sizeof(size));
+	cache_key_update(&k, content.items, content.count);
+	sb_free(&content);
+
+	*key = k;
+	return true;
+}
+
+// <dir>/<first two hex digits>/<remaining 30 hex digits>.o
+static void compile_cache_entry_path(CompileCache* cache, CacheKey key, char* path, size_t size, bool create_dir) {
+	char hex[33];
+	snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)key.a, (unsigned long long)key.b);
+	if (create_dir) {
+		snprintf(path, size, "%s/%.2s", cache->dir, hex);
+		if (MKDIR(path) != 0 && errno != EEXIST) {
+			fprintf(stderr, "[ERROR][cache] could not create %s: %s\n", path, strerror(errno));
+		}
+	}
+	snprintf(path, size, "%s/%.2s/%s.o", cache->dir, hex, hex + 2);
+}
+
+// copies into a temporary next to `to` and renames it over, returns the bytes copied
+static uint64_t copy_file_atomic(const char* from, const char* to) {
+	FILE* in = fopen(from, "rb");
+	if (!in) return 0;
+
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", to, (long)getpid());
+	FILE* out = fopen(tmp, "wb");
+	if (!out) {
+		fclose(in);
+		return 0;
+	}
+
+	char buffer[64 * 1024];
+	uint64_t total = 0;
+	bool ok = true;
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		if (fwrite(buffer, 1, n, out) != n) {
+			ok = false;
+			break;
+		}
+		total += n;
+	}
+	if (ferror(in)) ok = false;
+	fclose(in);
+	if (fclose(out) != 0) ok = false;
+
+	if (!ok || total == 0 || rename(tmp, to) != 0) {
+		remove(tmp);
+		return 0;
+	}
+	return total;
+}
+
+bool compile_cache_fetch(CompileCache* cache, CacheKey key, const char* output) {
+	char path[4096];
+	compile_cache_entry_path(cache, key, path, sizeof(path), false);
+
+	if (copy_file_atomic(path, output) == 0) {
+		cache->misses++;
+		return false;
+	}
+	// the mtime of an entry is its last use
+	utime(path, NULL);
+	cache->hits++;
+	return true;
+}
+
+// an entry that is already there, from another process or target, is left alone
+// and not counted again
+void compile_cache_store(CompileCache* cache, CacheKey key, const char* output) {
+	char path[4096];
+	compile_cache_entry_path(cache, key, path, sizeof(path), true);
+	if (access(path, F_OK) == 0) return;
+	cache->stored += copy_file_atomic(output, path);
+}
+
+
+typedef struct CacheEntry {
+	char* path;
+	uint64_t size;
+	uint64_t mtime;
+} CacheEntry;
+
+typedef struct CacheEntryList {
+	CacheEntry* items;
+	size_t count;
+	size_t capacity;
+} CacheEntryList;
+
+static int cache_entry_compare(const void* a, const void* b) {
+	const CacheEntry* x = a;
+	const CacheEntry* y = b;
+	return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+// walks every bucket, also sweeps temporaries left behind by killed processes
+static uint64_t compile_cache_scan(CompileCache* cache, CacheEntryList* entries) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+
+	uint64_t total = 0;
+	char bucket[4096];
+	char path[4096 + 1 + 256];
+	for (int i = 0; i < 256; ++i) {
+		snprintf(bucket, sizeof(bucket), "%s/%02x", cache->dir, i);
+		DIR* dir = opendir(bucket);
+		if (!dir) continue;
+
+		struct dirent* d;
+		while ((d = readdir(dir)) != NULL) {
+			if (d->d_name[0] == '.') continue;
+			snprintf(path, sizeof(path), "%s/%s", bucket, d->d_name);
+			FileState fs = get_file_state(path);
+			if (fs.mtime == 0) continue;
+
+			if (strstr(d->d_name, ".tmp.")) {
+				if (now_ns > fs.mtime + COMPILE_CACHE_STALE_TMP) remove(path);
+				continue;
+			}
+			if (!ends_with(d->d_name, ".o")) continue;
+
+			CacheEntry e = { .path = strdup(path), .size = fs.size, .mtime = fs.mtime };
+			da_append(entries, e);
+			total += fs.size;
+		}
+		closedir(dir);
+	}
+	return total;
+}
+
+// the total size is kept in `<dir>/size` so a build that stays under the cap does
+// not have to walk the whole cache. the lock serializes concurrent cook processes.
+void compile_cache_evict(CompileCache* cache) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/lock", cache->dir);
+	int lock = open(path, O_RDWR | O_CREAT, 0666);
+	if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+		fprintf(stderr, "[ERROR][cache] could not lock %s: %s\n", path, strerror(errno));
+		if (lock >= 0) close(lock);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/size", cache->dir);
+	uint64_t total = 0;
+	FILE* f = fopen(path, "r");
+	if (f) {
+		unsigned long long n = 0;
+		if (fscanf(f, "%llu", &n) == 1) total = n;
+		fclose(f);
+	}
+	total += cache->stored;
+	cache->stored = 0;
+
+	if (total > cache->max_size) {
+		CacheEntryList entries = {0};
+		total = compile_cache_scan(cache, &entries);
+		qsort(entries.items, entries.count, sizeof(CacheEntry), cache_entry_compare);
+
+		// leave some headroom so the next few builds do not rescan right away
+		uint64_t target = cache->max_size / 10 * 9;
+		for (size_t i = 0; i < entries.count; ++i) {
+			if (total > target && remove(entries.items[i].path) == 0) {
+				total -= entries.items[i].size;
+			}
+			free(entries.items[i].path);
+		}
+		free(entries.items);
+	}
+
+	f = fopen(path, "w");
+	if (f) {
+		fprintf(f, "%llu\n", (unsigned long long)total);
+		fclose(f);
+	}
+
+	flock(lock, LOCK_UN);
+	close(lock);
+}
+
+#endif // _WIN32
@@ -0,0 +1,50 @@
+#pragma once
+#include "da.h"
+#include "target.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define COMPILE_CACHE_DEFAULT_SIZE (5ull * 1024 * 1024 * 1024)
+
+// content addressed store of object files shared between builds, checkouts and
+// concurrent cook processes. entries live in `<dir>/<xx>/<key>.o` and are written
+// with a rename so readers never see a partial object.
+typedef struct CacheKey {
+	uint64_t a;
+	uint64_t b;
+} CacheKey;
+
+typedef struct CompilerId {
+	StringView name;
+	uint64_t id;
+} CompilerId;
+
+typedef struct CompilerIdList {
+	CompilerId* items;
+	size_t count;
+	size_t capacity;
+} CompilerIdList;
+
+typedef struct CompileCache {
+	char* dir;
+	uint64_t max_size;
+	uint64_t stored; // bytes added during this run
+	size_t hits;
+	size_t misses;
+	CompilerIdList compilers;
+} CompileCache;
+
+bool compile_cache_open (CompileCache* cache, StringView dir, uint64_t max_size);
+void compile_cache_close(CompileCache* cache);
+
+// the key covers the compiler binary, the argv without its output paths and the
+// preprocessed translation unit at `preprocessed`
+bool compile_cache_key  (CompileCache* cache, Cmd cmd, const char* preprocessed, CacheKey* key);
+bool compile_cache_fetch(CompileCache* cache, CacheKey key, const char* output);
+void compile_cache_store(CompileCache* cache, CacheKey key, const char* output);
+
+// drops the least recently used entries until the cache fits into max_size
+void compile_cache_evict(CompileCache* cache);
+
+// accepts plain bytes or a K, M or G suffix
+bool compile_cache_parse_size(StringView sv, uint64_t* size);
@@ -1,8 +1,10 @@
 #include "constructor.h"
+#include "compile_cache.h"
 #include "da.h"
 #include "statement.h"
 #include "symbol.h"
 #include "target.h"
+#include "stats.h"
 #include <signal.h>
 #include <stdint.h>
 
@@ -11,48 +13,130 @@ static const SymbolValue nill = { .type = SYMBOL_VALUE_NIL };
 Constructor constructor_new(Statement* root_statement) {
 	Constructor con = {0};
 	con.current_statement = root_statement;
-	con.current_environment = environment_new(&con.arena);
+	con.current_environment = environment_new(&con.arena, NULL);
 	con.current_build_command = build_command_new(&con.arena);
 	return con;
 }
 
+// points every body statement back at its build command, so the interpreter doesn't
+// have to search the tree. a statement shared by a chain keeps the first one in preorder.
+static void constructor_attach_statements(BuildCommand* bc) {
+	if (bc->body && !bc->body->attached) {
+		bc->body->attached = bc;
+	}
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		constructor_attach_statements(bc->children.items[i]);
+	}
+}
+
 BuildCommand* constructor_construct_build_command(Constructor* con) {
 	Statement* root = con->current_statement;
 	con->current_build_command->body = root;
 
+	PhaseStart start = stats_phase_begin();
 	constructor_execute(con, root);
 	constructor_expand_build_command_targets(con, con->current_build_command);
+	build_command_fingerprint(con->current_build_command);
+	build_command_prepare_cmd(&con->arena, con->current_build_command);
+	constructor_attach_statements(con->current_build_command);
+	stats_phase_end(PHASE_CONSTRUCT, start);
+
+	if (con->state) {
+		start = stats_phase_begin();
+		build_state_load(con->state, con->current_build_command->output_dir);
+		stats_phase_end(PHASE_LOAD_STATE, start);
+	}
+
+	start = stats_phase_begin();
 	constructor_analyze(con, con->current_build_command);
+	stats_phase_end(PHASE_ANALYZE, start);
 	con->current_build_command->dirty = true; // root build command is always dirty
 	return con->current_build_command;
 }
 
 
+inline static Target* build_command_first_dirty_target(BuildCommand* bc) {
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		if (bc->targets.items[i].dirty) return &bc->targets.items[i];
+	}
+	return NULL;
+}
+
+// the targets of every parent are built from the outputs of bc, they follow it
+static void constructor_dirty_parents(BuildCommand* bc, DirtyCause cause) {
+	for (BuildCommand* p = bc->parent; p; p = p->parent) {
+		for (size_t i = 0; i < p->targets.count; ++i) {
+			Target* t = &p->targets.items[i];
+			if (!t->dirty) t->cause = cause;
+		}
+		build_command_mark_all_targets_dirty(p, true);
+	}
+}
+
 void constructor_analyze(Constructor* con, BuildCommand* bc) {
 	if (!con || !bc) return;
 
-	bool dirty_child = false;
+	// what made bc dirty first, handed up to the targets of its parents
+	DirtyCause cause = { .reason = DIRTY_CHILD };
 	for (size_t i = 0; i < bc->children.count; ++i) {
-		constructor_analyze(con, bc->children.items[i]);
-		if (bc->children.items[i]->dirty) {
-			dirty_child = true;
+		BuildCommand* child = bc->children.items[i];
+		constructor_analyze(con, child);
+		if (child->dirty && !cause.from) {
+			cause.from = child;
+			cause.from_target = build_command_first_dirty_target(child);
 		}
 	}
 
 	for (size_t i = 0; i < bc->targets.count; ++i) {
-		if (target_check_dirty(bc, &bc->targets.items[i])) {
-			dirty_child = true;
+		Target* t = &bc->targets.items[i];
+		if (target_check_dirty(&con->scratch, con->state, bc, t) && !cause.from_target) {
+			cause.from = bc;
+			cause.from_target = t;
 		}
 	}
 
-	if (dirty_child && !bc->marked_clean_explicitly) {
+	if (cause.from && !bc->marked_clean_explicitly) {
 		bc->dirty = true;
-		BuildCommand* p = bc->parent;
-		while (p) {
-			build_command_mark_all_targets_dirty(p, true);
-			p = p->parent;
+		constructor_dirty_parents(bc, cause);
+	}
+}
+
+// bc is dirty while one of its targets, or anything below it, still has to be built
+static bool constructor_settle_dirty(BuildCommand* bc) {
+	bool dirty = bc->marked_dirty_explicitly;
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		if (constructor_settle_dirty(bc->children.items[i])) dirty = true;
+	}
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		if (bc->targets.items[i].dirty) dirty = true;
+	}
+	bc->dirty = dirty;
+	return dirty;
+}
+
+// --watch: the caller cleared the targets that were built, the rest stay dirty
+void constructor_settle(BuildCommand* root) {
+	constructor_settle_dirty(root);
+	root->dirty = true;
+}
+
+// --watch: checks again only the targets that read a file that changed,
+// and hands their dirtiness up like constructor_analyze does
+void constructor_reanalyze(Constructor* con, BuildCommand* root, TargetRef* refs, size_t count) {
+	PhaseStart start = stats_phase_begin();
+	arena_clean(&con->scratch);
+	for (size_t i = 0; i < count; ++i) {
+		BuildCommand* bc = refs[i].bc;
+		Target* t = refs[i].target;
+		if (t->dirty) continue;
+		if (!target_check_dirty(&con->scratch, con->state, bc, t)) continue;
+		for (BuildCommand* p = bc; p; p = p->parent) {
+			p->dirty = true;
 		}
+		constructor_dirty_parents(bc, (DirtyCause){ .reason = DIRTY_CHILD, .from = bc, .from_target = t });
 	}
+	root->dirty = true;
+	stats_phase_end(PHASE_ANALYZE, start);
 }
 
 void constructor_error(Constructor* con, Token token, const char* error_cstr) {
@@ -70,6 +154,16 @@ SymbolValue constructor_evaluate(Constructor* con, Expression* e) {
 
 	switch (e->type) {
 		case EXPR_VARIABLE: return constructor_lookup_variable(con, e->variable.name.str, e);
+		case EXPR_ASSIGNMENT: {
+			// a variable is looked up before the methods, it would hide the method for the whole scope
+			if (method_extract(e->assignment.name.str) != METHOD_NONE) {
+				constructor_error(con, e->assignment.name, "Cannot assign to the name of a method.");
+				return nill;
+			}
+			SymbolValue value = constructor_evaluate(con, e->assignment.value);
+			environment_define(&con->arena, con->current_environment, e->assignment.id, value);
+			return value;
+		}
 		case EXPR_CALL:     return constructor_interpret_call(con, &e->call);
 		case EXPR_CHAIN:    return constructor_interpret_chain(con, &e->chain);
 		case EXPR_LITERAL_STRING: {
@@ -111,9 +205,12 @@ SymbolValue constructor_interpret_description(Constructor* con, StatementDescrip
 		con->current_build_command->body = outer;
 	}
 
+	Environment* scope = con->current_environment;
+	con->current_environment = environment_new(&con->arena, scope);
 	for (size_t i = 0; i < s->block->block.statement_count; ++i) {
 		constructor_execute(con, s->block->block.statements[i]);
 	}
+	con->current_environment = scope;
 
 	con->current_build_command = enclosing;
 	return left;
@@ -185,7 +282,7 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->cflags, arg.string);
+				option_list_append(&con->arena, &bc->cflags, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_LDFLAGS) {
@@ -193,7 +290,7 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->ldflags, arg.string);
+				option_list_append(&con->arena, &bc->ldflags, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_SOURCE_DIR) {
@@ -217,7 +314,7 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->include_dirs, arg.string);
+				option_list_append(&con->arena, &bc->include_dirs, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_LIBRARY_DIR) {
@@ -225,7 +322,7 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->library_dirs, arg.string);
+				option_list_append(&con->arena, &bc->library_dirs, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_LINK) {
@@ -233,11 +330,12 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 		for (size_t i = 0; i < e->argc; ++i) {
 			SymbolValue arg = constructor_evaluate(con, e->args[i]);
 			if (arg.type == SYMBOL_VALUE_STRING) {
-				da_append_arena(&con->arena, &bc->library_links, arg.string);
+				option_list_append(&con->arena, &bc->library_links, arg.string);
 			}
 		}
 	} else if (callee.method_type == METHOD_DIRTY) {
 		BuildCommand* bc = con->current_build_command;
+		bc->marked_dirty_explicitly = true;
 		bc->dirty = true;
 		while (bc->parent) {
 			bc->parent->dirty = true;
@@ -246,12 +344,32 @@ SymbolValue constructor_interpret_call(Constructor* con, ExpressionCall* e) {
 	} else if (callee.method_type == METHOD_MARK_CLEAN) {
 		con->current_build_command->marked_clean_explicitly = true;
 		build_command_mark_all_children_dirty(con->current_build_command, false);
+	} else if (callee.method_type == METHOD_CACHE) {
+		if (e->argc < 1 || e->argc > 2) {
+			constructor_error(con, e->token, "cache method takes a directory and an optional size");
+			return nill;
+		}
+		SymbolValue dir = constructor_evaluate(con, e->args[0]);
+		con->cache_dir = dir.string;
+		if (e->argc == 2) {
+			SymbolValue size = constructor_evaluate(con, e->args[1]);
+			if (size.type != SYMBOL_VALUE_STRING || !compile_cache_parse_size(size.string, &con->cache_size)) {
+				constructor_error(con, e->token, "invalid cache size, expected bytes or a K, M or G suffix");
+				return nill;
+			}
+		}
 	}
 	return nill;
 }
 
 
 SymbolValue constructor_lookup_variable(Constructor* con, StringView sv, Expression* e) {
+	SymbolValue* variable = e ? environment_lookup(con->current_environment, e->variable.id) : NULL;
+	if (variable) {
+		return *variable;
+	}
+
+	// not assigned anywhere, a bare word is a method or a string
 	SymbolValue val = {0};
 	val.string.items = sv.items;
 	val.string.count = sv.count;
@@ -291,49 +409,68 @@ SymbolValue constructor_interpret_method_build(Constructor* con, ExpressionCall*
 	};
 }
 
-// NOTE: we have to wait for all the descriptions to end to run this,
-// otherwise we might miss the compiler change
-void constructor_expand_build_command_targets(Constructor* con, BuildCommand* bc) {
+inline static void path_start(StringBuilder* path, StringView dir, StringView name) {
+	path->count = 0;
+	if (dir.count > 0) {
+		da_append_many(path, dir.items, dir.count);
+		da_append(path, '/');
+	}
+	da_append_many(path, name.items, name.count);
+}
+
+inline static PathId path_intern_with(StringBuilder* path, const char* suffix) {
+	StringView sv = { .items = path->items, .count = path->count };
+	if (!suffix) return path_intern(sv);
+	size_t base = path->count;
+	da_append_many(path, suffix, strlen(suffix));
+	PathId id = path_intern(sv_from_sb(*path));
+	path->count = base;
+	return id;
+}
+
+static void constructor_expand_targets(Constructor* con, BuildCommand* bc, StringBuilder* path) {
+	const char* source_ext = NULL;
+	const char* header_ext = NULL;
+	StringView family = build_command_compiler_family(bc);
+	if ((family.count == 2 && strncmp(family.items, "cc", 2) == 0) ||
+		(family.count == 3 && strncmp(family.items, "gcc", 3) == 0) ||
+		(family.count == 5 && strncmp(family.items, "clang", 5) == 0)
+	) {
+		source_ext = ".c";
+		// TODO: check if it exists first
+		header_ext = ".h";
+	} else if (family.count == 3 && strncmp(family.items, "g++", 3) == 0) {
+		source_ext = ".cpp";
+		// TODO: check if it exists first, it could also be .hpp
+		header_ext = ".h";
+	}
+	bool depfile = bc->build_type == BUILD_OBJECT && build_command_supports_depfile(bc);
+
 	for (size_t i = 0; i < bc->targets.count; ++i) {
 		Target* t = &bc->targets.items[i];
 
-		t->input_name.count = 0;
-		if (bc->source_dir.count > 0) {
-			da_append_many_arena(&con->arena, &t->input_name, bc->source_dir.items, bc->source_dir.count);
-			da_append_arena(&con->arena, &t->input_name, '/');
-		}
-		da_append_many_arena(&con->arena, &t->input_name, t->name.items, t->name.count);
-		da_append_many_arena(&con->arena, &t->header_file, t->input_name.items, t->input_name.count);
-		if ((bc->compiler.count == 3 && strncmp(bc->compiler.items, "cc", 2) == 0) ||
-			(bc->compiler.count == 3 && strncmp(bc->compiler.items, "gcc", 3) == 0) ||
-			(bc->compiler.count == 5 && strncmp(bc->compiler.items, "clang", 5) == 0)
-		) {
-			da_append_many_arena(&con->arena, &t->input_name, ".c", 2);
-			// TODO: check if it exists first
-			da_append_many_arena(&con->arena, &t->header_file, ".h", 2);
-		} else if (bc->compiler.count == 3 && strncmp(bc->compiler.items, "g++", 3) == 0) {
-			da_append_many_arena(&con->arena, &t->input_name, ".cpp", 4);
-			// TODO: check if it exists first, it could also be .hpp
-			da_append_many_arena(&con->arena, &t->header_file, ".h", 2);
-		}
+		path_start(path, bc->source_dir, t->name);
+		t->input = path_intern_with(path, source_ext);
+		t->header = path_intern_with(path, header_ext);
 
-		t->output_name.count = 0;
-
-		if (bc->output_dir.count > 0) {
-			da_append_many_arena(&con->arena, &t->output_name, bc->output_dir.items, bc->output_dir.count);
-			da_append_arena(&con->arena, &t->output_name, '/');
-		}
-		da_append_many_arena(&con->arena, &t->output_name, t->name.items, t->name.count);
-		if (bc->build_type == BUILD_OBJECT) {
-			da_append_many_arena(&con->arena, &t->output_name, ".o", 2);
-		}
+		path_start(path, bc->output_dir, t->name);
+		t->depfile = depfile ? path_intern_with(path, ".d") : PATH_NONE;
+		t->output = path_intern_with(path, bc->build_type == BUILD_OBJECT ? ".o" : NULL);
 
 		if (bc->parent) {
-			da_append_arena(&con->arena, &bc->parent->input_objects, sv_from_sb(t->output_name));
+			da_append_arena(&con->arena, &bc->parent->input_objects, path_get(t->output));
 		}
 	}
 
 	for (size_t i = 0; i < bc->children.count; ++i) {
-		constructor_expand_build_command_targets(con, bc->children.items[i]);
+		constructor_expand_targets(con, bc->children.items[i], path);
 	}
 }
+
+// NOTE: we have to wait for all the descriptions to end to run this,
+// otherwise we might miss the compiler change
+void constructor_expand_build_command_targets(Constructor* con, BuildCommand* bc) {
+	StringBuilder path = {0};
+	constructor_expand_targets(con, bc, &path);
+	sb_free(&path);
+}
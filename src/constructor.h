@@ -1,14 +1,33 @@
 #pragma once
 #include "symbol.h"
 #include "build_command.h"
+#include "build_state.h"
 
 typedef struct {
 	Arena arena;
+	Arena scratch;  // temporaries of the dirty analysis
 	bool had_error;
 	Environment*  current_environment;
 	BuildCommand* current_build_command;
 	Statement*    current_statement;
+	BuildState*   state;
+
+	// set by cache(), applies to the whole build
+	StringView cache_dir;
+	uint64_t   cache_size;
 } Constructor;
+
+// a target together with the build command it belongs to
+typedef struct {
+	BuildCommand* bc;
+	Target* target;
+} TargetRef;
+
+typedef struct {
+	TargetRef* items;
+	size_t count;
+	size_t capacity;
+} TargetRefList;
 // TODO: keep track of the current Cookfile, for better error messages
 
 Constructor constructor_new(Statement*);
@@ -16,6 +35,8 @@ Constructor constructor_new(Statement*);
 BuildCommand* constructor_construct_build_command(Constructor*);
 
 void constructor_analyze(Constructor*, BuildCommand*);
+void constructor_settle(BuildCommand* root);
+void constructor_reanalyze(Constructor*, BuildCommand* root, TargetRef* refs, size_t count);
 
 
 void constructor_error(Constructor* con, Token token, const char* error_cstr);
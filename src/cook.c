@@ -1,15 +1,46 @@
 #include "cook.h"
 #include "arena.h"
 #include "build_command.h"
+#include "compile_cache.h"
 #include "constructor.h"
 #include "executer.h"
+#include "file.h"
 #include "lexer.h"
 #include "parser.h"
 #include "interpreter.h"
+#include "stat_cache.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
 
+// rows of each table of --report
+#define COOK_REPORT_COUNT 10
 
-int cook(CookOptions op) {
-	Lexer lexer = lexer_new(op.source);
+// --watch: for every file id of the watcher, the targets that are built from it
+typedef struct Dependents {
+	TargetRefList* items;
+	size_t count;
+	size_t capacity;
+} Dependents;
+
+// everything one evaluation of the Cookfile produces, --watch keeps it between builds
+typedef struct Cook {
+	CookOptions op;
+	StringBuilder source;  // the Cookfile as re-read by --watch
+	Lexer lexer;
+	Parser parser;
+	Constructor constructor;
+	BuildState state;
+	BuildCommand* root;
+	CompileCache cache;
+	Executer e;
+	Watcher* watcher;
+	Dependents dependents;
+} Cook;
+
+static void cook_load(Cook* c) {
+	CookOptions op = c->op;
+	c->lexer = lexer_new(op.source);
 
 	if (op.verbose > 3) {
 		printf("[file] dump:\n");
@@ -17,49 +48,329 @@ int cook(CookOptions op) {
 	}
 	if (op.verbose > 2) {
 		printf("[lexer] dump:\n");
-		lexer_dump(&lexer);
+		lexer_dump(&c->lexer);
 	}
 
-	Parser parser = parser_new(&lexer);
-	Statement* root_statement = parser_parse_all(&parser);
+	// the lexer runs on demand of the parser, so both are one phase
+	PhaseStart start = stats_phase_begin();
+	c->parser = parser_new(&c->lexer);
+	Statement* root_statement = parser_parse_all(&c->parser);
+	stats_phase_end(PHASE_PARSE, start);
 
 	if (op.verbose > 1) {
 		printf("[parser] dump:\n");
 		statement_print(root_statement, 1);
 	}
 
-	Constructor constructor = constructor_new(root_statement);
-	BuildCommand* root_build_command = constructor_construct_build_command(&constructor);
+	c->state = (BuildState){0};
+	c->constructor = constructor_new(root_statement);
+	c->constructor.state = &c->state;
+	c->root = constructor_construct_build_command(&c->constructor);
 
 	if (op.build_all) {
-		build_command_mark_all_children_dirty(root_build_command, true);
+		build_command_mark_all_children_dirty(c->root, true);
 	}
 
 	if (op.verbose > 0) {
 		printf("[cook] build command pretty:\n");
-		build_command_print(root_build_command, 0);
+		build_command_print(c->root, 0);
+	}
+
+	c->e = executer_new(NULL, op.jobs, op.max_load);
+	c->e.state = &c->state;
+	c->e.keep_going = op.keep_going;
+	c->e.verbose = op.verbose;
+
+	c->cache = (CompileCache){0};
+	StringView cache_dir = op.cache_dir.count > 0 ? op.cache_dir : c->constructor.cache_dir;
+	uint64_t cache_size = op.cache_size > 0 ? op.cache_size : c->constructor.cache_size;
+	if (!op.dry_run && cache_dir.count > 0 && compile_cache_open(&c->cache, cache_dir, cache_size)) {
+		c->e.cache = &c->cache;
+	}
+}
+
+static void cook_unload(Cook* c) {
+	compile_cache_close(&c->cache);
+	build_state_close(&c->state);
+	arena_free(&c->parser.arena);
+	intern_free(&c->parser.names);
+	arena_free(&c->constructor.arena);
+	arena_free(&c->constructor.scratch);
+	free(c->e.executed.items);
+	free(c->e.built.items);
+	free(c->e.jobs.items);
+}
+
+typedef bool (*InputVisitor)(Cook* c, BuildCommand* bc, Target* t, StringView path);
+
+// visits every file t is built from, stops as soon as visit returns true
+static bool cook_visit_inputs(Cook* c, BuildCommand* bc, Target* t, InputVisitor visit) {
+	if (visit(c, bc, t, path_get(t->input))) return true;
+	for (size_t i = 0; i < bc->input_files.count; ++i) {
+		if (visit(c, bc, t, bc->input_files.items[i])) return true;
+	}
+	if (t->header != PATH_NONE && visit(c, bc, t, path_get(t->header))) return true;
+
+	DepsRecord* record = deps_log_find(&c->state.deps, path_get(t->output));
+	for (uint32_t i = 0; record && i < record->count; ++i) {
+		if (visit(c, bc, t, intern_get(&c->state.deps.paths, record->inputs[i]))) return true;
+	}
+	return false;
+}
+
+static bool cook_input_changed(Cook* c, BuildCommand* bc, Target* t, StringView path) {
+	(void)bc; (void)t;
+	return watcher_changed(c->watcher, path);
+}
+
+static bool cook_watch_input(Cook* c, BuildCommand* bc, Target* t, StringView path) {
+	uint32_t id = watcher_add(c->watcher, path);
+	if (id == INTERN_NONE) return false;
+
+	while (c->dependents.count <= id) {
+		da_append(&c->dependents, (TargetRefList){0});
+	}
+	TargetRefList* refs = &c->dependents.items[id];
+	// the deps log lists the source again
+	if (refs->count > 0 && refs->items[refs->count - 1].target == t) return false;
+	da_append(refs, ((TargetRef){ .bc = bc, .target = t }));
+	return false;
+}
+
+static void cook_watch_targets(Cook* c, BuildCommand* bc) {
+	for (size_t i = 0; i < bc->targets.count; ++i) {
+		cook_visit_inputs(c, bc, &bc->targets.items[i], cook_watch_input);
+	}
+	for (size_t i = 0; i < bc->children.count; ++i) {
+		cook_watch_targets(c, bc->children.items[i]);
+	}
+}
+
+// watches every input of the tree and indexes which targets read it
+static void cook_watch_tree(Cook* c, BuildCommand* root) {
+	for (size_t i = 0; i < c->dependents.count; ++i) {
+		c->dependents.items[i].count = 0;
+	}
+	cook_watch_targets(c, root);
+}
+
+static void cook_free_dependents(Cook* c) {
+	for (size_t i = 0; i < c->dependents.count; ++i) {
+		free(c->dependents.items[i].items);
+	}
+	free(c->dependents.items);
+	c->dependents = (Dependents){0};
+}
+
+// checks again only the targets that read one of the changed files
+static void cook_reanalyze(Cook* c) {
+	TargetRefList refs = {0};
+	for (size_t i = 0; i < c->watcher->changed.count; ++i) {
+		uint32_t id = intern_find(&c->watcher->files, c->watcher->changed.items[i]);
+		if (id >= c->dependents.count) continue;
+		TargetRefList* dependents = &c->dependents.items[id];
+		da_append_many(&refs, dependents->items, dependents->count);
+	}
+	constructor_reanalyze(&c->constructor, c->root, refs.items, refs.count);
+	free(refs.items);
+}
+
+// the targets whose jobs finished are up to date, failed and cancelled ones stay dirty
+static void cook_settle(Cook* c) {
+	for (size_t i = 0; i < c->e.jobs.count; ++i) {
+		Job* job = &c->e.jobs.items[i];
+		if (job->state != JOB_DONE) continue;
+		job->target->dirty = false;
+		job->target->cause = (DirtyCause){0};
+	}
+	constructor_settle(c->root);
+}
+
+static bool cook_watch_changed(void* ctx) {
+	return watcher_read((Watcher*)ctx);
+}
+
+// a change arrived mid build, the jobs that compile an old version of a changed
+// file are killed, the others are left to finish. a stop signal kills them all.
+static void cook_cancel_stale_jobs(Cook* c) {
+	for (size_t i = 0; i < c->watcher->changed.count; ++i) {
+		stat_cache_invalidate(c->watcher->changed.items[i]);
+	}
+	for (size_t i = 0; i < c->e.jobs.count; ++i) {
+		Job* job = &c->e.jobs.items[i];
+		if (job->state != JOB_RUNNING) continue;
+		if (executer_stopped() || cook_visit_inputs(c, job->bc, job->target, cook_input_changed)) {
+			executer_cancel_job(&c->e, i);
+		}
+	}
+	executer_drain(&c->e);
+}
+
+static bool cook_build(Cook* c) {
+	if (c->op.explain) {
+		build_command_explain(c->root, stdout);
 	}
 
-	Interpreter interpreter = interpreter_new(root_build_command);
+	PhaseStart start = stats_phase_begin();
+	Interpreter interpreter = interpreter_new(c->root);
 	interpreter_interpret(&interpreter);
+	stats_phase_end(PHASE_INTERPRET, start);
 
-	Executer e = executer_new(&interpreter.arena);
+	c->e.arena = &interpreter.arena;
+	bool success = true;
 
-	if (op.dry_run) {
-		if (op.verbose > 0) {
+	if (c->op.dry_run) {
+		if (c->op.verbose > 0) {
 			printf("[cook] build command dump:\n");
 		}
-		build_command_mark_all_children_dirty(root_build_command, true);
-		executer_dry_run(&e, root_build_command);
+		build_command_mark_all_children_dirty(c->root, true);
+		executer_dry_run(&c->e, c->root);
 	} else {
-		executer_execute(&e, root_build_command);
+		success = executer_execute(&c->e, c->root);
+		if (c->e.interrupted) {
+			start = stats_phase_begin();
+			cook_cancel_stale_jobs(c);
+			stats_phase_end(PHASE_EXECUTE, start);
+		}
+		if (c->watcher) {
+			cook_settle(c);
+		}
+
+		if (!c->e.interrupted && success) {
+			start = stats_phase_begin();
+			file_state_save(&c->state.files);
+			stats_phase_end(PHASE_SAVE_STATE, start);
+		}
 	}
+	trace_flush();
 
+	stats_arena("interpreter", &interpreter.arena);
+	c->e.arena = NULL;
 	arena_free(&interpreter.arena);
-	arena_free(&parser.arena);
-	arena_free(&constructor.arena);
-	free(e.executed.items);
-	free(e.built.items);
+	return success;
+}
+
+// takes what --stats needs from the parts that are about to be freed
+static void cook_collect_stats(Cook* c) {
+	stats_arena("parser", &c->parser.arena);
+	stats_arena("constructor", &c->constructor.arena);
+	stats_arena("analysis", &c->constructor.scratch);
+	stats_arena("deps log", &c->state.deps.arena);
+	stats_arena("deps paths", &c->state.deps.paths.arena);
+	stats_arena("build log", &c->state.log.outputs.arena);
+	stats_arena("file state", &c->state.files.paths.arena);
+	stats_arena("paths", path_arena());
+	StatCacheStats sc = stat_cache_stats();
+	stats.stat_cache_hits = sc.hits;
+	stats.stat_cache_misses = sc.misses;
+	stats.compile_cache_enabled = c->e.cache != NULL;
+	stats.compile_cache_hits = c->cache.hits;
+	stats.compile_cache_misses = c->cache.misses;
+}
+
+static void cook_report(Cook* c) {
+	if (c->op.stats) {
+		stats_print(stdout);
+	}
+	if (c->op.stats_json) {
+		stats_write_json(c->op.stats_json);
+	}
+}
+
+// keeps the graph in memory and builds again whenever one of its files changes.
+// a change to the Cookfile itself starts over from lexing it.
+static int cook_watch(Cook* c) {
+	Watcher w = {0};
+	if (!watcher_open(&w)) {
+		return 1;
+	}
+	c->watcher = &w;
+	StringView cookfile = { .items = c->op.cookfile, .count = strlen(c->op.cookfile) };
+
+	executer_watch(&c->e, w.fd, cook_watch_changed, &w);
+	watcher_add(&w, cookfile);
+	cook_watch_tree(c, c->root);
+	cook_build(c);
+	cook_collect_stats(c);
+	cook_report(c);
+
+	// SIGINT and SIGTERM end the loop, the caller cleans up as usual
+	while (!executer_stopped()) {
+		if (!c->e.interrupted) {
+			// the build may have come across new headers
+			cook_watch_tree(c, c->root);
+			printf("[watch] waiting for changes\n");
+			fflush(stdout);
+			bool changed = false;
+			while (!changed && !executer_stopped()) {
+				changed = watcher_wait(&w, executer_signal_fd(), -1);
+			}
+			if (!changed) break;
+		}
+
+		for (size_t i = 0; i < w.changed.count; ++i) {
+			printf("[watch] changed: %.*s\n", (int)w.changed.items[i].count, w.changed.items[i].items);
+			stat_cache_invalidate(w.changed.items[i]);
+		}
+
+		if (watcher_changed(&w, cookfile)) {
+			StringBuilder source = {0};
+			if (!read_entire_file(c->op.cookfile, &source)) {
+				watcher_clear(&w);
+				c->e.interrupted = false;
+				continue;
+			}
+			cook_unload(c);
+			sb_free(&c->source);
+			c->source = source;
+			c->op.source = sv_from_sb(c->source);
+			cook_load(c);
+			executer_watch(&c->e, w.fd, cook_watch_changed, &w);
+			cook_watch_tree(c, c->root);
+		} else {
+			cook_reanalyze(c);
+		}
+
+		watcher_clear(&w);
+		cook_build(c);
+		cook_collect_stats(c);
+		cook_report(c);
+	}
+
+	cook_free_dependents(c);
+	watcher_close(&w);
+	c->watcher = NULL;
 	return 0;
 }
 
+int cook(CookOptions op) {
+	if (op.trace && !trace_open(op.trace)) {
+		return 1;
+	}
+
+	Cook c = { .op = op };
+	cook_load(&c);
+
+	int result = 0;
+	if (op.report) {
+		build_log_report(&c.state.log, stdout, COOK_REPORT_COUNT);
+	} else if (op.deps) {
+		deps_log_report(&c.state.deps, stdout);
+	} else if (op.watch && !op.dry_run) {
+		result = cook_watch(&c);
+	} else {
+		result = cook_build(&c) ? 0 : 1;
+	}
+
+	cook_collect_stats(&c);
+	PhaseStart start = stats_phase_begin();
+	cook_unload(&c);
+	sb_free(&c.source);
+	stat_cache_free();
+	path_pool_free();
+	stats_phase_end(PHASE_CLEANUP, start);
+
+	cook_report(&c);
+	trace_close();
+	return result;
+}
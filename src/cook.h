@@ -2,12 +2,26 @@
 
 #include "da.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct CookOptions {
 	StringView source;
+	const char* cookfile;  // where source was read from
 	int verbose;
 	bool dry_run;
 	bool build_all;
+	bool stats;
+	const char* stats_json; // --stats-json output file, NULL if not wanted
+	bool watch;
+	bool report;           // print what the build log knows instead of building
+	bool deps;             // print what the deps log knows instead of building
+	bool explain;          // print why each dirty target is dirty before building
+	bool keep_going;       // -k: build everything that doesn't depend on a failed command
+	const char* trace;     // --trace output file, NULL if not tracing
+	size_t jobs; // 0 means one per cpu cook may use, adjusted to the load while building
+	double max_load;       // -l: start fewer jobs while the load average is above it, 0 for no cap
+	StringView cache_dir;  // overrides cache() from the Cookfile
+	uint64_t cache_size;   // 0 means the Cookfile's or the default cap
 } CookOptions;
 
 static inline CookOptions cook_options_default(void) {
@@ -15,6 +29,18 @@ static inline CookOptions cook_options_default(void) {
 		.verbose = 0,
 		.dry_run = false,
 		.build_all = false,
+		.stats = false,
+		.stats_json = NULL,
+		.watch = false,
+		.report = false,
+		.deps = false,
+		.explain = false,
+		.keep_going = false,
+		.trace = NULL,
+		.jobs = 0,
+		.max_load = 0,
+		.cache_dir = {0},
+		.cache_size = 0,
 	};
 }
 
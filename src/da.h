@@ -34,10 +34,10 @@
 
 #define da_reserve_arena(arena, da, expected_capacity)                                     \
 	do {                                                                                   \
-		size_t old_size = (da)->capacity;                                                  \
+		size_t old_size = (da)->capacity * sizeof(*(da)->items);                           \
 		if ((expected_capacity) > (da)->capacity) {                                        \
 			if ((da)->capacity == 0) {                                                     \
-				(da)->capacity = 256;                                                      \
+				(da)->capacity = 16;                                                       \
 			}                                                                              \
 			while ((expected_capacity) > (da)->capacity) {                                 \
 				(da)->capacity *= 2;                                                       \
@@ -0,0 +1,75 @@
+#include "depfile.h"
+#include "file.h"
+#include <stdio.h>
+
+void depfile_parse(Arena* arena, StringView content, StringList* deps) {
+	const char* c = content.items;
+	const char* end = content.items + content.count;
+
+	StringBuilder word = {0};
+	bool targets = true; // a rule starts with its targets, up to the word ending in `:`
+
+	while (c < end) {
+		// skip separators and line continuations, a real line break starts the next rule
+		if (*c == '\n') {
+			targets = true;
+			c++;
+			continue;
+		}
+		if (*c == ' ' || *c == '\t' || *c == '\r') {
+			c++;
+			continue;
+		}
+		if (*c == '\\' && c + 1 < end && (c[1] == '\n' || c[1] == '\r')) {
+			c += 2;
+			if (c[-1] == '\r' && c < end && *c == '\n') c++;
+			continue;
+		}
+
+		word.count = 0;
+		while (c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n') {
+			if (*c == '\\' && c + 1 < end && (c[1] == ' ' || c[1] == '#' || c[1] == '\\')) {
+				da_append_arena(arena, &word, c[1]);
+				c += 2;
+			} else if (*c == '\\' && c + 1 < end && (c[1] == '\n' || c[1] == '\r')) {
+				break;
+			} else if (*c == '$' && c + 1 < end && c[1] == '$') {
+				da_append_arena(arena, &word, '$');
+				c += 2;
+			} else {
+				da_append_arena(arena, &word, *c);
+				c++;
+			}
+		}
+
+		if (word.count == 0) continue;
+
+		// `target:` or a lone `:` ends the targets of a rule
+		if (word.items[word.count - 1] == ':') {
+			targets = false;
+			continue;
+		}
+		if (targets) continue;
+
+		StringView dep = { .items = word.items, .count = word.count };
+		da_append_arena(arena, deps, dep);
+		word = (StringBuilder){0};
+	}
+}
+
+bool depfile_read(Arena* arena, StringView path, StringList* deps) {
+	char buf[512];
+	if (path.count >= sizeof(buf)) return false;
+	memcpy(buf, path.items, path.count);
+	buf[path.count] = '\0';
+
+	if (access(buf, F_OK) != 0) return false;
+
+	StringBuilder content = {0};
+	if (!read_entire_file(buf, &content)) {
+		return false;
+	}
+	depfile_parse(arena, sv_from_sb(content), deps);
+	sb_free(&content);
+	return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "arena.h"
+#include "da.h"
+#include <stdbool.h>
+
+// reads the make style dependency files written by `-MMD -MF`.
+// only the prerequisites are collected, the targets of the rules are skipped.
+void depfile_parse(Arena* arena, StringView content, StringList* deps);
+bool depfile_read (Arena* arena, StringView path, StringList* deps);
@@ -0,0 +1,295 @@
+#include "deps_log.h"
+#include "file.h"
+#include <errno.h>
+#include <string.h>
+
+#define DEPS_LOG_SIGNATURE "# cookdeps\n"
+#define DEPS_LOG_SIGNATURE_SIZE (sizeof(DEPS_LOG_SIGNATURE) - 1)
+#define DEPS_LOG_VERSION 2
+#define DEPS_LOG_DEPS_BIT 0x80000000u
+#define DEPS_LOG_MAX_RECORD_SIZE (1u << 20)
+// don't bother compacting small logs
+#define DEPS_LOG_MIN_RECORDS_TO_COMPACT 1000
+
+inline static uint32_t deps_log_read_u32(const char* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void deps_log_set_record(DepsLog* log, uint32_t output, DepsRecord* record) {
+	if (output >= log->records_capacity) {
+		size_t capacity = log->records_capacity == 0 ? 256 : log->records_capacity;
+		while (output >= capacity) capacity *= 2;
+		log->records = realloc(log->records, capacity * sizeof(*log->records));
+		assert(log->records != NULL);
+		memset(log->records + log->records_capacity, 0,
+			(capacity - log->records_capacity) * sizeof(*log->records));
+		log->records_capacity = capacity;
+	}
+	if (!log->records[output]) {
+		log->live_count++;
+	}
+	log->records[output] = record;
+}
+
+bool deps_log_load(DepsLog* log, StringView output_dir) {
+	StringBuilder path = {0};
+	if (output_dir.count > 0) {
+		da_append_many(&path, output_dir.items, output_dir.count);
+		da_append(&path, '/');
+	}
+	da_append_many(&path, DEPS_LOG_FILENAME, strlen(DEPS_LOG_FILENAME));
+	da_append(&path, '\0');
+	log->filepath = path.items;
+
+	if (access(log->filepath, F_OK) != 0) {
+		return true;
+	}
+
+	StringBuilder content = {0};
+	if (!read_entire_file(log->filepath, &content)) {
+		return false;
+	}
+
+	const char* data = content.items;
+	size_t size = content.count;
+	size_t pos = DEPS_LOG_SIGNATURE_SIZE + sizeof(uint32_t);
+
+	if (size < pos
+		|| memcmp(data, DEPS_LOG_SIGNATURE, DEPS_LOG_SIGNATURE_SIZE) != 0
+		|| deps_log_read_u32(data + DEPS_LOG_SIGNATURE_SIZE) != DEPS_LOG_VERSION) {
+		// unknown format, start over
+		log->needs_recompact = true;
+		sb_free(&content);
+		return true;
+	}
+
+	bool corrupt = false;
+	while (pos + sizeof(uint32_t) <= size) {
+		uint32_t header = deps_log_read_u32(data + pos);
+		uint32_t record_size = header & ~DEPS_LOG_DEPS_BIT;
+		pos += sizeof(uint32_t);
+
+		if (record_size > DEPS_LOG_MAX_RECORD_SIZE || pos + record_size > size || record_size % 4 != 0) {
+			corrupt = true;
+			break;
+		}
+
+		const char* record = data + pos;
+		pos += record_size;
+
+		if (header & DEPS_LOG_DEPS_BIT) {
+			if (record_size < 12) { corrupt = true; break; }
+
+			uint32_t path_count = (uint32_t)log->paths.strings.count;
+			uint32_t output = deps_log_read_u32(record);
+			if (output >= path_count) { corrupt = true; break; }
+
+			DepsRecord* r = arena_alloc(&log->arena, sizeof(DepsRecord));
+			memcpy(&r->mtime, record + 4, sizeof(r->mtime));
+			r->count = (record_size - 12) / 4;
+			r->inputs = arena_alloc(&log->arena, r->count * sizeof(uint32_t));
+			memcpy(r->inputs, record + 12, r->count * sizeof(uint32_t));
+			for (uint32_t i = 0; i < r->count; ++i) {
+				if (r->inputs[i] >= path_count) { corrupt = true; break; }
+			}
+			if (corrupt) break;
+
+			deps_log_set_record(log, output, r);
+			log->record_count++;
+		} else {
+			if (record_size < 4) { corrupt = true; break; }
+
+			size_t path_size = record_size - 4;
+			while (path_size > 0 && record[path_size - 1] == '\0') path_size--;
+
+			uint32_t expected_id = (uint32_t)log->paths.strings.count;
+			uint32_t checksum = deps_log_read_u32(record + record_size - 4);
+			if (checksum != ~expected_id) { corrupt = true; break; }
+
+			StringView sv = { .items = record, .count = path_size };
+			if (intern(&log->paths, sv) != expected_id) { corrupt = true; break; }
+		}
+	}
+
+	// drop whatever follows a truncated or broken record
+	if (corrupt || pos != size) {
+		log->needs_recompact = true;
+	}
+	if (log->record_count > DEPS_LOG_MIN_RECORDS_TO_COMPACT && log->record_count > 3 * log->live_count) {
+		log->needs_recompact = true;
+	}
+	log->written_paths = log->paths.strings.count;
+
+	sb_free(&content);
+	return true;
+}
+
+DepsRecord* deps_log_find(DepsLog* log, StringView output) {
+	uint32_t id = intern_find(&log->paths, output);
+	if (id == INTERN_NONE || id >= log->records_capacity) return NULL;
+	return log->records[id];
+}
+
+
+static bool deps_log_write_path(FILE* f, StringView path, uint32_t id) {
+	uint32_t padding = (4 - path.count % 4) % 4;
+	uint32_t size = (uint32_t)path.count + padding + 4;
+	uint32_t checksum = ~id;
+	static const char zeroes[4] = {0};
+
+	return fwrite(&size, 4, 1, f) == 1
+		&& fwrite(path.items, 1, path.count, f) == path.count
+		&& fwrite(zeroes, 1, padding, f) == padding
+		&& fwrite(&checksum, 4, 1, f) == 1;
+}
+
+static bool deps_log_write_deps(FILE* f, uint32_t output, DepsRecord* r) {
+	uint32_t header = (12 + r->count * 4) | DEPS_LOG_DEPS_BIT;
+
+	return fwrite(&header, 4, 1, f) == 1
+		&& fwrite(&output, 4, 1, f) == 1
+		&& fwrite(&r->mtime, 8, 1, f) == 1
+		&& fwrite(r->inputs, 4, r->count, f) == r->count;
+}
+
+// rewrites the file with only the live records and the paths they use
+static bool deps_log_recompact(DepsLog* log) {
+	StringBuilder tmp = {0};
+	da_append_many(&tmp, log->filepath, strlen(log->filepath));
+	da_append_many(&tmp, ".tmp", 5);
+
+	FILE* f = fopen(tmp.items, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][deps_log] could not open %s: %s\n", tmp.items, strerror(errno));
+		free(tmp.items);
+		return false;
+	}
+
+	uint32_t version = DEPS_LOG_VERSION;
+	bool ok = fwrite(DEPS_LOG_SIGNATURE, 1, DEPS_LOG_SIGNATURE_SIZE, f) == DEPS_LOG_SIGNATURE_SIZE
+		&& fwrite(&version, 4, 1, f) == 1;
+
+	InternPool paths = {0};
+	DepsRecord** records = log->records;
+	size_t records_capacity = log->records_capacity;
+	log->records = NULL;
+	log->records_capacity = 0;
+	log->live_count = 0;
+
+	for (size_t output = 0; ok && output < records_capacity; ++output) {
+		DepsRecord* r = records[output];
+		if (!r) continue;
+
+		for (uint32_t i = 0; ok && i <= r->count; ++i) {
+			uint32_t old_id = i < r->count ? r->inputs[i] : (uint32_t)output;
+			StringView sv = intern_get(&log->paths, old_id);
+			size_t count_before = paths.strings.count;
+			uint32_t id = intern(&paths, sv);
+			if (paths.strings.count != count_before) {
+				ok = deps_log_write_path(f, sv, id);
+			}
+			if (i < r->count) r->inputs[i] = id;
+		}
+
+		uint32_t new_output = intern(&paths, intern_get(&log->paths, (uint32_t)output));
+		ok = ok && deps_log_write_deps(f, new_output, r);
+		deps_log_set_record(log, new_output, r);
+	}
+	free(records);
+
+	intern_free(&log->paths);
+	log->paths = paths;
+	log->written_paths = paths.strings.count;
+	log->record_count = log->live_count;
+	log->needs_recompact = false;
+
+	if (fclose(f) != 0) ok = false;
+	if (ok) {
+#ifdef _WIN32
+		remove(log->filepath);
+#endif
+		ok = rename(tmp.items, log->filepath) == 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "[ERROR][deps_log] could not write %s: %s\n", log->filepath, strerror(errno));
+	}
+	free(tmp.items);
+	return ok;
+}
+
+static bool deps_log_open(DepsLog* log) {
+	if (log->file) return true;
+	if (!log->filepath) return false;
+
+	if (log->needs_recompact || access(log->filepath, F_OK) != 0) {
+		if (!deps_log_recompact(log)) return false;
+	}
+
+	log->file = fopen(log->filepath, "ab");
+	if (!log->file) {
+		fprintf(stderr, "[ERROR][deps_log] could not open %s: %s\n", log->filepath, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool deps_log_record(DepsLog* log, StringView output, uint64_t mtime, const StringList* inputs) {
+	// opening may recompact and renumber the paths, so intern after it
+	if (!deps_log_open(log)) return false;
+
+	uint32_t output_id = intern(&log->paths, output);
+
+	DepsRecord* r = arena_alloc(&log->arena, sizeof(DepsRecord));
+	r->mtime = mtime;
+	r->count = (uint32_t)inputs->count;
+	r->inputs = arena_alloc(&log->arena, r->count * sizeof(uint32_t));
+	for (size_t i = 0; i < inputs->count; ++i) {
+		r->inputs[i] = intern(&log->paths, inputs->items[i]);
+	}
+
+	DepsRecord* old = output_id < log->records_capacity ? log->records[output_id] : NULL;
+	if (old && old->mtime == r->mtime && old->count == r->count
+		&& memcmp(old->inputs, r->inputs, r->count * sizeof(uint32_t)) == 0) {
+		return true;
+	}
+	deps_log_set_record(log, output_id, r);
+
+	bool ok = true;
+	for (uint32_t id = (uint32_t)log->written_paths; ok && id < log->paths.strings.count; ++id) {
+		ok = deps_log_write_path(log->file, intern_get(&log->paths, id), id);
+	}
+	log->written_paths = log->paths.strings.count;
+
+	ok = ok && deps_log_write_deps(log->file, output_id, r);
+	ok = ok && fflush(log->file) == 0;
+	log->record_count++;
+	return ok;
+}
+
+void deps_log_report(DepsLog* log, FILE* stream) {
+	for (size_t id = 0; id < log->records_capacity; ++id) {
+		DepsRecord* r = log->records[id];
+		if (!r) continue;
+		StringView output = intern_get(&log->paths, (uint32_t)id);
+		fprintf(stream, "%.*s: %u inputs\n", (int)output.count, output.items, r->count);
+		for (uint32_t i = 0; i < r->count; ++i) {
+			StringView input = intern_get(&log->paths, r->inputs[i]);
+			fprintf(stream, "    %.*s\n", (int)input.count, input.items);
+		}
+	}
+	fprintf(stream, "[deps] %zu outputs, %zu records in %s\n", log->live_count, log->record_count,
+		log->filepath ? log->filepath : DEPS_LOG_FILENAME);
+}
+
+void deps_log_close(DepsLog* log) {
+	if (log->file) {
+		fclose(log->file);
+	}
+	intern_free(&log->paths);
+	arena_free(&log->arena);
+	free(log->records);
+	free(log->filepath);
+	*log = (DepsLog){0};
+}
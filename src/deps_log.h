@@ -0,0 +1,38 @@
+#pragma once
+#include "intern.h"
+#include <stdio.h>
+
+#define DEPS_LOG_FILENAME ".cook_deps"
+
+// header dependencies of every object, folded from the compiler's depfiles into
+// one append only binary file in the output dir.
+//
+// the file is a header followed by records, each starting with a u32:
+//   path record: size, the path padded to 4 bytes with NULs, u32 checksum (~id)
+//   deps record: size | DEPS_LOG_DEPS_BIT, u32 output id, u64 mtime, u32 input ids...
+// paths get ids in the order they appear, a later deps record replaces an earlier one.
+typedef struct DepsRecord {
+	uint64_t mtime;     // mtime of the output when the record was written
+	uint32_t count;
+	uint32_t* inputs;
+} DepsRecord;
+
+typedef struct DepsLog {
+	Arena arena;
+	InternPool paths;
+	DepsRecord** records;      // output id -> record, NULL if none
+	size_t records_capacity;
+	size_t record_count;       // deps records in the file, stale ones included
+	size_t live_count;         // outputs with a record
+	size_t written_paths;      // paths with ids below this are in the file
+	char* filepath;
+	FILE* file;
+	bool needs_recompact;
+} DepsLog;
+
+bool        deps_log_load  (DepsLog* log, StringView output_dir);
+DepsRecord* deps_log_find  (DepsLog* log, StringView output);
+bool        deps_log_record(DepsLog* log, StringView output, uint64_t mtime, const StringList* inputs);
+void        deps_log_close (DepsLog* log);
+// prints every output with a record and its inputs, in the order of their ids
+void        deps_log_report(DepsLog* log, FILE* stream);
@@ -1,36 +1,183 @@
 #include "executer.h"
 #include "file.h"
 #include "build_command.h"
+#include "compile_cache.h"
+#include "depfile.h"
+#include "hash.h"
+#include "stat_cache.h"
 #include "target.h"
+#include "stats.h"
+#include "trace.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 
+#ifdef _WIN32
+	#include <windows.h>
+	#include <sys/types.h>
+	#include <sys/stat.h>
+#else
+	#include <sys/stat.h>
+	#include <time.h>
+#endif
+
+#ifdef _WIN32
 #define CMD_LINE_MAX 2000
+// gcc and clang read more arguments from an @file, a build command whose shared
+// arguments render longer than this passes them through one, and so does any command
+// that would not fit in CMD_LINE_MAX otherwise. only those move, the compiler, cflags
+// and the target's own paths stay in the command line.
+#define RESPONSE_FILE_THRESHOLD (CMD_LINE_MAX / 2)
 
+// the caller made sure line fits, a cut command is never run
 static inline int execute_line(const char* line) {
-#ifdef _WIN32
-		char full_command[CMD_LINE_MAX + 16];
-		snprintf(full_command, sizeof(full_command), "cmd /C \"%s\"", line);
-		return system(full_command);
+	char full_command[CMD_LINE_MAX + 16];
+	int n = snprintf(full_command, sizeof(full_command), "cmd /C \"%s\"", line);
+	if (n < 0 || (size_t)n >= sizeof(full_command)) return -1;
+	return system(full_command);
+}
 #else
-	return system(line);
-#endif
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <signal.h>
+	#include <spawn.h>
+	#include <sys/resource.h>
+	#include <sys/wait.h>
+
+extern char** environ;
+
+// far below ARG_MAX, long link lines stop being copied into every spawn. shorter
+// shared arguments are still passed in the argv, like the compiler and cflags.
+#define RESPONSE_FILE_THRESHOLD (32 * 1024)
+
+// no shell in between, the compiler is started straight from the argv. its stdout
+// and stderr share one pipe, so what it prints can be shown in one piece.
+// with own_group it leads a new process group, which a cancel kills as a whole.
+static inline long execute_cmd_async(Cmd cmd, bool own_group, int* output_fd) {
+	int fds[2];
+	if (pipe(fds) != 0) return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	if (own_group) {
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+		posix_spawnattr_setpgroup(&attr, 0);
+	}
+
+	pid_t pid = 0;
+	int err = posix_spawnp(&pid, cmd.items[0], &actions, &attr, (char* const*)cmd.items, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+	if (err != 0) {
+		close(fds[0]);
+		errno = err;
+		return -1;
+	}
+	*output_fd = fds[0];
+	return (long)pid;
 }
+#endif
 
-Executer executer_new(Arena* arena) {
+// max_jobs 0 sizes the build from the cpus and lets it adapt to the load
+Executer executer_new(Arena* arena, size_t max_jobs, double max_load) {
 	Executer e = {0};
 	e.arena = arena;
+	e.max_jobs = max_jobs > 0 ? max_jobs : load_cpu_count();
+	e.load = load_controller_new(e.max_jobs, max_load, max_jobs == 0);
+	e.watch_fd = -1;
+#ifndef _WIN32
+	const char* term = getenv("TERM");
+	bool terminal = term && strcmp(term, "dumb") != 0;
+	e.progress = terminal && isatty(STDOUT_FILENO);
+	e.color = e.progress && isatty(STDERR_FILENO) && getenv("NO_COLOR") == NULL;
+#endif
 	return e;
 }
 
-void execute_build_command(Executer* e, BuildCommand* bc, bool execute_lines) {
+
+inline static void job_index_list_add_unique(Arena* arena, JobIndexList* list, size_t index) {
+	for (size_t i = 0; i < list->count; ++i) {
+		if (list->items[i] == index) return;
+	}
+	da_append_arena(arena, list, index);
+}
+
+static void fingerprint_set_add(Arena* arena, FingerprintSet* set, uint64_t fingerprint, size_t index) {
+	// keep the load factor under a half
+	if ((set->count + 1) * 2 > set->slot_count) {
+		size_t slot_count = set->slot_count == 0 ? 256 : set->slot_count * 2;
+		FingerprintSlot* slots = arena_alloc(arena, slot_count * sizeof(FingerprintSlot));
+		memset(slots, 0, slot_count * sizeof(FingerprintSlot));
+		for (size_t i = 0; i < set->slot_count; ++i) {
+			FingerprintSlot slot = set->slots[i];
+			if (slot.index == 0) continue;
+			size_t j = slot.fingerprint & (slot_count - 1);
+			while (slots[j].index != 0) j = (j + 1) & (slot_count - 1);
+			slots[j] = slot;
+		}
+		set->slots = slots;
+		set->slot_count = slot_count;
+	}
+
+	size_t i = fingerprint & (set->slot_count - 1);
+	while (set->slots[i].index != 0) i = (i + 1) & (set->slot_count - 1);
+	set->slots[i] = (FingerprintSlot){ .fingerprint = fingerprint, .index = index + 1 };
+	set->count++;
+}
+
+// the next slot after *cursor with this fingerprint, NULL once there is none.
+// *cursor starts at SIZE_MAX.
+static FingerprintSlot* fingerprint_set_next(FingerprintSet* set, uint64_t fingerprint, size_t* cursor) {
+	if (set->slot_count == 0) return NULL;
+	size_t i = *cursor == SIZE_MAX ? fingerprint & (set->slot_count - 1) : (*cursor + 1) & (set->slot_count - 1);
+	for (; set->slots[i].index != 0; i = (i + 1) & (set->slot_count - 1)) {
+		if (set->slots[i].fingerprint == fingerprint) {
+			*cursor = i;
+			return &set->slots[i];
+		}
+	}
+	return NULL;
+}
+
+static bool executer_was_executed(Executer* e, BuildCommand* bc) {
+	size_t cursor = SIZE_MAX;
+	FingerprintSlot* slot;
+	while ((slot = fingerprint_set_next(&e->executed_set, bc->fingerprint, &cursor))) {
+		if (build_command_is_same(bc, e->executed.items[slot->index - 1])) return true;
+	}
+	return false;
+}
+
+// the job that already builds t, or SIZE_MAX
+static size_t executer_find_built(Executer* e, Target* t) {
+	size_t cursor = SIZE_MAX;
+	FingerprintSlot* slot;
+	while ((slot = fingerprint_set_next(&e->built_set, t->fingerprint, &cursor))) {
+		if (target_is_same(t, e->built.items[slot->index - 1])) return slot->index - 1;
+	}
+	return SIZE_MAX;
+}
+
+// walks the build command tree in the old serial order and turns every dirty target
+// into a job. the jobs of the children become the dependencies of the parent's targets.
+// `frontier` receives the jobs that a parent of bc has to wait for.
+void executer_plan(Executer* e, BuildCommand* bc, JobIndexList* frontier, bool create_dirs) {
 	if (!bc || !bc->dirty) {
 		return;
 	}
 
 	// create output dir
-	if (execute_lines) {
+	if (create_dirs) {
 		StringBuilder sb = {0};
 		da_append_many(&sb, bc->output_dir.items, bc->output_dir.count);
 		da_append(&sb,'\0');
@@ -40,71 +187,829 @@ void execute_build_command(Executer* e, BuildCommand* bc, bool execute_lines) {
 		free(sb.items);
 	}
 
+	JobIndexList deps = {0};
 	for (size_t i = 0; i < bc->children.count; ++i) {
-		execute_build_command(e, bc->children.items[i], execute_lines);
+		executer_plan(e, bc->children.items[i], &deps, create_dirs);
 	}
 
-	bool already_executed = false;
-	for (size_t b = 0; b < e->executed.count; ++b) {
-		if (build_command_is_same(bc, e->executed.items[b])) already_executed = true;
+	size_t frontier_before = frontier->count;
+
+	bool already_executed = executer_was_executed(e, bc);
+	if (!already_executed) {
+		fingerprint_set_add(e->arena, &e->executed_set, bc->fingerprint, e->executed.count);
+		da_append(&e->executed, bc);
 	}
-	if (already_executed) return;
-	da_append(&e->executed, bc);
 
-	
 	for (size_t i = 0; i < bc->targets.count; ++i) {
 		Target* t = &bc->targets.items[i];
 		if (!t->dirty) continue;
 
-		bool already_built = false;
-		for (size_t b = 0; b < e->built.count; ++b) {
-			if (target_is_same(t, e->built.items[b])) already_built = true;
+		// e->built and e->jobs grow together, so the index of a built target is its job
+		size_t built = executer_find_built(e, t);
+		if (built != SIZE_MAX) {
+			job_index_list_add_unique(e->arena, frontier, built);
+			continue;
 		}
-		if (already_built) continue;
+		if (already_executed) continue;
+		fingerprint_set_add(e->arena, &e->built_set, t->fingerprint, e->built.count);
 		da_append(&e->built, t);
 
-		StringBuilder sb = target_generate_cmdline_cstr(e->arena, bc, t);
+		Job job = {
+			.bc = bc,
+			.target = t,
+			.state = JOB_WAITING,
+			.pending = deps.count,
+			.output_fd = -1,
+		};
+		size_t index = e->jobs.count;
+		da_append(&e->jobs, job);
+		for (size_t d = 0; d < deps.count; ++d) {
+			da_append_arena(e->arena, &e->jobs.items[deps.items[d]].dependents, index);
+		}
+		job_index_list_add_unique(e->arena, frontier, index);
+	}
+
+	// a build command without work of its own still has to hand its children over
+	if (frontier->count == frontier_before) {
+		for (size_t d = 0; d < deps.count; ++d) {
+			job_index_list_add_unique(e->arena, frontier, deps.items[d]);
+		}
+	}
+}
+
+// without a recorded duration, a job is guessed from the size of its source
+#define JOB_GUESS_US_PER_BYTE 20
+#define JOB_GUESS_MIN_US      50000
+
+static uint64_t executer_estimate(Executer* e, Job* job) {
+	if (e->state) {
+		BuildLogEntry* entry = build_log_find(&e->state->log, path_get(job->target->output));
+		if (entry && entry->usage.exit_code == 0 && entry->usage.wall > 0) {
+			return entry->usage.wall;
+		}
+	}
+	uint64_t guess = stat_cache_state_id(job->target->input).size * JOB_GUESS_US_PER_BYTE;
+	return guess > JOB_GUESS_MIN_US ? guess : JOB_GUESS_MIN_US;
+}
+
+// the longest chain of estimated durations from each job to the end of the build.
+// a job is always planned after the jobs it depends on, so one backwards pass does it.
+static void executer_prioritize(Executer* e) {
+	for (size_t i = e->jobs.count; i-- > 0;) {
+		Job* job = &e->jobs.items[i];
+		uint64_t longest = 0;
+		for (size_t d = 0; d < job->dependents.count; ++d) {
+			assert(job->dependents.items[d] > i);
+			Job* dependent = &e->jobs.items[job->dependents.items[d]];
+			if (dependent->priority > longest) longest = dependent->priority;
+		}
+		job->priority = executer_estimate(e, job) + longest;
+	}
+}
+
+// the job on the longest path goes first, ties keep the planned order
+inline static bool executer_ready_before(Executer* e, size_t a, size_t b) {
+	uint64_t pa = e->jobs.items[a].priority, pb = e->jobs.items[b].priority;
+	return pa != pb ? pa > pb : a < b;
+}
+
+static void executer_ready_push(Executer* e, size_t index) {
+	JobIndexList* h = &e->ready;
+	da_append_arena(e->arena, h, index);
+	size_t i = h->count - 1;
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!executer_ready_before(e, h->items[i], h->items[parent])) break;
+		size_t tmp = h->items[parent];
+		h->items[parent] = h->items[i];
+		h->items[i] = tmp;
+		i = parent;
+	}
+}
+
+static size_t executer_ready_pop(Executer* e) {
+	JobIndexList* h = &e->ready;
+	assert(h->count > 0);
+	size_t top = h->items[0];
+	h->items[0] = h->items[--h->count];
+	size_t i = 0;
+	while (true) {
+		size_t l = 2 * i + 1, r = l + 1, m = i;
+		if (l < h->count && executer_ready_before(e, h->items[l], h->items[m])) m = l;
+		if (r < h->count && executer_ready_before(e, h->items[r], h->items[m])) m = r;
+		if (m == i) break;
+		size_t tmp = h->items[m];
+		h->items[m] = h->items[i];
+		h->items[i] = tmp;
+		i = m;
+	}
+	return top;
+}
+
+// pooled paths are NUL terminated
+static const char* executer_output_cstr(Job* job) {
+	return path_get(job->target->output).items;
+}
+
+// folds the depfile the compiler just wrote into the deps log
+static void executer_record_deps(Executer* e, Job* job) {
+	Target* t = job->target;
+	if (!e->state || t->depfile == PATH_NONE) return;
+
+	// the log copies what it keeps, the parsed depfile is thrown away
+	ArenaMark mark = arena_save(e->arena);
+	StringList deps = {0};
+	if (depfile_read(e->arena, path_get(t->depfile), &deps)) {
+		uint64_t mtime = stat_cache_mtime_id(t->output);
+		if (deps_log_record(&e->state->deps, path_get(t->output), mtime, &deps)) {
+			remove(path_get(t->depfile).items);
+		}
+	}
+	arena_restore(e->arena, mark);
+}
+
+static size_t build_command_depth(BuildCommand* bc) {
+	size_t depth = 0;
+	for (BuildCommand* p = bc->parent; p; p = p->parent) depth++;
+	return depth;
+}
+
+static void executer_release_slot(Executer* e, Job* job, int exit_code) {
+	trace_command(job->start_time, job->slot, path_get(job->target->output), job->target->name,
+		build_command_depth(job->bc), exit_code, job->cached);
+	da_append_arena(e->arena, &e->free_slots, job->slot);
+	e->slot_jobs[job->slot] = SIZE_MAX;
+}
+
+static void executer_clear_status(Executer* e) {
+	if (!e->status_shown) return;
+	printf("\r\x1b[K");
+	e->status_shown = false;
+}
+
+// the progress line on a terminal, the job that started or ended last
+static void executer_show_status(Executer* e, Job* job) {
+	StringView output = path_get(job->target->output);
+	printf("\r[%zu/%zu] %.*s\x1b[K", e->finished, e->total, (int)output.count, output.items);
+	fflush(stdout);
+	e->status_shown = true;
+}
+
+// a job's output is printed all at once when it ends, so parallel jobs don't mix
+static void executer_report_job(Executer* e, Job* job, int exit_code) {
+	e->finished++;
+	StringView output = path_get(job->target->output);
+	if (exit_code != 0) {
+		executer_clear_status(e);
+		fflush(stdout);
+		fprintf(stderr, "[ERROR][executer] %.*s failed with exit code %d\n$ %.*s\n",
+			(int)output.count, output.items, exit_code, (int)job->cmdline.count, job->cmdline.items);
+		if (job->output.count > 0) {
+			fwrite(job->output.items, 1, job->output.count, stderr);
+		}
+		fflush(stderr);
+	} else {
+		if (e->verbose == 0 && (!e->progress || job->output.count > 0)) {
+			executer_clear_status(e);
+			printf("[%zu/%zu] %.*s\n", e->finished, e->total, (int)output.count, output.items);
+		}
+		if (job->output.count > 0) {
+			fwrite(job->output.items, 1, job->output.count, stdout);
+		}
+	}
+	if (e->verbose == 0 && e->progress) {
+		executer_show_status(e, job);
+	}
+	fflush(stdout);
+	job->output = (StringBuilder){0};
+}
+
+// everything that depends on a failed job can't be built anymore
+static void executer_skip_dependents(Executer* e, Job* job) {
+	for (size_t i = 0; i < job->dependents.count; ++i) {
+		Job* d = &e->jobs.items[job->dependents.items[i]];
+		if (d->state != JOB_WAITING) continue;
+		d->state = JOB_SKIPPED;
+		executer_skip_dependents(e, d);
+	}
+}
+
+// fail fast, the running jobs are killed and leave nothing behind
+static void executer_cancel_running(Executer* e) {
+	for (size_t s = 0; s < e->max_jobs; ++s) {
+		if (e->slot_jobs[s] != SIZE_MAX) {
+			executer_cancel_job(e, e->slot_jobs[s]);
+		}
+	}
+}
+
+static void executer_finish_job(Executer* e, size_t index, int exit_code) {
+	Job* job = &e->jobs.items[index];
+	executer_release_slot(e, job, exit_code);
+	executer_report_job(e, job, exit_code);
+	stat_cache_invalidate_id(job->target->output);
+	job->usage.wall = (stats_clock() - job->started) / 1000;
+	job->usage.exit_code = exit_code;
+	if (exit_code != 0) {
+		job->state = JOB_FAILED;
+		e->failed = true;
+		e->failures++;
+		if (e->state) {
+			build_log_record(&e->state->log, path_get(job->target->output), 0, job->usage);
+		}
+		executer_skip_dependents(e, job);
+		if (!e->keep_going) {
+			executer_cancel_running(e);
+		}
+		return;
+	}
+	job->state = JOB_DONE;
+	if (job->cacheable && job->phase == JOB_PHASE_COMPILE) {
+		compile_cache_store(e->cache, job->cache_key, executer_output_cstr(job));
+	}
+	executer_record_deps(e, job);
+	if (e->state) {
+		build_log_record(&e->state->log, path_get(job->target->output), job->command_hash, job->usage);
+	}
+	for (size_t i = 0; i < job->dependents.count; ++i) {
+		Job* d = &e->jobs.items[job->dependents.items[i]];
+		if (--d->pending == 0) {
+			executer_ready_push(e, job->dependents.items[i]);
+		}
+	}
+}
+
+static void executer_job_exited(Executer* e, size_t index, int exit_code);
+
+// compilers only color what goes to a terminal, the pipe has to ask for it.
+// the flag is left out of the command line, so it doesn't cause rebuilds.
+static Cmd executer_color_cmd(Executer* e, Job* job, Cmd cmd) {
+	if (!e->color || !build_command_supports_depfile(job->bc)) return cmd;
+	Cmd colored = {0};
+	da_reserve_arena(e->arena, &colored, cmd.count + 2);
+	memcpy(colored.items, cmd.items, cmd.count * sizeof(*cmd.items));
+	colored.count = cmd.count;
+	colored.items[colored.count++] = "-fdiagnostics-color=always";
+	colored.items[colored.count] = NULL;
+	return colored;
+}
+
+// a response file that already holds these bytes is left alone, so its mtime
+// only changes along with the arguments
+static bool executer_file_holds(const char* path, StringView content) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+	char* buffer = malloc(content.count + 1);
+	size_t n = fread(buffer, 1, content.count + 1, f);
+	fclose(f);
+	bool same = n == content.count && memcmp(buffer, content.items, content.count) == 0;
+	free(buffer);
+	return same;
+}
+
+// the @file with the tail of bc's commands, written once per build and shared by
+// all of its targets. it is named after bc's first output, so changed arguments
+// overwrite it instead of leaving the old one behind.
+static const char* executer_response_file(Executer* e, BuildCommand* bc) {
+	size_t cursor = SIZE_MAX;
+	FingerprintSlot* slot;
+	while ((slot = fingerprint_set_next(&e->response_set, bc->fingerprint, &cursor))) {
+		ResponseFile* r = &e->responses.items[slot->index - 1];
+		if (r->bc == bc || build_command_is_same(r->bc, bc)) return r->arg;
+	}
+
+	StringView output = path_get(bc->targets.items[0].output);
+	StringBuilder sb = {0};
+	da_append_arena(e->arena, &sb, '@');
+	da_append_many_arena(e->arena, &sb, output.items, output.count);
+	da_append_many_arena(e->arena, &sb, ".rsp", 5);
+
+	const char* path = sb.items + 1;
+	StringView tail = bc->cmd.tail_line;
+	if (!executer_file_holds(path, tail)) {
+		FILE* f = fopen(path, "wb");
+		if (!f) {
+			fprintf(stderr, "[ERROR][executer] could not open %s: %s\n", path, strerror(errno));
+			return NULL;
+		}
+		bool ok = fwrite(tail.items, 1, tail.count, f) == tail.count;
+		ok = fclose(f) == 0 && ok;
+		if (!ok) {
+			fprintf(stderr, "[ERROR][executer] could not write %s: %s\n", path, strerror(errno));
+			return NULL;
+		}
+	}
+
+	fingerprint_set_add(e->arena, &e->response_set, bc->fingerprint, e->responses.count);
+	da_append_arena(e->arena, &e->responses, ((ResponseFile){ .bc = bc, .arg = sb.items }));
+	return sb.items;
+}
+
+// the tail of every command of bc comes last, even with -E put in front,
+// so it can be swapped for the response file
+static Cmd executer_response_cmd(Executer* e, Job* job, Cmd cmd, bool force) {
+	CmdTemplate* tmpl = &job->bc->cmd;
+	if (!tmpl->ready || (!force && tmpl->tail_line.count < RESPONSE_FILE_THRESHOLD)) return cmd;
+	if (!build_command_supports_depfile(job->bc)) return cmd;
+	assert(cmd.count >= tmpl->tail.count);
+
+	const char* response = executer_response_file(e, job->bc);
+	if (!response) return cmd;
+
+	Cmd shorter = {0};
+	size_t keep = cmd.count - tmpl->tail.count;
+	da_reserve_arena(e->arena, &shorter, keep + 2);
+	memcpy(shorter.items, cmd.items, keep * sizeof(*cmd.items));
+	shorter.count = keep;
+	shorter.items[shorter.count++] = response;
+	shorter.items[shorter.count] = NULL;
+	return shorter;
+}
+
+// the driver forks cc1, as and ld, killing only the driver leaves them running.
+// --watch handles SIGINT itself and kills every job, so there each job gets its own
+// process group. otherwise the jobs stay in cook's group, where ctrl-c reaches them.
+static inline bool executer_groups_jobs(Executer* e) {
+	return e->watch_fd >= 0;
+}
+
+static void executer_spawn(Executer* e, size_t index, Cmd cmd) {
+	Job* job = &e->jobs.items[index];
+	stats.spawns++;
+	Cmd full = cmd;
+	cmd = executer_response_cmd(e, job, full, false);
+	// a preprocessor that ran first was only looking for the cache key
+	job->output.count = 0;
+#ifdef _WIN32
+	StringBuilder sb = cmd_render(e->arena, cmd);
+	if (sb.count > CMD_LINE_MAX) {
+		cmd = executer_response_cmd(e, job, full, true);
+		sb = cmd_render(e->arena, cmd);
+	}
+	if (sb.count > CMD_LINE_MAX) {
+		StringView output = path_get(job->target->output);
+		fprintf(stderr, "[ERROR][executer] the command for %.*s is %zu characters long, cmd.exe takes %d\n",
+			(int)output.count, output.items, sb.count, CMD_LINE_MAX);
+		executer_job_exited(e, index, -1);
+		return;
+	}
+	da_append_arena(e->arena, &sb, '\0');
+	executer_job_exited(e, index, execute_line(sb.items));
+#else
+	job->pid = execute_cmd_async(executer_color_cmd(e, job, cmd), executer_groups_jobs(e), &job->output_fd);
+	if (job->pid < 0) {
+		fprintf(stderr, "[ERROR][executer] could not run %s: %s\n", cmd.items[0], strerror(errno));
+		executer_finish_job(e, index, -1);
+		return;
+	}
+	job->state = JOB_RUNNING;
+	e->running++;
+#endif
+}
+
+// the compile command with -E in front and the object swapped for `output`
+static Cmd executer_preprocess_cmd(Executer* e, Cmd cmd, const char* output) {
+	Cmd pp = {0};
+	da_reserve_arena(e->arena, &pp, cmd.count + 2);
+	for (size_t i = 0; i < cmd.count; ++i) {
+		pp.items[pp.count++] = cmd.items[i];
+		if (i == 0) {
+			pp.items[pp.count++] = "-E";
+		} else if (strcmp(cmd.items[i], "-o") == 0 && i + 1 < cmd.count) {
+			pp.items[pp.count++] = output;
+			++i;
+		}
+	}
+	pp.items[pp.count] = NULL;
+	return pp;
+}
+
+// .i for c and .ii for c++, the compiler picks the language of a preprocessed file
+// by its extension. NULL for other sources, those are not cached.
+static const char* executer_preprocessed_ext(Job* job) {
+	StringView input = path_get(job->target->input);
+	static const char* cxx[] = { ".cpp", ".cc", ".cxx", ".c++", ".C" };
+	if (input.count > 2 && strcmp(input.items + input.count - 2, ".c") == 0) return ".i";
+	for (size_t i = 0; i < sizeof(cxx)/sizeof(cxx[0]); ++i) {
+		size_t len = strlen(cxx[i]);
+		if (input.count > len && strcmp(input.items + input.count - len, cxx[i]) == 0) return ".ii";
+	}
+	return NULL;
+}
+
+static const char* executer_preprocessed_cstr(Executer* e, Job* job) {
+	StringBuilder sb = {0};
+	StringView output = path_get(job->target->output);
+	const char* ext = executer_preprocessed_ext(job);
+	da_append_many_arena(e->arena, &sb, output.items, output.count);
+	da_append_many_arena(e->arena, &sb, ext, strlen(ext) + 1);
+	return sb.items;
+}
+
+// the compile command with the source swapped for the preprocessed file that was
+// hashed, so the object always matches its key even if the source or a header
+// changes in between. the preprocessor already wrote the depfile.
+static Cmd executer_compile_preprocessed_cmd(Executer* e, Job* job, const char* preprocessed) {
+	const char* input = path_get(job->target->input).items;
+	Cmd cmd = {0};
+	da_reserve_arena(e->arena, &cmd, job->cmd.count + 1);
+	for (size_t i = 0; i < job->cmd.count; ++i) {
+		const char* arg = job->cmd.items[i];
+		if (arg == input) {
+			arg = preprocessed;
+		} else if (job->target->depfile != PATH_NONE && strcmp(arg, "-MMD") == 0
+			&& i + 2 < job->cmd.count && strcmp(job->cmd.items[i + 1], "-MF") == 0) {
+			i += 2;
+			continue;
+		}
+		cmd.items[cmd.count++] = arg;
+	}
+	cmd.items[cmd.count] = NULL;
+	return cmd;
+}
+
+static void executer_start_job(Executer* e, size_t index) {
+	Job* job = &e->jobs.items[index];
+	assert(e->free_slots.count > 0);
+	job->slot = e->free_slots.items[--e->free_slots.count];
+	e->slot_jobs[job->slot] = index;
+	job->start_time = trace_now();
+	job->started = stats_clock();
+	job->usage = (CommandUsage){0};
+	job->cacheable = false;
+	job->cmd = target_generate_cmd(e->arena, job->bc, job->target);
+	StringBuilder sb = target_generate_cmdline(e->arena, job->bc, job->target);
+	job->command_hash = hash_bytes(sb.items, sb.count, HASH_SEED);
+	job->cmdline = (StringView){ .items = sb.items, .count = sb.count };
+	if (e->verbose > 0) {
+		executer_clear_status(e);
+		printf("$ %.*s\n", (int)sb.count, sb.items);
+		fflush(stdout);
+	} else if (e->progress) {
+		executer_show_status(e, job);
+	}
+
+	if (job->cmd.count == 0) {
+		executer_finish_job(e, index, -1);
+		return;
+	}
+
+	// only compilers that understand -E and -MMD can be cached
+	if (e->cache && job->bc->build_type == BUILD_OBJECT && build_command_supports_depfile(job->bc)
+		&& executer_preprocessed_ext(job)) {
+		job->phase = JOB_PHASE_PREPROCESS;
+		executer_spawn(e, index, executer_preprocess_cmd(e, job->cmd, executer_preprocessed_cstr(e, job)));
+		return;
+	}
+	job->phase = JOB_PHASE_COMPILE;
+	executer_spawn(e, index, job->cmd);
+}
+
+// the preprocessor also wrote the depfile, so a hit is a finished job.
+// on a miss or a preprocessor error the real compile runs and reports as usual.
+static void executer_finish_preprocess(Executer* e, size_t index, int exit_code) {
+	Job* job = &e->jobs.items[index];
+	const char* preprocessed = executer_preprocessed_cstr(e, job);
+
+	bool hit = false;
+	if (exit_code == 0 && compile_cache_key(e->cache, job->cmd, preprocessed, &job->cache_key)) {
+		job->cacheable = true;
+		hit = compile_cache_fetch(e->cache, job->cache_key, executer_output_cstr(job));
+	} else {
+		e->cache->misses++;
+	}
+
+	if (hit) {
+		remove(preprocessed);
+		job->cached = true;
+		executer_finish_job(e, index, 0);
+		return;
+	}
+	job->phase = JOB_PHASE_COMPILE;
+	if (job->cacheable) {
+		executer_spawn(e, index, executer_compile_preprocessed_cmd(e, job, preprocessed));
+		return;
+	}
+	remove(preprocessed);
+	executer_spawn(e, index, job->cmd);
+}
+
+static void executer_job_exited(Executer* e, size_t index, int exit_code) {
+	Job* job = &e->jobs.items[index];
+	if (job->cancelled) {
+		executer_release_slot(e, job, exit_code);
+		job->output = (StringBuilder){0};
+		// whatever it left behind was built from stale inputs
+		if (job->phase == JOB_PHASE_PREPROCESS || job->cacheable) {
+			remove(executer_preprocessed_cstr(e, job));
+		}
+		remove(executer_output_cstr(job));
+		stat_cache_invalidate_id(job->target->output);
+		job->state = JOB_WAITING;
+		return;
+	}
+	if (job->phase == JOB_PHASE_PREPROCESS) {
+		executer_finish_preprocess(e, index, exit_code);
+	} else {
+		if (job->cacheable) {
+			remove(executer_preprocessed_cstr(e, job));
+		}
+		executer_finish_job(e, index, exit_code);
+	}
+}
 
-		if (execute_lines) {
-			printf("$ %.*s\n", (int)sb.count, sb.items);
-			int ret = execute_line(sb.items);
-			if (ret != 0) break;
+#ifndef _WIN32
+inline static uint64_t timeval_us(struct timeval tv) {
+	return (uint64_t)tv.tv_sec * 1000000ull + (uint64_t)tv.tv_usec;
+}
+
+// reads what the job printed so far, the pipe is closed once it hits the end
+static void executer_read_output(Executer* e, Job* job) {
+	char buffer[4096];
+	while (job->output_fd >= 0) {
+		ssize_t n = read(job->output_fd, buffer, sizeof(buffer));
+		if (n > 0) {
+			da_append_many_arena(e->arena, &job->output, buffer, (size_t)n);
+		} else if (n < 0 && errno == EINTR) {
+			continue;
 		} else {
-			printf("%.*s\n", (int)sb.count, sb.items);
+			if (n == 0 || errno != EAGAIN) {
+				close(job->output_fd);
+				job->output_fd = -1;
+			}
+			return;
 		}
 	}
 }
 
-void executer_dry_run(Executer* e, BuildCommand* root) {
-	e->built.count = 0;
-	e->executed.count = 0;
-	execute_build_command(e, root, false);
+static void executer_reap(Executer* e, pid_t pid, int status, struct rusage* ru) {
+	for (size_t s = 0; s < e->max_jobs; ++s) {
+		size_t i = e->slot_jobs[s];
+		if (i == SIZE_MAX) continue;
+		Job* job = &e->jobs.items[i];
+		if (job->state != JOB_RUNNING || job->pid != (long)pid) continue;
+		e->running--;
+
+		// whatever is left, a process it started may still hold the pipe open
+		executer_read_output(e, job);
+		if (job->output_fd >= 0) {
+			close(job->output_fd);
+			job->output_fd = -1;
+		}
+
+		job->usage.user += timeval_us(ru->ru_utime);
+		job->usage.system += timeval_us(ru->ru_stime);
+#ifdef __APPLE__
+		uint64_t max_rss = (uint64_t)ru->ru_maxrss / 1024;
+#else
+		uint64_t max_rss = (uint64_t)ru->ru_maxrss;
+#endif
+		if (max_rss > job->usage.max_rss) job->usage.max_rss = max_rss;
+
+		int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		executer_job_exited(e, i, exit_code);
+		return;
+	}
 }
 
-void executer_execute(Executer* e, BuildCommand* root) {
-	e->built.count = 0;
-	e->executed.count = 0;
-	execute_build_command(e, root, true);
+// SIGCHLD is turned into a readable pipe, so exits can be polled next to the
+// outputs of the running jobs and watch_fd
+static int executer_sigchld_pipe[2] = { -1, -1 };
+
+static void executer_on_sigchld(int sig) {
+	(void)sig;
+	int saved = errno;
+	char c = 0;
+	ssize_t n = write(executer_sigchld_pipe[1], &c, 1);
+	(void)n;
+	errno = saved;
 }
 
+// in watch mode SIGINT and SIGTERM are written to the same pipe, so the build or
+// the wait for changes wakes up and cook can stop and clean up normally
+static volatile sig_atomic_t executer_stop_signal = 0;
 
+static void executer_on_stop(int sig) {
+	executer_stop_signal = sig;
+	executer_on_sigchld(sig);
+}
 
+static bool executer_sigchld_open(void) {
+	if (executer_sigchld_pipe[0] >= 0) return true;
+	if (pipe(executer_sigchld_pipe) != 0) {
+		fprintf(stderr, "[ERROR][executer] pipe failed: %s\n", strerror(errno));
+		return false;
+	}
+	for (int i = 0; i < 2; ++i) {
+		fcntl(executer_sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+		fcntl(executer_sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	struct sigaction sa = {0};
+	sa.sa_handler = executer_on_sigchld;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+	return true;
+}
 
+// waits until a job exits, a job prints something or, with `watch`, watch_fd changes.
+// while the load controller holds jobs back, it also wakes up to sample again.
+static void executer_wait(Executer* e, bool watch) {
+	struct pollfd* fds = e->pollfds;
+	fds[0] = (struct pollfd){ .fd = executer_sigchld_pipe[0], .events = POLLIN };
+	fds[1] = (struct pollfd){ .fd = watch ? e->watch_fd : -1, .events = POLLIN };
+	for (size_t s = 0; s < e->max_jobs; ++s) {
+		size_t i = e->slot_jobs[s];
+		int fd = i == SIZE_MAX ? -1 : e->jobs.items[i].output_fd;
+		fds[2 + s] = (struct pollfd){ .fd = fd, .events = POLLIN };
+	}
 
+	// jobs are ready but the load limit keeps them waiting, wake up to sample again
+	bool held_back = (e->keep_going || !e->failed) && e->ready.count > 0 && e->running >= e->load.limit;
+	int timeout = held_back ? LOAD_SAMPLE_INTERVAL_MS : -1;
+	if (poll(fds, (nfds_t)(e->max_jobs + 2), timeout) < 0) {
+		if (errno == EINTR) return;
+		fprintf(stderr, "[ERROR][executer] poll failed: %s\n", strerror(errno));
+		e->running = 0;
+		e->failed = true;
+		return;
+	}
+	for (size_t s = 0; s < e->max_jobs; ++s) {
+		if (fds[2 + s].revents != 0) {
+			executer_read_output(e, &e->jobs.items[e->slot_jobs[s]]);
+		}
+	}
+	if (fds[0].revents & POLLIN) {
+		char buffer[64];
+		while (read(executer_sigchld_pipe[0], buffer, sizeof(buffer)) > 0) {}
+		int status = 0;
+		struct rusage ru = {0};
+		pid_t pid;
+		while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+			executer_reap(e, pid, status, &ru);
+		}
+		if (executer_stop_signal) {
+			e->interrupted = true;
+		}
+	}
+	if ((fds[1].revents & POLLIN) && e->watch_changed(e->watch_ctx)) {
+		e->interrupted = true;
+	}
+}
+#endif
+
+void executer_watch(Executer* e, int fd, bool (*changed)(void* ctx), void* ctx) {
 #ifdef _WIN32
-	#include <windows.h>
-	#include <sys/types.h>
-	#include <sys/stat.h>
+	(void)e; (void)fd; (void)changed; (void)ctx;
 #else
-	#include <sys/stat.h>
-	#include <time.h>
+	if (!executer_sigchld_open()) return;
+	e->watch_fd = fd;
+	e->watch_changed = changed;
+	e->watch_ctx = ctx;
+
+	struct sigaction sa = {0};
+	sa.sa_handler = executer_on_stop;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 #endif
+}
 
-uint64_t get_modification_time(const char *path_cstr) {
+bool executer_stopped(void) {
+#ifdef _WIN32
+	return false;
+#else
+	return executer_stop_signal != 0;
+#endif
+}
+
+int executer_signal_fd(void) {
+#ifdef _WIN32
+	return -1;
+#else
+	return executer_sigchld_pipe[0];
+#endif
+}
+
+void executer_cancel_job(Executer* e, size_t index) {
+	Job* job = &e->jobs.items[index];
+	if (job->state != JOB_RUNNING || job->cancelled) return;
+	job->cancelled = true;
+#ifndef _WIN32
+	pid_t pid = (pid_t)job->pid;
+	kill(executer_groups_jobs(e) ? -pid : pid, SIGTERM);
+#endif
+}
+
+void executer_drain(Executer* e) {
+#ifndef _WIN32
+	while (e->running > 0) {
+		executer_wait(e, false);
+	}
+#else
+	(void)e;
+#endif
+}
+
+static void executer_reset(Executer* e) {
+	e->built.count = 0;
+	e->executed.count = 0;
+	e->jobs.count = 0;
+	// these live in the arena, which --watch cleans between builds
+	e->executed_set = (FingerprintSet){0};
+	e->built_set = (FingerprintSet){0};
+	e->responses = (ResponseFileList){0};
+	e->response_set = (FingerprintSet){0};
+	e->ready = (JobIndexList){0};
+	e->free_slots = (JobIndexList){0};
+	e->running = 0;
+	e->failed = false;
+	e->failures = 0;
+	e->interrupted = false;
+}
+
+void executer_dry_run(Executer* e, BuildCommand* root) {
+	executer_reset(e);
+	JobIndexList frontier = {0};
+	executer_plan(e, root, &frontier, false);
+
+	for (size_t i = 0; i < e->jobs.count; ++i) {
+		Job* job = &e->jobs.items[i];
+		StringBuilder sb = target_generate_cmdline_cstr(e->arena, job->bc, job->target);
+		printf("%.*s\n", (int)sb.count, sb.items);
+	}
+}
+
+bool executer_execute(Executer* e, BuildCommand* root) {
+	executer_reset(e);
+	PhaseStart start = stats_phase_begin();
+	JobIndexList frontier = {0};
+	executer_plan(e, root, &frontier, true);
+	executer_prioritize(e);
+	stats_phase_end(PHASE_PLAN, start);
+
+	// popped from the back, slot 0 goes out first
+	e->slot_jobs = arena_alloc(e->arena, e->max_jobs * sizeof(*e->slot_jobs));
+	for (size_t s = e->max_jobs; s-- > 0;) {
+		da_append_arena(e->arena, &e->free_slots, s);
+		e->slot_jobs[s] = SIZE_MAX;
+	}
+#ifndef _WIN32
+	e->pollfds = arena_alloc(e->arena, (e->max_jobs + 2) * sizeof(*e->pollfds));
+	if (!executer_sigchld_open()) return false;
+#endif
+	e->total = e->jobs.count;
+	e->finished = 0;
+	e->status_shown = false;
+
+	start = stats_phase_begin();
+	for (size_t i = 0; i < e->jobs.count; ++i) {
+		if (e->jobs.items[i].pending == 0) {
+			executer_ready_push(e, i);
+		}
+	}
+
+	while (true) {
+		// without -k no new work is handed out after the first failure, the jobs
+		// that were running are killed and waited for
+		size_t limit = load_controller_update(&e->load);
+		while ((e->keep_going || !e->failed) && !e->interrupted
+			&& e->ready.count > 0 && e->running < limit) {
+			executer_start_job(e, executer_ready_pop(e));
+		}
+		if (e->running == 0 || e->interrupted) break;
+#ifndef _WIN32
+		executer_wait(e, e->watch_fd >= 0);
+#endif
+	}
+
+	stats_phase_end(PHASE_EXECUTE, start);
+	if (e->status_shown) {
+		printf("\n");
+		e->status_shown = false;
+	}
+	if (e->failed) {
+		size_t not_built = 0;
+		for (size_t i = 0; i < e->jobs.count; ++i) {
+			JobState state = e->jobs.items[i].state;
+			if (state != JOB_DONE && state != JOB_FAILED) not_built++;
+		}
+		fprintf(stderr, "[ERROR][executer] %zu command%s failed, %zu target%s not built%s\n",
+			e->failures, e->failures == 1 ? "" : "s", not_built, not_built == 1 ? "" : "s",
+			e->keep_going ? "" : ", use -k to build everything that doesn't depend on a failure");
+	}
+	return !e->failed && !e->interrupted;
+}
+
+
+FileState get_file_state(const char *path_cstr) {
+	FileState fs = {0};
+	stats.stat_calls++;
 #ifdef _WIN32
 	WIN32_FILE_ATTRIBUTE_DATA attr;
 	if (!GetFileAttributesExA(path_cstr, GetFileExInfoStandard, &attr)) {
-		return 0;
+		return fs;
 	}
 
 	FILETIME ft = attr.ftLastWriteTime;
@@ -112,20 +1017,30 @@ uint64_t get_modification_time(const char *path_cstr) {
 	ull.LowPart  = ft.dwLowDateTime;
 	ull.HighPart = ft.dwHighDateTime;
 
-	return (ull.QuadPart - 116444736000000000ULL) / 10000000ULL;
+	// 100ns intervals since 1601
+	fs.mtime = (ull.QuadPart - 116444736000000000ULL) * 100ULL;
+	fs.size  = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
 #else
 	struct stat st;
 	if (stat(path_cstr, &st) != 0) {
-		return 0;
+		return fs;
 	}
-	return (uint64_t)st.st_mtime;
+#ifdef __APPLE__
+	fs.mtime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ULL + (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+	fs.mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
 #endif
+	fs.size  = (uint64_t)st.st_size;
+	fs.inode = (uint64_t)st.st_ino;
+#endif
+	return fs;
+}
+
+// in nanoseconds, 0 if the file does not exist
+uint64_t get_modification_time(const char *path_cstr) {
+	return get_file_state(path_cstr).mtime;
 }
 
 uint64_t get_modification_time_sv(StringView path) {
-	char buf[512];
-	assert(path.count < sizeof(buf));
-	memcpy(buf, path.items, path.count);
-	buf[path.count] = '\0';
-	return get_modification_time(buf);
+	return stat_cache_mtime(path);
 }
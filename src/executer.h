@@ -1,5 +1,9 @@
 #pragma once
 #include "build_command.h"
+#include "build_state.h"
+#include "compile_cache.h"
+#include "load.h"
+#include "stat_cache.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -9,18 +13,136 @@ typedef struct {
 	size_t capacity;
 } BuiltList;
 
+typedef struct {
+	size_t* items;
+	size_t count;
+	size_t capacity;
+} JobIndexList;
+
+typedef enum JobState {
+	JOB_WAITING,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_FAILED,
+	JOB_SKIPPED,               // something it depends on failed
+} JobState;
+
+// a cached object compile first runs the preprocessor to find its cache key
+typedef enum JobPhase {
+	JOB_PHASE_COMPILE,
+	JOB_PHASE_PREPROCESS,
+} JobPhase;
+
+// one node of the build graph, a single target of a build command.
+// a job can start once all the jobs it depends on are done.
+typedef struct Job {
+	BuildCommand* bc;
+	Target* target;
+	JobState state;
+	size_t pending;            // number of unfinished dependencies
+	uint64_t priority;         // µs on the longest estimated path through it to the end
+	JobIndexList dependents;   // jobs waiting on this one
+	long pid;
+	uint64_t command_hash;
+	Cmd cmd;
+	StringView cmdline;        // what it was hashed as, printed when it fails
+	int output_fd;             // read end of its stdout and stderr, -1 once closed
+	StringBuilder output;      // everything it printed, shown when it ends
+	JobPhase phase;
+	bool cacheable;            // the key is known, store the object once it is built
+	CacheKey cache_key;
+	bool cancelled;            // killed by --watch or because another job failed
+	bool cached;               // restored from the compile cache
+	size_t slot;               // which of the max_jobs slots it runs in
+	uint64_t start_time;       // for --trace
+	uint64_t started;          // stats_clock when it was started
+	CommandUsage usage;        // of all its phases together, goes to the build log
+} Job;
+
+typedef struct {
+	Job* items;
+	size_t count;
+	size_t capacity;
+} JobList;
+
+typedef struct FingerprintSlot {
+	uint64_t fingerprint;
+	size_t index;              // + 1 into the list the set indexes, 0 is an empty slot
+} FingerprintSlot;
+
+// open addressing set over `executed` or `built`, keyed by fingerprint
+typedef struct FingerprintSet {
+	FingerprintSlot* slots;
+	size_t slot_count;
+	size_t count;
+} FingerprintSet;
+
+// an @file argument and the build command whose shared arguments it holds
+typedef struct ResponseFile {
+	BuildCommand* bc;
+	const char* arg;
+} ResponseFile;
+
+typedef struct {
+	ResponseFile* items;
+	size_t count;
+	size_t capacity;
+} ResponseFileList;
+
 typedef struct {
 	BuildCommandList executed;
 	BuiltList built;
+	FingerprintSet executed_set;
+	FingerprintSet built_set;
+	ResponseFileList responses;
+	FingerprintSet response_set;  // build command fingerprint to responses
+	JobList jobs;
+	JobIndexList ready;        // heap of job indices, the longest critical path on top
+	JobIndexList free_slots;
+	size_t* slot_jobs;         // which job runs in each slot, SIZE_MAX for a free one
+	struct pollfd* pollfds;    // the sigchld pipe, watch_fd and one output per slot
 	Arena* arena;
+	BuildState* state;
+	CompileCache* cache;       // NULL when caching is off
+	size_t max_jobs;
+	LoadController load;       // how many of the max_jobs slots may be used right now
+	size_t running;
+	bool failed;
+	bool keep_going;           // -k: a failure only stops the jobs that depend on it
+	size_t failures;           // commands that failed
+
+	// without --verbose a job prints a [done/total] line instead of its command,
+	// on a terminal that line is rewritten in place
+	int verbose;
+	bool progress;             // stdout is a terminal
+	bool color;                // so the compilers are asked for colored diagnostics
+	bool status_shown;         // the progress line is on screen and has no newline yet
+	size_t finished;
+	size_t total;
+
+	// --watch: while jobs run, watch_fd is polled too and a relevant change
+	// stops the build early, the caller decides what happens to running jobs
+	int watch_fd;
+	bool (*watch_changed)(void* ctx);
+	void* watch_ctx;
+	bool interrupted;
 } Executer;
 
-Executer executer_new(Arena* arena);
+Executer executer_new(Arena* arena, size_t max_jobs, double max_load);
 void executer_dry_run(Executer* e, BuildCommand* root);
-void executer_execute(Executer* e, BuildCommand* root);
+bool executer_execute(Executer* e, BuildCommand* root);
 
+void executer_watch     (Executer* e, int fd, bool (*changed)(void* ctx), void* ctx);
+void executer_cancel_job(Executer* e, size_t index);
+void executer_drain     (Executer* e);
+// whether SIGINT or SIGTERM arrived since executer_watch
+bool executer_stopped   (void);
+// readable once a signal arrived, for waiting outside of a build
+int  executer_signal_fd (void);
+
+
+FileState get_file_state(const char *path_cstr);
 
 uint64_t get_modification_time_sv(StringView path);
 uint64_t get_modification_time(const char *path_cstr);
 
-
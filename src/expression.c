@@ -37,6 +37,10 @@ void expression_print(Expression* expr, int indent) {
 		case EXPR_VARIABLE:
 			printf("variable: %.*s\n", (int)expr->variable.name.str.count, expr->variable.name.str.items);
 			break;
+		case EXPR_ASSIGNMENT:
+			printf("assignment: %.*s\n", (int)expr->assignment.name.str.count, expr->assignment.name.str.items);
+			expression_print(expr->assignment.value, indent + 2);
+			break;
 		case EXPR_LITERAL_INT:
 			printf("literal int: %d\n", expr->literal_int.value);
 			break;
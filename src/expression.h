@@ -1,6 +1,7 @@
 #pragma once
 #include "da.h"
 #include "token.h"
+#include <stdint.h>
 #include <stdio.h>
 
 typedef enum ExpressionType {
@@ -22,6 +23,7 @@ typedef struct Expression Expression;
 
 typedef struct {
 	Token name;
+	uint32_t id;    // of name, interned by the parser
 	Expression* value;
 } ExpressionAssignment;
 
@@ -61,6 +63,7 @@ typedef struct {
 
 typedef struct {
 	Token name;
+	uint32_t id;    // of name, interned by the parser
 } ExpressionVariable;
 
 typedef struct {
@@ -0,0 +1,204 @@
+#include "file_state.h"
+#include "executer.h"
+#include "file.h"
+#include "hash.h"
+#include <errno.h>
+#include <stdio.h>
+
+#define FILE_STATE_SIGNATURE "# cookstate\n"
+#define FILE_STATE_SIGNATURE_SIZE (sizeof(FILE_STATE_SIGNATURE) - 1)
+#define FILE_STATE_VERSION 1
+#define FILE_STATE_ENTRY_SIZE (5 * sizeof(uint64_t))
+
+inline static bool file_state_same(FileState a, FileState b) {
+	return a.mtime == b.mtime && a.size == b.size && a.inode == b.inode;
+}
+
+static FileSnapshot* file_state_snapshot(FileStateDb* db, StringView path) {
+	uint32_t id = intern(&db->paths, path);
+	if (id >= db->capacity) {
+		size_t capacity = db->capacity == 0 ? 1024 : db->capacity;
+		while (id >= capacity) capacity *= 2;
+		db->items = realloc(db->items, capacity * sizeof(FileSnapshot));
+		assert(db->items != NULL);
+		memset(db->items + db->capacity, 0, (capacity - db->capacity) * sizeof(FileSnapshot));
+		db->capacity = capacity;
+	}
+	return &db->items[id];
+}
+
+static bool file_state_hash_file(const char* path_cstr, uint64_t* hash) {
+	StringBuilder content = {0};
+	if (!read_entire_file(path_cstr, &content)) {
+		return false;
+	}
+	*hash = hash_bytes(content.items, content.count, HASH_SEED);
+	sb_free(&content);
+	return true;
+}
+
+bool file_state_load(FileStateDb* db, StringView output_dir) {
+	StringBuilder path = {0};
+	if (output_dir.count > 0) {
+		da_append_many(&path, output_dir.items, output_dir.count);
+		da_append(&path, '/');
+	}
+	da_append_many(&path, FILE_STATE_FILENAME, strlen(FILE_STATE_FILENAME));
+	da_append(&path, '\0');
+	db->filepath = path.items;
+
+	if (access(db->filepath, F_OK) != 0) {
+		return true;
+	}
+
+	StringBuilder content = {0};
+	if (!read_entire_file(db->filepath, &content)) {
+		return false;
+	}
+
+	const char* data = content.items;
+	size_t size = content.count;
+	size_t pos = FILE_STATE_SIGNATURE_SIZE + sizeof(uint32_t);
+
+	uint32_t version = 0;
+	if (size >= pos) memcpy(&version, data + FILE_STATE_SIGNATURE_SIZE, sizeof(version));
+	if (size < pos || memcmp(data, FILE_STATE_SIGNATURE, FILE_STATE_SIGNATURE_SIZE) != 0
+		|| version != FILE_STATE_VERSION) {
+		sb_free(&content);
+		return true;
+	}
+
+	while (pos + sizeof(uint32_t) <= size) {
+		uint32_t path_size;
+		memcpy(&path_size, data + pos, sizeof(path_size));
+		pos += sizeof(uint32_t);
+		if (pos + path_size + FILE_STATE_ENTRY_SIZE > size) break;
+
+		StringView sv = { .items = data + pos, .count = path_size };
+		pos += path_size;
+
+		uint64_t fields[5];
+		memcpy(fields, data + pos, FILE_STATE_ENTRY_SIZE);
+		pos += FILE_STATE_ENTRY_SIZE;
+
+		FileSnapshot* s = file_state_snapshot(db, sv);
+		s->state.mtime = fields[0];
+		s->state.size  = fields[1];
+		s->state.inode = fields[2];
+		s->hash        = fields[3];
+		s->recorded    = fields[4] != 0;
+	}
+	db->saved = get_file_state(db->filepath).mtime;
+
+	sb_free(&content);
+	return true;
+}
+
+// whether path changed since an output written at `since` was built from it.
+// the path is remembered as an input, and snapshotted by file_state_save.
+bool file_state_changed(FileStateDb* db, StringView path, uint64_t since) {
+	FileState now = stat_cache_state(path);
+	FileSnapshot* s = file_state_snapshot(db, path);
+	if (!s->tracked || !file_state_same(s->seen, now)) {
+		s->seen = now;
+		s->seen_hashed = false;
+	}
+	s->tracked = true;
+
+	if (now.mtime == 0 || since == 0) return false;
+	// a run that failed somewhere may have built the output from content that was
+	// never snapshotted, and reverting the input would otherwise look unchanged
+	if (!s->recorded || since > db->saved) return now.mtime > since;
+	if (file_state_same(s->state, now)) return false;
+
+	if (!s->seen_hashed) {
+		// interned strings are NUL terminated
+		StringView interned = intern_get(&db->paths, intern_find(&db->paths, path));
+		if (!file_state_hash_file(interned.items, &s->seen_hash)) return true;
+		s->seen_hashed = true;
+	}
+	return s->seen_hash != s->hash;
+}
+
+static bool file_state_write(FileStateDb* db) {
+	StringBuilder tmp = {0};
+	da_append_many(&tmp, db->filepath, strlen(db->filepath));
+	da_append_many(&tmp, ".tmp", 5);
+
+	FILE* f = fopen(tmp.items, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][file_state] could not open %s: %s\n", tmp.items, strerror(errno));
+		free(tmp.items);
+		return false;
+	}
+
+	uint32_t version = FILE_STATE_VERSION;
+	bool ok = fwrite(FILE_STATE_SIGNATURE, 1, FILE_STATE_SIGNATURE_SIZE, f) == FILE_STATE_SIGNATURE_SIZE
+		&& fwrite(&version, sizeof(version), 1, f) == 1;
+
+	for (size_t id = 0; ok && id < db->paths.strings.count; ++id) {
+		FileSnapshot* s = &db->items[id];
+		if (!s->recorded) continue;
+		StringView sv = db->paths.strings.items[id];
+		uint32_t path_size = (uint32_t)sv.count;
+		uint64_t fields[5] = { s->state.mtime, s->state.size, s->state.inode, s->hash, 1 };
+		ok = fwrite(&path_size, sizeof(path_size), 1, f) == 1
+			&& fwrite(sv.items, 1, sv.count, f) == sv.count
+			&& fwrite(fields, FILE_STATE_ENTRY_SIZE, 1, f) == 1;
+	}
+
+	if (fclose(f) != 0) ok = false;
+	if (ok) {
+#ifdef _WIN32
+		remove(db->filepath);
+#endif
+		ok = rename(tmp.items, db->filepath) == 0;
+	}
+	if (ok) {
+		db->saved = get_file_state(db->filepath).mtime;
+	}
+	if (!ok) {
+		fprintf(stderr, "[ERROR][file_state] could not write %s: %s\n", db->filepath, strerror(errno));
+	}
+	free(tmp.items);
+	return ok;
+}
+
+// call only after a fully successful build, every target is then up to date
+// with the inputs as the dirty analysis saw them. the file is written even when no
+// snapshot changed, its mtime tells which outputs the snapshots vouch for.
+bool file_state_save(FileStateDb* db) {
+	if (!db->filepath) return false;
+
+	for (size_t id = 0; id < db->paths.strings.count; ++id) {
+		FileSnapshot* s = &db->items[id];
+		if (!s->tracked) continue;
+
+		const char* path_cstr = db->paths.strings.items[id].items;
+		FileState now = get_file_state(path_cstr);
+
+		// edited while building, the output may have been built from either version
+		if (now.mtime == 0 || !file_state_same(now, s->seen)) {
+			s->recorded = false;
+			continue;
+		}
+		if (s->recorded && file_state_same(s->state, s->seen)) continue;
+
+		if (!s->seen_hashed) {
+			if (!file_state_hash_file(path_cstr, &s->seen_hash)) continue;
+			s->seen_hashed = true;
+		}
+		s->state = s->seen;
+		s->hash = s->seen_hash;
+		s->recorded = true;
+	}
+
+	return file_state_write(db);
+}
+
+void file_state_close(FileStateDb* db) {
+	intern_free(&db->paths);
+	free(db->items);
+	free(db->filepath);
+	*db = (FileStateDb){0};
+}
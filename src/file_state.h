@@ -0,0 +1,33 @@
+#pragma once
+#include "intern.h"
+#include "stat_cache.h"
+
+#define FILE_STATE_FILENAME ".cook_state"
+
+// (mtime, size, inode) and content hash of every input, as it was at the end of the
+// last successful build. a file only counts as changed if that tuple differs and
+// its content hashes differently, so touching or checking out identical content
+// doesn't rebuild anything. an output written after that build may come from other
+// content, such outputs are compared by mtime only.
+typedef struct FileSnapshot {
+	FileState state;      // recorded by the last successful build
+	uint64_t hash;
+	FileState seen;       // what this run's dirty analysis saw
+	uint64_t seen_hash;
+	bool recorded;
+	bool tracked;         // used as an input during this run
+	bool seen_hashed;
+} FileSnapshot;
+
+typedef struct FileStateDb {
+	InternPool paths;
+	FileSnapshot* items;  // path id -> snapshot
+	size_t capacity;
+	char* filepath;
+	uint64_t saved;       // mtime of the file, when the snapshots were last saved
+} FileStateDb;
+
+bool file_state_load   (FileStateDb* db, StringView output_dir);
+bool file_state_changed(FileStateDb* db, StringView path, uint64_t since);
+bool file_state_save   (FileStateDb* db);
+void file_state_close  (FileStateDb* db);
@@ -0,0 +1,16 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_SEED 0xcbf29ce484222325ull
+
+// fnv-1a, chain calls by passing the previous result as the seed
+static inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t h = seed;
+	for (size_t i = 0; i < size; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
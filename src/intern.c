@@ -0,0 +1,76 @@
+#include "intern.h"
+#include "hash.h"
+#include <assert.h>
+#include <string.h>
+
+inline static bool intern_same(StringView a, StringView b) {
+	return a.count == b.count && memcmp(a.items, b.items, a.count) == 0;
+}
+
+static void intern_grow(InternPool* pool) {
+	size_t slot_count = pool->slot_count == 0 ? 1024 : pool->slot_count * 2;
+	uint32_t* slots = calloc(slot_count, sizeof(uint32_t));
+	assert(slots != NULL);
+
+	for (size_t id = 0; id < pool->strings.count; ++id) {
+		StringView sv = pool->strings.items[id];
+		size_t i = hash_bytes(sv.items, sv.count, HASH_SEED) & (slot_count - 1);
+		while (slots[i] != 0) {
+			i = (i + 1) & (slot_count - 1);
+		}
+		slots[i] = (uint32_t)id + 1;
+	}
+
+	free(pool->slots);
+	pool->slots = slots;
+	pool->slot_count = slot_count;
+}
+
+// returns the slot for sv, either holding its id or the empty one it would go into
+inline static size_t intern_slot(InternPool* pool, StringView sv) {
+	size_t i = hash_bytes(sv.items, sv.count, HASH_SEED) & (pool->slot_count - 1);
+	while (pool->slots[i] != 0) {
+		if (intern_same(pool->strings.items[pool->slots[i] - 1], sv)) break;
+		i = (i + 1) & (pool->slot_count - 1);
+	}
+	return i;
+}
+
+uint32_t intern(InternPool* pool, StringView sv) {
+	// keep the load factor under a half
+	if ((pool->strings.count + 1) * 2 > pool->slot_count) {
+		intern_grow(pool);
+	}
+
+	size_t i = intern_slot(pool, sv);
+	if (pool->slots[i] != 0) {
+		return pool->slots[i] - 1;
+	}
+
+	char* copy = arena_alloc(&pool->arena, sv.count + 1);
+	memcpy(copy, sv.items, sv.count);
+	copy[sv.count] = '\0';
+
+	uint32_t id = (uint32_t)pool->strings.count;
+	da_append(&pool->strings, ((StringView){ .items = copy, .count = sv.count }));
+	pool->slots[i] = id + 1;
+	return id;
+}
+
+uint32_t intern_find(InternPool* pool, StringView sv) {
+	if (pool->slot_count == 0) return INTERN_NONE;
+	size_t i = intern_slot(pool, sv);
+	return pool->slots[i] != 0 ? pool->slots[i] - 1 : INTERN_NONE;
+}
+
+StringView intern_get(InternPool* pool, uint32_t id) {
+	assert(id < pool->strings.count);
+	return pool->strings.items[id];
+}
+
+void intern_free(InternPool* pool) {
+	arena_free(&pool->arena);
+	free(pool->strings.items);
+	free(pool->slots);
+	*pool = (InternPool){0};
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "arena.h"
+#include "da.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define INTERN_NONE UINT32_MAX
+
+// stores every distinct string once and hands out dense 32 bit ids for them.
+// equal strings always get the same id, so ids can be compared instead of strings.
+typedef struct InternPool {
+	Arena arena;
+	StringList strings;  // id -> string
+	uint32_t* slots;     // open addressing table of id + 1, 0 is an empty slot
+	size_t slot_count;
+} InternPool;
+
+uint32_t   intern     (InternPool* pool, StringView sv);
+uint32_t   intern_find(InternPool* pool, StringView sv);
+StringView intern_get (InternPool* pool, uint32_t id);
+void       intern_free(InternPool* pool);
@@ -15,7 +15,7 @@ static const SymbolValue nil = { .type = SYMBOL_VALUE_NIL };
 Interpreter interpreter_new(BuildCommand* bc) {
 	Interpreter in = {0};
 	in.root_build_command = bc;
-	in.current_environment = environment_new(&in.arena);
+	in.current_environment = environment_new(&in.arena, NULL);
 	return in;
 }
 
@@ -40,6 +40,11 @@ SymbolValue interpreter_evaluate(Interpreter* in, Expression* e) {
 
 	switch (e->type) {
 		case EXPR_VARIABLE: return interpreter_lookup_variable(in, e->variable.name.str, e);
+		case EXPR_ASSIGNMENT: {
+			SymbolValue value = interpreter_evaluate(in, e->assignment.value);
+			environment_define(&in->arena, in->current_environment, e->assignment.id, value);
+			return value;
+		}
 		case EXPR_CALL:     return interpret_call(in, &e->call);
 		case EXPR_CHAIN:    return interpret_chain(in, &e->chain);
 		case EXPR_LITERAL_STRING: {
@@ -53,18 +58,8 @@ SymbolValue interpreter_evaluate(Interpreter* in, Expression* e) {
 	return (SymbolValue){0};
 }
 
-BuildCommand* statement_find_attached_build_command(Statement* s, BuildCommand* bc) {
-	if (!bc || !s || !bc->body) return NULL;
-	if (bc->body == s)          return bc;
-	for (size_t i = 0; i < bc->children.count; ++i) {
-		BuildCommand* bcc = statement_find_attached_build_command(s, bc->children.items[i]);
-		if (bcc) return bcc;
-	}
-	return NULL;
-}
-
 SymbolValue interpreter_execute(Interpreter* in, Statement* s) {
-	BuildCommand* bc = statement_find_attached_build_command(s, in->root_build_command);
+	BuildCommand* bc = s->attached;
 	if (bc && !bc->dirty && bc->parent != NULL) return nil;
 	//if (bc != in->root_build_command) return nil;
 
@@ -87,9 +82,12 @@ SymbolValue interpret_block(Interpreter* in, StatementBlock*  s) {
 SymbolValue interpret_description(Interpreter* in, StatementDescription* s) {
 	SymbolValue left = interpreter_execute(in, s->statement);
 
+	Environment* scope = in->current_environment;
+	in->current_environment = environment_new(&in->arena, scope);
 	for (size_t i = 0; i < s->block->block.statement_count; ++i) {
 		interpreter_execute(in, s->block->block.statements[i]);
 	}
+	in->current_environment = scope;
 
 	return left;
 }
@@ -129,6 +127,12 @@ SymbolValue interpret_call(Interpreter* in, ExpressionCall* e) {
 
 
 SymbolValue interpreter_lookup_variable(Interpreter* in, StringView sv, Expression* e) {
+	SymbolValue* variable = e ? environment_lookup(in->current_environment, e->variable.id) : NULL;
+	if (variable) {
+		return *variable;
+	}
+
+	// not assigned anywhere, a bare word is a method or a string
 	SymbolValue val = {0};
 	val.string.items = sv.items;
 	val.string.count = sv.count;
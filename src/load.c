@@ -0,0 +1,190 @@
+#include "load.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+#endif
+
+// share of the time some task waited for a cpu, above HIGH the job limit goes
+// down by a quarter, below LOW it goes up by one
+#define LOAD_PRESSURE_HIGH 0.5
+#define LOAD_PRESSURE_LOW  0.2
+
+#ifdef __linux__
+static bool load_read_file(const char* path, char* buffer, size_t size) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+	size_t n = fread(buffer, 1, size - 1, f);
+	fclose(f);
+	buffer[n] = '\0';
+	return n > 0;
+}
+
+// "0-3,8-11" from Cpus_allowed_list
+static size_t load_affinity_count(void) {
+	char status[8192];
+	if (!load_read_file("/proc/self/status", status, sizeof(status))) return 0;
+	const char* list = strstr(status, "Cpus_allowed_list:");
+	if (!list) return 0;
+	list += strlen("Cpus_allowed_list:");
+
+	size_t count = 0;
+	while (*list && *list != '\n') {
+		char* end;
+		long first = strtol(list, &end, 10);
+		if (end == list) {
+			list++;
+			continue;
+		}
+		long last = first;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+		}
+		if (last >= first) count += (size_t)(last - first + 1);
+		list = end;
+	}
+	return count;
+}
+
+// cpus allowed by a "quota period" quota, 0 when unlimited
+static size_t load_quota_cpus(long long quota, long long period) {
+	if (quota <= 0 || period <= 0) return 0;
+	size_t cpus = (size_t)((quota + period - 1) / period);
+	return cpus > 0 ? cpus : 1;
+}
+
+// the smallest cpu.max of cook's cgroup and its parents, cgroup v2 and then v1
+static size_t load_cgroup_count(void) {
+	char buffer[4096];
+	size_t best = 0;
+
+	char path[4096] = "";
+	if (load_read_file("/proc/self/cgroup", buffer, sizeof(buffer))) {
+		char* v2 = strstr(buffer, "0::");
+		if (v2 == buffer || (v2 && v2[-1] == '\n')) {
+			v2 += 3;
+			size_t len = strcspn(v2, "\n");
+			if (len < sizeof(path)) {
+				memcpy(path, v2, len);
+				path[len] = '\0';
+			}
+		}
+	}
+	while (true) {
+		char file[4200];
+		snprintf(file, sizeof(file), "/sys/fs/cgroup%s/cpu.max", strcmp(path, "/") == 0 ? "" : path);
+		long long quota = 0, period = 0;
+		if (load_read_file(file, buffer, sizeof(buffer)) && sscanf(buffer, "%lld %lld", &quota, &period) == 2) {
+			size_t cpus = load_quota_cpus(quota, period);
+			if (cpus > 0 && (best == 0 || cpus < best)) best = cpus;
+		}
+		char* slash = strrchr(path, '/');
+		if (!slash || path[0] == '\0' || strcmp(path, "/") == 0) break;
+		*slash = '\0';
+	}
+
+	char quota[64], period[64];
+	if (best == 0
+		&& load_read_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", quota, sizeof(quota))
+		&& load_read_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us", period, sizeof(period))) {
+		best = load_quota_cpus(atoll(quota), atoll(period));
+	}
+	return best;
+}
+
+// the "total" of the "some" line, µs some task waited for a cpu
+static bool load_cpu_pressure(uint64_t* stalled) {
+	char buffer[512];
+	if (!load_read_file("/proc/pressure/cpu", buffer, sizeof(buffer))) return false;
+	const char* total = strstr(buffer, "total=");
+	if (strncmp(buffer, "some", 4) != 0 || !total) return false;
+	*stalled = strtoull(total + strlen("total="), NULL, 10);
+	return true;
+}
+#else
+static bool load_cpu_pressure(uint64_t* stalled) {
+	(void)stalled;
+	return false;
+}
+#endif
+
+size_t load_cpu_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (size_t)info.dwNumberOfProcessors : 1;
+#else
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t count = online > 0 ? (size_t)online : 1;
+#ifdef __linux__
+	size_t affinity = load_affinity_count();
+	if (affinity > 0 && affinity < count) count = affinity;
+	size_t cgroup = load_cgroup_count();
+	if (cgroup > 0 && cgroup < count) count = cgroup;
+#endif
+	return count;
+#endif
+}
+
+static bool load_average(double* load) {
+#ifdef _WIN32
+	(void)load;
+	return false;
+#else
+	return getloadavg(load, 1) == 1;
+#endif
+}
+
+LoadController load_controller_new(size_t max, double max_load, bool adaptive) {
+	return (LoadController){
+		.max = max,
+		.limit = max,
+		.max_load = max_load,
+		.adaptive = adaptive,
+	};
+}
+
+size_t load_controller_update(LoadController* lc) {
+	if (!lc->adaptive && lc->max_load <= 0) return lc->limit;
+
+	uint64_t now = stats_clock();
+	uint64_t interval = (uint64_t)LOAD_SAMPLE_INTERVAL_MS * 1000000ull;
+	if (lc->sampled != 0 && now - lc->sampled < interval) return lc->limit;
+	uint64_t elapsed_us = (now - lc->sampled) / 1000;
+	bool first = lc->sampled == 0;
+	lc->sampled = now;
+
+	bool contended = false;
+	bool idle = true;
+
+	double load = 0;
+	if (lc->max_load > 0 && load_average(&load)) {
+		if (load >= lc->max_load) contended = true;
+		else if (load + 1 > lc->max_load) idle = false;
+	}
+
+	uint64_t stalled = 0;
+	if (lc->adaptive && load_cpu_pressure(&stalled)) {
+		if (lc->has_stalled && !first && elapsed_us > 0) {
+			double pressure = (double)(stalled - lc->stalled) / (double)elapsed_us;
+			if (pressure > LOAD_PRESSURE_HIGH) contended = true;
+			else if (pressure > LOAD_PRESSURE_LOW) idle = false;
+		}
+		lc->stalled = stalled;
+		lc->has_stalled = true;
+	}
+
+	if (contended) {
+		size_t step = lc->limit / 4 > 0 ? lc->limit / 4 : 1;
+		lc->limit = lc->limit > step ? lc->limit - step : 1;
+	} else if (idle && lc->limit < lc->max) {
+		lc->limit++;
+	}
+	return lc->limit;
+}
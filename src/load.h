@@ -0,0 +1,27 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// how often the load average and cpu pressure are read while a build runs
+#define LOAD_SAMPLE_INTERVAL_MS 1000
+
+// how many jobs may run right now. a build starts with as many as the cpus cook
+// may use, then backs off while the machine is contended and ramps up again
+// once it is idle, never above `max`.
+typedef struct LoadController {
+	size_t max;
+	size_t limit;
+	double max_load;       // -l: back off while the load average is above it, 0 for none
+	bool adaptive;         // follow cpu pressure, off for an explicit -j
+	uint64_t sampled;      // stats_clock of the last sample, 0 before the first
+	uint64_t stalled;      // cpu pressure total at the last sample, µs
+	bool has_stalled;
+} LoadController;
+
+// online cpus, narrowed down by the affinity mask and the cgroup cpu quota
+size_t load_cpu_count(void);
+
+LoadController load_controller_new(size_t max, double max_load, bool adaptive);
+// samples the machine at most every LOAD_SAMPLE_INTERVAL_MS, returns the new limit
+size_t load_controller_update(LoadController* lc);
@@ -1,4 +1,5 @@
 #include "cook.h"
+#include "compile_cache.h"
 #include "file.h"
 #include <stdio.h>
 #include <unistd.h>
@@ -9,11 +10,24 @@ void print_usage(const char* pname) {
 		"usage: %s [options]\n"
 		"\n"
 		"options:\n"
-		"  -h, --help      show this help message\n"
-		"  -f <file>       use specified cookfile\n"
-		"  -B              unconditionally build all\n"
-		"  --verbose       verbose printing\n"
-		"  --dry-run       show the commands that would be run, but don't execute them\n",
+		"  -h, --help            show this help message\n"
+		"  -f <file>             use specified cookfile\n"
+		"  -B                    unconditionally build all\n"
+		"  -j <n>                run <n> jobs in parallel, defaults to the cpus cook may use\n"
+		"                        and follows the load of the machine while building\n"
+		"  -l <load>             start fewer jobs while the load average is above <load>\n"
+		"  -k                    keep going, build everything that doesn't depend on a failed command\n"
+		"  --verbose             verbose printing\n"
+		"  --dry-run             show the commands that would be run, but don't execute them\n"
+		"  --stats               print timings and counters of cook itself at exit\n"
+		"  --stats-json=<file>   write the same statistics to <file> as json\n"
+		"  --watch               stay running and build again whenever an input changes\n"
+		"  --explain             print why each target that gets built is out of date\n"
+		"  --report              list the slowest and most memory hungry targets of past builds\n"
+		"  --deps                list the headers each object depended on when it was last built\n"
+		"  --trace=<file>        write a chrome trace of cook's phases and commands to <file>\n"
+		"  --cache-dir <dir>     reuse object files from a compile cache in <dir>\n"
+		"  --cache-size <size>   cap the compile cache at <size> bytes, K, M or G suffix\n",
 		pname
 	);
 }
@@ -50,10 +64,78 @@ int main(int argc, char** argv) {
 				return 1;
 			}
 			filepath = shift(argv, argc);
+		} else if (strncmp(arg, "-j", 2) == 0) {
+			const char* n = arg + 2;
+			if (*n == '\0') {
+				if (argc == 0) {
+					fprintf(stderr, "[ERROR] expected a job count after -j\n");
+					print_usage(pname);
+					return 1;
+				}
+				n = shift(argv, argc);
+			}
+			int jobs = atoi(n);
+			if (jobs <= 0) {
+				fprintf(stderr, "[ERROR] invalid job count: %s\n", n);
+				return 1;
+			}
+			op.jobs = (size_t)jobs;
+		} else if (strncmp(arg, "-l", 2) == 0) {
+			const char* n = arg + 2;
+			if (*n == '\0') {
+				if (argc == 0) {
+					fprintf(stderr, "[ERROR] expected a load average after -l\n");
+					print_usage(pname);
+					return 1;
+				}
+				n = shift(argv, argc);
+			}
+			char* end = NULL;
+			double load = strtod(n, &end);
+			if (end == n || *end != '\0' || load <= 0) {
+				fprintf(stderr, "[ERROR] invalid load average: %s\n", n);
+				return 1;
+			}
+			op.max_load = load;
+		} else if (strcmp(arg, "-k") == 0) {
+			op.keep_going = true;
 		} else if (strcmp(arg, "-B") == 0) {
 			op.build_all = true;
 		} else if (strcmp(arg, "--dry-run") == 0) {
 			op.dry_run = true;
+		} else if (strcmp(arg, "--stats") == 0) {
+			op.stats = true;
+		} else if (strncmp(arg, "--stats-json=", 13) == 0 && arg[13] != '\0') {
+			op.stats_json = arg + 13;
+		} else if (strcmp(arg, "--watch") == 0) {
+			op.watch = true;
+		} else if (strcmp(arg, "--explain") == 0) {
+			op.explain = true;
+		} else if (strcmp(arg, "--report") == 0) {
+			op.report = true;
+		} else if (strcmp(arg, "--deps") == 0) {
+			op.deps = true;
+		} else if (strncmp(arg, "--trace=", 8) == 0 && arg[8] != '\0') {
+			op.trace = arg + 8;
+		} else if (strcmp(arg, "--cache-dir") == 0) {
+			if (argc == 0) {
+				fprintf(stderr, "[ERROR] expected a directory after --cache-dir\n");
+				print_usage(pname);
+				return 1;
+			}
+			const char* dir = shift(argv, argc);
+			op.cache_dir = (StringView){ .items = dir, .count = strlen(dir) };
+		} else if (strcmp(arg, "--cache-size") == 0) {
+			if (argc == 0) {
+				fprintf(stderr, "[ERROR] expected a size after --cache-size\n");
+				print_usage(pname);
+				return 1;
+			}
+			const char* size = shift(argv, argc);
+			if (!compile_cache_parse_size((StringView){ .items = size, .count = strlen(size) }, &op.cache_size)) {
+				fprintf(stderr, "[ERROR] invalid cache size: %s\n", size);
+				return 1;
+			}
 		} else if (strncmp(arg, "--verbose=", 10) == 0) {
 			op.verbose = arg[10] - '0';
 		} else if (strcmp(arg, "--verbose") == 0) {
@@ -72,14 +154,16 @@ int main(int argc, char** argv) {
 			return 1;
 		}
 		op.source = sv_from_sb(source);
+		op.cookfile = filepath;
 	} else if (access("./Cookfile", F_OK) == 0 && read_entire_file("./Cookfile", &source)) {
 		op.source = sv_from_sb(source);
+		op.cookfile = "./Cookfile";
 	} else {
 		print_usage(pname);
 		return 1;
 	}
 
-	bool result = cook(op);
+	int result = cook(op);
 
 	sb_free(&source);
 	return result;
@@ -0,0 +1,49 @@
+#include "option_list.h"
+#include <string.h>
+
+// most build commands add one or two options, not the 256 of da_reserve_arena
+#define OPTION_LIST_INITIAL_CAPACITY 4
+
+OptionList option_list_inherit(OptionList* parent) {
+	// an empty ancestor adds nothing to the chain, link past it
+	while (parent && parent->local.count == 0) {
+		parent = parent->parent;
+	}
+	return (OptionList){
+		.parent = parent,
+		.parent_count = parent ? parent->count : 0,
+		.count = parent ? parent->count : 0,
+	};
+}
+
+void option_list_append(Arena* arena, OptionList* list, StringView option) {
+	StringList* local = &list->local;
+	if (local->count == local->capacity) {
+		size_t capacity = local->capacity == 0 ? OPTION_LIST_INITIAL_CAPACITY : local->capacity * 2;
+		local->items = arena_realloc(arena, local->items,
+			local->capacity * sizeof(StringView), capacity * sizeof(StringView));
+		assert(local->items != NULL);
+		local->capacity = capacity;
+	}
+	local->items[local->count++] = option;
+	list->count++;
+}
+
+StringView option_list_at(const OptionList* list, size_t index) {
+	assert(index < list->count);
+	while (index < list->parent_count) {
+		list = list->parent;
+	}
+	return list->local.items[index - list->parent_count];
+}
+
+bool option_list_same(const OptionList* a, const OptionList* b) {
+	if (a->count != b->count) return false;
+	// inherited unchanged from the same list
+	if (a->local.count == 0 && b->local.count == 0 && a->parent == b->parent) return true;
+	for (size_t i = 0; i < a->count; ++i) {
+		StringView x = option_list_at(a, i), y = option_list_at(b, i);
+		if (x.count != y.count || memcmp(x.items, y.items, x.count) != 0) return false;
+	}
+	return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "arena.h"
+#include "da.h"
+#include <stdbool.h>
+
+// the flags and dirs a build command inherits from its parent. a child links to
+// the parent's list instead of copying it and only stores what it appends itself,
+// so both can keep growing without writing into each other's arrays.
+typedef struct OptionList {
+	struct OptionList* parent;
+	size_t parent_count;   // how much of the parent was there when it was inherited
+	StringList local;
+	size_t count;          // parent_count + local.count
+} OptionList;
+
+OptionList option_list_inherit(OptionList* parent);
+void       option_list_append (Arena* arena, OptionList* list, StringView option);
+StringView option_list_at     (const OptionList* list, size_t index);
+bool       option_list_same   (const OptionList* a, const OptionList* b);
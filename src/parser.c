@@ -4,6 +4,7 @@
 #include "expression.h"
 #include "lexer.h"
 #include "statement.h"
+#include "stats.h"
 #include "token.h"
 #include <stdio.h>
 
@@ -30,6 +31,7 @@ Expression* parser_arena_alloc_expression(Parser* p) {
 	return (Expression*)arena_alloc(&p->arena, sizeof(Expression));
 }
 Statement* parser_arena_alloc_statement(Parser* p) {
+	stats.statements++;
 	return (Statement*)arena_alloc(&p->arena, sizeof(Statement));
 }
 
@@ -42,6 +44,7 @@ Token parser_advance(Parser* p) {
 	p->previous = p->current;
 	p->current = p->next;
 	p->next = lexer_next_token(p->lexer);
+	if (p->next.type != TOKEN_END) stats.tokens++;
 	return p->previous;
 }
 
@@ -83,6 +86,7 @@ Expression* parse_assignment(Parser* p) {
 			Expression* assign = parser_arena_alloc_expression(p);
 			assign->type = EXPR_ASSIGNMENT;
 			assign->assignment.name = expression->variable.name;
+			assign->assignment.id = expression->variable.id;
 			assign->assignment.value = value;
 			return assign;
 		} else {
@@ -249,6 +253,7 @@ Expression* parse_primary(Parser* p) {
 			Expression* e = parser_arena_alloc_expression(p);
 			e->type = EXPR_VARIABLE;
 			e->variable.name = p->previous;
+			e->variable.id = intern(&p->names, p->previous.str);
 			return e;
 		}
 		case TOKEN_KEYWORD_FALSE: {
@@ -1,5 +1,6 @@
 #pragma once
 #include "arena.h"
+#include "intern.h"
 #include "lexer.h"
 #include "expression.h"
 #include "statement.h"
@@ -10,6 +11,7 @@ typedef struct {
 	Token next;
 	Token previous;
 	Arena arena;
+	InternPool names;  // of every identifier, variables are looked up by id
 	bool had_error;
 } Parser;
 
@@ -0,0 +1,29 @@
+#include "path_pool.h"
+#include "intern.h"
+
+static InternPool path_pool = {0};
+
+PathId path_intern(StringView path) {
+	return intern(&path_pool, path);
+}
+
+PathId path_find(StringView path) {
+	uint32_t id = intern_find(&path_pool, path);
+	return id == INTERN_NONE ? PATH_NONE : id;
+}
+
+StringView path_get(PathId id) {
+	return intern_get(&path_pool, id);
+}
+
+size_t path_count(void) {
+	return path_pool.strings.count;
+}
+
+Arena* path_arena(void) {
+	return &path_pool.arena;
+}
+
+void path_pool_free(void) {
+	intern_free(&path_pool);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "arena.h"
+#include "da.h"
+#include <stdint.h>
+
+// process wide pool of every path cook deals with, targets and the stat cache
+// refer to paths by their 32 bit id. like the stat cache it lives across --watch
+// reloads, a path is stored once no matter how many targets use it.
+typedef uint32_t PathId;
+
+#define PATH_NONE UINT32_MAX
+
+PathId     path_intern(StringView path);
+PathId     path_find  (StringView path);  // PATH_NONE if it was never interned
+StringView path_get   (PathId id);        // NUL terminated
+size_t     path_count (void);
+Arena*     path_arena (void);
+void       path_pool_free(void);
@@ -0,0 +1,73 @@
+#include "stat_cache.h"
+#include "executer.h"
+#include "path_pool.h"
+
+typedef struct StatCacheEntry {
+	FileState state;
+	bool valid;
+} StatCacheEntry;
+
+typedef struct StatCache {
+	StatCacheEntry* entries; // path id -> entry
+	size_t capacity;
+	StatCacheStats stats;
+} StatCache;
+
+static StatCache stat_cache = {0};
+
+static StatCacheEntry* stat_cache_entry(PathId id) {
+	if (id >= stat_cache.capacity) {
+		size_t capacity = stat_cache.capacity == 0 ? 1024 : stat_cache.capacity;
+		while (id >= capacity) capacity *= 2;
+		stat_cache.entries = realloc(stat_cache.entries, capacity * sizeof(StatCacheEntry));
+		assert(stat_cache.entries != NULL);
+		memset(stat_cache.entries + stat_cache.capacity, 0,
+			(capacity - stat_cache.capacity) * sizeof(StatCacheEntry));
+		stat_cache.capacity = capacity;
+	}
+	return &stat_cache.entries[id];
+}
+
+FileState stat_cache_state_id(PathId id) {
+	StatCacheEntry* entry = stat_cache_entry(id);
+	if (entry->valid) {
+		stat_cache.stats.hits++;
+		return entry->state;
+	}
+	stat_cache.stats.misses++;
+	// interned strings are NUL terminated
+	entry->state = get_file_state(path_get(id).items);
+	entry->valid = true;
+	return entry->state;
+}
+
+FileState stat_cache_state(StringView path) {
+	return stat_cache_state_id(path_intern(path));
+}
+
+uint64_t stat_cache_mtime(StringView path) {
+	return stat_cache_state_id(path_intern(path)).mtime;
+}
+
+uint64_t stat_cache_mtime_id(PathId id) {
+	return stat_cache_state_id(id).mtime;
+}
+
+void stat_cache_invalidate_id(PathId id) {
+	if (id != PATH_NONE && id < stat_cache.capacity) {
+		stat_cache.entries[id].valid = false;
+	}
+}
+
+void stat_cache_invalidate(StringView path) {
+	stat_cache_invalidate_id(path_find(path));
+}
+
+StatCacheStats stat_cache_stats(void) {
+	return stat_cache.stats;
+}
+
+void stat_cache_free(void) {
+	free(stat_cache.entries);
+	stat_cache = (StatCache){0};
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "da.h"
+#include "path_pool.h"
+#include <stdint.h>
+
+// process wide cache of file modification times keyed by path id,
+// so every unique path is stat'ed once per build no matter how often it is referenced.
+typedef struct FileState {
+	uint64_t mtime; // nanoseconds, 0 if the file does not exist
+	uint64_t size;
+	uint64_t inode;
+} FileState;
+
+typedef struct StatCacheStats {
+	size_t hits;
+	size_t misses;
+} StatCacheStats;
+
+FileState      stat_cache_state        (StringView path);
+FileState      stat_cache_state_id     (PathId id);
+uint64_t       stat_cache_mtime        (StringView path);
+uint64_t       stat_cache_mtime_id     (PathId id);
+void           stat_cache_invalidate   (StringView path);
+void           stat_cache_invalidate_id(PathId id);
+StatCacheStats stat_cache_stats        (void);
+void           stat_cache_free         (void);
@@ -25,8 +25,11 @@ typedef struct {
 	Statement* block;
 } StatementDescription;
 
+struct BuildCommand;
+
 struct Statement {
 	StatementType type;
+	struct BuildCommand* attached;  // the build command whose body this is, see constructor_attach_statements
 	union {
 		StatementExpression expression;
 		StatementBlock block;
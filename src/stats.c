@@ -0,0 +1,194 @@
+#include "stats.h"
+#include "trace.h"
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/resource.h>
+	#include <time.h>
+#endif
+
+Stats stats = {0};
+
+static const char* phase_names[PHASE_COUNT] = {
+	[PHASE_PARSE]      = "parse",
+	[PHASE_CONSTRUCT]  = "construct",
+	[PHASE_LOAD_STATE] = "load state",
+	[PHASE_ANALYZE]    = "analyze",
+	[PHASE_INTERPRET]  = "interpret",
+	[PHASE_PLAN]       = "plan",
+	[PHASE_EXECUTE]    = "execute",
+	[PHASE_SAVE_STATE] = "save state",
+	[PHASE_CLEANUP]    = "cleanup",
+};
+
+#ifdef _WIN32
+static uint64_t filetime_ns(FILETIME ft) {
+	return ((uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime) * 100ull;
+}
+#endif
+
+uint64_t stats_clock(void) {
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ull
+		+ (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ull / (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint64_t stats_cpu_ns(void) {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0;
+	return filetime_ns(kernel) + filetime_ns(user);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// user + system time of every command cook waited for
+static uint64_t stats_children_cpu_ns(void) {
+#ifdef _WIN32
+	return 0;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_CHILDREN, &ru) != 0) return 0;
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull
+		+ (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+#endif
+}
+
+PhaseStart stats_phase_begin(void) {
+	return (PhaseStart){
+		.trace = trace_now(),
+		.wall = stats_clock(),
+		.cpu = stats_cpu_ns(),
+	};
+}
+
+void stats_phase_end(StatsPhase phase, PhaseStart start) {
+	PhaseTime* p = &stats.phases[phase];
+	p->wall += stats_clock() - start.wall;
+	p->cpu += stats_cpu_ns() - start.cpu;
+	p->count++;
+	trace_phase(phase_names[phase], start.trace);
+}
+
+void stats_arena(const char* name, Arena* arena) {
+	ArenaSummary sum = arena_summary(arena);
+
+	// an arena that is recorded again, like the interpreter's under --watch, keeps its peak
+	for (size_t i = 0; i < stats.arena_count; ++i) {
+		StatsArena* a = &stats.arenas[i];
+		if (strcmp(a->name, name) != 0) continue;
+		if (sum.used > a->used) a->used = sum.used;
+		if (sum.capacity > a->capacity) a->capacity = sum.capacity;
+		if (sum.requested > a->requested) a->requested = sum.requested;
+		if (sum.abandoned > a->abandoned) a->abandoned = sum.abandoned;
+		if (sum.regions > a->regions) a->regions = sum.regions;
+		return;
+	}
+	if (stats.arena_count < STATS_MAX_ARENAS) {
+		stats.arenas[stats.arena_count++] = (StatsArena){
+			.name = name,
+			.used = sum.used,
+			.capacity = sum.capacity,
+			.requested = sum.requested,
+			.abandoned = sum.abandoned,
+			.regions = sum.regions,
+		};
+	}
+}
+
+inline static double ms(uint64_t ns) {
+	return (double)ns / 1000000.0;
+}
+
+void stats_print(FILE* stream) {
+	fprintf(stream, "[stats] %-12s %10s %10s\n", "phase", "wall ms", "cpu ms");
+	uint64_t wall = 0, cpu = 0;
+	for (size_t i = 0; i < PHASE_COUNT; ++i) {
+		PhaseTime* p = &stats.phases[i];
+		if (p->count == 0) continue;
+		fprintf(stream, "[stats] %-12s %10.3f %10.3f\n", phase_names[i], ms(p->wall), ms(p->cpu));
+		wall += p->wall;
+		cpu += p->cpu;
+	}
+	fprintf(stream, "[stats] %-12s %10.3f %10.3f\n", "total", ms(wall), ms(cpu));
+	fprintf(stream, "[stats] commands cpu: %.3f ms\n", ms(stats_children_cpu_ns()));
+
+	fprintf(stream, "[stats] tokens lexed: %zu\n", stats.tokens);
+	fprintf(stream, "[stats] statements: %zu\n", stats.statements);
+	fprintf(stream, "[stats] build commands: %zu\n", stats.build_commands);
+	fprintf(stream, "[stats] stat calls: %zu\n", stats.stat_calls);
+	fprintf(stream, "[stats] stat cache: %zu hits, %zu misses\n", stats.stat_cache_hits, stats.stat_cache_misses);
+	fprintf(stream, "[stats] dirty targets: %zu\n", stats.dirty_targets);
+	fprintf(stream, "[stats] commands spawned: %zu\n", stats.spawns);
+	if (stats.compile_cache_enabled) {
+		fprintf(stream, "[stats] compile cache: %zu hits, %zu misses\n",
+			stats.compile_cache_hits, stats.compile_cache_misses);
+	}
+	for (size_t i = 0; i < stats.arena_count; ++i) {
+		StatsArena* a = &stats.arenas[i];
+		fprintf(stream, "[stats] arena %-12s %10zu / %zu bytes in %zu regions, %zu requested, %zu abandoned\n",
+			a->name, a->used, a->capacity, a->regions, a->requested, a->abandoned);
+	}
+}
+
+bool stats_write_json(const char* path) {
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][stats] could not open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	fprintf(f, "{\n\t\"phases\": {");
+	bool first = true;
+	for (size_t i = 0; i < PHASE_COUNT; ++i) {
+		PhaseTime* p = &stats.phases[i];
+		if (p->count == 0) continue;
+		fprintf(f, "%s\n\t\t\"%s\": { \"wall_ns\": %llu, \"cpu_ns\": %llu, \"count\": %zu }",
+			first ? "" : ",", phase_names[i],
+			(unsigned long long)p->wall, (unsigned long long)p->cpu, p->count);
+		first = false;
+	}
+	fprintf(f, "\n\t},\n");
+
+	fprintf(f, "\t\"commands_cpu_ns\": %llu,\n", (unsigned long long)stats_children_cpu_ns());
+	fprintf(f, "\t\"tokens\": %zu,\n", stats.tokens);
+	fprintf(f, "\t\"statements\": %zu,\n", stats.statements);
+	fprintf(f, "\t\"build_commands\": %zu,\n", stats.build_commands);
+	fprintf(f, "\t\"stat_calls\": %zu,\n", stats.stat_calls);
+	fprintf(f, "\t\"stat_cache_hits\": %zu,\n", stats.stat_cache_hits);
+	fprintf(f, "\t\"stat_cache_misses\": %zu,\n", stats.stat_cache_misses);
+	fprintf(f, "\t\"dirty_targets\": %zu,\n", stats.dirty_targets);
+	fprintf(f, "\t\"spawns\": %zu,\n", stats.spawns);
+	if (stats.compile_cache_enabled) {
+		fprintf(f, "\t\"compile_cache_hits\": %zu,\n", stats.compile_cache_hits);
+		fprintf(f, "\t\"compile_cache_misses\": %zu,\n", stats.compile_cache_misses);
+	}
+
+	fprintf(f, "\t\"arenas\": {");
+	for (size_t i = 0; i < stats.arena_count; ++i) {
+		StatsArena* a = &stats.arenas[i];
+		fprintf(f, "%s\n\t\t\"%s\": { \"used\": %zu, \"capacity\": %zu, \"regions\": %zu, \"requested\": %zu, \"abandoned\": %zu }",
+			i == 0 ? "" : ",", a->name, a->used, a->capacity, a->regions, a->requested, a->abandoned);
+	}
+	fprintf(f, "\n\t}\n}\n");
+
+	bool ok = fclose(f) == 0;
+	if (!ok) {
+		fprintf(stderr, "[ERROR][stats] could not write %s: %s\n", path, strerror(errno));
+	}
+	return ok;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// what --stats reports: time spent in each phase of cook itself and counters
+// bumped by the modules doing the work. process wide, like the stat cache.
+typedef enum StatsPhase {
+	PHASE_PARSE,
+	PHASE_CONSTRUCT,
+	PHASE_LOAD_STATE,
+	PHASE_ANALYZE,
+	PHASE_INTERPRET,
+	PHASE_PLAN,
+	PHASE_EXECUTE,
+	PHASE_SAVE_STATE,
+	PHASE_CLEANUP,
+	PHASE_COUNT,
+} StatsPhase;
+
+typedef struct PhaseTime {
+	uint64_t wall;  // nanoseconds
+	uint64_t cpu;   // of cook itself, the commands it runs are not included
+	size_t count;
+} PhaseTime;
+
+typedef struct PhaseStart {
+	uint64_t trace;
+	uint64_t wall;
+	uint64_t cpu;
+} PhaseStart;
+
+typedef struct StatsArena {
+	const char* name;
+	size_t used;
+	size_t capacity;
+	size_t requested;  // asked for by callers, the rest of used is alignment padding
+	size_t abandoned;  // copied away from by arena_realloc
+	size_t regions;
+} StatsArena;
+
+#define STATS_MAX_ARENAS 16
+
+typedef struct Stats {
+	PhaseTime phases[PHASE_COUNT];
+
+	size_t tokens;
+	size_t statements;
+	size_t build_commands;
+	size_t stat_calls;        // actual stat syscalls, after the stat cache
+	size_t stat_cache_hits;
+	size_t stat_cache_misses;
+	size_t dirty_targets;
+	size_t spawns;
+	size_t compile_cache_hits;
+	size_t compile_cache_misses;
+	bool compile_cache_enabled;
+
+	StatsArena arenas[STATS_MAX_ARENAS];
+	size_t arena_count;
+} Stats;
+
+extern Stats stats;
+
+// monotonic, in nanoseconds
+uint64_t stats_clock(void);
+
+// a phase also becomes a span of --trace
+PhaseStart stats_phase_begin(void);
+void       stats_phase_end  (StatsPhase phase, PhaseStart start);
+
+// remembers how much of the arena is in use, call before freeing it
+void stats_arena(const char* name, Arena* arena);
+
+void stats_print     (FILE* stream);
+bool stats_write_json(const char* path);
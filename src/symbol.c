@@ -7,11 +7,57 @@
 // COOK_VERSION=0.0.1
 // GCC_VERSION (get it from gcc itself) ...
 // DEBUG/RELEASE/MIN_SIZE_REL/DIST
-Environment* environment_new(Arena* arena) {
+Environment* environment_new(Arena* arena, Environment* enclosing) {
 	Environment* env = (Environment*)arena_alloc(arena, sizeof(Environment));
+	env->enclosing = enclosing;
 	return env;
 }
 
+inline static size_t symbol_map_home(SymbolMap* map, uint32_t name) {
+	// fibonacci hashing, the ids are dense so the high bits are the mixed ones
+	return (size_t)(((uint64_t)name * 0x9e3779b97f4a7c15ull) >> 32) & (map->slot_count - 1);
+}
+
+static SymbolEntry* symbol_map_slot(SymbolMap* map, uint32_t name) {
+	size_t i = symbol_map_home(map, name);
+	while (map->slots[i].name != 0 && map->slots[i].name != name + 1) {
+		i = (i + 1) & (map->slot_count - 1);
+	}
+	return &map->slots[i];
+}
+
+void environment_define(Arena* arena, Environment* env, uint32_t name, SymbolValue value) {
+	SymbolMap* map = &env->map;
+	// keep the load factor under a half
+	if ((map->count + 1) * 2 > map->slot_count) {
+		SymbolMap grown = { .slot_count = map->slot_count == 0 ? 16 : map->slot_count * 2 };
+		grown.slots = arena_alloc(arena, grown.slot_count * sizeof(SymbolEntry));
+		for (size_t i = 0; i < map->slot_count; ++i) {
+			SymbolEntry* entry = &map->slots[i];
+			if (entry->name == 0) continue;
+			*symbol_map_slot(&grown, entry->name - 1) = *entry;
+			grown.count++;
+		}
+		*map = grown;
+	}
+
+	SymbolEntry* entry = symbol_map_slot(map, name);
+	if (entry->name == 0) {
+		entry->name = name + 1;
+		map->count++;
+	}
+	entry->value = value;
+}
+
+SymbolValue* environment_lookup(Environment* env, uint32_t name) {
+	for (; env; env = env->enclosing) {
+		if (env->map.count == 0) continue;
+		SymbolEntry* entry = symbol_map_slot(&env->map, name);
+		if (entry->name != 0) return &entry->value;
+	}
+	return NULL;
+}
+
 const char* symbol_value_type_name_cstr(SymbolValueType type) {
 	switch (type) {
 		#define CASE(T) case T: return #T;
@@ -46,20 +92,24 @@ void symbol_value_print(SymbolValue value, int indent) {
 	printf("\n");
 }
 
+// the whole word has to match, "c" is a variable and not compiler
+#define METHOD_IS(name, sv) ((sv).count == sizeof(name) - 1 && strncmp(name, (sv).items, (sv).count) == 0)
+
 MethodType method_extract(StringView sv) {
-	if (strncmp("build",       sv.items, sv.count) == 0) return METHOD_BUILD;
-	if (strncmp("compiler",    sv.items, sv.count) == 0) return METHOD_COMPILER;
-	if (strncmp("input",       sv.items, sv.count) == 0) return METHOD_INPUT;
-	if (strncmp("cflags",      sv.items, sv.count) == 0) return METHOD_CFLAGS;
-	if (strncmp("ldflags",     sv.items, sv.count) == 0) return METHOD_LDFLAGS;
-	if (strncmp("source_dir",  sv.items, sv.count) == 0) return METHOD_SOURCE_DIR;
-	if (strncmp("output_dir",  sv.items, sv.count) == 0) return METHOD_OUTPUT_DIR;
-	if (strncmp("include_dir", sv.items, sv.count) == 0) return METHOD_INCLUDE_DIR;
-	if (strncmp("library_dir", sv.items, sv.count) == 0) return METHOD_LIBRARY_DIR;
-	if (strncmp("link",        sv.items, sv.count) == 0) return METHOD_LINK;
-	if (strncmp("dirty",       sv.items, sv.count) == 0) return METHOD_DIRTY;
-	if (strncmp("mark_clean",  sv.items, sv.count) == 0) return METHOD_MARK_CLEAN;
-	if (strncmp("echo",        sv.items, sv.count) == 0) return METHOD_ECHO;
+	if (METHOD_IS("build",       sv)) return METHOD_BUILD;
+	if (METHOD_IS("compiler",    sv)) return METHOD_COMPILER;
+	if (METHOD_IS("input",       sv)) return METHOD_INPUT;
+	if (METHOD_IS("cflags",      sv)) return METHOD_CFLAGS;
+	if (METHOD_IS("ldflags",     sv)) return METHOD_LDFLAGS;
+	if (METHOD_IS("source_dir",  sv)) return METHOD_SOURCE_DIR;
+	if (METHOD_IS("output_dir",  sv)) return METHOD_OUTPUT_DIR;
+	if (METHOD_IS("include_dir", sv)) return METHOD_INCLUDE_DIR;
+	if (METHOD_IS("library_dir", sv)) return METHOD_LIBRARY_DIR;
+	if (METHOD_IS("link",        sv)) return METHOD_LINK;
+	if (METHOD_IS("dirty",       sv)) return METHOD_DIRTY;
+	if (METHOD_IS("mark_clean",  sv)) return METHOD_MARK_CLEAN;
+	if (METHOD_IS("echo",        sv)) return METHOD_ECHO;
+	if (METHOD_IS("cache",       sv)) return METHOD_CACHE;
 
 	return METHOD_NONE;
 }
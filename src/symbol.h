@@ -1,6 +1,7 @@
 #pragma once
 #include "arena.h"
 #include "da.h"
+#include <stdint.h>
 
 typedef enum SymbolValueType {
 	SYMBOL_VALUE_NIL = 0,
@@ -26,6 +27,7 @@ typedef enum MethodType {
 	METHOD_DIRTY,
 	METHOD_MARK_CLEAN,
 	METHOD_ECHO,
+	METHOD_CACHE,
 } MethodType;
 
 typedef struct SymbolValue {
@@ -40,24 +42,29 @@ typedef struct SymbolValue {
 } SymbolValue;
 
 typedef struct SymbolEntry {
-	StringView name;
+	uint32_t name;      // interned by the parser, + 1 so 0 is an empty slot
 	SymbolValue value;
 } SymbolEntry;
 
+// open addressing map from interned variable name to value
 typedef struct SymbolMap {
-	// TODO: use hash map
-	// string -> symbol
-	SymbolEntry** items;
+	SymbolEntry* slots;
+	size_t slot_count;
 	size_t count;
-	size_t capacity;
 } SymbolMap;
 
 
+// one scope, the block of a description opens a new one
 typedef struct Environment {
 	struct Environment* enclosing;
 	SymbolMap map;
 } Environment;
-Environment* environment_new(Arena*);
+Environment* environment_new(Arena*, Environment* enclosing);
+
+// assignment always binds in the innermost scope, shadowing outer ones
+void         environment_define(Arena* arena, Environment* env, uint32_t name, SymbolValue value);
+// NULL if no scope up the chain has it
+SymbolValue* environment_lookup(Environment* env, uint32_t name);
 
 
 const char* symbol_value_type_name_cstr(SymbolValueType);
@@ -1,7 +1,12 @@
 #include "target.h"
 #include "build_command.h"
 #include "da.h"
+#include "depfile.h"
+#include "build_state.h"
 #include "executer.h"
+#include "hash.h"
+#include "stats.h"
+#include <ctype.h>
 
 StringBuilder target_generate_cmdline_cstr(Arena* arena, struct BuildCommand* bc, Target* t) {
 	StringBuilder sb = target_generate_cmdline(arena, bc, t);
@@ -10,82 +15,281 @@ StringBuilder target_generate_cmdline_cstr(Arena* arena, struct BuildCommand* bc
 }
 
 
-inline static void target_print_stringview(Arena* arena, StringBuilder* sb, StringView sv) {
-	da_reserve_arena(arena, sb, sb->count + sv.count + 1);
-	int written = snprintf(sb->items + sb->count, sv.count + 2, "%.*s ", (int)sv.count, sv.items);
-	sb->count += written;
+inline static const char* target_cstr(Arena* arena, const char* prefix, size_t prefix_len, StringView sv) {
+	char* cstr = arena_alloc(arena, prefix_len + sv.count + 1);
+	memcpy(cstr, prefix, prefix_len);
+	memcpy(cstr + prefix_len, sv.items, sv.count);
+	cstr[prefix_len + sv.count] = '\0';
+	return cstr;
 }
 
-inline static void target_string_list_print_flat(Arena* arena, StringBuilder* sb, const StringList* list, const char* prefix, size_t prefix_len) {
+inline static void cmd_append(Arena* arena, Cmd* cmd, const char* arg) {
+	da_reserve_arena(arena, cmd, cmd->count + 2);
+	cmd->items[cmd->count++] = arg;
+	cmd->items[cmd->count] = NULL;
+}
+
+inline static void cmd_append_sv(Arena* arena, Cmd* cmd, StringView sv) {
+	cmd_append(arena, cmd, target_cstr(arena, "", 0, sv));
+}
+
+inline static void cmd_append_list(Arena* arena, Cmd* cmd, const StringList* list, const char* prefix) {
 	if (!list || !list->items) {
 		return;
 	}
+	size_t prefix_len = strlen(prefix);
+	for (size_t i = 0; i < list->count; ++i) {
+		cmd_append(arena, cmd, target_cstr(arena, prefix, prefix_len, list->items[i]));
+	}
+}
+
+inline static void cmd_append_options(Arena* arena, Cmd* cmd, const OptionList* list, const char* prefix) {
+	size_t prefix_len = strlen(prefix);
+	for (size_t i = 0; i < list->count; ++i) {
+		cmd_append(arena, cmd, target_cstr(arena, prefix, prefix_len, option_list_at(list, i)));
+	}
+}
+
+// flags used to go through the shell, so `cflags(-O2 -g)` is two arguments
+inline static void cmd_append_flags(Arena* arena, Cmd* cmd, const OptionList* list) {
 	for (size_t i = 0; i < list->count; ++i) {
-		if (prefix_len > 0) {
-			da_reserve_arena(arena, sb, sb->count + prefix_len + 1);
-			int written = snprintf(sb->items + sb->count, prefix_len + 1, "%.*s", (int)prefix_len, prefix);
-			sb->count += written;
+		StringView sv = option_list_at(list, i);
+		size_t start = 0;
+		while (start < sv.count) {
+			while (start < sv.count && isspace((unsigned char)sv.items[start])) start++;
+			size_t end = start;
+			while (end < sv.count && !isspace((unsigned char)sv.items[end])) end++;
+			if (end > start) {
+				cmd_append_sv(arena, cmd, (StringView){ .items = sv.items + start, .count = end - start });
+			}
+			start = end;
 		}
-		target_print_stringview(arena, sb, list->items[i]);
 	}
 }
 
-StringBuilder target_generate_cmdline(Arena* arena, struct BuildCommand* bc, Target* t) {
+inline static bool cmd_arg_needs_quotes(const char* arg) {
+	if (*arg == '\0') return true;
+	for (const char* c = arg; *c; ++c) {
+		if (!isalnum((unsigned char)*c) && !strchr("-_+=./:,@%^", *c)) return true;
+	}
+	return false;
+}
+
+inline static void cmd_render_arg(Arena* arena, StringBuilder* sb, const char* arg) {
+	if (!cmd_arg_needs_quotes(arg)) {
+		da_append_many_arena(arena, sb, arg, strlen(arg));
+	} else {
+#ifdef _WIN32
+		da_append_arena(arena, sb, '"');
+		da_append_many_arena(arena, sb, arg, strlen(arg));
+		da_append_arena(arena, sb, '"');
+#else
+		da_append_arena(arena, sb, '\'');
+		for (const char* c = arg; *c; ++c) {
+			if (*c == '\'') {
+				da_append_many_arena(arena, sb, "'\\''", 4);
+			} else {
+				da_append_arena(arena, sb, *c);
+			}
+		}
+		da_append_arena(arena, sb, '\'');
+#endif
+	}
+	da_append_arena(arena, sb, ' ');
+}
+
+// only for printing and --dry-run, commands are spawned from the argv directly
+StringBuilder cmd_render(Arena* arena, Cmd cmd) {
 	StringBuilder sb = {0};
-	if (!arena || !bc || !t) return sb;
+	size_t size = 0;
+	for (size_t i = 0; i < cmd.count; ++i) {
+		size += strlen(cmd.items[i]) + 1;
+	}
+	// quoting may still grow it, the common case fits
+	da_reserve_arena(arena, &sb, size + 1);
+	for (size_t i = 0; i < cmd.count; ++i) {
+		cmd_render_arg(arena, &sb, cmd.items[i]);
+	}
+	return sb;
+}
 
+CmdTemplate cmd_template_new(Arena* arena, struct BuildCommand* bc) {
+	CmdTemplate tmpl = { .ready = true };
 
 	if (bc->compiler.count > 0) {
-		target_print_stringview(arena, &sb, bc->compiler);
+		cmd_append_sv(arena, &tmpl.head, bc->compiler);
+	}
+	cmd_append_flags(arena, &tmpl.head, &bc->cflags);
+	if (bc->build_type == BUILD_OBJECT) {
+		cmd_append(arena, &tmpl.head, "-c");
 	}
+	cmd_append(arena, &tmpl.head, "-o");
 
-	target_string_list_print_flat(arena, &sb, &bc->cflags, "",0);
+	cmd_append_options(arena, &tmpl.tail, &bc->include_dirs, "-I");
+	cmd_append_list(arena, &tmpl.tail, &bc->input_files,   "");
+	cmd_append_list(arena, &tmpl.tail, &bc->input_objects, "");
+	if (bc->build_type == BUILD_EXECUTABLE || bc->build_type == BUILD_LIB) {
+		cmd_append_options(arena, &tmpl.tail, &bc->library_dirs,  "-L");
+		cmd_append_options(arena, &tmpl.tail, &bc->library_links, "-l");
+	}
+	cmd_append_flags(arena, &tmpl.tail, &bc->ldflags);
 
-	if (bc->build_type == BUILD_OBJECT) {
-		da_append_many_arena(arena, &sb, "-c ", 3);
+	StringBuilder head = cmd_render(arena, tmpl.head);
+	StringBuilder tail = cmd_render(arena, tmpl.tail);
+	tmpl.head_line = (StringView){ .items = head.items, .count = head.count };
+	tmpl.tail_line = (StringView){ .items = tail.items, .count = tail.count };
+	return tmpl;
+}
+
+// a build command that was not prepared, like one made outside the constructor,
+// gets a template that only lives as long as the result
+inline static CmdTemplate target_cmd_template(Arena* arena, struct BuildCommand* bc) {
+	return bc->cmd.ready ? bc->cmd : cmd_template_new(arena, bc);
+}
+
+#define TARGET_MAX_ARGS 5
+
+// the arguments that differ between the targets of a build command, pooled paths
+// are NUL terminated already
+inline static size_t target_args(Target* t, const char* args[TARGET_MAX_ARGS]) {
+	size_t count = 0;
+	args[count++] = path_get(t->output).items;
+	args[count++] = path_get(t->input).items;
+	if (t->depfile != PATH_NONE) {
+		args[count++] = "-MMD";
+		args[count++] = "-MF";
+		args[count++] = path_get(t->depfile).items;
 	}
+	return count;
+}
 
-	da_append_many_arena(arena, &sb, "-o ", 3);
-	target_print_stringview(arena, &sb, sv_from_sb(t->output_name));
-	target_print_stringview(arena, &sb, sv_from_sb(t->input_name));
+Cmd target_generate_cmd(Arena* arena, struct BuildCommand* bc, Target* t) {
+	Cmd cmd = {0};
+	if (!arena || !bc || !t) return cmd;
 
-	target_string_list_print_flat(arena, &sb, &bc->include_dirs,  "-I", 2);
-	target_string_list_print_flat(arena, &sb, &bc->input_files,   "",   0);
-	target_string_list_print_flat(arena, &sb, &bc->input_objects, "",   0);
-	if (bc->build_type == BUILD_EXECUTABLE || bc->build_type == BUILD_LIB) {
-		target_string_list_print_flat(arena, &sb, &bc->library_dirs,  "-L", 2);
-		target_string_list_print_flat(arena, &sb, &bc->library_links, "-l", 2);
+	CmdTemplate tmpl = target_cmd_template(arena, bc);
+	const char* args[TARGET_MAX_ARGS];
+	size_t arg_count = target_args(t, args);
+
+	cmd.capacity = tmpl.head.count + arg_count + tmpl.tail.count + 1;
+	cmd.items = arena_alloc(arena, cmd.capacity * sizeof(*cmd.items));
+	memcpy(cmd.items, tmpl.head.items, tmpl.head.count * sizeof(*cmd.items));
+	cmd.count = tmpl.head.count;
+	memcpy(cmd.items + cmd.count, args, arg_count * sizeof(*cmd.items));
+	cmd.count += arg_count;
+	if (tmpl.tail.count > 0) {
+		memcpy(cmd.items + cmd.count, tmpl.tail.items, tmpl.tail.count * sizeof(*cmd.items));
+		cmd.count += tmpl.tail.count;
 	}
-	target_string_list_print_flat(arena, &sb, &bc->ldflags,       "",   0);
+	cmd.items[cmd.count] = NULL;
+	return cmd;
+}
 
+StringBuilder target_generate_cmdline(Arena* arena, struct BuildCommand* bc, Target* t) {
+	StringBuilder sb = {0};
+	if (!arena || !bc || !t) return sb;
+
+	CmdTemplate tmpl = target_cmd_template(arena, bc);
+	const char* args[TARGET_MAX_ARGS];
+	size_t arg_count = target_args(t, args);
+
+	size_t size = tmpl.head_line.count + tmpl.tail_line.count;
+	for (size_t i = 0; i < arg_count; ++i) {
+		size += strlen(args[i]) + 1;
+	}
+	// one more for target_generate_cmdline_cstr
+	da_reserve_arena(arena, &sb, size + 1);
+	da_append_many_arena(arena, &sb, tmpl.head_line.items, tmpl.head_line.count);
+	for (size_t i = 0; i < arg_count; ++i) {
+		cmd_render_arg(arena, &sb, args[i]);
+	}
+	da_append_many_arena(arena, &sb, tmpl.tail_line.items, tmpl.tail_line.count);
 	return sb;
 }
 
 
-bool target_check_dirty(struct BuildCommand* bc, Target* t) {
+// remembers the first input that changed in `cause`
+inline static void target_check_input(BuildState* state, StringView path, uint64_t out_time,
+                                      uint64_t* in_time, DirtyCause* cause) {
+	uint64_t time = get_modification_time_sv(path);
+	if (time > *in_time) {
+		*in_time = time;
+	}
+	bool changed = state ? file_state_changed(&state->files, path, out_time) : time > out_time;
+	if (changed && cause->reason == DIRTY_NONE) {
+		*cause = (DirtyCause){
+			.reason = DIRTY_INPUT_CHANGED,
+			.input = path_intern(path),
+			.input_time = time,
+			.output_time = out_time,
+		};
+	}
+}
+
+bool target_check_dirty(Arena* arena, BuildState* state, struct BuildCommand* bc, Target* t) {
 	if (bc->marked_clean_explicitly) return false;
 
-	uint64_t out_time = get_modification_time_sv(sv_from_sb(t->output_name));
-	uint64_t in_time  = get_modification_time_sv(sv_from_sb(t->input_name));
+	// the depfile and the cmdline are only needed for the check itself
+	ArenaMark mark = arena_save(arena);
+	uint64_t out_time = stat_cache_mtime_id(t->output);
+	StringView output = path_get(t->output);
+	uint64_t in_time  = 0;
+	DirtyCause cause = {0};
+
+	target_check_input(state, path_get(t->input), out_time, &in_time, &cause);
 
 	for (size_t i = 0; i < bc->input_files.count; ++i) {
-		uint64_t time = get_modification_time_sv(bc->input_files.items[i]);
-		if (time != 0 && time > in_time) {
-			in_time = time;
+		target_check_input(state, bc->input_files.items[i], out_time, &in_time, &cause);
+	}
+
+	if (t->header != PATH_NONE) {
+		target_check_input(state, path_get(t->header), out_time, &in_time, &cause);
+	}
+
+	// every header the compiler saw last time, an object without recorded deps was
+	// never compiled by us and has to be built once to get them
+	if (t->depfile != PATH_NONE && out_time != 0) {
+		DepsLog* deps_log = state ? &state->deps : NULL;
+		DepsRecord* record = deps_log ? deps_log_find(deps_log, output) : NULL;
+		StringList deps = {0};
+		if (record && record->mtime >= out_time) {
+			for (uint32_t i = 0; i < record->count; ++i) {
+				StringView dep = intern_get(&deps_log->paths, record->inputs[i]);
+				target_check_input(state, dep, out_time, &in_time, &cause);
+			}
+		} else if (depfile_read(arena, path_get(t->depfile), &deps)) {
+			for (size_t i = 0; i < deps.count; ++i) {
+				target_check_input(state, deps.items[i], out_time, &in_time, &cause);
+			}
+		} else if (cause.reason == DIRTY_NONE) {
+			cause = (DirtyCause){ .reason = DIRTY_DEPS_UNKNOWN, .output_time = out_time };
 		}
 	}
 
-	uint64_t header_time = get_modification_time_sv(sv_from_sb(t->header_file));
-	if (header_time > in_time) {
-		in_time = header_time;
+	// the command that built the output last time, changed flags rebuild it
+	if (state && out_time != 0 && cause.reason == DIRTY_NONE) {
+		StringBuilder cmdline = target_generate_cmdline(arena, bc, t);
+		uint64_t command_hash = hash_bytes(cmdline.items, cmdline.count, HASH_SEED);
+		BuildLogEntry* entry = build_log_find(&state->log, output);
+		if (!entry || entry->command_hash != command_hash) {
+			cause = (DirtyCause){ .reason = DIRTY_COMMAND_CHANGED, .output_time = out_time };
+		}
 	}
 
-	if (out_time >= in_time) {
+	// a missing output only needs building if there is something to build it from
+	if (out_time == 0 && in_time != 0) {
+		cause = (DirtyCause){ .reason = DIRTY_OUTPUT_MISSING };
+	}
+	arena_restore(arena, mark);
+	bool dirty = out_time == 0 ? in_time != 0 : cause.reason != DIRTY_NONE;
+	if (!dirty) {
 		return false;
 	}
-	
+
+	t->cause = cause;
 	t->dirty = true;
 	bc->dirty = true;
+	stats.dirty_targets++;
 
 	BuildCommand* p = bc->parent;
 	while (p) {
@@ -95,6 +299,3 @@ bool target_check_dirty(struct BuildCommand* bc, Target* t) {
 
 	return true;
 }
-
-
-
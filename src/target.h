@@ -1,15 +1,43 @@
 #pragma once
 #include "arena.h"
 #include "da.h"
+#include "path_pool.h"
 #include <stdbool.h>
+#include <stdint.h>
+
+struct BuildCommand;
+struct Target;
+
+// why the dirty analysis decided to build a target, for --explain
+typedef enum DirtyReason {
+	DIRTY_NONE,
+	DIRTY_OUTPUT_MISSING,
+	DIRTY_INPUT_CHANGED,
+	DIRTY_DEPS_UNKNOWN,     // no recorded header dependencies
+	DIRTY_COMMAND_CHANGED,
+	DIRTY_CHILD,            // a build command below it is dirty
+	DIRTY_FORCED,           // -B
+} DirtyReason;
+
+typedef struct DirtyCause {
+	DirtyReason reason;
+	PathId input;                  // the first input that changed
+	uint64_t input_time;
+	uint64_t output_time;
+	struct BuildCommand* from;     // DIRTY_CHILD: the dirty build command
+	struct Target* from_target;    // and its first dirty target, if it has one
+} DirtyCause;
 
 typedef struct Target {
 	StringView name;
-	StringBuilder input_name;
-	StringBuilder output_name;
-	StringBuilder header_file;
+	PathId input;
+	PathId output;
+	PathId header;             // PATH_NONE if it has none
+	PathId depfile;            // written by the compiler, PATH_NONE if not supported
 	bool dirty;
 	bool built;
+	DirtyCause cause;
+	uint64_t fingerprint;      // of everything target_is_same compares
 } Target;
 
 typedef struct TargetList {
@@ -19,9 +47,31 @@ typedef struct TargetList {
 } TargetList;
 
 
-struct BuildCommand;
+// argument vector of a command, terminated by a NULL entry that is not counted
+typedef struct Cmd {
+	const char** items;
+	size_t count;
+	size_t capacity;
+} Cmd;
+
+// the arguments that are the same for every target of a build command, the
+// targets only splice their output, input and depfile in between
+typedef struct CmdTemplate {
+	Cmd head;              // compiler, cflags, -c and -o
+	Cmd tail;              // include dirs, inputs, libraries and ldflags
+	StringView head_line;  // both rendered, each argument followed by a space
+	StringView tail_line;
+	bool ready;
+} CmdTemplate;
+
+CmdTemplate   cmd_template_new            (Arena* arena, struct BuildCommand* bc);
+
+Cmd           target_generate_cmd         (Arena* arena, struct BuildCommand* bc, Target* t);
 StringBuilder target_generate_cmdline_cstr(Arena* arena, struct BuildCommand* bc, Target* t);
 StringBuilder target_generate_cmdline     (Arena* arena, struct BuildCommand* bc, Target* t);
 
-bool target_check_dirty(struct BuildCommand* bc, Target* t);
+StringBuilder cmd_render(Arena* arena, Cmd cmd);
+
+struct BuildState;
+bool target_check_dirty(Arena* arena, struct BuildState* state, struct BuildCommand* bc, Target* t);
 
@@ -13,6 +13,13 @@ static const char* tests[] = {
 	"nested",
 	"multiple_target_names",
 	"dirty",
+	"variables",
+	"inherit",
+	"inherit_chain",
+	"compiler_path",
+	"depfile",
+	"deps_log",
+	"snapshots",
 };
 
 
@@ -81,10 +88,13 @@ int main(void) {
 	const char* build_cmd_f   = "cook --dry-run -f ";
 	const char* expected_path = "/expected_cmd";
 	const char* cookfile      = "/Cookfile";
+	// a test that needs more than a dry run keeps the command line to run in here
+	const char* custom_cmd    = "/cmd";
 
 	StringBuilder test_cmd     = {0};
 	StringBuilder output_cmd   = {0};
 	StringBuilder expected_cmd = {0};
+	StringBuilder custom_cmd_path = {0};
 
 	size_t test_count   = sizeof(tests)/sizeof(tests[0]);
 	size_t max_test_name_count = 0;
@@ -100,11 +110,29 @@ int main(void) {
 		output_cmd.count   = 0;
 		expected_cmd.count = 0;
 
-		da_append_many(&test_cmd, build_path,  strlen(build_path));
-		da_append_many(&test_cmd, build_cmd_f, strlen(build_cmd_f));
-		da_append_many(&test_cmd, tests_path,  strlen(tests_path));
-		da_append_many(&test_cmd, tests[i],    strlen(tests[i]));
-		da_append_many(&test_cmd, cookfile,    strlen(cookfile));
+		custom_cmd_path.count = 0;
+		da_append_many(&custom_cmd_path, tests_path, strlen(tests_path));
+		da_append_many(&custom_cmd_path, tests[i],   strlen(tests[i]));
+		da_append_many(&custom_cmd_path, custom_cmd, strlen(custom_cmd));
+		da_append(&custom_cmd_path, 0);
+
+		if (access(custom_cmd_path.items, F_OK) == 0) {
+			if (!read_entire_file(custom_cmd_path.items, &test_cmd)) {
+				failed_count++;
+				continue;
+			}
+			while (test_cmd.count > 0 && (
+				test_cmd.items[test_cmd.count - 1] == '\n' ||
+				test_cmd.items[test_cmd.count - 1] == '\r' )) {
+				test_cmd.count--;
+			}
+		} else {
+			da_append_many(&test_cmd, build_path,  strlen(build_path));
+			da_append_many(&test_cmd, build_cmd_f, strlen(build_cmd_f));
+			da_append_many(&test_cmd, tests_path,  strlen(tests_path));
+			da_append_many(&test_cmd, tests[i],    strlen(tests[i]));
+			da_append_many(&test_cmd, cookfile,    strlen(cookfile));
+		}
 		da_append(&test_cmd, 0);
 
 		da_append_many(&expected_cmd, tests_path,    strlen(tests_path));
@@ -139,5 +167,6 @@ int main(void) {
 	sb_free(&test_cmd);
 	sb_free(&output_cmd);
 	sb_free(&expected_cmd);
+	sb_free(&custom_cmd_path);
 	return 0;
 }
@@ -0,0 +1,125 @@
+#include "trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+#define TRACE_PID 1
+#define TRACE_MAIN_TID 0
+
+typedef struct Trace {
+	FILE* file;
+	uint64_t origin;     // monotonic clock at trace_open, in microseconds
+	size_t lanes;        // worker lanes that already have a name
+	bool first;
+} Trace;
+
+static Trace trace = {0};
+
+static uint64_t trace_clock(void) {
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000ull
+		+ (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000ull / (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000ull;
+#endif
+}
+
+static void trace_write_string(const char* s, size_t n) {
+	fputc('"', trace.file);
+	for (size_t i = 0; i < n; ++i) {
+		unsigned char c = (unsigned char)s[i];
+		if (c == '"' || c == '\\') {
+			fputc('\\', trace.file);
+			fputc(c, trace.file);
+		} else if (c < 0x20) {
+			fprintf(trace.file, "\\u%04x", c);
+		} else {
+			fputc(c, trace.file);
+		}
+	}
+	fputc('"', trace.file);
+}
+
+static void trace_begin_event(void) {
+	fputs(trace.first ? "\n" : ",\n", trace.file);
+	trace.first = false;
+}
+
+static void trace_lane_name(size_t tid, const char* name) {
+	trace_begin_event();
+	fprintf(trace.file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+		TRACE_PID, tid, name);
+}
+
+bool trace_open(const char* path) {
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "[ERROR][trace] could not open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	trace = (Trace){ .file = f, .origin = trace_clock(), .first = true };
+	fputc('[', trace.file);
+	trace_lane_name(TRACE_MAIN_TID, "cook");
+	return true;
+}
+
+// a file that never gets closed, like under --watch, still loads without the `]`
+void trace_close(void) {
+	if (!trace.file) return;
+	fputs("\n]\n", trace.file);
+	fclose(trace.file);
+	trace = (Trace){0};
+}
+
+bool trace_enabled(void) {
+	return trace.file != NULL;
+}
+
+void trace_flush(void) {
+	if (trace.file) fflush(trace.file);
+}
+
+uint64_t trace_now(void) {
+	if (!trace.file) return 0;
+	return trace_clock() - trace.origin;
+}
+
+void trace_phase(const char* name, uint64_t start) {
+	if (!trace.file) return;
+	uint64_t end = trace_now();
+	trace_begin_event();
+	fprintf(trace.file, "{\"name\":\"%s\",\"cat\":\"cook\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d}",
+		name, (unsigned long long)start, (unsigned long long)(end - start), TRACE_PID, TRACE_MAIN_TID);
+}
+
+void trace_command(uint64_t start, size_t slot, StringView output, StringView target,
+                   size_t depth, int exit_code, bool cached) {
+	if (!trace.file) return;
+	uint64_t end = trace_now();
+	size_t tid = slot + 1;
+	while (trace.lanes < tid) {
+		char name[32];
+		snprintf(name, sizeof(name), "slot %zu", trace.lanes);
+		trace_lane_name(++trace.lanes, name);
+	}
+
+	trace_begin_event();
+	fputs("{\"name\":", trace.file);
+	trace_write_string(output.items, output.count);
+	fprintf(trace.file, ",\"cat\":\"command\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%zu,\"args\":{\"target\":",
+		(unsigned long long)start, (unsigned long long)(end - start), TRACE_PID, tid);
+	trace_write_string(target.items, target.count);
+	fprintf(trace.file, ",\"depth\":%zu,\"exit_code\":%d,\"cached\":%s}}",
+		depth, exit_code, cached ? "true" : "false");
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "da.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// chrome trace event json for --trace, open it in perfetto or chrome://tracing.
+// cook's own phases go on the first lane and every spawned command on the lane
+// of the executer slot it ran in. all calls do nothing until trace_open.
+bool     trace_open (const char* path);
+void     trace_close(void);
+bool     trace_enabled(void);
+void     trace_flush(void);
+
+// microseconds since trace_open, 0 when tracing is off
+uint64_t trace_now  (void);
+
+// a phase of cook itself that started at `start` and ends now
+void trace_phase  (const char* name, uint64_t start);
+void trace_command(uint64_t start, size_t slot, StringView output, StringView target,
+                   size_t depth, int exit_code, bool cached);
@@ -0,0 +1,166 @@
+#include "watch.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+	#include <poll.h>
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#endif
+
+// a save is often several events in a row, wait this long for the rest of them
+#define WATCH_SETTLE_MS 5
+
+bool watcher_changed(Watcher* w, StringView path) {
+	for (size_t i = 0; i < w->changed.count; ++i) {
+		StringView c = w->changed.items[i];
+		if (c.count == path.count && memcmp(c.items, path.items, path.count) == 0) return true;
+	}
+	return false;
+}
+
+void watcher_clear(Watcher* w) {
+	w->changed.count = 0;
+}
+
+#ifndef __linux__
+
+bool watcher_open(Watcher* w) {
+	*w = (Watcher){ .fd = -1 };
+	fprintf(stderr, "[ERROR][watch] --watch needs inotify and is only supported on linux\n");
+	return false;
+}
+void watcher_close(Watcher* w) { (void)w; }
+uint32_t watcher_add(Watcher* w, StringView path) { (void)w; (void)path; return INTERN_NONE; }
+bool watcher_wait(Watcher* w, int wake_fd, int timeout_ms) { (void)w; (void)wake_fd; (void)timeout_ms; return false; }
+bool watcher_read(Watcher* w) { (void)w; return false; }
+
+#else
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_ATTRIB)
+
+bool watcher_open(Watcher* w) {
+	*w = (Watcher){0};
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd < 0) {
+		fprintf(stderr, "[ERROR][watch] inotify_init1 failed: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void watcher_close(Watcher* w) {
+	if (w->fd >= 0) close(w->fd);
+	intern_free(&w->files);
+	intern_free(&w->dirs);
+	free(w->watches.items);
+	free(w->changed.items);
+	*w = (Watcher){ .fd = -1 };
+}
+
+uint32_t watcher_add(Watcher* w, StringView path) {
+	if (path.count == 0) return INTERN_NONE;
+
+	size_t before = w->files.strings.count;
+	uint32_t file = intern(&w->files, path);
+	if (w->files.strings.count == before) return file;
+
+	StringView dir = { .items = path.items, .count = 0 };
+	for (size_t i = path.count; i > 0; --i) {
+		if (path.items[i - 1] == '/') {
+			dir.count = i > 1 ? i - 1 : 1;
+			break;
+		}
+	}
+
+	before = w->dirs.strings.count;
+	uint32_t id = intern(&w->dirs, dir);
+	if (w->dirs.strings.count == before) return file;
+
+	const char* dir_cstr = dir.count > 0 ? intern_get(&w->dirs, id).items : ".";
+	int wd = inotify_add_watch(w->fd, dir_cstr, WATCH_EVENTS);
+	if (wd < 0) {
+		fprintf(stderr, "[ERROR][watch] could not watch %s: %s\n", dir_cstr, strerror(errno));
+		return file;
+	}
+	da_append(&w->watches, ((WatchDir){ .wd = wd, .dir = id }));
+	return file;
+}
+
+static void watcher_mark(Watcher* w, StringView path) {
+	uint32_t id = intern_find(&w->files, path);
+	if (id == INTERN_NONE) return;
+	StringView interned = intern_get(&w->files, id);
+	if (!watcher_changed(w, interned)) {
+		da_append(&w->changed, interned);
+	}
+}
+
+static void watcher_handle(Watcher* w, const struct inotify_event* ev) {
+	if (ev->mask & IN_Q_OVERFLOW) {
+		// events were dropped, anything could have changed
+		for (size_t i = 0; i < w->files.strings.count; ++i) {
+			watcher_mark(w, w->files.strings.items[i]);
+		}
+		return;
+	}
+	if (ev->len == 0) return;
+
+	// the same directory can be reached through differently spelled paths
+	char path[4096 + 1 + 256];
+	for (size_t i = 0; i < w->watches.count; ++i) {
+		if (w->watches.items[i].wd != ev->wd) continue;
+		StringView dir = intern_get(&w->dirs, w->watches.items[i].dir);
+		int n;
+		if (dir.count == 0) {
+			n = snprintf(path, sizeof(path), "%s", ev->name);
+		} else if (dir.items[dir.count - 1] == '/') {
+			n = snprintf(path, sizeof(path), "%s%s", dir.items, ev->name);
+		} else {
+			n = snprintf(path, sizeof(path), "%s/%s", dir.items, ev->name);
+		}
+		if (n <= 0 || (size_t)n >= sizeof(path)) continue;
+		watcher_mark(w, (StringView){ .items = path, .count = (size_t)n });
+	}
+}
+
+bool watcher_read(Watcher* w) {
+	size_t before = w->changed.count;
+	_Alignas(struct inotify_event) char buffer[64 * 1024];
+	while (true) {
+		ssize_t n = read(w->fd, buffer, sizeof(buffer));
+		if (n <= 0) break;
+		for (char* p = buffer; p < buffer + n; ) {
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			watcher_handle(w, ev);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	return w->changed.count > before;
+}
+
+bool watcher_wait(Watcher* w, int wake_fd, int timeout_ms) {
+	struct pollfd pfds[2] = {
+		{ .fd = w->fd, .events = POLLIN },
+		{ .fd = wake_fd, .events = POLLIN },
+	};
+	while (true) {
+		int r = poll(pfds, 2, timeout_ms);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		if (pfds[1].revents & POLLIN) {
+			char buffer[64];
+			while (read(wake_fd, buffer, sizeof(buffer)) > 0) {}
+			return false;
+		}
+		if (watcher_read(w)) break;
+	}
+	struct pollfd pfd = pfds[0];
+	while (poll(&pfd, 1, WATCH_SETTLE_MS) > 0) {
+		watcher_read(w);
+	}
+	return true;
+}
+
+#endif // __linux__
@@ -0,0 +1,38 @@
+#pragma once
+#include "da.h"
+#include "intern.h"
+#include <stdbool.h>
+
+// inotify based file watching for --watch. the directories of the files are watched
+// rather than the files, since editors often save by renaming over the old file.
+typedef struct WatchDir {
+	int wd;
+	uint32_t dir; // id in Watcher.dirs, "" stands for the current directory
+} WatchDir;
+
+typedef struct WatchDirList {
+	WatchDir* items;
+	size_t count;
+	size_t capacity;
+} WatchDirList;
+
+typedef struct Watcher {
+	int fd;
+	InternPool files;      // every path a build depends on
+	InternPool dirs;
+	WatchDirList watches;
+	StringList changed;    // watched files changed since the last watcher_clear
+} Watcher;
+
+bool watcher_open (Watcher* w);
+void watcher_close(Watcher* w);
+// returns the id of path in Watcher.files, INTERN_NONE for an empty path
+uint32_t watcher_add(Watcher* w, StringView path);
+
+// waits up to timeout_ms (-1 blocks) for events, returns whether any watched file changed.
+// wake_fd being readable ends the wait early, it is drained and false is returned.
+bool watcher_wait (Watcher* w, int wake_fd, int timeout_ms);
+// collects the events that are already queued without blocking
+bool watcher_read (Watcher* w);
+bool watcher_changed(Watcher* w, StringView path);
+void watcher_clear(Watcher* w);